@@ -0,0 +1,12 @@
+#ifndef HDR_MALLOC_H__
+#define HDR_MALLOC_H__
+
+/* The per command latency histograms are allocated upfront, several
+ * megabytes in total, so they use the libc allocator and are left out of
+ * used_memory: accounting them would move the maxmemory eviction threshold
+ * and every estimate based on used_memory as soon as tracking is enabled. */
+#include <stdlib.h>
+
+#define hdr_calloc calloc
+#define hdr_free free
+#endif
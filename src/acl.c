@@ -57,6 +57,10 @@ static rax *commandId = NULL; /* Command name to id mapping */
 
 static unsigned long nextid = 0; /* Next command id that has not been assigned */
 
+static uint64_t ACLPatternsEpoch = 0; /* Incremented every time the key or
+                                         channel patterns of any user change,
+                                         invalidating the clients key cache. */
+
 struct ACLCategoryItem {
     const char *name;
     uint64_t flag;
@@ -236,6 +240,128 @@ void *ACLListDupSds(void *item) {
     return sdsdup(item);
 }
 
+/* =============================================================================
+ * Compiled key and channel patterns
+ * ==========================================================================*/
+
+/* Testing every key against every pattern of the user with stringmatchlen()
+ * makes the cost of the ACL check grow with the number of patterns. So the
+ * patterns of a user are compiled into a radix tree, indexed by the literal
+ * prefix of each pattern, that is the part before the first glob special
+ * char. Since all the prefixes of a key lay on the same path of the tree,
+ * finding the candidate patterns takes a single descent: exact patterns and
+ * patterns in the form "prefix*", by far the most common, are matched by the
+ * descent itself, while the remaining ones are matched with stringmatchlen()
+ * only if their literal prefix matched already. */
+#define ACL_PATTERN_EXACT (1<<0)    /* The prefix is itself a pattern. */
+#define ACL_PATTERN_PREFIX (1<<1)   /* "prefix*" is a pattern. */
+
+typedef struct aclPatternNode {
+    int flags;      /* ACL_PATTERN_* flags. */
+    int numglobs;   /* Number of entries in 'globs'. */
+    sds *globs;     /* Other patterns having this literal prefix. They are
+                       referenced, not owned, since the compiled tree is
+                       released every time the patterns list changes. */
+} aclPatternNode;
+
+/* Return the length of the literal prefix of the glob-style pattern. The
+ * backslash stops the prefix as well, leaving escapes to stringmatchlen(). */
+static size_t ACLPatternLiteralLen(sds pattern) {
+    size_t len = sdslen(pattern), j;
+
+    for (j = 0; j < len; j++) {
+        char c = pattern[j];
+        if (c == '*' || c == '?' || c == '[' || c == '\\') break;
+    }
+    return j;
+}
+
+/* Compile the list of glob-style patterns into the tree described above. */
+static rax *ACLCompilePatterns(list *patterns) {
+    rax *tree = raxNew();
+    listIter li;
+    listNode *ln;
+
+    listRewind(patterns,&li);
+    while((ln = listNext(&li))) {
+        sds pattern = listNodeValue(ln);
+        size_t plen = sdslen(pattern);
+        size_t prefixlen = ACLPatternLiteralLen(pattern);
+        aclPatternNode *node = raxFind(tree,(unsigned char*)pattern,prefixlen);
+
+        if (node == raxNotFound) {
+            node = zcalloc(sizeof(*node));
+            raxInsert(tree,(unsigned char*)pattern,prefixlen,node,NULL);
+        }
+        if (prefixlen == plen) {
+            node->flags |= ACL_PATTERN_EXACT;
+        } else if (prefixlen == plen-1 && pattern[prefixlen] == '*') {
+            node->flags |= ACL_PATTERN_PREFIX;
+        } else {
+            node->globs = zrealloc(node->globs,
+                                   sizeof(sds)*(node->numglobs+1));
+            node->globs[node->numglobs++] = pattern;
+        }
+    }
+    return tree;
+}
+
+static void ACLFreePatternNode(void *data) {
+    aclPatternNode *node = data;
+    zfree(node->globs);
+    zfree(node);
+}
+
+/* State of ACLPatternsMatch(), passed to the raxWalkPrefixes() callback. */
+typedef struct aclPatternMatchState {
+    const char *str;
+    size_t len;
+    int globbed;    /* Set if stringmatchlen() was called. */
+} aclPatternMatchState;
+
+static int ACLPatternNodeMatch(void *data, size_t prefixlen, void *privdata) {
+    aclPatternNode *node = data;
+    aclPatternMatchState *ms = privdata;
+
+    if (node->flags & ACL_PATTERN_PREFIX) return 1;
+    if ((node->flags & ACL_PATTERN_EXACT) && prefixlen == ms->len) return 1;
+    for (int j = 0; j < node->numglobs; j++) {
+        sds glob = node->globs[j];
+        ms->globbed = 1;
+        /* The literal prefix already matched: skip it. */
+        if (stringmatchlen(glob+prefixlen,sdslen(glob)-prefixlen,
+                           ms->str+prefixlen,ms->len-prefixlen,0))
+            return 1;
+    }
+    return 0;
+}
+
+/* Return 1 if the string matches any of the patterns compiled in 'tree'
+ * with ACLCompilePatterns(), otherwise 0. If 'globbed' is not NULL it is
+ * set to 1 when the result required glob matching, 0 otherwise. */
+static int ACLPatternsMatch(rax *tree, const char *str, size_t len, int *globbed) {
+    aclPatternMatchState ms = {str, len, 0};
+    int match = raxWalkPrefixes(tree,(unsigned char*)str,len,
+                                ACLPatternNodeMatch,&ms);
+    if (globbed) *globbed = ms.globbed;
+    return match;
+}
+
+/* Release the compiled patterns of the user, so that they are compiled
+ * again, from the current lists, the next time they are needed. This must
+ * be called every time the key or channel patterns of the user change. */
+static void ACLResetCompiledPatterns(user *u) {
+    if (u->patterns_compiled) {
+        raxFreeWithCallback(u->patterns_compiled,ACLFreePatternNode);
+        u->patterns_compiled = NULL;
+    }
+    if (u->channels_compiled) {
+        raxFreeWithCallback(u->channels_compiled,ACLFreePatternNode);
+        u->channels_compiled = NULL;
+    }
+    ACLPatternsEpoch++;
+}
+
 /* Create a new user with the specified name, store it in the list
  * of users (the Users global radix tree), and returns a reference to
  * the structure representing the user.
@@ -250,6 +376,8 @@ user *ACLCreateUser(const char *name, size_t namelen) {
     u->passwords = listCreate();
     u->patterns = listCreate();
     u->channels = listCreate();
+    u->patterns_compiled = NULL;
+    u->channels_compiled = NULL;
     listSetMatchMethod(u->passwords,ACLListMatchSds);
     listSetFreeMethod(u->passwords,ACLListFreeSds);
     listSetDupMethod(u->passwords,ACLListDupSds);
@@ -288,6 +416,7 @@ void ACLFreeUser(user *u) {
     listRelease(u->passwords);
     listRelease(u->patterns);
     listRelease(u->channels);
+    ACLResetCompiledPatterns(u);
     ACLResetSubcommands(u);
     zfree(u);
 }
@@ -332,6 +461,7 @@ void ACLCopyUser(user *dst, user *src) {
     dst->passwords = listDup(src->passwords);
     dst->patterns = listDup(src->patterns);
     dst->channels = listDup(src->channels);
+    ACLResetCompiledPatterns(dst);
     memcpy(dst->allowed_commands,src->allowed_commands,
            sizeof(dst->allowed_commands));
     dst->flags = src->flags;
@@ -842,17 +972,21 @@ int ACLSetUser(user *u, const char *op, ssize_t oplen) {
     {
         u->flags |= USER_FLAG_ALLKEYS;
         listEmpty(u->patterns);
+        ACLResetCompiledPatterns(u);
     } else if (!strcasecmp(op,"resetkeys")) {
         u->flags &= ~USER_FLAG_ALLKEYS;
         listEmpty(u->patterns);
+        ACLResetCompiledPatterns(u);
     } else if (!strcasecmp(op,"allchannels") ||
                !strcasecmp(op,"&*"))
     {
         u->flags |= USER_FLAG_ALLCHANNELS;
         listEmpty(u->channels);
+        ACLResetCompiledPatterns(u);
     } else if (!strcasecmp(op,"resetchannels")) {
         u->flags &= ~USER_FLAG_ALLCHANNELS;
         listEmpty(u->channels);
+        ACLResetCompiledPatterns(u);
     } else if (!strcasecmp(op,"allcommands") ||
                !strcasecmp(op,"+@all"))
     {
@@ -926,6 +1060,7 @@ int ACLSetUser(user *u, const char *op, ssize_t oplen) {
         else
             sdsfree(newpat);
         u->flags &= ~USER_FLAG_ALLKEYS;
+        ACLResetCompiledPatterns(u);
     } else if (op[0] == '&') {
         if (u->flags & USER_FLAG_ALLCHANNELS) {
             errno = EISDIR;
@@ -943,6 +1078,7 @@ int ACLSetUser(user *u, const char *op, ssize_t oplen) {
         else
             sdsfree(newpat);
         u->flags &= ~USER_FLAG_ALLCHANNELS;
+        ACLResetCompiledPatterns(u);
     } else if (op[0] == '+' && op[1] != '@') {
         if (strchr(op,'|') == NULL) {
             if (ACLLookupCommand(op+1) == NULL) {
@@ -1167,6 +1303,38 @@ user *ACLGetUserByName(const char *name, size_t namelen) {
     return myuser;
 }
 
+/* Return 1 if the user of the client 'c' can access the specified key
+ * according to its key patterns, otherwise 0.
+ *
+ * Keys that required glob matching are remembered in a per client cache of
+ * one entry, so that commands repeatedly touching the same key (counters,
+ * queues, ...) don't pay for the glob matching every time. The cache is
+ * invalidated by any change of the users patterns, see ACLPatternsEpoch. */
+static int ACLCheckKey(client *c, sds key) {
+    user *u = c->user;
+    size_t keylen = sdslen(key);
+    int globbed;
+
+    if (c->acl_key_cache &&
+        c->acl_key_cache_user == u &&
+        c->acl_key_cache_epoch == ACLPatternsEpoch &&
+        sdslen(c->acl_key_cache) == keylen &&
+        memcmp(c->acl_key_cache,key,keylen) == 0) return 1;
+
+    if (u->patterns_compiled == NULL)
+        u->patterns_compiled = ACLCompilePatterns(u->patterns);
+    if (!ACLPatternsMatch(u->patterns_compiled,key,keylen,&globbed))
+        return 0;
+
+    if (globbed && keylen <= ACL_KEY_CACHE_MAX_LEN) {
+        if (c->acl_key_cache == NULL) c->acl_key_cache = sdsempty();
+        c->acl_key_cache = sdscpylen(c->acl_key_cache,key,keylen);
+        c->acl_key_cache_user = u;
+        c->acl_key_cache_epoch = ACLPatternsEpoch;
+    }
+    return 1;
+}
+
 /* Check if the command is ready to be executed in the client 'c', already
  * referenced by c->cmd, and can be executed by this client according to the
  * ACLs associated to the client user c->user.
@@ -1219,24 +1387,7 @@ int ACLCheckCommandPerm(client *c, int *keyidxptr) {
         int numkeys = getKeysFromCommand(c->cmd,c->argv,c->argc,&result);
         int *keyidx = result.keys;
         for (int j = 0; j < numkeys; j++) {
-            listIter li;
-            listNode *ln;
-            listRewind(u->patterns,&li);
-
-            /* Test this key against every pattern. */
-            int match = 0;
-            while((ln = listNext(&li))) {
-                sds pattern = listNodeValue(ln);
-                size_t plen = sdslen(pattern);
-                int idx = keyidx[j];
-                if (stringmatchlen(pattern,plen,c->argv[idx]->ptr,
-                                   sdslen(c->argv[idx]->ptr),0))
-                {
-                    match = 1;
-                    break;
-                }
-            }
-            if (!match) {
+            if (!ACLCheckKey(c,c->argv[keyidx[j]]->ptr)) {
                 if (keyidxptr) *keyidxptr = keyidx[j];
                 getKeysFreeResult(&result);
                 return ACL_DENIED_KEY;
@@ -1348,9 +1499,15 @@ int ACLCheckPubsubPerm(client *c, int idx, int count, int literal, int *idxptr)
     /* Check if the user can access the channels mentioned in the command's
      * arguments. */
     if (!(c->user->flags & USER_FLAG_ALLCHANNELS)) {
+        if (!literal && u->channels_compiled == NULL)
+            u->channels_compiled = ACLCompilePatterns(u->channels);
         for (int j = idx; j < idx+count; j++) {
-            if (ACLCheckPubsubChannelPerm(c->argv[j]->ptr,u->channels,literal)
-                != ACL_OK) {
+            sds channel = c->argv[j]->ptr;
+            int allowed = literal ?
+                ACLCheckPubsubChannelPerm(channel,u->channels,1) == ACL_OK :
+                ACLPatternsMatch(u->channels_compiled,channel,
+                                 sdslen(channel),NULL);
+            if (!allowed) {
                 if (idxptr) *idxptr = j;
                 return ACL_DENIED_CHANNEL;
             }
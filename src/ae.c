@@ -44,6 +44,7 @@
 #include <errno.h>
 
 #include "zmalloc.h"
+#include "dict.h"
 #include "config.h"
 
 /* Include the best multiplexing layer supported by this system.
@@ -62,6 +63,29 @@
     #endif
 #endif
 
+/* Time event ID -> time event. The keys point to the 'id' field of the
+ * events themselves, so an event must be removed from the dictionary before
+ * its ID is changed. */
+static uint64_t aeTimeEventIdHash(const void *key) {
+    return dictGenHashFunction(key,sizeof(long long));
+}
+
+static int aeTimeEventIdCompare(void *privdata, const void *key1,
+                                const void *key2)
+{
+    (void)privdata;
+    return *(const long long *)key1 == *(const long long *)key2;
+}
+
+static dictType aeTimeEventIdDictType = {
+    aeTimeEventIdHash,          /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    aeTimeEventIdCompare,       /* key compare */
+    NULL,                       /* key destructor */
+    NULL,                       /* val destructor */
+    NULL                        /* allow to expand */
+};
 
 aeEventLoop *aeCreateEventLoop(int setsize) {
     aeEventLoop *eventLoop;
@@ -75,6 +99,9 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->timeEventHead = NULL;
+    eventLoop->timeEventHeap = NULL;
+    eventLoop->timeEventHeapSize = 0;
+    eventLoop->timeEventHeapAlloc = 0;
     eventLoop->timeEventNextId = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
@@ -82,6 +109,7 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     eventLoop->aftersleep = NULL;
     eventLoop->flags = 0;
     if (aeApiCreate(eventLoop) == -1) goto err;
+    eventLoop->timeEventIds = dictCreate(&aeTimeEventIdDictType,NULL);
     /* Events with mask == AE_NONE are not set. So let's initialize the
      * vector with it. */
     for (i = 0; i < setsize; i++)
@@ -147,6 +175,8 @@ void aeDeleteEventLoop(aeEventLoop *eventLoop) {
         zfree(te);
         te = next_te;
     }
+    zfree(eventLoop->timeEventHeap);
+    dictRelease(eventLoop->timeEventIds);
     zfree(eventLoop);
 }
 
@@ -203,6 +233,66 @@ int aeGetFileEvents(aeEventLoop *eventLoop, int fd) {
     return fe->mask;
 }
 
+/* The time events are kept in a doubly linked list, in a dictionary used to
+ * find them by ID, and in a binary min-heap ordered by the time they are due,
+ * so that finding the nearest timer is O(1) while scheduling and deleting
+ * one is O(log(N)). Every event remembers its heap position, in order to
+ * reschedule it in place. */
+static void aeTimeHeapSet(aeEventLoop *eventLoop, int i, aeTimeEvent *te) {
+    eventLoop->timeEventHeap[i] = te;
+    te->heapIndex = i;
+}
+
+static void aeTimeHeapUp(aeEventLoop *eventLoop, int i) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap, *te = heap[i];
+
+    while (i > 0) {
+        int parent = (i-1)/2;
+        if (heap[parent]->when <= te->when) break;
+        aeTimeHeapSet(eventLoop,i,heap[parent]);
+        i = parent;
+    }
+    aeTimeHeapSet(eventLoop,i,te);
+}
+
+static void aeTimeHeapDown(aeEventLoop *eventLoop, int i) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap, *te = heap[i];
+    int size = eventLoop->timeEventHeapSize;
+
+    while (1) {
+        int child = i*2+1;
+        if (child >= size) break;
+        if (child+1 < size && heap[child+1]->when < heap[child]->when) child++;
+        if (te->when <= heap[child]->when) break;
+        aeTimeHeapSet(eventLoop,i,heap[child]);
+        i = child;
+    }
+    aeTimeHeapSet(eventLoop,i,te);
+}
+
+static void aeTimeHeapPush(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timeEventHeapSize == eventLoop->timeEventHeapAlloc) {
+        eventLoop->timeEventHeapAlloc = eventLoop->timeEventHeapAlloc ?
+                                        eventLoop->timeEventHeapAlloc*2 : 16;
+        eventLoop->timeEventHeap = zrealloc(eventLoop->timeEventHeap,
+            sizeof(aeTimeEvent*)*eventLoop->timeEventHeapAlloc);
+    }
+    aeTimeHeapSet(eventLoop,eventLoop->timeEventHeapSize++,te);
+    aeTimeHeapUp(eventLoop,te->heapIndex);
+}
+
+/* Remove and return the nearest time event. */
+static aeTimeEvent *aeTimeHeapPop(aeEventLoop *eventLoop) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap, *top = heap[0];
+
+    if (--eventLoop->timeEventHeapSize > 0) {
+        aeTimeHeapSet(eventLoop,0,heap[eventLoop->timeEventHeapSize]);
+        aeTimeHeapDown(eventLoop,0);
+    }
+    top->heapIndex = -1;
+    return top;
+}
+
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
@@ -223,110 +313,104 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     if (te->next)
         te->next->prev = te;
     eventLoop->timeEventHead = te;
+    dictAdd(eventLoop->timeEventIds,&te->id,te);
+    aeTimeHeapPush(eventLoop,te);
     return id;
 }
 
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    while(te) {
-        if (te->id == id) {
-            te->id = AE_DELETED_EVENT_ID;
-            return AE_OK;
-        }
-        te = te->next;
+    aeTimeEvent *te = dictFetchValue(eventLoop->timeEventIds,&id);
+
+    if (te == NULL) return AE_ERR; /* NO event with the specified ID found */
+    dictDelete(eventLoop->timeEventIds,&id);
+    te->id = AE_DELETED_EVENT_ID;
+    /* Move it to the top of the heap: the next processTimeEvents() call
+     * will release it. */
+    if (te->heapIndex != -1) {
+        te->when = 0;
+        aeTimeHeapUp(eventLoop,te->heapIndex);
     }
-    return AE_ERR; /* NO event with the specified ID found */
+    return AE_OK;
 }
 
 /* How many microseconds until the first timer should fire.
- * If there are no timers, -1 is returned.
- *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
+ * If there are no timers, -1 is returned. */
 static int64_t usUntilEarliestTimer(aeEventLoop *eventLoop) {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    if (te == NULL) return -1;
-
-    aeTimeEvent *earliest = NULL;
-    while (te) {
-        if (!earliest || te->when < earliest->when)
-            earliest = te;
-        te = te->next;
-    }
+    if (eventLoop->timeEventHeapSize == 0) return -1;
 
+    aeTimeEvent *earliest = eventLoop->timeEventHeap[0];
     monotime now = getMonotonicUs();
     return (now >= earliest->when) ? 0 : earliest->when - now;
 }
 
 /* Process time events */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
-    aeTimeEvent *te;
+    int processed = 0, count = 0, alloc = 64, j;
+    aeTimeEvent *stackbatch[64], **batch = stackbatch, *te;
     long long maxId;
 
-    te = eventLoop->timeEventHead;
     maxId = eventLoop->timeEventNextId-1;
     monotime now = getMonotonicUs();
-    while(te) {
-        long long id;
-
-        /* Remove events scheduled for deletion. */
-        if (te->id == AE_DELETED_EVENT_ID) {
-            aeTimeEvent *next = te->next;
-            /* If a reference exists for this timer event,
-             * don't free it. This is currently incremented
-             * for recursive timerProc calls */
-            if (te->refcount) {
-                te = next;
-                continue;
-            }
-            if (te->prev)
-                te->prev->next = te->next;
-            else
-                eventLoop->timeEventHead = te->next;
-            if (te->next)
-                te->next->prev = te->prev;
-            if (te->finalizerProc) {
-                te->finalizerProc(eventLoop, te->clientData);
-                now = getMonotonicUs();
+
+    /* Take out of the heap all the events that are due, including the ones
+     * scheduled for deletion, that are at the top of the heap. The events of
+     * the batch are referenced, so that recursive calls can't free them. */
+    while (eventLoop->timeEventHeapSize &&
+           eventLoop->timeEventHeap[0]->when <= now)
+    {
+        if (count == alloc) {
+            alloc *= 2;
+            if (batch == stackbatch) {
+                batch = zmalloc(sizeof(aeTimeEvent*)*alloc);
+                memcpy(batch,stackbatch,sizeof(stackbatch));
+            } else {
+                batch = zrealloc(batch,sizeof(aeTimeEvent*)*alloc);
             }
-            zfree(te);
-            te = next;
-            continue;
         }
+        te = aeTimeHeapPop(eventLoop);
+        te->refcount++;
+        batch[count++] = te;
+    }
 
-        /* Make sure we don't process time events created by time events in
-         * this iteration. Note that this check is currently useless: we always
-         * add new timers on the head, however if we change the implementation
-         * detail, this check may be useful again: we keep it here for future
-         * defense. */
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
+    for (j = 0; j < count; j++) {
+        te = batch[j];
+
+        /* Make sure we don't process time events created by the finalizers
+         * of the events of this batch, or deleted by a previous callback. */
+        if (te->id == AE_DELETED_EVENT_ID || te->id > maxId) continue;
+
+        int retval = te->timeProc(eventLoop, te->id, te->clientData);
+        processed++;
+        now = getMonotonicUs();
+        if (retval != AE_NOMORE) {
+            te->when = now + retval * 1000;
+        } else if (te->id != AE_DELETED_EVENT_ID) {
+            /* The callback may have deleted its own event already. */
+            dictDelete(eventLoop->timeEventIds,&te->id);
+            te->id = AE_DELETED_EVENT_ID;
         }
+    }
 
-        if (te->when <= now) {
-            int retval;
-
-            id = te->id;
-            te->refcount++;
-            retval = te->timeProc(eventLoop, id, te->clientData);
-            te->refcount--;
-            processed++;
-            now = getMonotonicUs();
-            if (retval != AE_NOMORE) {
-                te->when = now + retval * 1000;
-            } else {
-                te->id = AE_DELETED_EVENT_ID;
-            }
+    /* Reschedule the events of the batch, or release the deleted ones. */
+    for (j = 0; j < count; j++) {
+        te = batch[j];
+        if (--te->refcount) continue;
+        if (te->id != AE_DELETED_EVENT_ID) {
+            aeTimeHeapPush(eventLoop,te);
+            continue;
         }
-        te = te->next;
+        if (te->prev)
+            te->prev->next = te->next;
+        else
+            eventLoop->timeEventHead = te->next;
+        if (te->next)
+            te->next->prev = te->prev;
+        if (te->finalizerProc)
+            te->finalizerProc(eventLoop, te->clientData);
+        zfree(te);
     }
+    if (batch != stackbatch) zfree(batch);
     return processed;
 }
 
@@ -501,3 +585,146 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
     eventLoop->aftersleep = aftersleep;
 }
+
+#ifdef REDIS_TEST
+#include <assert.h>
+
+#define UNUSED(x) ((void)(x))
+
+/* Record of what the test timers did. */
+static struct {
+    long long order[32];   /* Index of the timers, in the order they fired. */
+    int fired;
+    int finalized;
+    long long victim;      /* Timer deleted by aeTestDeleteOther(). */
+    monotime calls[4];     /* When aeTestPeriodic() was called. */
+} aeTestState;
+
+static int aeTestRecord(aeEventLoop *eventLoop, long long id, void *clientData) {
+    UNUSED(eventLoop);
+    UNUSED(id);
+    aeTestState.order[aeTestState.fired++] = (long)clientData;
+    return AE_NOMORE;
+}
+
+static void aeTestFinalize(aeEventLoop *eventLoop, void *clientData) {
+    UNUSED(eventLoop);
+    UNUSED(clientData);
+    aeTestState.finalized++;
+}
+
+static int aeTestPeriodic(aeEventLoop *eventLoop, long long id, void *clientData) {
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+    aeTestState.calls[aeTestState.fired++] = getMonotonicUs();
+    return aeTestState.fired < 3 ? 5 : AE_NOMORE;
+}
+
+static int aeTestDeleteOther(aeEventLoop *eventLoop, long long id, void *clientData) {
+    UNUSED(id);
+    aeTestState.order[aeTestState.fired++] = (long)clientData;
+    assert(aeDeleteTimeEvent(eventLoop,aeTestState.victim) == AE_OK);
+    return AE_NOMORE;
+}
+
+static int aeTestDeleteSelf(aeEventLoop *eventLoop, long long id, void *clientData) {
+    aeTestState.order[aeTestState.fired++] = (long)clientData;
+    assert(aeDeleteTimeEvent(eventLoop,id) == AE_OK);
+    return 1; /* Rescheduling a deleted timer must not revive it. */
+}
+
+static void aeTestReset(void) {
+    memset(&aeTestState,0,sizeof(aeTestState));
+}
+
+/* Process the time events until 'fired' timers fired. */
+static void aeTestRun(aeEventLoop *eventLoop, int fired) {
+    while (aeTestState.fired < fired) aeProcessEvents(eventLoop,AE_TIME_EVENTS);
+}
+
+/* Process the timers due, and release the deleted ones. */
+static void aeTestFlush(aeEventLoop *eventLoop) {
+    aeProcessEvents(eventLoop,AE_TIME_EVENTS|AE_DONT_WAIT);
+}
+
+int aeTest(int argc, char **argv, int accurate) {
+    aeEventLoop *el;
+    long long ids[16];
+    long j;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    UNUSED(accurate);
+    monotonicInit();
+    el = aeCreateEventLoop(64);
+
+    printf("Time events fire in 'when' order: ");
+    {
+        long delays[] = {30, 10, 20, 0, 25, 5};
+        long expected[] = {3, 5, 1, 2, 4, 0};
+
+        aeTestReset();
+        for (j = 0; j < 6; j++)
+            aeCreateTimeEvent(el,delays[j],aeTestRecord,(void*)j,aeTestFinalize);
+        aeTestRun(el,6);
+        for (j = 0; j < 6; j++) assert(aeTestState.order[j] == expected[j]);
+        assert(aeTestState.finalized == 6);
+        assert(el->timeEventHeapSize == 0 && dictSize(el->timeEventIds) == 0);
+        printf("OK\n");
+    }
+
+    printf("Delete a time event in the middle of the heap: ");
+    {
+        aeTestReset();
+        for (j = 0; j < 16; j++)
+            ids[j] = aeCreateTimeEvent(el,j+1,aeTestRecord,(void*)j,aeTestFinalize);
+        assert(aeDeleteTimeEvent(el,ids[8]) == AE_OK);
+        assert(aeDeleteTimeEvent(el,ids[8]) == AE_ERR);
+        assert(dictSize(el->timeEventIds) == 15);
+        aeTestRun(el,15);
+        for (j = 0; j < 15; j++) assert(aeTestState.order[j] == (j < 8 ? j : j+1));
+        assert(aeTestState.finalized == 16);
+        assert(el->timeEventHeapSize == 0 && dictSize(el->timeEventIds) == 0);
+        printf("OK\n");
+    }
+
+    printf("Reschedule a time event returning its period: ");
+    {
+        aeTestReset();
+        aeCreateTimeEvent(el,0,aeTestPeriodic,NULL,aeTestFinalize);
+        aeTestRun(el,3);
+        assert(aeTestState.calls[1]-aeTestState.calls[0] >= 5000);
+        assert(aeTestState.calls[2]-aeTestState.calls[1] >= 5000);
+        aeTestFlush(el);
+        assert(aeTestState.fired == 3 && aeTestState.finalized == 1);
+        assert(el->timeEventHeapSize == 0 && dictSize(el->timeEventIds) == 0);
+        printf("OK\n");
+    }
+
+    printf("Time events deleted while processing don't fire: ");
+    {
+        aeTestReset();
+        /* All due in the same batch: the first deletes the third, the
+         * second deletes itself and asks to run again. */
+        aeCreateTimeEvent(el,0,aeTestDeleteOther,(void*)0,aeTestFinalize);
+        aeCreateTimeEvent(el,0,aeTestDeleteSelf,(void*)1,aeTestFinalize);
+        aeTestState.victim =
+            aeCreateTimeEvent(el,0,aeTestRecord,(void*)2,aeTestFinalize);
+        usleep(1000);
+        aeTestFlush(el);
+        assert(aeTestState.fired == 2);
+        assert(aeTestState.order[0] == 0 && aeTestState.order[1] == 1);
+        assert(aeTestState.finalized == 3);
+        usleep(5000);
+        aeTestFlush(el);
+        assert(aeTestState.fired == 2 && aeTestState.finalized == 3);
+        assert(el->timeEventHeapSize == 0 && dictSize(el->timeEventIds) == 0);
+        assert(el->timeEventHead == NULL);
+        printf("OK\n");
+    }
+
+    aeDeleteEventLoop(el);
+    return 0;
+}
+#endif
@@ -130,6 +130,7 @@ typedef struct aeTimeEvent {
     struct aeTimeEvent *next;
     int refcount; /* refcount to prevent timer events from being
   		   * freed in recursive time event calls. */
+    int heapIndex; /* Position in the timers heap, -1 if not in the heap. */
 } aeTimeEvent;
 
 /* A fired event
@@ -161,9 +162,6 @@ typedef struct aeEventLoop {
     // 用于生成时间事件 id
     long long timeEventNextId;
 
-    // 最后一次执行时间事件的时间
-    time_t lastTime;     /* Used to detect system clock skew */
-
     // 已注册的文件事件
     aeFileEvent *events; /* Registered events */
 
@@ -173,6 +171,15 @@ typedef struct aeEventLoop {
     // 时间事件
     aeTimeEvent *timeEventHead;
 
+    /* Min-heap of the time events ordered by 'when', so that the nearest
+     * timer is always timeEventHeap[0]. */
+    aeTimeEvent **timeEventHeap;
+    int timeEventHeapSize;
+    int timeEventHeapAlloc;
+
+    /* Time event ID -> time event, to delete the events in O(log(N)). */
+    struct dict *timeEventIds;
+
     // 事件处理器的开关
     int stop;
 
@@ -207,4 +214,8 @@ int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 void aeSetDontWait(aeEventLoop *eventLoop, int noWait);
 
+#ifdef REDIS_TEST
+int aeTest(int argc, char **argv, int accurate);
+#endif
+
 #endif
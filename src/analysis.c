@@ -0,0 +1,719 @@
+/* Copyright (c) 2009-2021, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Background keyspace analysis.
+ *
+ * MEMORY ANALYZE forks a child that walks the whole keyspace, as it was at
+ * the time of the fork, estimating the memory used by every key the same way
+ * MEMORY USAGE does. The child computes size histograms per type, encoding
+ * and key prefix, the biggest keys and the distribution of the TTLs, and
+ * sends the report to the parent through a pipe. MEMORY REPORT returns the
+ * last report received.
+ *
+ * Unlike BGSAVE and BGREWRITEAOF the analysis child is not exclusive: it can
+ * run for hours on big datasets, so it must not prevent persistence from
+ * working in the meantime. Like the LDB children, its pid is tracked here and
+ * not in server.child_pid. */
+
+#include "server.h"
+#include "rdb.h"
+
+#include <sys/wait.h>
+
+#define KSA_HIST_BUCKETS 64     /* Bucket i counts sizes in [2^i, 2^(i+1)). */
+#define KSA_MAX_PREFIXES 1024   /* Prefixes tracked, others are grouped. */
+#define KSA_DEFAULT_TOP 100     /* Biggest keys reported by default. */
+#define KSA_MAX_TOP 10000
+#define KSA_OTHER_PREFIXES "(other)"
+#define KSA_NO_PREFIX "(no prefix)"
+
+/* Kinds of groups the keys are accounted in. */
+#define KSA_GROUP_TYPE 0
+#define KSA_GROUP_ENCODING 1
+#define KSA_GROUP_PREFIX 2
+#define KSA_GROUP_KINDS 3
+
+static const char *ksaGroupNames[KSA_GROUP_KINDS] = {
+    "types", "encodings", "prefixes"
+};
+
+/* TTL distribution: keys without TTL, keys already expired but not yet
+ * reclaimed, then keys expiring within a minute, an hour, a day, a week,
+ * and later. */
+#define KSA_TTL_BUCKETS 7
+static const char *ksaTTLNames[KSA_TTL_BUCKETS] = {
+    "none", "expired", "<1m", "<1h", "<1d", "<1w", ">=1w"
+};
+static const long long ksaTTLLimits[KSA_TTL_BUCKETS] = {
+    0, 0, 60*1000LL, 3600*1000LL, 86400*1000LL, 7*86400*1000LL, LLONG_MAX
+};
+
+typedef struct ksaGroup {
+    sds name;
+    unsigned long long keys;
+    unsigned long long bytes;
+    unsigned long long hist[KSA_HIST_BUCKETS];
+} ksaGroup;
+
+typedef struct ksaBigKey {
+    int dbid;
+    sds key;
+    sds type;
+    unsigned long long bytes;
+} ksaBigKey;
+
+typedef struct ksaReport {
+    long long finished;             /* Unix time the analysis ended. */
+    long long duration;             /* Milliseconds taken by the child. */
+    unsigned long long keys;
+    unsigned long long bytes;
+    sds separator;
+    ksaGroup *groups[KSA_GROUP_KINDS];  /* Sorted by bytes, biggest first. */
+    unsigned long numgroups[KSA_GROUP_KINDS];
+    unsigned long long ttl[KSA_TTL_BUCKETS];
+    ksaBigKey *top;                 /* Sorted by bytes, biggest first. */
+    unsigned long numtop;
+} ksaReport;
+
+#define KSA_STATUS_NONE 0
+#define KSA_STATUS_RUNNING 1
+#define KSA_STATUS_DONE 2
+#define KSA_STATUS_FAILED 3
+
+static struct {
+    pid_t child_pid;        /* -1 if no analysis is running. */
+    int pipe_fd;            /* Read end of the pipe from the child. */
+    sds buf;                /* Serialized report read so far. */
+    int status;             /* Status of the last analysis. */
+    ksaReport *report;      /* Last successful report, or NULL. */
+} analysis = {-1, -1, NULL, KSA_STATUS_NONE, NULL};
+
+/* ----------------------------- Report handling ---------------------------- */
+
+static ksaReport *ksaCreateReport(void) {
+    return zcalloc(sizeof(ksaReport));
+}
+
+static void ksaFreeReport(ksaReport *r) {
+    if (!r) return;
+    for (int k = 0; k < KSA_GROUP_KINDS; k++) {
+        for (unsigned long j = 0; j < r->numgroups[k]; j++)
+            sdsfree(r->groups[k][j].name);
+        zfree(r->groups[k]);
+    }
+    for (unsigned long j = 0; j < r->numtop; j++) {
+        sdsfree(r->top[j].key);
+        sdsfree(r->top[j].type);
+    }
+    zfree(r->top);
+    sdsfree(r->separator);
+    zfree(r);
+}
+
+static int ksaHistBucket(unsigned long long bytes) {
+    int b = 0;
+    while (bytes >>= 1) b++;
+    return b;
+}
+
+static void ksaAccount(dict *d, const char *name, size_t len,
+                       unsigned long long bytes)
+{
+    sds key = sdsnewlen(name, len);
+    dictEntry *de = dictFind(d, key);
+    ksaGroup *g;
+
+    if (de) {
+        sdsfree(key);
+        g = dictGetVal(de);
+    } else {
+        g = zcalloc(sizeof(*g));
+        g->name = key;
+        dictAdd(d, key, g);
+    }
+    g->keys++;
+    g->bytes += bytes;
+    g->hist[ksaHistBucket(bytes)]++;
+}
+
+static int ksaGroupCompare(const void *a, const void *b) {
+    const ksaGroup *ga = a, *gb = b;
+    if (ga->bytes == gb->bytes) return sdscmp(ga->name, gb->name);
+    return ga->bytes > gb->bytes ? -1 : 1;
+}
+
+static int ksaBigKeyCompare(const void *a, const void *b) {
+    const ksaBigKey *ka = a, *kb = b;
+    if (ka->bytes == kb->bytes) return sdscmp(ka->key, kb->key);
+    return ka->bytes > kb->bytes ? -1 : 1;
+}
+
+/* Move the groups accumulated in the dictionary 'd' into the report, and
+ * release the dictionary. */
+static void ksaCollectGroups(ksaReport *r, int kind, dict *d) {
+    dictIterator *di = dictGetIterator(d);
+    dictEntry *de;
+    unsigned long j = 0;
+
+    r->groups[kind] = zmalloc(sizeof(ksaGroup) * (dictSize(d) ? dictSize(d) : 1));
+    while ((de = dictNext(di)) != NULL) {
+        ksaGroup *g = dictGetVal(de);
+        r->groups[kind][j++] = *g;
+        zfree(g);
+    }
+    dictReleaseIterator(di);
+    r->numgroups[kind] = j;
+    qsort(r->groups[kind], j, sizeof(ksaGroup), ksaGroupCompare);
+    dictRelease(d);
+}
+
+/* Restore the min-heap property of the 'n' biggest keys found so far, after
+ * the root was replaced. */
+static void ksaHeapSiftDown(ksaBigKey *heap, unsigned long n) {
+    unsigned long i = 0;
+
+    while (1) {
+        unsigned long l = 2*i+1, r = 2*i+2, min = i;
+        if (l < n && heap[l].bytes < heap[min].bytes) min = l;
+        if (r < n && heap[r].bytes < heap[min].bytes) min = r;
+        if (min == i) break;
+        ksaBigKey tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+static void ksaHeapPush(ksaBigKey *heap, unsigned long n) {
+    unsigned long i = n;
+
+    while (i) {
+        unsigned long parent = (i-1)/2;
+        if (heap[parent].bytes <= heap[i].bytes) break;
+        ksaBigKey tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
+}
+
+/* Walk the whole keyspace and return the report. Called by the child. */
+static ksaReport *ksaAnalyzeKeyspace(unsigned long top, const char *separator,
+                                     long long samples)
+{
+    ksaReport *r = ksaCreateReport();
+    dict *groups[KSA_GROUP_KINDS];
+    long long start = mstime();
+    long long now = start;
+
+    for (int k = 0; k < KSA_GROUP_KINDS; k++)
+        groups[k] = dictCreate(&sdsReplyDictType, NULL);
+    r->separator = sdsnew(separator);
+    r->top = zmalloc(sizeof(ksaBigKey) * (top ? top : 1));
+
+    for (int dbid = 0; dbid < server.dbnum; dbid++) {
+        redisDb *db = server.db+dbid;
+        dictIterator *di;
+        dictEntry *de;
+
+        if (dictSize(db->dict) == 0) continue;
+        di = dictGetIterator(db->dict);
+        while ((de = dictNext(di)) != NULL) {
+            sds key = dictGetKey(de);
+            robj *val = dictGetVal(de);
+            dictEntry *expire;
+            unsigned long long bytes;
+            const char *type = getObjectTypeName(val);
+            char *sep;
+            int ttl;
+
+            bytes = objectComputeSize(val, samples);
+            bytes += sdsZmallocSize(key);
+            bytes += sizeof(dictEntry);
+
+            r->keys++;
+            r->bytes += bytes;
+            ksaAccount(groups[KSA_GROUP_TYPE], type, strlen(type), bytes);
+            ksaAccount(groups[KSA_GROUP_ENCODING], strEncoding(val->encoding),
+                       strlen(strEncoding(val->encoding)), bytes);
+
+            /* The prefix is the part of the key before the separator. Once
+             * KSA_MAX_PREFIXES were seen, new ones are accounted together. */
+            sep = memchr(key, separator[0], sdslen(key));
+            if (sep == NULL) {
+                ksaAccount(groups[KSA_GROUP_PREFIX], KSA_NO_PREFIX,
+                           strlen(KSA_NO_PREFIX), bytes);
+            } else if (dictSize(groups[KSA_GROUP_PREFIX]) < KSA_MAX_PREFIXES) {
+                ksaAccount(groups[KSA_GROUP_PREFIX], key, sep-key, bytes);
+            } else {
+                sds prefix = sdsnewlen(key, sep-key);
+                int known = dictFind(groups[KSA_GROUP_PREFIX], prefix) != NULL;
+                sdsfree(prefix);
+                if (known)
+                    ksaAccount(groups[KSA_GROUP_PREFIX], key, sep-key, bytes);
+                else
+                    ksaAccount(groups[KSA_GROUP_PREFIX], KSA_OTHER_PREFIXES,
+                               strlen(KSA_OTHER_PREFIXES), bytes);
+            }
+
+            /* TTL distribution. */
+            if (dictSize(db->expires) &&
+                (expire = dictFind(db->expires, key)) != NULL)
+            {
+                long long left = dictGetSignedIntegerVal(expire) - now;
+                if (left <= 0) {
+                    ttl = 1;
+                } else {
+                    for (ttl = 2; left >= ksaTTLLimits[ttl]; ttl++);
+                }
+            } else {
+                ttl = 0;
+            }
+            r->ttl[ttl]++;
+
+            /* Biggest keys, using a min-heap of 'top' elements. */
+            if (top == 0) continue;
+            if (r->numtop < top) {
+                ksaBigKey *bk = r->top+r->numtop;
+                bk->dbid = dbid;
+                bk->key = sdsdup(key);
+                bk->type = sdsnew(type);
+                bk->bytes = bytes;
+                ksaHeapPush(r->top, r->numtop++);
+            } else if (bytes > r->top[0].bytes) {
+                sdsfree(r->top[0].key);
+                sdsfree(r->top[0].type);
+                r->top[0].dbid = dbid;
+                r->top[0].key = sdsdup(key);
+                r->top[0].type = sdsnew(type);
+                r->top[0].bytes = bytes;
+                ksaHeapSiftDown(r->top, r->numtop);
+            }
+        }
+        dictReleaseIterator(di);
+    }
+
+    for (int k = 0; k < KSA_GROUP_KINDS; k++)
+        ksaCollectGroups(r, k, groups[k]);
+    qsort(r->top, r->numtop, sizeof(ksaBigKey), ksaBigKeyCompare);
+    r->finished = time(NULL);
+    r->duration = mstime()-start;
+    return r;
+}
+
+/* The report travels from the child to the parent serialized with the RDB
+ * encoding of lengths and strings. */
+static sds ksaSerializeReport(ksaReport *r) {
+    rio rdb;
+
+    rioInitWithBuffer(&rdb, sdsempty());
+    rdbSaveLen(&rdb, r->finished);
+    rdbSaveLen(&rdb, r->duration);
+    rdbSaveLen(&rdb, r->keys);
+    rdbSaveLen(&rdb, r->bytes);
+    rdbSaveRawString(&rdb, (unsigned char *) r->separator, sdslen(r->separator));
+    for (int k = 0; k < KSA_GROUP_KINDS; k++) {
+        rdbSaveLen(&rdb, r->numgroups[k]);
+        for (unsigned long j = 0; j < r->numgroups[k]; j++) {
+            ksaGroup *g = r->groups[k]+j;
+            rdbSaveRawString(&rdb, (unsigned char *) g->name, sdslen(g->name));
+            rdbSaveLen(&rdb, g->keys);
+            rdbSaveLen(&rdb, g->bytes);
+            for (int b = 0; b < KSA_HIST_BUCKETS; b++)
+                rdbSaveLen(&rdb, g->hist[b]);
+        }
+    }
+    for (int t = 0; t < KSA_TTL_BUCKETS; t++) rdbSaveLen(&rdb, r->ttl[t]);
+    rdbSaveLen(&rdb, r->numtop);
+    for (unsigned long j = 0; j < r->numtop; j++) {
+        ksaBigKey *bk = r->top+j;
+        rdbSaveLen(&rdb, bk->dbid);
+        rdbSaveRawString(&rdb, (unsigned char *) bk->key, sdslen(bk->key));
+        rdbSaveRawString(&rdb, (unsigned char *) bk->type, sdslen(bk->type));
+        rdbSaveLen(&rdb, bk->bytes);
+    }
+    return rdb.io.buffer.ptr;
+}
+
+/* Load a report serialized by ksaSerializeReport(). Returns NULL if the
+ * payload is truncated or otherwise invalid. */
+static ksaReport *ksaDeserializeReport(sds payload) {
+    ksaReport *r = ksaCreateReport();
+    uint64_t len;
+    rio rdb;
+
+/* Load a length into 'dst', or jump to the error label. */
+#define ksaLoadLen(dst) do { \
+    if ((len = rdbLoadLen(&rdb, NULL)) == RDB_LENERR) goto err; \
+    (dst) = len; \
+} while(0)
+/* Load a string into 'dst', or jump to the error label. */
+#define ksaLoadString(dst) do { \
+    if (((dst) = rdbGenericLoadStringObject(&rdb, RDB_LOAD_SDS, NULL)) == NULL) \
+        goto err; \
+} while(0)
+
+    rioInitWithBuffer(&rdb, payload);
+    ksaLoadLen(r->finished);
+    ksaLoadLen(r->duration);
+    ksaLoadLen(r->keys);
+    ksaLoadLen(r->bytes);
+    ksaLoadString(r->separator);
+    for (int k = 0; k < KSA_GROUP_KINDS; k++) {
+        uint64_t numgroups;
+
+        ksaLoadLen(numgroups);
+        if (numgroups > sdslen(payload)) goto err;
+        /* One more element, zeroed, so that the error path below can
+         * always free the element being loaded. */
+        r->groups[k] = zcalloc(sizeof(ksaGroup) * (numgroups+1));
+        for (; r->numgroups[k] < numgroups; r->numgroups[k]++) {
+            ksaGroup *g = r->groups[k]+r->numgroups[k];
+            ksaLoadString(g->name);
+            ksaLoadLen(g->keys);
+            ksaLoadLen(g->bytes);
+            for (int b = 0; b < KSA_HIST_BUCKETS; b++) ksaLoadLen(g->hist[b]);
+        }
+    }
+    for (int t = 0; t < KSA_TTL_BUCKETS; t++) ksaLoadLen(r->ttl[t]);
+    uint64_t numtop;
+    ksaLoadLen(numtop);
+    if (numtop > KSA_MAX_TOP) goto err;
+    r->top = zcalloc(sizeof(ksaBigKey) * (numtop+1));
+    for (; r->numtop < numtop; r->numtop++) {
+        ksaBigKey *bk = r->top+r->numtop;
+        ksaLoadLen(bk->dbid);
+        ksaLoadString(bk->key);
+        ksaLoadString(bk->type);
+        ksaLoadLen(bk->bytes);
+    }
+    return r;
+
+#undef ksaLoadLen
+#undef ksaLoadString
+err:
+    /* The element being loaded is counted only once complete, so free the
+     * fields of that element that were already loaded too. */
+    for (int k = 0; k < KSA_GROUP_KINDS; k++) {
+        if (r->groups[k]) sdsfree(r->groups[k][r->numgroups[k]].name);
+    }
+    if (r->top) {
+        sdsfree(r->top[r->numtop].key);
+        sdsfree(r->top[r->numtop].type);
+    }
+    ksaFreeReport(r);
+    return NULL;
+}
+
+/* ------------------------------ Child handling ---------------------------- */
+
+/* Read what the child sent so far. Returns 0 if more data may follow, 1 on
+ * EOF, and -1 on read errors, with errno set. */
+static int ksaReadPipe(int fd) {
+    while (1) {
+        ssize_t nread;
+
+        analysis.buf = sdsMakeRoomFor(analysis.buf, PROTO_IOBUF_LEN);
+        nread = read(fd, analysis.buf+sdslen(analysis.buf),
+                     sdsavail(analysis.buf));
+        if (nread == 0) return 1;
+        if (nread == -1) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        sdsIncrLen(analysis.buf, nread);
+    }
+}
+
+static void ksaClosePipe(void) {
+    if (analysis.pipe_fd == -1) return;
+    aeDeleteFileEvent(server.el, analysis.pipe_fd, AE_READABLE);
+    close(analysis.pipe_fd);
+    analysis.pipe_fd = -1;
+}
+
+/* Make 'r' the last report. */
+static void ksaAnalysisDone(ksaReport *r) {
+    ksaFreeReport(analysis.report);
+    analysis.report = r;
+    analysis.status = KSA_STATUS_DONE;
+    serverLog(LL_NOTICE, "Keyspace analysis of %llu keys done in %lld ms",
+              r->keys, r->duration);
+}
+
+/* The child closes the pipe only once the whole report is written, so at
+ * EOF the report is complete, or the analysis failed. In both cases, as well
+ * as on read errors, stop listening: the child is reaped later, or killed
+ * right away if the analysis failed. */
+static void ksaPipeReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    ksaReport *r;
+    int retval;
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    if ((retval = ksaReadPipe(fd)) == 0) return;
+    ksaClosePipe();
+    if (retval == -1) {
+        serverLog(LL_WARNING, "Error reading from the keyspace analysis "
+                  "child: %s", strerror(errno));
+    } else if ((r = ksaDeserializeReport(analysis.buf)) != NULL) {
+        ksaAnalysisDone(r);
+        return;
+    } else {
+        serverLog(LL_WARNING, "The keyspace analysis child closed the pipe "
+                  "before sending the whole report");
+    }
+    killKeyspaceAnalysisChild();
+}
+
+/* Start the analysis in a child process. Returns C_ERR if it can't be
+ * started. */
+static int ksaStartAnalysis(unsigned long top, const char *separator,
+                            long long samples)
+{
+    int pipefds[2];
+    pid_t childpid;
+
+    if (pipe(pipefds) == -1) {
+        serverLog(LL_WARNING, "Can't create the pipe for the keyspace "
+                  "analysis: %s", strerror(errno));
+        return C_ERR;
+    }
+
+    if ((childpid = redisFork(CHILD_TYPE_ANALYSIS)) == 0) {
+        /* Child */
+        ksaReport *r;
+        sds payload;
+        char *p;
+        size_t left;
+        int retval = 0;
+
+        close(pipefds[0]);
+        redisSetProcTitle("redis-analysis");
+        r = ksaAnalyzeKeyspace(top, separator, samples);
+        payload = ksaSerializeReport(r);
+        p = payload;
+        left = sdslen(payload);
+        while (left) {
+            ssize_t nwritten = write(pipefds[1], p, left);
+            if (nwritten == -1) {
+                if (errno == EINTR) continue;
+                retval = 1;
+                break;
+            }
+            p += nwritten;
+            left -= nwritten;
+        }
+        close(pipefds[1]);
+        exitFromChild(retval);
+    } else {
+        /* Parent */
+        close(pipefds[1]);
+        if (childpid == -1) {
+            close(pipefds[0]);
+            serverLog(LL_WARNING, "Can't fork the keyspace analysis: %s",
+                      strerror(errno));
+            return C_ERR;
+        }
+        anetNonBlock(NULL, pipefds[0]);
+        if (aeCreateFileEvent(server.el, pipefds[0], AE_READABLE,
+                              ksaPipeReadHandler, NULL) == AE_ERR)
+        {
+            serverLog(LL_WARNING, "Can't read from the keyspace analysis "
+                      "child, killing it");
+            kill(childpid, SIGUSR1);
+            waitpid(childpid, NULL, 0);
+            close(pipefds[0]);
+            return C_ERR;
+        }
+        serverLog(LL_NOTICE, "Keyspace analysis started by pid %ld",
+                  (long) childpid);
+        analysis.child_pid = childpid;
+        analysis.pipe_fd = pipefds[0];
+        analysis.buf = sdsempty();
+        analysis.status = KSA_STATUS_RUNNING;
+        updateDictResizePolicy();
+    }
+    return C_OK;
+}
+
+int keyspaceAnalysisInProgress(void) {
+    return analysis.child_pid != -1;
+}
+
+/* Called by checkChildrenDone() for the children that are not the one in
+ * server.child_pid. Returns 1 if 'pid' is the analysis child, that is then
+ * handled here. */
+int keyspaceAnalysisChildDone(pid_t pid, int exitcode, int bysignal) {
+    ksaReport *r = NULL;
+
+    if (analysis.child_pid == -1 || pid != analysis.child_pid) return 0;
+
+    /* Read what's left in the pipe: the child may exit before we consumed
+     * everything it sent. If the pipe is already closed, the report was
+     * handled by ksaPipeReadHandler(). */
+    if (!bysignal && exitcode == 0 && analysis.pipe_fd != -1 &&
+        ksaReadPipe(analysis.pipe_fd) == 1)
+    {
+        r = ksaDeserializeReport(analysis.buf);
+    }
+    ksaClosePipe();
+    sdsfree(analysis.buf);
+    analysis.buf = NULL;
+    analysis.child_pid = -1;
+    updateDictResizePolicy();
+
+    if (r) {
+        ksaAnalysisDone(r);
+    } else if (analysis.status == KSA_STATUS_RUNNING) {
+        analysis.status = KSA_STATUS_FAILED;
+        serverLog(LL_WARNING, "Keyspace analysis failed (exitcode %d, "
+                  "signal %d)", exitcode, bysignal);
+    }
+    return 1;
+}
+
+/* Kill the analysis child if any, waiting for it to terminate. */
+void killKeyspaceAnalysisChild(void) {
+    if (analysis.child_pid == -1) return;
+    serverLog(LL_NOTICE, "Killing the keyspace analysis child %ld",
+              (long) analysis.child_pid);
+    if (kill(analysis.child_pid, SIGUSR1) != -1) {
+        while (waitpid(analysis.child_pid, NULL, 0) == -1 && errno == EINTR);
+    }
+    keyspaceAnalysisChildDone(analysis.child_pid, 1, SIGUSR1);
+}
+
+/* ------------------------------- Commands --------------------------------- */
+
+/* MEMORY ANALYZE [TOP <count>] [SEPARATOR <char>] [SAMPLES <count>] */
+void memoryAnalyzeCommand(client *c) {
+    long top = KSA_DEFAULT_TOP, samples = OBJ_COMPUTE_SIZE_DEF_SAMPLES;
+    sds separator = NULL;
+
+    for (int j = 2; j < c->argc; j++) {
+        int moreargs = j+1 < c->argc;
+
+        if (!strcasecmp(c->argv[j]->ptr, "top") && moreargs) {
+            if (getRangeLongFromObjectOrReply(c, c->argv[++j], 0,
+                KSA_MAX_TOP, &top, NULL) != C_OK) return;
+        } else if (!strcasecmp(c->argv[j]->ptr, "samples") && moreargs) {
+            if (getRangeLongFromObjectOrReply(c, c->argv[++j], 0,
+                LONG_MAX, &samples, NULL) != C_OK) return;
+            if (samples == 0) samples = LONG_MAX;
+        } else if (!strcasecmp(c->argv[j]->ptr, "separator") && moreargs) {
+            separator = c->argv[++j]->ptr;
+            if (sdslen(separator) != 1) {
+                addReplyError(c, "The separator must be a single character");
+                return;
+            }
+        } else {
+            addReplyErrorObject(c, shared.syntaxerr);
+            return;
+        }
+    }
+
+    if (analysis.child_pid != -1) {
+        addReplyError(c, "A keyspace analysis is already in progress");
+        return;
+    }
+    if (ksaStartAnalysis(top, separator ? separator : ":", samples) == C_ERR) {
+        addReplyError(c, "Can't start the keyspace analysis, check the logs");
+        return;
+    }
+    addReplyStatus(c, "Keyspace analysis started");
+}
+
+static void ksaReplyGroup(client *c, ksaGroup *g) {
+    int buckets = 0;
+
+    addReplyBulkCBuffer(c, g->name, sdslen(g->name));
+    addReplyMapLen(c, 3);
+    addReplyBulkCString(c, "keys");
+    addReplyLongLong(c, g->keys);
+    addReplyBulkCString(c, "bytes");
+    addReplyLongLong(c, g->bytes);
+    /* Only the non empty buckets, keyed by their smallest size. */
+    addReplyBulkCString(c, "histogram");
+    for (int b = 0; b < KSA_HIST_BUCKETS; b++) if (g->hist[b]) buckets++;
+    addReplyMapLen(c, buckets);
+    for (int b = 0; b < KSA_HIST_BUCKETS; b++) {
+        if (!g->hist[b]) continue;
+        addReplyLongLong(c, 1LL << b);
+        addReplyLongLong(c, g->hist[b]);
+    }
+}
+
+/* MEMORY REPORT */
+void memoryReportCommand(client *c) {
+    static const char *statuses[] = {"none", "running", "done", "failed"};
+    ksaReport *r = analysis.report;
+
+    addReplyMapLen(c, r ? 11 : 1);
+    addReplyBulkCString(c, "status");
+    addReplyBulkCString(c, statuses[analysis.status]);
+    if (!r) return;
+
+    addReplyBulkCString(c, "finished-at");
+    addReplyLongLong(c, r->finished);
+    addReplyBulkCString(c, "duration-ms");
+    addReplyLongLong(c, r->duration);
+    addReplyBulkCString(c, "keys");
+    addReplyLongLong(c, r->keys);
+    addReplyBulkCString(c, "bytes");
+    addReplyLongLong(c, r->bytes);
+    addReplyBulkCString(c, "separator");
+    addReplyBulkCBuffer(c, r->separator, sdslen(r->separator));
+    for (int k = 0; k < KSA_GROUP_KINDS; k++) {
+        addReplyBulkCString(c, ksaGroupNames[k]);
+        addReplyMapLen(c, r->numgroups[k]);
+        for (unsigned long j = 0; j < r->numgroups[k]; j++)
+            ksaReplyGroup(c, r->groups[k]+j);
+    }
+    addReplyBulkCString(c, "ttl");
+    addReplyMapLen(c, KSA_TTL_BUCKETS);
+    for (int t = 0; t < KSA_TTL_BUCKETS; t++) {
+        addReplyBulkCString(c, ksaTTLNames[t]);
+        addReplyLongLong(c, r->ttl[t]);
+    }
+    addReplyBulkCString(c, "top-keys");
+    addReplyArrayLen(c, r->numtop);
+    for (unsigned long j = 0; j < r->numtop; j++) {
+        ksaBigKey *bk = r->top+j;
+        addReplyMapLen(c, 4);
+        addReplyBulkCString(c, "db");
+        addReplyLongLong(c, bk->dbid);
+        addReplyBulkCString(c, "key");
+        addReplyBulkCBuffer(c, bk->key, sdslen(bk->key));
+        addReplyBulkCString(c, "type");
+        addReplyBulkCBuffer(c, bk->type, sdslen(bk->type));
+        addReplyBulkCString(c, "bytes");
+        addReplyLongLong(c, bk->bytes);
+    }
+}
@@ -914,6 +914,7 @@ struct client *createAOFClient(void) {
     c->querybuf_peak = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->argv_transient = 0;
     c->original_argc = 0;
     c->original_argv = NULL;
     c->argv_len_sum = 0;
@@ -2463,7 +2464,8 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
         serverLog(LL_VERBOSE,
                   "Background AOF rewrite signal handler took %lldus", ustime() - now);
 
-        // BGREWRITEAOF 重写出错    } else if (!bysignal && exitcode != 0) {
+        // BGREWRITEAOF 重写出错
+    } else if (!bysignal && exitcode != 0) {
         server.aof_lastbgrewrite_status = C_ERR;
 
         serverLog(LL_WARNING,
@@ -2480,12 +2482,14 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
 
     cleanup:
     aofClosePipes();
-    // 清空 AOF 缓冲区    aofRewriteBufferReset();
+    // 清空 AOF 缓冲区
+    aofRewriteBufferReset();
 
     // 移除临时文件
     aofRemoveTempFile(server.child_pid);
 
-    // 重置默认属性    server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
+    // 重置默认属性
+    server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
     server.aof_rewrite_time_start = -1;
     /* Schedule a new rewrite if we are waiting for it to switch the AOF ON. */
     if (server.aof_state == AOF_WAIT_REWRITE)
@@ -10,6 +10,9 @@
  * atomicSet(var,value)  -- Set the atomic counter value
  * atomicGetWithSync(var,value)  -- 'atomicGet' with inter-thread synchronization
  * atomicSetWithSync(var,value)  -- 'atomicSet' with inter-thread synchronization
+ * atomicCompareSwap(var,oldvalue,newvalue,success_var) -- Set the atomic
+ *     counter to 'newvalue' only if it is 'oldvalue', with inter-thread
+ *     synchronization. 'success_var' is set to 1 if the value was swapped.
  *
  * Never use return value from the macros, instead use the AtomicGetIncr()
  * if you need to get the current value and increment it atomically, like
@@ -103,6 +106,11 @@
 } while(0)
 #define atomicSetWithSync(var,value) \
     atomic_store_explicit(&var,value,memory_order_seq_cst)
+#define atomicCompareSwap(var,oldvalue,newvalue,success_var) do { \
+    __typeof__(oldvalue) _expected = (oldvalue); \
+    success_var = atomic_compare_exchange_strong_explicit(&var,&_expected, \
+        (newvalue),memory_order_seq_cst,memory_order_relaxed); \
+} while(0)
 #define REDIS_ATOMIC_API "c11-builtin"
 
 #elif !defined(__ATOMIC_VAR_FORCE_SYNC_MACROS) && \
@@ -124,6 +132,11 @@
 } while(0)
 #define atomicSetWithSync(var,value) \
     __atomic_store_n(&var,value,__ATOMIC_SEQ_CST)
+#define atomicCompareSwap(var,oldvalue,newvalue,success_var) do { \
+    __typeof__(oldvalue) _expected = (oldvalue); \
+    success_var = __atomic_compare_exchange_n(&var,&_expected,(newvalue), \
+        0,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED); \
+} while(0)
 #define REDIS_ATOMIC_API "atomic-builtin"
 
 #elif defined(HAVE_ATOMIC)
@@ -149,6 +162,9 @@
     ANNOTATE_HAPPENS_BEFORE(&var);  \
     while(!__sync_bool_compare_and_swap(&var,var,value,__sync_synchronize)); \
 } while(0)
+#define atomicCompareSwap(var,oldvalue,newvalue,success_var) do { \
+    success_var = __sync_bool_compare_and_swap(&var,(oldvalue),(newvalue)); \
+} while(0)
 #define REDIS_ATOMIC_API "sync-builtin"
 
 #else
@@ -6559,7 +6559,8 @@ void migrateCommand(client *c) {
         return; /* error sent to the client by migrateGetSocket() */
     }
 
-// 创建用于指定数据库的 SELECT 命令，以免键值对被还原到了错误的地方    rioInitWithBuffer(&cmd,sdsempty());
+// 创建用于指定数据库的 SELECT 命令，以免键值对被还原到了错误的地方
+rioInitWithBuffer(&cmd,sdsempty());
 
 /* Authentication */
     if (password) {
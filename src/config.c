@@ -30,6 +30,7 @@
 
 #include "server.h"
 #include "cluster.h"
+#include "slowlog.h"
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -381,6 +382,49 @@ static int updateOOMScoreAdjValues(sds *args, const char **err, int apply) {
     return C_OK;
 }
 
+/* Parse an array of 'argc' sds strings holding the percentiles to report in
+ * INFO latencystats, validate and populate server.latency_tracking_info_percentiles
+ * if valid. A single empty string stands for an empty list. */
+static int updateLatencyTrackingInfoPercentiles(sds *args, int argc, const char **err) {
+    int j;
+    double *values;
+
+    if (argc == 1 && sdslen(args[0]) == 0) argc = 0;
+    values = zmalloc(sizeof(double)*(argc ? argc : 1));
+    for (j = 0; j < argc; j++) {
+        char *eptr;
+        double val = strtod(args[j], &eptr);
+
+        if (sdslen(args[j]) == 0 || *eptr != '\0' ||
+            !(val >= 0.0 && val <= 100.0))
+        {
+            if (err) *err = "Invalid latency-tracking-info-percentiles, elements must be between 0 and 100.";
+            zfree(values);
+            return C_ERR;
+        }
+        values[j] = val;
+    }
+
+    zfree(server.latency_tracking_info_percentiles);
+    server.latency_tracking_info_percentiles = values;
+    server.latency_tracking_info_percentiles_len = argc;
+    return C_OK;
+}
+
+/* Return the configured latency-tracking-info-percentiles as a space
+ * separated string. The caller should free the returned sds. */
+static sds getLatencyTrackingInfoPercentilesString(void) {
+    sds buf = sdsempty();
+    int j;
+
+    for (j = 0; j < server.latency_tracking_info_percentiles_len; j++) {
+        buf = sdscatprintf(buf,"%g",server.latency_tracking_info_percentiles[j]);
+        if (j != server.latency_tracking_info_percentiles_len-1)
+            buf = sdscatlen(buf," ",1);
+    }
+    return buf;
+}
+
 void initConfigValues() {
     for (standardConfig *config = configs; config->name != NULL; config++) {
         config->interface.init(config->data);
@@ -584,6 +628,8 @@ void loadServerConfigFromString(char *config) {
             server.client_obuf_limits[class].soft_limit_seconds = soft_seconds;
         } else if (!strcasecmp(argv[0],"oom-score-adj-values") && argc == 1 + CONFIG_OOM_COUNT) {
             if (updateOOMScoreAdjValues(&argv[1], &err, 0) == C_ERR) goto loaderr;
+        } else if (!strcasecmp(argv[0],"latency-tracking-info-percentiles") && argc >= 2) {
+            if (updateLatencyTrackingInfoPercentiles(&argv[1], argc-1, &err) == C_ERR) goto loaderr;
         } else if (!strcasecmp(argv[0],"notify-keyspace-events") && argc == 2) {
             int flags = keyspaceEventsStringToFlags(argv[1]);
 
@@ -870,6 +916,17 @@ void configSetCommand(client *c) {
         if (vlen != CONFIG_OOM_COUNT || updateOOMScoreAdjValues(v, &errstr, 1) == C_ERR)
             success = 0;
 
+        sdsfreesplitres(v, vlen);
+        if (!success)
+            goto badfmt;
+    } config_set_special_field("latency-tracking-info-percentiles") {
+        int vlen;
+        int success = 1;
+
+        sds *v = sdssplitlen(o->ptr, sdslen(o->ptr), " ", 1, &vlen);
+        if (updateLatencyTrackingInfoPercentiles(v, vlen, &errstr) == C_ERR)
+            success = 0;
+
         sdsfreesplitres(v, vlen);
         if (!success)
             goto badfmt;
@@ -1068,6 +1125,15 @@ void configGetCommand(client *c) {
         matches++;
     }
 
+    if (stringmatch(pattern,"latency-tracking-info-percentiles",0)) {
+        sds buf = getLatencyTrackingInfoPercentilesString();
+
+        addReplyBulkCString(c,"latency-tracking-info-percentiles");
+        addReplyBulkCString(c,buf);
+        sdsfree(buf);
+        matches++;
+    }
+
     setDeferredMapLen(c,replylen,matches);
 }
 
@@ -1542,6 +1608,23 @@ void rewriteConfigOOMScoreAdjValuesOption(struct rewriteConfigState *state) {
     rewriteConfigRewriteLine(state,option,line,force);
 }
 
+/* Rewrite the latency-tracking-info-percentiles option. */
+void rewriteConfigLatencyTrackingInfoPercentilesOption(struct rewriteConfigState *state) {
+    char *option = "latency-tracking-info-percentiles";
+    sds values = getLatencyTrackingInfoPercentilesString();
+    int force = strcmp(values,CONFIG_LATENCY_TRACKING_INFO_PERCENTILES) != 0;
+    sds line;
+
+    line = sdsnew(option);
+    line = sdscatlen(line, " ", 1);
+    if (sdslen(values) == 0)
+        line = sdscatlen(line, "\"\"", 2);
+    else
+        line = sdscatsds(line, values);
+    sdsfree(values);
+    rewriteConfigRewriteLine(state,option,line,force);
+}
+
 /* Rewrite the bind option. */
 void rewriteConfigBindOption(struct rewriteConfigState *state) {
     int force = 1;
@@ -1724,6 +1807,7 @@ int rewriteConfig(char *path, int force_all) {
     rewriteConfigNotifykeyspaceeventsOption(state);
     rewriteConfigClientoutputbufferlimitOption(state);
     rewriteConfigOOMScoreAdjValuesOption(state);
+    rewriteConfigLatencyTrackingInfoPercentilesOption(state);
 
     /* Rewrite Sentinel config if in Sentinel mode. */
     if (server.sentinel_mode) rewriteConfigSentinelOption(state);
@@ -2256,6 +2340,15 @@ static int updatePort(long long val, long long prev, const char **err) {
     return 1;
 }
 
+static int updateOrderedKeyIndex(int val, int prev, const char **err) {
+    UNUSED(val);
+    UNUSED(prev);
+    UNUSED(err);
+    for (int j = 0; j < server.dbnum; j++)
+        keyIndexUpdateConfig(&server.db[j]);
+    return 1;
+}
+
 static int updateJemallocBgThread(int val, int prev, const char **err) {
     UNUSED(prev);
     UNUSED(err);
@@ -2263,6 +2356,34 @@ static int updateJemallocBgThread(int val, int prev, const char **err) {
     return 1;
 }
 
+static int updateLatencyTracking(int val, int prev, const char **err) {
+    UNUSED(val);
+    UNUSED(prev);
+    UNUSED(err);
+    updateLatencyTrackingHistograms();
+    return 1;
+}
+
+static int updateMaxmemoryClients(long long val, long long prev, const char **err) {
+    UNUSED(err);
+    if (val && (!prev || val < prev)) evictClients();
+    return 1;
+}
+
+static int updateSlowlogAggregateMaxLen(long long val, long long prev, const char **err) {
+    UNUSED(prev);
+    UNUSED(err);
+    slowlogAggregateTrim(val);
+    return 1;
+}
+
+static int updateJemallocTransientArena(int val, int prev, const char **err) {
+    UNUSED(prev);
+    UNUSED(err);
+    set_jemalloc_transient_arena(val);
+    return 1;
+}
+
 static int updateReplBacklogSize(long long val, long long prev, const char **err) {
     /* resizeReplicationBacklog sets server.repl_backlog_size, and relies on
      * being able to tell when the size changes, so restore prev before calling it. */
@@ -2450,7 +2571,9 @@ standardConfig configs[] = {
     createBoolConfig("replica-serve-stale-data", "slave-serve-stale-data", MODIFIABLE_CONFIG, server.repl_serve_stale_data, 1, NULL, NULL),
     createBoolConfig("replica-read-only", "slave-read-only", MODIFIABLE_CONFIG, server.repl_slave_ro, 1, NULL, NULL),
     createBoolConfig("replica-ignore-maxmemory", "slave-ignore-maxmemory", MODIFIABLE_CONFIG, server.repl_slave_ignore_maxmemory, 1, NULL, NULL),
+    createBoolConfig("latency-tracking", NULL, MODIFIABLE_CONFIG, server.latency_tracking_enabled, 1, NULL, updateLatencyTracking),
     createBoolConfig("jemalloc-bg-thread", NULL, MODIFIABLE_CONFIG, server.jemalloc_bg_thread, 1, NULL, updateJemallocBgThread),
+    createBoolConfig("jemalloc-transient-arena", NULL, MODIFIABLE_CONFIG, server.jemalloc_transient_arena, 0, NULL, updateJemallocTransientArena),
     createBoolConfig("activedefrag", NULL, MODIFIABLE_CONFIG, server.active_defrag_enabled, 0, isValidActiveDefrag, NULL),
     createBoolConfig("syslog-enabled", NULL, IMMUTABLE_CONFIG, server.syslog_enabled, 0, NULL, NULL),
     createBoolConfig("cluster-enabled", NULL, IMMUTABLE_CONFIG, server.cluster_enabled, 0, NULL, NULL),
@@ -2462,6 +2585,7 @@ standardConfig configs[] = {
     createBoolConfig("disable-thp", NULL, MODIFIABLE_CONFIG, server.disable_thp, 1, NULL, NULL),
     createBoolConfig("cluster-allow-replica-migration", NULL, MODIFIABLE_CONFIG, server.cluster_allow_replica_migration, 1, NULL, NULL),
     createBoolConfig("replica-announced", NULL, MODIFIABLE_CONFIG, server.replica_announced, 1, NULL, NULL),
+    createBoolConfig("ordered-key-index", NULL, MODIFIABLE_CONFIG, server.ordered_key_index, 0, NULL, updateOrderedKeyIndex),
 
     /* String Configs */
     createStringConfig("aclfile", NULL, IMMUTABLE_CONFIG, ALLOW_EMPTY_STRING, server.acl_filename, "", NULL, NULL),
@@ -2536,6 +2660,7 @@ standardConfig configs[] = {
     /* Unsigned Long configs */
     createULongConfig("active-defrag-max-scan-fields", NULL, MODIFIABLE_CONFIG, 1, LONG_MAX, server.active_defrag_max_scan_fields, 1000, INTEGER_CONFIG, NULL, NULL), /* Default: keys with more than 1000 fields will be processed separately */
     createULongConfig("slowlog-max-len", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, server.slowlog_max_len, 128, INTEGER_CONFIG, NULL, NULL),
+    createULongConfig("slowlog-aggregate-max-len", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, server.slowlog_aggregate_max_len, 128, INTEGER_CONFIG, NULL, updateSlowlogAggregateMaxLen),
     createULongConfig("acllog-max-len", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, server.acllog_max_len, 128, INTEGER_CONFIG, NULL, NULL),
 
     /* Long Long configs */
@@ -2561,6 +2686,7 @@ standardConfig configs[] = {
     createSizeTConfig("hll-sparse-max-bytes", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, server.hll_sparse_max_bytes, 3000, MEMORY_CONFIG, NULL, NULL),
     createSizeTConfig("tracking-table-max-keys", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, server.tracking_table_max_keys, 1000000, INTEGER_CONFIG, NULL, NULL), /* Default: 1 million keys max. */
     createSizeTConfig("client-query-buffer-limit", NULL, MODIFIABLE_CONFIG, 1024*1024, LONG_MAX, server.client_max_querybuf_len, 1024*1024*1024, MEMORY_CONFIG, NULL, NULL), /* Default: 1GB max query buffer. */
+    createSizeTConfig("maxmemory-clients", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, server.maxmemory_clients, 0, MEMORY_CONFIG, NULL, updateMaxmemoryClients),
 
     /* Other configs */
     createTimeTConfig("repl-backlog-ttl", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, server.repl_backlog_time_limit, 60*60, INTEGER_CONFIG, NULL, NULL), /* Default: 1 hour */
@@ -2570,11 +2696,14 @@ standardConfig configs[] = {
     createIntConfig("tls-port", NULL, MODIFIABLE_CONFIG, 0, 65535, server.tls_port, 0, INTEGER_CONFIG, NULL, updateTLSPort), /* TCP port. */
     createIntConfig("tls-session-cache-size", NULL, MODIFIABLE_CONFIG, 0, INT_MAX, server.tls_ctx_config.session_cache_size, 20*1024, INTEGER_CONFIG, NULL, updateTlsCfgInt),
     createIntConfig("tls-session-cache-timeout", NULL, MODIFIABLE_CONFIG, 0, INT_MAX, server.tls_ctx_config.session_cache_timeout, 300, INTEGER_CONFIG, NULL, updateTlsCfgInt),
+    createIntConfig("tls-session-ticket-key-rotation", NULL, MODIFIABLE_CONFIG, 0, INT_MAX, server.tls_ctx_config.session_ticket_key_rotation, 3600, INTEGER_CONFIG, NULL, NULL),
     createBoolConfig("tls-cluster", NULL, MODIFIABLE_CONFIG, server.tls_cluster, 0, NULL, updateTlsCfgBool),
     createBoolConfig("tls-replication", NULL, MODIFIABLE_CONFIG, server.tls_replication, 0, NULL, updateTlsCfgBool),
     createEnumConfig("tls-auth-clients", NULL, MODIFIABLE_CONFIG, tls_auth_clients_enum, server.tls_auth_clients, TLS_CLIENT_AUTH_YES, NULL, NULL),
     createBoolConfig("tls-prefer-server-ciphers", NULL, MODIFIABLE_CONFIG, server.tls_ctx_config.prefer_server_ciphers, 0, NULL, updateTlsCfgBool),
     createBoolConfig("tls-session-caching", NULL, MODIFIABLE_CONFIG, server.tls_ctx_config.session_caching, 1, NULL, updateTlsCfgBool),
+    createBoolConfig("tls-session-tickets", NULL, MODIFIABLE_CONFIG, server.tls_ctx_config.session_tickets, 1, NULL, updateTlsCfgBool),
+    createBoolConfig("tls-ktls", NULL, MODIFIABLE_CONFIG, server.tls_ctx_config.ktls, 0, NULL, updateTlsCfgBool),
     createStringConfig("tls-cert-file", NULL, MODIFIABLE_CONFIG, EMPTY_STRING_IS_NULL, server.tls_ctx_config.cert_file, NULL, NULL, updateTlsCfg),
     createStringConfig("tls-key-file", NULL, MODIFIABLE_CONFIG, EMPTY_STRING_IS_NULL, server.tls_ctx_config.key_file, NULL, NULL, updateTlsCfg),
     createStringConfig("tls-key-file-pass", NULL, MODIFIABLE_CONFIG, EMPTY_STRING_IS_NULL, server.tls_ctx_config.key_file_pass, NULL, NULL, updateTlsCfg),
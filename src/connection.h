@@ -68,6 +68,8 @@ typedef struct ConnectionType {
     ssize_t (*sync_read)(struct connection *conn, char *ptr, ssize_t size, long long timeout);
     ssize_t (*sync_readline)(struct connection *conn, char *ptr, ssize_t size, long long timeout);
     int (*get_type)(struct connection *conn);
+    void (*handshake)(struct connection *conn);
+    void (*update_state)(struct connection *conn);
 } ConnectionType;
 
 struct connection {
@@ -203,6 +205,23 @@ static inline int connGetType(connection *conn) {
     return conn->type->get_type(conn);
 }
 
+/* Run the step of the handshake of an accepted connection that the
+ * connection type handed to the I/O threads with postponeConnHandshake().
+ * It can be called by any thread, and it never touches the event loop nor
+ * calls the accept handler: connUpdateState() does it later in the main
+ * thread. */
+static inline void connHandshake(connection *conn) {
+    if (conn->type->handshake) conn->type->handshake(conn);
+}
+
+/* I/O performed outside the main thread can't update the event loop and
+ * can't call the connection handlers: this must be called by the main
+ * thread, once the I/O threads are done, for every connection they served,
+ * in order to apply the postponed changes. */
+static inline void connUpdateState(connection *conn) {
+    if (conn->type->update_state) conn->type->update_state(conn);
+}
+
 connection *connCreateSocket();
 connection *connCreateAcceptedSocket(int fd);
 
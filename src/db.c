@@ -263,6 +263,7 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
 
     // 如果开启了集群模式，那么将键保存到槽里面
     if (server.cluster_enabled) slotToKeyAdd(key->ptr);
+    keyIndexAdd(db, key->ptr);
 }
 
 /* This is a special version of dbAdd() that is used only when loading
@@ -280,6 +281,7 @@ int dbAddRDBLoad(redisDb *db, sds key, robj *val) {
     int retval = dictAdd(db->dict, key, val);
     if (retval != DICT_OK) return 0;
     if (server.cluster_enabled) slotToKeyAdd(key);
+    keyIndexAdd(db, key);
     return 1;
 }
 
@@ -436,6 +438,7 @@ int dbSyncDelete(redisDb *db, robj *key) {
         dictFreeUnlinkedEntry(db->dict, de);
         // 如果开启了集群模式，那么从槽中删除给定的键
         if (server.cluster_enabled) slotToKeyDel(key->ptr);
+        keyIndexDel(db, key->ptr);
         return 1;
     } else {
         return 0;
@@ -516,6 +519,7 @@ long long emptyDbStructure(redisDb *dbarray, int dbnum, int async,
             // 删除所有键的过期时间
             dictEmpty(dbarray[j].expires, callback);
         }
+        keyIndexFlush(&dbarray[j], async);
         /* Because all keys of database are removed, reset average ttl. */
         dbarray[j].avg_ttl = 0;
         dbarray[j].expires_cursor = 0;
@@ -592,6 +596,7 @@ dbBackup *backupDb(void) {
         backup->dbarray[i] = server.db[i];
         server.db[i].dict = dictCreate(&dbDictType, NULL);
         server.db[i].expires = dictCreate(&dbExpiresDictType, NULL);
+        if (server.db[i].key_index) server.db[i].key_index = raxNew();
     }
 
     /* Backup cluster slots to keys map if enable cluster. */
@@ -621,6 +626,8 @@ void discardDbBackup(dbBackup *buckup, int flags, void(callback)(void *)) {
     for (int i = 0; i < server.dbnum; i++) {
         dictRelease(buckup->dbarray[i].dict);
         dictRelease(buckup->dbarray[i].expires);
+        if (buckup->dbarray[i].key_index)
+            freeKeyIndex(buckup->dbarray[i].key_index, async);
     }
 
     /* Release slots to keys map backup if enable cluster. */
@@ -646,7 +653,10 @@ void restoreDbBackup(dbBackup *buckup) {
         serverAssert(dictSize(server.db[i].expires) == 0);
         dictRelease(server.db[i].dict);
         dictRelease(server.db[i].expires);
+        if (server.db[i].key_index) freeKeyIndex(server.db[i].key_index, 0);
         server.db[i] = buckup->dbarray[i];
+        /* ordered-key-index may have been changed since the backup. */
+        keyIndexUpdateConfig(&server.db[i]);
     }
 
     /* Restore slots to keys map backup if enable cluster. */
@@ -708,6 +718,7 @@ long long dbTotalServerKeyCount() {
 void signalModifiedKey(client *c, redisDb *db, robj *key) {
     touchWatchedKey(db, key);
     trackingInvalidateKey(c, key);
+    hllCountCacheTouchKey(db, key);
 }
 
 void signalFlushedDb(int dbid, int async) {
@@ -724,6 +735,7 @@ void signalFlushedDb(int dbid, int async) {
     }
 
     trackingInvalidateKeysOnFlush(async);
+    hllCountCacheFlush();
 }
 
 /*-----------------------------------------------------------------------------
@@ -894,6 +906,15 @@ void randomkeyCommand(client *c) {
     decrRefCount(key);
 }
 
+/* Return the length of the literal prefix of the glob-style 'pattern', that
+ * is the leading bytes every key matching it starts with. */
+static size_t patternPrefixLen(const char *pattern, size_t patlen) {
+    size_t len = 0;
+
+    while (len < patlen && !strchr("*?[\\", pattern[len])) len++;
+    return len;
+}
+
 void keysCommand(client *c) {
     dictIterator *di;
     dictEntry *de;
@@ -902,6 +923,33 @@ void keysCommand(client *c) {
     int plen = sdslen(pattern), allkeys;
     unsigned long numkeys = 0;
     void *replylen = addReplyDeferredLen(c);
+    size_t prefixlen = c->db->key_index ? patternPrefixLen(pattern, plen) : 0;
+
+    /* With the ordered key index only the keys sharing the literal prefix of
+     * the pattern are visited. */
+    if (prefixlen) {
+        raxIterator ri;
+
+        raxStart(&ri, c->db->key_index);
+        raxSeek(&ri, ">=", (unsigned char *) pattern, prefixlen);
+        while (raxNext(&ri)) {
+            robj *keyobj;
+
+            if (ri.key_len < prefixlen || memcmp(ri.key, pattern, prefixlen))
+                break;
+            if (!stringmatchlen(pattern, plen, (char *) ri.key, ri.key_len, 0))
+                continue;
+            keyobj = createStringObject((char *) ri.key, ri.key_len);
+            if (!keyIsExpired(c->db, keyobj)) {
+                addReplyBulk(c, keyobj);
+                numkeys++;
+            }
+            decrRefCount(keyobj);
+        }
+        raxStop(&ri);
+        setDeferredArrayLen(c, replylen, numkeys);
+        return;
+    }
 
     // 遍历整个数据库，返回（名字）和模式匹配的键
     di = dictGetSafeIterator(c->db->dict);
@@ -928,27 +976,74 @@ void keysCommand(client *c) {
     setDeferredArrayLen(c, replylen, numkeys);
 }
 
+/* Max time in microseconds spent by a SCAN call that filters elements. */
+#define SCAN_FILTER_TIME_BUDGET 1000
+
+/* State shared by scanGenericCommand() and scanCallback(). The filters are
+ * evaluated by the callback while the dictionary is walked, so that no object
+ * is created for the elements that are rejected. */
+typedef struct {
+    list *keys;             /* Elements that passed the filters. */
+    robj *o;                /* Object scanned, NULL for the keyspace. */
+    redisDb *db;            /* DB of the keyspace scanned. */
+    sds pat;                /* MATCH pattern, NULL if not used. */
+    int patlen;
+    /* The following filters only apply to the keyspace. */
+    sds typename;           /* TYPE of the values, NULL if not used. */
+    sds encoding;           /* ENCODING of the values, NULL if not used. */
+    long long minsize;      /* MINSIZE in bytes, -1 if not used. */
+    long long idle;         /* IDLE time in milliseconds, -1 if not used. */
+    int nottl;              /* NOTTL: only keys without an expire. */
+} scanData;
+
+/* Return 1 if the keyspace element 'de' passes the value filters of the
+ * SCAN command, that is, all but MATCH. */
+static int scanKeyPassesFilters(scanData *data, const dictEntry *de) {
+    sds key = dictGetKey(de);
+    robj *val = dictGetVal(de);
+
+    if (data->typename && strcasecmp(data->typename, getObjectTypeName(val)))
+        return 0;
+    if (data->encoding && strcasecmp(data->encoding, strEncoding(val->encoding)))
+        return 0;
+    if (data->nottl && dictSize(data->db->expires) &&
+        dictFind(data->db->expires, key) != NULL) return 0;
+    if (data->idle != -1 &&
+        (long long) estimateObjectIdleTime(val) < data->idle) return 0;
+    if (data->minsize != -1) {
+        /* The same estimate reported by MEMORY USAGE. */
+        size_t usage = objectComputeSize(val, OBJ_COMPUTE_SIZE_DEF_SAMPLES);
+        usage += sdsZmallocSize(key);
+        usage += sizeof(dictEntry);
+        if ((long long) usage < data->minsize) return 0;
+    }
+    return 1;
+}
+
 /* This callback is used by scanGenericCommand in order to collect elements
  * returned by the dictionary iterator into a list. */
 void scanCallback(void *privdata, const dictEntry *de) {
-    void **pd = (void **) privdata;
-    list *keys = pd[0];
-    robj *o = pd[1];
+    scanData *data = privdata;
+    list *keys = data->keys;
+    robj *o = data->o;
     robj *key, *val = NULL;
+    sds sdskey = dictGetKey(de);
+
+    /* Filter the element before creating any object for it. */
+    if (data->pat &&
+        !stringmatchlen(data->pat, data->patlen, sdskey, sdslen(sdskey), 0))
+        return;
+    if (o == NULL && !scanKeyPassesFilters(data, de)) return;
 
     if (o == NULL) {
-        sds sdskey = dictGetKey(de);
         key = createStringObject(sdskey, sdslen(sdskey));
     } else if (o->type == OBJ_SET) {
-        sds keysds = dictGetKey(de);
-        key = createStringObject(keysds, sdslen(keysds));
+        key = createStringObject(sdskey, sdslen(sdskey));
     } else if (o->type == OBJ_HASH) {
-        sds sdskey = dictGetKey(de);
         sds sdsval = dictGetVal(de);
         key = createStringObject(sdskey, sdslen(sdskey));
         val = createStringObject(sdsval, sdslen(sdsval));
     } else if (o->type == OBJ_ZSET) {
-        sds sdskey = dictGetKey(de);
         key = createStringObject(sdskey, sdslen(sdskey));
         val = createStringObjectFromLongDouble(*(double *) dictGetVal(de), 0);
     } else {
@@ -1000,14 +1095,52 @@ int parseScanCursorOrReply(client *c, robj *o, unsigned long *cursor) {
  *
  * 如果被迭代的是哈希对象，那么函数返回的是键值对。
  */
+/* Feed scanCallback() with the keys of the ordered key index starting with
+ * 'prefix'. If there are more than 'limit' of them C_ERR is returned and the
+ * list of keys is emptied again, otherwise C_OK. */
+static int keyIndexScan(scanData *data, const char *prefix, size_t prefixlen,
+                        long limit) {
+    raxIterator ri;
+    listNode *ln;
+    sds key = sdsempty();
+    int retval = C_OK;
+
+    raxStart(&ri, data->db->key_index);
+    raxSeek(&ri, ">=", (unsigned char *) prefix, prefixlen);
+    while (raxNext(&ri)) {
+        dictEntry *de;
+
+        if (ri.key_len < prefixlen || memcmp(ri.key, prefix, prefixlen))
+            break;
+        if (limit-- == 0) {
+            retval = C_ERR;
+            break;
+        }
+        key = sdscpylen(key, (char *) ri.key, ri.key_len);
+        de = dictFind(data->db->dict, key);
+        serverAssert(de != NULL);
+        scanCallback(data, de);
+    }
+    raxStop(&ri);
+    sdsfree(key);
+
+    if (retval == C_ERR) {
+        while ((ln = listFirst(data->keys)) != NULL) {
+            decrRefCount(listNodeValue(ln));
+            listDelNode(data->keys, ln);
+        }
+    }
+    return retval;
+}
+
 void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     int i, j;
     list *keys = listCreate();
     listNode *node, *nextnode;
     long count = 10;
     sds pat = NULL;
-    sds typename = NULL;
     int patlen = 0, use_pattern = 0;
+    scanData data = {keys, o, c->db, NULL, 0, NULL, NULL, -1, -1, 0};
     dict *ht;
 
     /* Object must be NULL (to iterate keys names), or the type of the object
@@ -1051,8 +1184,34 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             i += 2;
         } else if (!strcasecmp(c->argv[i]->ptr, "type") && o == NULL && j >= 2) {
             /* SCAN for a particular type only applies to the db dict */
-            typename = c->argv[i + 1]->ptr;
+            data.typename = c->argv[i + 1]->ptr;
+            i += 2;
+        } else if (!strcasecmp(c->argv[i]->ptr, "encoding") && o == NULL && j >= 2) {
+            data.encoding = c->argv[i + 1]->ptr;
+            i += 2;
+        } else if (!strcasecmp(c->argv[i]->ptr, "minsize") && o == NULL && j >= 2) {
+            long minsize;
+
+            if (getPositiveLongFromObjectOrReply(c, c->argv[i + 1],
+                &minsize, NULL) != C_OK) goto cleanup;
+            data.minsize = minsize;
             i += 2;
+        } else if (!strcasecmp(c->argv[i]->ptr, "idle") && o == NULL && j >= 2) {
+            long idle;
+
+            /* IDLE is in seconds, like OBJECT IDLETIME. */
+            if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+                addReplyError(c, "An LFU maxmemory policy is selected, "
+                                 "idle time not tracked.");
+                goto cleanup;
+            }
+            if (getRangeLongFromObjectOrReply(c, c->argv[i + 1], 0,
+                LONG_MAX / 1000, &idle, NULL) != C_OK) goto cleanup;
+            data.idle = (long long) idle * 1000;
+            i += 2;
+        } else if (!strcasecmp(c->argv[i]->ptr, "nottl") && o == NULL) {
+            data.nottl = 1;
+            i++;
         } else {
             addReplyErrorObject(c, shared.syntaxerr);
             goto cleanup;
@@ -1092,27 +1251,46 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     }
 
     if (ht) {
-        void *privdata[2];
         /* We set the max number of iterations to ten times the specified
          * COUNT, so if the hash table is in a pathological state (very
          * sparsely populated) we avoid to block too much time at the cost
          * of returning no or very few elements. */
         long maxiterations = count * 10;
+        /* When filtering, most of the visited elements may be rejected and
+         * checking them may be expensive (MINSIZE), so the call is also
+         * limited in time. */
+        int filtering = use_pattern || data.typename || data.encoding ||
+                        data.minsize != -1 || data.idle != -1 || data.nottl;
+        long long start = filtering ? ustime() : 0;
+
+        /* The callback filters the elements and adds the ones that pass to
+         * the list, fetching more data from the object containing the
+         * dictionary in a type-dependent way. */
+        // 回调函数在遍历字典时过滤元素，被拒绝的元素不会创建任何对象，
+        // 通过过滤的元素被添加到列表中
+        if (use_pattern) {
+            data.pat = pat;
+            data.patlen = patlen;
+        }
 
-        /* We pass two pointers to the callback: the list to which it will
-         * add new elements, and the object containing the dictionary so that
-         * it is possible to fetch more data in a type-dependent way. */
-        // 我们向回调函数传入两个指针：
-        // 一个是用于记录被迭代元素的列表
-        // 另一个是字典对象
-        // 从而实现类型无关的数据提取操作
-        privdata[0] = keys;
-        privdata[1] = o;
-        do {
-            cursor = dictScan(ht, cursor, scanCallback, NULL, privdata);
-        } while (cursor &&
-                 maxiterations-- &&
-                 listLength(keys) < (unsigned long) count);
+        /* With the ordered key index, a pattern with a literal prefix is
+         * served by the range of keys sharing it when the range fits in the
+         * iterations budget: the whole of it is returned at once, with a
+         * zero cursor. Otherwise the hash table is scanned as usual. */
+        size_t prefixlen = 0;
+        if (o == NULL && cursor == 0 && use_pattern && c->db->key_index)
+            prefixlen = patternPrefixLen(pat, patlen);
+        if (prefixlen == 0 ||
+            keyIndexScan(&data, pat, prefixlen, maxiterations) == C_ERR)
+        {
+            do {
+                cursor = dictScan(ht, cursor, scanCallback, NULL, &data);
+                if (filtering && (maxiterations & 15) == 0 &&
+                    ustime() - start > SCAN_FILTER_TIME_BUDGET) break;
+            } while (cursor &&
+                     maxiterations-- &&
+                     listLength(keys) < (unsigned long) count);
+        }
     } else if (o->type == OBJ_SET) {
         int pos = 0;
         int64_t ll;
@@ -1145,8 +1323,9 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         nextnode = listNextNode(node);
         int filter = 0;
 
-        /* Filter element if it does not match the pattern. */
-        if (use_pattern) {
+        /* Filter element if it does not match the pattern. The elements
+         * of hash tables were already matched by scanCallback(). */
+        if (use_pattern && !ht) {
             if (sdsEncodedObject(kobj)) {
                 if (!stringmatchlen(pat, patlen, kobj->ptr, sdslen(kobj->ptr), 0))
                     filter = 1;
@@ -1160,13 +1339,6 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             }
         }
 
-        /* Filter an element if it isn't the type we want. */
-        if (!filter && o == NULL && typename) {
-            robj *typecheck = lookupKeyReadWithFlags(c->db, kobj, LOOKUP_NOTOUCH);
-            char *type = getObjectTypeName(typecheck);
-            if (strcasecmp((char *) typename, type)) filter = 1;
-        }
-
         /* Filter element if it is an expired key. */
         if (!filter && o == NULL && expireIfNeeded(c->db, kobj)) filter = 1;
 
@@ -1577,11 +1749,13 @@ int dbSwapDatabases(int id1, int id2) {
     db1->expires = db2->expires;
     db1->avg_ttl = db2->avg_ttl;
     db1->expires_cursor = db2->expires_cursor;
+    db1->key_index = db2->key_index;
 
     db2->dict = aux.dict;
     db2->expires = aux.expires;
     db2->avg_ttl = aux.avg_ttl;
     db2->expires_cursor = aux.expires_cursor;
+    db2->key_index = aux.key_index;
 
     /* Now we need to handle clients blocked on lists: as an effect
      * of swapping the two DBs, a client that was waiting for list
@@ -1599,6 +1773,7 @@ int dbSwapDatabases(int id1, int id2) {
     touchAllWatchedKeysInDb(db1, db2);
     scanDatabaseForReadyLists(db2);
     touchAllWatchedKeysInDb(db2, db1);
+    hllCountCacheFlush();
     return C_OK;
 }
 
@@ -2312,3 +2487,58 @@ unsigned int delKeysInSlot(unsigned int hashslot) {
 unsigned int countKeysInSlot(unsigned int hashslot) {
     return server.cluster->slots_keys_count[hashslot];
 }
+
+/*-----------------------------------------------------------------------------
+ * Ordered key index API
+ *
+ * When ordered-key-index is enabled every DB also keeps the names of its keys
+ * in a radix tree, so that KEYS and SCAN can seek to the keys sharing the
+ * literal prefix of a pattern instead of walking the whole keyspace.
+ *----------------------------------------------------------------------------*/
+
+void keyIndexAdd(redisDb *db, sds key) {
+    if (db->key_index)
+        raxInsert(db->key_index, (unsigned char *) key, sdslen(key), NULL, NULL);
+}
+
+void keyIndexDel(redisDb *db, sds key) {
+    if (db->key_index)
+        raxRemove(db->key_index, (unsigned char *) key, sdslen(key), NULL);
+}
+
+/* Release the key index radix tree 'rt'. If 'async' is true, we release
+ * it asynchronously. */
+void freeKeyIndex(rax *rt, int async) {
+    if (async) {
+        freeKeyIndexAsync(rt);
+    } else {
+        raxFree(rt);
+    }
+}
+
+/* Empty the key index of 'db', if any. If 'async' is true the old radix tree
+ * is released in a background thread. */
+void keyIndexFlush(redisDb *db, int async) {
+    rax *old = db->key_index;
+
+    if (old == NULL || raxSize(old) == 0) return;
+    db->key_index = raxNew();
+    freeKeyIndex(old, async);
+}
+
+/* Create or release the key index of 'db' according to ordered-key-index.
+ * Creating it indexes all the keys of the DB in a single pass. */
+void keyIndexUpdateConfig(redisDb *db) {
+    if (server.ordered_key_index && db->key_index == NULL) {
+        dictIterator *di = dictGetIterator(db->dict);
+        dictEntry *de;
+
+        db->key_index = raxNew();
+        while ((de = dictNext(di)) != NULL)
+            keyIndexAdd(db, dictGetKey(de));
+        dictReleaseIterator(di);
+    } else if (!server.ordered_key_index && db->key_index) {
+        freeKeyIndex(db->key_index, server.lazyfree_lazy_server_del);
+        db->key_index = NULL;
+    }
+}
@@ -38,6 +38,9 @@
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #ifdef HAVE_BACKTRACE
 #include <execinfo.h>
@@ -67,6 +70,8 @@ void bugReportStart(void);
 void printCrashReport(void);
 void bugReportEnd(int killViaSignal, int sig);
 void logStackTrace(void *eip, int uplevel);
+void debugProfileCommand(client *c);
+void debugPersistBenchCommand(client *c);
 
 /* ================================= Debugging ============================== */
 
@@ -427,9 +432,24 @@ void debugCommand(client *c) {
 "    Crash the server simulating an out-of-memory error.",
 "PANIC",
 "    Crash the server simulating a panic.",
+"PERSISTBENCH <keys> [<elements> [<value-size> [<type> ...]]]",
+"    For every <type> (string, list, set, intset, zset, hash, stream, default",
+"    all) populate a scratch dataset of <keys> keys holding <elements> elements",
+"    of <value-size> bytes (defaults 32 and 16), and time RDB save and load,",
+"    AOF rewrite and AOF load. The real dataset is put aside meanwhile. The",
+"    members of 'intset' are integers, and <value-size> is ignored.",
 "POPULATE <count> [<prefix>] [<size>]",
 "    Create <count> string keys named key:<num>. If <prefix> is specified then",
 "    it is used instead of the 'key' prefix.",
+"PROFILE <subcommand>",
+"    Sampling CPU profiler driven by SIGPROF. Subcommands:",
+"    * START [<hz>]: sample the running threads <hz> times per second of CPU",
+"      time (default 99).",
+"    * STOP: stop sampling, collected samples are retained.",
+"    * DUMP: return the samples as folded stacks, one",
+"      'thread;root;...;leaf <count>' line per stack, ready for flamegraph.pl.",
+"    * STATS: return the number of samples, dropped samples and stacks.",
+"    * RESET: discard the collected samples.",
 "DEBUG PROTOCOL <type>",
 "    Reply with a test value of the specified type. <type> can be: string,",
 "    integer, double, bignum, null, array, set, map, attrib, push, verbatim,",
@@ -762,6 +782,10 @@ NULL
         } else {
             addReplyError(c,"Wrong protocol type name. Please use one of the following: string|integer|double|bignum|null|array|set|map|attrib|push|verbatim|true|false");
         }
+    } else if (!strcasecmp(c->argv[1]->ptr,"profile") && c->argc >= 3) {
+        debugProfileCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr,"persistbench") && c->argc >= 3) {
+        debugPersistBenchCommand(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"sleep") && c->argc == 3) {
         double dtime = strtod(c->argv[2]->ptr,NULL);
         long long utime = dtime*1000000;
@@ -1976,6 +2000,620 @@ void disableWatchdog(void) {
     server.watchdog_period = 0;
 }
 
+/* ============================ Sampling profiler ===========================
+ *
+ * DEBUG PROFILE START arms an ITIMER_PROF timer: every time the process
+ * consumed 1/hz seconds of CPU a SIGPROF is delivered to one of the threads
+ * that are currently running (main thread, IO threads, bio threads), and the
+ * handler captures its stack with backtrace().
+ *
+ * Nothing the handler does may allocate or take locks, so samples are stored
+ * into a preallocated ring of slots. Every slot has a state: the handler, that
+ * may run in several threads at the same time, claims a FREE slot switching
+ * it to WRITING with a compare and swap (if the slot is busy the sample is
+ * counted as dropped) and marks it READY when done, while the main thread
+ * drains READY slots from serverCron(), resolves the frames with dladdr()
+ * and aggregates the samples into a table of folded stacks
+ * ("thread;root;...;leaf" -> count), that is the input format of
+ * flamegraph.pl. The table is bounded: once it holds
+ * PROFILER_MAX_STACKS distinct stacks new ones are accounted in a single
+ * overflow entry. */
+
+#define PROFILER_DEFAULT_HZ 99
+#define PROFILER_MAX_HZ 1000
+#define PROFILER_RING_SIZE 512
+#define PROFILER_MAX_FRAMES 64
+#define PROFILER_SKIP_FRAMES 2  /* The handler itself and the signal trampoline. */
+#define PROFILER_MAX_STACKS 10000
+#define PROFILER_OVERFLOW_STACK "[overflow]"
+
+#define PROFILER_SLOT_FREE 0
+#define PROFILER_SLOT_WRITING 1
+#define PROFILER_SLOT_READY 2
+
+typedef struct profilerSample {
+    redisAtomic int state;
+    int nframes;
+    char thread[16];
+    void *frames[PROFILER_MAX_FRAMES];
+} profilerSample;
+
+static struct {
+    int active;                 /* True if the SIGPROF timer is armed. */
+    int hz;                     /* Sampling frequency. */
+    profilerSample *ring;       /* Slots shared with the signal handler. */
+    redisAtomic unsigned long long head; /* Next slot to claim. */
+    redisAtomic unsigned long long dropped; /* Samples lost, ring was full. */
+    unsigned long long samples; /* Samples aggregated so far. */
+    dict *stacks;               /* Folded stack (sds) -> count (u64). */
+    void *self_base;            /* Load address of the server executable. */
+    struct sigaction old_sigprof; /* SIGPROF action before profilerStart(). */
+} profiler;
+
+#ifdef HAVE_BACKTRACE
+void profilerSignalHandler(int sig, siginfo_t *info, void *secret) {
+    UNUSED(sig);
+    UNUSED(info);
+    UNUSED(secret);
+    int saved_errno = errno;
+    unsigned long long idx;
+    int claimed;
+
+    /* Two threads may get the same slot once the index wrapped around the
+     * ring, so the slot itself is claimed atomically. */
+    atomicGetIncr(profiler.head,idx,1);
+    profilerSample *s = profiler.ring+(idx % PROFILER_RING_SIZE);
+    atomicCompareSwap(s->state,PROFILER_SLOT_FREE,PROFILER_SLOT_WRITING,claimed);
+    if (!claimed) {
+        atomicIncr(profiler.dropped,1);
+        errno = saved_errno;
+        return;
+    }
+#ifdef __linux__
+    if (prctl(PR_GET_NAME,s->thread,0,0,0) == -1)
+#endif
+        memcpy(s->thread,"thread",7);
+    s->thread[sizeof(s->thread)-1] = '\0';
+    s->nframes = backtrace(s->frames,PROFILER_MAX_FRAMES);
+    atomicSetWithSync(s->state,PROFILER_SLOT_READY);
+    errno = saved_errno;
+}
+#endif
+
+/* Arm (or with hz == 0 disarm) the SIGPROF timer. Returns C_ERR with errno
+ * set if the timer could not be set. */
+static int profilerScheduleSignal(int hz) {
+    struct itimerval it;
+
+    it.it_value.tv_sec = hz ? 1/hz : 0;
+    it.it_value.tv_usec = hz ? (1000000/hz) % 1000000 : 0;
+    it.it_interval = it.it_value;
+    return setitimer(ITIMER_PROF, &it, NULL) == 0 ? C_OK : C_ERR;
+}
+
+/* Move the READY samples from the ring to the folded stacks table. Only the
+ * main thread calls this function. */
+void profilerDrainSamples(void) {
+    if (profiler.ring == NULL) return;
+    for (int j = 0; j < PROFILER_RING_SIZE; j++) {
+        profilerSample *s = profiler.ring+j;
+        int state;
+
+        atomicGetWithSync(s->state,state);
+        if (state != PROFILER_SLOT_READY) continue;
+
+        /* Frames are leaf first, the folded format wants the root first. */
+        sds stack = sdsnew(s->thread);
+        for (int i = s->nframes-1; i >= PROFILER_SKIP_FRAMES; i--) {
+            Dl_info info;
+            if (!dladdr(s->frames[i],&info)) {
+                stack = sdscat(stack,";[unknown]");
+            } else if (info.dli_sname) {
+                stack = sdscatfmt(stack,";%s",info.dli_sname);
+            } else {
+                /* Static functions are not exported: report just the object
+                 * so that different offsets don't split the same stack. Our
+                 * own dli_fname is the process title, so it is not used. */
+                const char *obj = info.dli_fname ? info.dli_fname : "unknown";
+                const char *slash = strrchr(obj,'/');
+                if (info.dli_fbase == profiler.self_base) obj = "redis-server";
+                else if (slash) obj = slash+1;
+                stack = sdscatfmt(stack,";[%s]",obj);
+            }
+        }
+        atomicSetWithSync(s->state,PROFILER_SLOT_FREE);
+
+        dictEntry *de = dictFind(profiler.stacks,stack);
+        if (de == NULL && dictSize(profiler.stacks) >= PROFILER_MAX_STACKS) {
+            sdsfree(stack);
+            stack = sdsnew(PROFILER_OVERFLOW_STACK);
+            de = dictFind(profiler.stacks,stack);
+        }
+        if (de == NULL) {
+            de = dictAddRaw(profiler.stacks,stack,NULL);
+            dictSetUnsignedIntegerVal(de,0);
+        } else {
+            sdsfree(stack);
+        }
+        dictSetUnsignedIntegerVal(de,dictGetUnsignedIntegerVal(de)+1);
+        profiler.samples++;
+    }
+}
+
+/* Called by serverCron() so that the ring never fills up while profiling. */
+void profilerCron(void) {
+    if (profiler.active) profilerDrainSamples();
+}
+
+/* Start sampling at the specified frequency. Returns C_ERR with errno set
+ * if the profiler is not supported on this platform or the timer could not
+ * be armed. */
+/* Give SIGPROF back to the action it had before profilerStart(). The signal
+ * is ignored first, so that a tick already pending is discarded instead of
+ * reaching the old action, that is usually the default one terminating the
+ * process. */
+static void profilerRestoreSignal(void) {
+    struct sigaction act;
+
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPROF, &act, NULL);
+    sigaction(SIGPROF, &profiler.old_sigprof, NULL);
+}
+
+static int profilerStart(int hz) {
+#ifdef HAVE_BACKTRACE
+    struct sigaction act;
+    void *warmup[1];
+
+    if (profiler.ring == NULL) {
+        Dl_info info;
+
+        profiler.ring = zcalloc(sizeof(profilerSample)*PROFILER_RING_SIZE);
+        profiler.stacks = dictCreate(&setDictType,NULL);
+        if (dladdr(&server,&info))
+            profiler.self_base = info.dli_fbase;
+    }
+    /* The first call to backtrace() may load libgcc, that is not something
+     * we want to happen inside the signal handler. */
+    backtrace(warmup,1);
+
+    if (!profiler.active) {
+        sigemptyset(&act.sa_mask);
+        act.sa_flags = SA_SIGINFO | SA_RESTART;
+        act.sa_sigaction = profilerSignalHandler;
+        sigaction(SIGPROF, &act, &profiler.old_sigprof);
+    }
+    if (profilerScheduleSignal(hz) == C_ERR) {
+        if (!profiler.active) {
+            int saved_errno = errno;
+            profilerRestoreSignal();
+            errno = saved_errno;
+        }
+        return C_ERR;
+    }
+    profiler.hz = hz;
+    profiler.active = 1;
+    return C_OK;
+#else
+    UNUSED(hz);
+    errno = ENOTSUP;
+    return C_ERR;
+#endif
+}
+
+static void profilerStop(void) {
+    if (!profiler.active) return;
+    profilerScheduleSignal(0);
+    profilerRestoreSignal();
+    profiler.active = 0;
+    profilerDrainSamples();
+}
+
+/* Forget the collected samples, releasing the memory if not sampling. */
+static void profilerReset(void) {
+    profilerDrainSamples();
+    if (profiler.stacks) dictEmpty(profiler.stacks,NULL);
+    profiler.samples = 0;
+    atomicSet(profiler.dropped,0);
+    if (!profiler.active && profiler.ring) {
+        zfree(profiler.ring);
+        dictRelease(profiler.stacks);
+        profiler.ring = NULL;
+        profiler.stacks = NULL;
+    }
+}
+
+/* DEBUG PROFILE START [<hz>] | STOP | DUMP | STATS | RESET */
+void debugProfileCommand(client *c) {
+    char *sub = c->argv[2]->ptr;
+
+    if (!strcasecmp(sub,"start") && (c->argc == 3 || c->argc == 4)) {
+        long hz = PROFILER_DEFAULT_HZ;
+        if (c->argc == 4 &&
+            getRangeLongFromObjectOrReply(c,c->argv[3],1,PROFILER_MAX_HZ,&hz,
+                "hz must be between 1 and 1000") != C_OK) return;
+        if (profilerStart(hz) == C_ERR) {
+            addReplyErrorFormat(c,"Can't start the profiler: %s",
+                strerror(errno));
+            return;
+        }
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(sub,"stop") && c->argc == 3) {
+        profilerStop();
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(sub,"dump") && c->argc == 3) {
+        dictIterator *di;
+        dictEntry *de;
+        sds out = sdsempty();
+
+        profilerDrainSamples();
+        if (profiler.stacks) {
+            di = dictGetIterator(profiler.stacks);
+            while((de = dictNext(di)) != NULL) {
+                out = sdscatfmt(out,"%S %U\n",(sds)dictGetKey(de),
+                    (unsigned long long)dictGetUnsignedIntegerVal(de));
+            }
+            dictReleaseIterator(di);
+        }
+        addReplyVerbatim(c,out,sdslen(out),"txt");
+        sdsfree(out);
+    } else if (!strcasecmp(sub,"stats") && c->argc == 3) {
+        unsigned long long dropped;
+
+        profilerDrainSamples();
+        atomicGet(profiler.dropped,dropped);
+        addReplyMapLen(c,5);
+        addReplyBulkCString(c,"active");
+        addReplyLongLong(c,profiler.active);
+        addReplyBulkCString(c,"hz");
+        addReplyLongLong(c,profiler.active ? profiler.hz : 0);
+        addReplyBulkCString(c,"samples");
+        addReplyLongLong(c,profiler.samples);
+        addReplyBulkCString(c,"dropped");
+        addReplyLongLong(c,dropped);
+        addReplyBulkCString(c,"stacks");
+        addReplyLongLong(c,profiler.stacks ? dictSize(profiler.stacks) : 0);
+    } else if (!strcasecmp(sub,"reset") && c->argc == 3) {
+        profilerReset();
+        addReply(c,shared.ok);
+    } else {
+        addReplySubcommandSyntaxError(c);
+    }
+}
+
+/* ========================== Persistence benchmark =========================
+ *
+ * DEBUG PERSISTBENCH measures how fast a given dataset shape is saved and
+ * loaded. The real dataset is moved aside with backupDb(), so the benchmark
+ * runs against empty databases that are populated with synthetic keys of one
+ * type at a time. The save phases call rdbSaveRio() and
+ * rewriteAppendOnlyFileRio() directly, like the BGSAVE / BGREWRITEAOF
+ * children do, while the load phases use rdbLoad() and loadAppendOnlyFile()
+ * so that the same code of a restart is measured. The encoding of the
+ * populated objects depends on the *-max-ziplist-* settings, exactly like
+ * for keys created by clients. */
+
+#define PERSISTBENCH_DEFAULT_ELEMENTS 32
+#define PERSISTBENCH_DEFAULT_VALUE_SIZE 16
+#define PERSISTBENCH_FILLER_SIZE 4096
+
+/* "intset" is a set of integer members, that is intset encoded as long as
+ * it has no more than set-max-intset-entries elements. */
+static char *persistBenchTypes[] = {"string","list","set","intset","zset",
+                                    "hash","stream"};
+
+typedef struct persistBenchPhase {
+    long long bytes;    /* Size of the written file. */
+    long long usec;     /* Duration of the phase. */
+} persistBenchPhase;
+
+typedef struct persistBenchResult {
+    char *encoding;
+    long long populate_usec;
+    persistBenchPhase rdbsave, rdbload, aofsave, aofload;
+} persistBenchResult;
+
+/* Return the j-th element: a unique "<j>:" prefix followed by bytes taken
+ * from 'filler', so that the values don't compress more than real data. */
+static sds persistBenchElement(sds s, const char *filler, long j, long size) {
+    char buf[LONG_STR_SIZE+1];
+    int len = ll2string(buf,sizeof(buf),j);
+    buf[len++] = ':';
+    s = sdscpylen(s,buf,len);
+    /* Values larger than the filler are built appending it in chunks, never
+     * reading past its PERSISTBENCH_FILLER_SIZE*2 bytes. */
+    long off = (j*7) % PERSISTBENCH_FILLER_SIZE, left = size-len;
+    while (left > 0) {
+        long chunk = PERSISTBENCH_FILLER_SIZE*2 - off;
+        if (chunk > left) chunk = left;
+        s = sdscatlen(s,filler+off,chunk);
+        left -= chunk;
+        off = (off+7) % PERSISTBENCH_FILLER_SIZE;
+    }
+    return s;
+}
+
+/* Create a key of the given type with 'elements' elements. */
+static robj *persistBenchCreateObject(char *type, const char *filler,
+                                      long elements, long size)
+{
+    sds ele = sdsempty();
+    robj *o;
+
+    if (!strcmp(type,"string")) {
+        ele = persistBenchElement(ele,filler,0,size);
+        o = createStringObject(ele,sdslen(ele));
+    } else if (!strcmp(type,"list")) {
+        o = createQuicklistObject();
+        quicklistSetOptions(o->ptr, server.list_max_ziplist_size,
+                            server.list_compress_depth);
+        for (long j = 0; j < elements; j++) {
+            ele = persistBenchElement(ele,filler,j,size);
+            robj *val = createStringObject(ele,sdslen(ele));
+            listTypePush(o,val,LIST_TAIL);
+            decrRefCount(val);
+        }
+    } else if (!strcmp(type,"set")) {
+        ele = persistBenchElement(ele,filler,0,size);
+        o = setTypeCreate(ele);
+        for (long j = 0; j < elements; j++) {
+            ele = persistBenchElement(ele,filler,j,size);
+            setTypeAdd(o,ele);
+        }
+    } else if (!strcmp(type,"intset")) {
+        ele = sdscpylen(ele,"0",1);
+        o = setTypeCreate(ele);
+        for (long j = 0; j < elements; j++) {
+            sdsclear(ele);
+            ele = sdscatfmt(ele,"%I",(long long)j*7);
+            setTypeAdd(o,ele);
+        }
+    } else if (!strcmp(type,"zset")) {
+        int flags;
+        if (server.zset_max_ziplist_entries == 0 ||
+            server.zset_max_ziplist_value < (size_t)size)
+            o = createZsetObject();
+        else
+            o = createZsetZiplistObject();
+        for (long j = 0; j < elements; j++) {
+            ele = persistBenchElement(ele,filler,j,size);
+            zsetAdd(o,j,ele,ZADD_IN_NONE,&flags,NULL);
+        }
+    } else if (!strcmp(type,"hash")) {
+        o = createHashObject();
+        if (server.hash_max_ziplist_value < (size_t)size)
+            hashTypeConvert(o,OBJ_ENCODING_HT);
+        for (long j = 0; j < elements; j++) {
+            sds field = sdsfromlonglong(j);
+            ele = persistBenchElement(ele,filler,j,size);
+            hashTypeSet(o,field,ele,HASH_SET_TAKE_FIELD);
+        }
+    } else {
+        o = createStreamObject();
+        robj *argv[2];
+        streamID id;
+        argv[0] = createStringObject("field",5);
+        for (long j = 0; j < elements; j++) {
+            ele = persistBenchElement(ele,filler,j,size);
+            argv[1] = createStringObject(ele,sdslen(ele));
+            streamAppendItem(o->ptr,argv,1,&id,NULL);
+            decrRefCount(argv[1]);
+        }
+        decrRefCount(argv[0]);
+    }
+    sdsfree(ele);
+    return o;
+}
+
+/* Empty the scratch databases, without the side effects of emptyDb() like
+ * the invalidation of the keys tracked by clients. */
+static void persistBenchEmpty(void) {
+    emptyDbStructure(server.db,-1,0,NULL);
+    if (server.cluster_enabled) slotToKeyFlush(0);
+}
+
+/* Write the dataset to 'filename' with the given serializer, including the
+ * final fsync, as the saving children do. */
+static int persistBenchSave(char *filename, int aof, persistBenchPhase *res) {
+    long long start = ustime();
+    int error = 0, retval;
+    FILE *fp = fopen(filename,"w");
+    rio r;
+
+    if (fp == NULL) return C_ERR;
+    rioInitWithFile(&r,fp);
+    if (aof) {
+        if (server.aof_rewrite_incremental_fsync)
+            rioSetAutoSync(&r,REDIS_AUTOSYNC_BYTES);
+        retval = rewriteAppendOnlyFileRio(&r);
+    } else {
+        if (server.rdb_save_incremental_fsync)
+            rioSetAutoSync(&r,REDIS_AUTOSYNC_BYTES);
+        retval = rdbSaveRio(&r,&error,RDBFLAGS_NONE,NULL);
+    }
+    if (retval == C_ERR || fflush(fp) || fsync(fileno(fp))) {
+        fclose(fp);
+        return C_ERR;
+    }
+    res->bytes = ftello(fp);
+    fclose(fp);
+    res->usec = ustime()-start;
+    return C_OK;
+}
+
+static int persistBenchLoad(char *filename, int aof, persistBenchPhase *res) {
+    long long start = ustime();
+    int retval;
+
+    if (aof) {
+        /* loadAppendOnlyFile() refreshes the AOF size from server.aof_fd:
+         * point it to the file we load, the caller restores the fields. */
+        int fd = open(filename,O_RDONLY);
+        if (fd == -1) return C_ERR;
+        int old_fd = server.aof_fd;
+        server.aof_fd = fd;
+        retval = loadAppendOnlyFile(filename);
+        server.aof_fd = old_fd;
+        close(fd);
+    } else {
+        retval = rdbLoad(filename,NULL,RDBFLAGS_NONE);
+    }
+    res->usec = ustime()-start;
+    return retval;
+}
+
+static void addReplyPersistBenchPhase(client *c, char *phase,
+                                      persistBenchPhase *res, long keys)
+{
+    double sec = res->usec ? (double)res->usec/1000000 : 0.000001;
+    char field[64];
+
+    snprintf(field,sizeof(field),"%s_usec",phase);
+    addReplyBulkCString(c,field);
+    addReplyLongLong(c,res->usec);
+    snprintf(field,sizeof(field),"%s_mbps",phase);
+    addReplyBulkCString(c,field);
+    addReplyDouble(c,res->bytes/sec/(1024*1024));
+    snprintf(field,sizeof(field),"%s_keys_per_sec",phase);
+    addReplyBulkCString(c,field);
+    addReplyDouble(c,keys/sec);
+}
+
+void debugPersistBenchCommand(client *c) {
+    long keys, elements = PERSISTBENCH_DEFAULT_ELEMENTS;
+    long size = PERSISTBENCH_DEFAULT_VALUE_SIZE;
+    int numtypes = sizeof(persistBenchTypes)/sizeof(char*);
+    int selected[sizeof(persistBenchTypes)/sizeof(char*)];
+    int all = 1, j, t;
+
+    if (getRangeLongFromObjectOrReply(c,c->argv[2],1,LONG_MAX,&keys,
+            "keys must be positive") != C_OK) return;
+    if (c->argc > 3 &&
+        getRangeLongFromObjectOrReply(c,c->argv[3],1,LONG_MAX,&elements,
+            "elements must be positive") != C_OK) return;
+    if (c->argc > 4 &&
+        getRangeLongFromObjectOrReply(c,c->argv[4],1,512*1024*1024,&size,
+            "value-size must be between 1 and 536870912") != C_OK) return;
+
+    memset(selected,0,sizeof(selected));
+    for (j = 5; j < c->argc; j++) {
+        for (t = 0; t < numtypes; t++) {
+            if (!strcasecmp(c->argv[j]->ptr,persistBenchTypes[t])) break;
+        }
+        if (t == numtypes) {
+            addReplyErrorFormat(c,"Unknown type '%s', use one of: "
+                "string, list, set, intset, zset, hash, stream",
+                (char*)c->argv[j]->ptr);
+            return;
+        }
+        selected[t] = 1;
+        all = 0;
+    }
+    if (hasActiveChildProcess()) {
+        addReplyError(c,"Can't run the benchmark while a child process is "
+                        "active");
+        return;
+    }
+
+    /* Restored at the end: loading the AOF replays commands that increment
+     * the dirty counter, and updates the AOF size fields. */
+    long long dirty = server.dirty;
+    off_t aof_current_size = server.aof_current_size;
+    off_t aof_rewrite_base_size = server.aof_rewrite_base_size;
+    off_t aof_fsync_offset = server.aof_fsync_offset;
+    char rdbfile[64], aoffile[64], filler[PERSISTBENCH_FILLER_SIZE*2];
+
+    for (j = 0; j < (int)sizeof(filler); j++)
+        filler[j] = 'a' + (rand() % 26);
+    snprintf(rdbfile,sizeof(rdbfile),"temp-persistbench-%d.rdb",(int)getpid());
+    snprintf(aoffile,sizeof(aoffile),"temp-persistbench-%d.aof",(int)getpid());
+
+    protectClient(c);
+    dbBackup *backup = backupDb();
+    persistBenchResult results[sizeof(persistBenchTypes)/sizeof(char*)];
+    int err = 0;
+    for (t = 0; t < numtypes && !err; t++) {
+        char *type = persistBenchTypes[t];
+        persistBenchResult *r = results+t;
+        char buf[64];
+        long long start;
+
+        if (!all && !selected[t]) continue;
+        memset(r,0,sizeof(*r));
+
+        /* Populate. */
+        start = ustime();
+        dictExpand(server.db[0].dict,keys);
+        for (long k = 0; k < keys; k++) {
+            int len = snprintf(buf,sizeof(buf),"persistbench:%s:%ld",type,k);
+            robj *key = createStringObject(buf,len);
+            robj *val = persistBenchCreateObject(type,filler,elements,size);
+            if (r->encoding == NULL) r->encoding = strEncoding(val->encoding);
+            dbAdd(&server.db[0],key,val);
+            decrRefCount(key);
+        }
+        r->populate_usec = ustime()-start;
+
+        /* Save and load the RDB, then rewrite and load the AOF. Every load
+         * must bring back all the keys. */
+        errno = 0;
+        err = persistBenchSave(rdbfile,0,&r->rdbsave) == C_ERR;
+        persistBenchEmpty();
+        if (!err) err = persistBenchLoad(rdbfile,0,&r->rdbload) != C_OK;
+        if (!err) err = dictSize(server.db[0].dict) != (unsigned long)keys;
+        if (!err) err = persistBenchSave(aoffile,1,&r->aofsave) == C_ERR;
+        persistBenchEmpty();
+        if (!err) err = persistBenchLoad(aoffile,1,&r->aofload) != C_OK;
+        if (!err) err = dictSize(server.db[0].dict) != (unsigned long)keys;
+        persistBenchEmpty();
+        r->rdbload.bytes = r->rdbsave.bytes;
+        r->aofload.bytes = r->aofsave.bytes;
+        if (err) {
+            addReplyErrorFormat(c,"Benchmark of type '%s' failed: %s",
+                type, errno ? strerror(errno) : "keys count mismatch");
+        }
+    }
+    restoreDbBackup(backup);
+    unprotectClient(c);
+    unlink(rdbfile);
+    unlink(aoffile);
+    server.dirty = dirty;
+    server.aof_current_size = aof_current_size;
+    server.aof_rewrite_base_size = aof_rewrite_base_size;
+    server.aof_fsync_offset = aof_fsync_offset;
+    if (err) return;
+
+    int count = 0;
+    for (t = 0; t < numtypes; t++) count += all || selected[t];
+    addReplyMapLen(c,count);
+    for (t = 0; t < numtypes; t++) {
+        char *type = persistBenchTypes[t];
+        persistBenchResult *r = results+t;
+
+        if (!all && !selected[t]) continue;
+        addReplyBulkCString(c,type);
+        addReplyMapLen(c,18);
+        addReplyBulkCString(c,"encoding");
+        addReplyBulkCString(c,r->encoding);
+        addReplyBulkCString(c,"keys");
+        addReplyLongLong(c,keys);
+        addReplyBulkCString(c,"elements_per_key");
+        addReplyLongLong(c,strcmp(type,"string") ? elements : 1);
+        addReplyBulkCString(c,"populate_usec");
+        addReplyLongLong(c,r->populate_usec);
+        addReplyBulkCString(c,"rdb_bytes");
+        addReplyLongLong(c,r->rdbsave.bytes);
+        addReplyPersistBenchPhase(c,"rdb_save",&r->rdbsave,keys);
+        addReplyPersistBenchPhase(c,"rdb_load",&r->rdbload,keys);
+        addReplyBulkCString(c,"aof_bytes");
+        addReplyLongLong(c,r->aofsave.bytes);
+        addReplyPersistBenchPhase(c,"aof_rewrite",&r->aofsave,keys);
+        addReplyPersistBenchPhase(c,"aof_load",&r->aofload,keys);
+    }
+}
+
 /* Positive input is sleep time in microseconds. Negative input is fractions
  * of microseconds, i.e. -10 means 100 nanoseconds. */
 void debugDelay(int usec) {
@@ -1103,7 +1103,7 @@ void activeDefragCycle(void) {
         return;
     }
 
-    if (hasActiveChildProcess())
+    if (hasActiveChildProcess() || keyspaceAnalysisInProgress())
         return; /* Defragging memory while there's a fork will just do damage. */
 
     /* Once a second, check if the fragmentation justfies starting a scan
@@ -344,6 +344,12 @@ size_t freeMemoryGetNotCountedMemory(void) {
     if (server.aof_state != AOF_OFF) {
         overhead += sdsalloc(server.aof_buf)+aofRewriteBufferSize();
     }
+    /* When the clients memory has a limit of its own, evicting keys to
+     * make room for the clients would be pointless. */
+    if (server.maxmemory_clients) {
+        overhead += server.stat_clients_type_memory[CLIENT_TYPE_NORMAL] +
+                    server.stat_clients_type_memory[CLIENT_TYPE_PUBSUB];
+    }
     return overhead;
 }
 
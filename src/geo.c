@@ -31,7 +31,6 @@
 #include "geo.h"
 #include "geohash_helper.h"
 #include "debugmacro.h"
-#include "pqsort.h"
 
 /* Things exported from t_zset.c only for geo.c, since it is the only other
  * part of Redis that requires close zset introspection. */
@@ -57,6 +56,8 @@ geoArray *geoArrayCreate(void) {
     ga->array = NULL;
     ga->buckets = 0;
     ga->used = 0;
+    ga->topk = 0;
+    ga->topk_desc = 0;
     return ga;
 }
 
@@ -72,6 +73,52 @@ geoPoint *geoArrayAppend(geoArray *ga) {
     return gp;
 }
 
+/* Return non zero if the point 'a' must stay above 'b' in the heap of the
+ * points kept by a geoArray with 'topk' set: the root is the point that
+ * would be evicted first. */
+static int geoArrayHeapAbove(geoArray *ga, geoPoint *a, geoPoint *b) {
+    return ga->topk_desc ? a->dist < b->dist : a->dist > b->dist;
+}
+
+/* Add the point 'p' to the heap of the geoArray 'ga', evicting the root when
+ * the heap is full and 'p' is a better result than it. Return the slot of
+ * 'p' in the heap, or NULL if it was not added. */
+static geoPoint *geoArrayHeapPush(geoArray *ga, geoPoint *p) {
+    geoPoint *heap, tmp;
+    size_t pos, child;
+
+    if (ga->used < ga->topk) {
+        pos = ga->used;
+        *geoArrayAppend(ga) = *p;
+        heap = ga->array;
+        while (pos > 0) {
+            size_t parent = (pos-1)/2;
+            if (!geoArrayHeapAbove(ga,heap+pos,heap+parent)) break;
+            tmp = heap[pos];
+            heap[pos] = heap[parent];
+            heap[parent] = tmp;
+            pos = parent;
+        }
+        return heap+pos;
+    }
+
+    heap = ga->array;
+    if (!geoArrayHeapAbove(ga,heap,p)) return NULL;
+    sdsfree(heap[0].member);
+    heap[0] = *p;
+    pos = 0;
+    while ((child = pos*2+1) < ga->used) {
+        if (child+1 < ga->used &&
+            geoArrayHeapAbove(ga,heap+child+1,heap+child)) child++;
+        if (!geoArrayHeapAbove(ga,heap+child,heap+pos)) break;
+        tmp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = tmp;
+        pos = child;
+    }
+    return heap+pos;
+}
+
 /* Destroy a geoArray created with geoArrayCreate(). */
 void geoArrayFree(geoArray *ga) {
     size_t i;
@@ -213,31 +260,37 @@ void addReplyDoubleDistance(client *c, double d) {
  * representing a point, and a GeoShape, appends this entry as a geoPoint
  * into the specified geoArray only if the point is within the search area.
  *
- * returns C_OK if the point is included, or REIDS_ERR if it is outside. */
-int geoAppendIfWithinShape(geoArray *ga, GeoShape *shape, double score, sds member) {
+ * Returns the geoPoint added, whose member is left for the caller to set, or
+ * NULL if the point is outside the search area (or, when the array keeps only
+ * the 'topk' best points, not among them). This way no member string is
+ * created for the points that are discarded. */
+geoPoint *geoAppendIfWithinShape(geoArray *ga, GeoShape *shape, double score) {
     double distance = 0, xy[2];
+    geoPoint *gp, p;
 
-    if (!decodeGeohash(score,xy)) return C_ERR; /* Can't decode. */
+    if (!decodeGeohash(score,xy)) return NULL; /* Can't decode. */
     /* Note that geohashGetDistanceIfInRadiusWGS84() takes arguments in
      * reverse order: longitude first, latitude later. */
     if (shape->type == CIRCULAR_TYPE) {
         if (!geohashGetDistanceIfInRadiusWGS84(shape->xy[0], shape->xy[1], xy[0], xy[1],
-                                               shape->t.radius*shape->conversion, &distance)) return C_ERR;
+                                               shape->t.radius*shape->conversion, &distance)) return NULL;
     } else if (shape->type == RECTANGLE_TYPE) {
         if (!geohashGetDistanceIfInRectangle(shape->t.r.width * shape->conversion,
                                              shape->t.r.height * shape->conversion,
                                              shape->xy[0], shape->xy[1], xy[0], xy[1], &distance))
-            return C_ERR;
+            return NULL;
     }
 
     /* Append the new element. */
-    geoPoint *gp = geoArrayAppend(ga);
-    gp->longitude = xy[0];
-    gp->latitude = xy[1];
-    gp->dist = distance;
-    gp->member = member;
-    gp->score = score;
-    return C_OK;
+    p.longitude = xy[0];
+    p.latitude = xy[1];
+    p.dist = distance;
+    p.member = NULL;
+    p.score = score;
+    if (ga->topk) return geoArrayHeapPush(ga,&p);
+    gp = geoArrayAppend(ga);
+    *gp = p;
+    return gp;
 }
 
 /* Query a Redis sorted set to extract all the elements between 'min' and
@@ -256,8 +309,8 @@ int geoGetPointsInRange(robj *zobj, double min, double max, GeoShape *shape, geo
     /* minex 0 = include min in range; maxex 1 = exclude max in range */
     /* That's: min <= val < max */
     zrangespec range = { .min = min, .max = max, .minex = 0, .maxex = 1 };
-    size_t origincount = ga->used;
-    sds member;
+    int added = 0;
+    geoPoint *gp;
 
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
         unsigned char *zl = zobj->ptr;
@@ -280,12 +333,14 @@ int geoGetPointsInRange(robj *zobj, double min, double max, GeoShape *shape, geo
             if (!zslValueLteMax(score, &range))
                 break;
 
-            /* We know the element exists. ziplistGet should always succeed */
-            ziplistGet(eptr, &vstr, &vlen, &vlong);
-            member = (vstr == NULL) ? sdsfromlonglong(vlong) :
-                                      sdsnewlen(vstr,vlen);
-            if (geoAppendIfWithinShape(ga,shape,score,member)
-                == C_ERR) sdsfree(member);
+            if ((gp = geoAppendIfWithinShape(ga,shape,score)) != NULL) {
+                /* We know the element exists. ziplistGet should always
+                 * succeed */
+                ziplistGet(eptr, &vstr, &vlen, &vlong);
+                gp->member = (vstr == NULL) ? sdsfromlonglong(vlong) :
+                                              sdsnewlen(vstr,vlen);
+                added++;
+            }
             if (ga->used && limit && ga->used >= limit) break;
             zzlNext(zl, &eptr, &sptr);
         }
@@ -305,14 +360,15 @@ int geoGetPointsInRange(robj *zobj, double min, double max, GeoShape *shape, geo
             if (!zslValueLteMax(ln->score, &range))
                 break;
 
-            ele = sdsdup(ele);
-            if (geoAppendIfWithinShape(ga,shape,ln->score,ele)
-                == C_ERR) sdsfree(ele);
+            if ((gp = geoAppendIfWithinShape(ga,shape,ln->score)) != NULL) {
+                gp->member = sdsdup(ele);
+                added++;
+            }
             if (ga->used && limit && ga->used >= limit) break;
             ln = ln->level[0].forward;
         }
     }
-    return ga->used - origincount;
+    return added;
 }
 
 /* Compute the sorted set scores min (inclusive), max (exclusive) we should
@@ -344,14 +400,57 @@ void scoresOfGeoHashBox(GeoHashBits hash, GeoHashFix52Bits *min, GeoHashFix52Bit
     *max = geohashAlign52Bits(hash);
 }
 
+/* The boxes found by geohashCalculateAreasByShapeWGS84() can be much larger
+ * than the search area. Each of them is split in 4^GEO_COVER_EXTRA_STEPS
+ * smaller boxes, and only the ones that may intersect the search area are
+ * queried, so that fewer points out of it are scanned. */
+#define GEO_COVER_EXTRA_STEPS 2
+
 /* Obtain all members between the min/max of this geohash bounding box.
  * Populate a geoArray of GeoPoints by calling geoGetPointsInRange().
  * Return the number of points added to the array. */
 int membersOfGeoHashBox(robj *zobj, GeoHashBits hash, geoArray *ga, GeoShape *shape, unsigned long limit) {
-    GeoHashFix52Bits min, max;
+    GeoHashFix52Bits min, max, range_min = 0, range_max = 0;
+    GeoHashRange long_range, lat_range;
+    int extra = GEO_COVER_EXTRA_STEPS, count = 0;
+    uint64_t j;
+
+    /* A ziplist is small and always scanned from its head: there is
+     * nothing to gain from querying smaller boxes. */
+    if (extra > GEO_STEP_MAX - hash.step) extra = GEO_STEP_MAX - hash.step;
+    if (zobj->encoding != OBJ_ENCODING_SKIPLIST || extra == 0) {
+        scoresOfGeoHashBox(hash,&min,&max);
+        return geoGetPointsInRange(zobj, min, max, shape, ga, limit);
+    }
 
-    scoresOfGeoHashBox(hash,&min,&max);
-    return geoGetPointsInRange(zobj, min, max, shape, ga, limit);
+    /* The sub-boxes are visited in score order, so that the adjacent ones
+     * are merged into a single range query. */
+    geohashGetCoordRange(&long_range,&lat_range);
+    for (j = 0; j < (1ULL << (extra*2)); j++) {
+        GeoHashBits sub = {
+            .bits = (hash.bits << (extra*2)) | j,
+            .step = hash.step + extra
+        };
+        GeoHashArea area;
+
+        geohashDecode(long_range, lat_range, sub, &area);
+        if (!geohashAreaMayIntersectShape(shape, &area)) continue;
+        scoresOfGeoHashBox(sub,&min,&max);
+        if (range_max && min == range_max) {
+            range_max = max;
+            continue;
+        }
+        if (range_max) {
+            count += geoGetPointsInRange(zobj, range_min, range_max, shape,
+                                         ga, limit);
+            if (ga->used && limit && ga->used >= limit) return count;
+        }
+        range_min = min;
+        range_max = max;
+    }
+    if (range_max)
+        count += geoGetPointsInRange(zobj, range_min, range_max, shape, ga, limit);
+    return count;
 }
 
 /* Search all eight neighbors + self geohash box */
@@ -685,8 +784,14 @@ void georadiusGeneric(client *c, int srcKeyIndex, int flags) {
     /* Get all neighbor geohash boxes for our radius search */
     GeoHashRadius georadius = geohashCalculateAreasByShapeWGS84(&shape);
 
-    /* Search the zset for all matching points */
+    /* Search the zset for all matching points. With COUNT only the best
+     * 'count' of them are kept while searching, instead of sorting them all
+     * later. */
     geoArray *ga = geoArrayCreate();
+    if (count != 0 && !any) {
+        ga->topk = count;
+        ga->topk_desc = (sort == SORT_DESC);
+    }
     membersOfAllNeighbors(zobj, georadius, &shape, ga, any ? count : 0);
 
     /* If no matching results, the user gets an empty reply. */
@@ -710,12 +815,7 @@ void georadiusGeneric(client *c, int srcKeyIndex, int flags) {
             sort_gp_callback = sort_gp_desc;
         }
 
-        if (returned_items == result_length) {
-            qsort(ga->array, result_length, sizeof(geoPoint), sort_gp_callback);
-        } else {
-            pqsort(ga->array, result_length, sizeof(geoPoint), sort_gp_callback,
-                0, (returned_items - 1));
-        }
+        qsort(ga->array, result_length, sizeof(geoPoint), sort_gp_callback);
     }
 
     if (storekey == NULL) {
@@ -17,6 +17,9 @@ typedef struct geoArray {
     struct geoPoint *array;
     size_t buckets;
     size_t used;
+    size_t topk;        /* If not zero, only the 'topk' nearest points (or the
+                           farthest ones if 'topk_desc') are kept, as a heap. */
+    int topk_desc;
 } geoArray;
 
 #endif
@@ -57,6 +57,10 @@ const double MERCATOR_MIN = -20037726.37;
 static inline double deg_rad(double ang) { return ang * D_R; }
 static inline double rad_deg(double ang) { return ang / D_R; }
 
+/* Relative tolerance used when a lower bound is compared with the search
+ * radius, so that floating point rounding never excludes a matching point. */
+#define GEO_BOUND_MARGIN (1 + 1e-9)
+
 /* This function is used in order to estimate the step (bits precision)
  * of the 9 search area boxes during radius queries. */
 uint8_t geohashEstimateStepsByRadius(double range_meters, double lat) {
@@ -232,6 +236,10 @@ double geohashGetDistance(double lon1d, double lat1d, double lon2d, double lat2d
 int geohashGetDistanceIfInRadius(double x1, double y1,
                                  double x2, double y2, double radius,
                                  double *distance) {
+    /* The distance is at least the one along the meridian, so the points too
+     * far in latitude are rejected without computing it. */
+    if (deg_rad(fabs(y2 - y1)) * EARTH_RADIUS_IN_METERS >
+        radius * GEO_BOUND_MARGIN) return 0;
     *distance = geohashGetDistance(x1, y1, x2, y2);
     if (*distance > radius) return 0;
     return 1;
@@ -243,6 +251,50 @@ int geohashGetDistanceIfInRadiusWGS84(double x1, double y1, double x2,
     return geohashGetDistanceIfInRadius(x1, y1, x2, y2, radius, distance);
 }
 
+/* Return 0 if no point of the geohash box 'area' can be within 'shape', as
+ * tested by geohashGetDistanceIfInRadius() or geohashGetDistanceIfInRectangle(),
+ * otherwise 1. The test compares the shape with lower bounds of the haversine
+ * terms over the whole box, so a box is never excluded by mistake. */
+int geohashAreaMayIntersectShape(GeoShape *shape, const GeoHashArea *area) {
+    double lon = shape->xy[0], lat = shape->xy[1];
+    double dlat = 0, dlon = 0, cosmin, u, v;
+
+    /* Smallest latitude and longitude differences between the center of the
+     * shape and the box, the latter taking the antimeridian into account. */
+    if (lat < area->latitude.min) dlat = area->latitude.min - lat;
+    else if (lat > area->latitude.max) dlat = lat - area->latitude.max;
+    if (lon < area->longitude.min)
+        dlon = fmin(area->longitude.min - lon, lon + 360 - area->longitude.max);
+    else if (lon > area->longitude.max)
+        dlon = fmin(lon - area->longitude.max, area->longitude.min + 360 - lon);
+
+    /* The cosine of the latitude of the points in the box is at least the
+     * one of the box edge nearest to a pole. */
+    cosmin = cos(deg_rad(fmax(fabs(area->latitude.min),
+                              fabs(area->latitude.max))));
+    u = sin(deg_rad(dlat) / 2);
+    v = sin(deg_rad(dlon) / 2);
+
+    if (shape->type == CIRCULAR_TYPE) {
+        double half_angle = shape->t.radius * shape->conversion /
+                            EARTH_RADIUS_IN_METERS / 2;
+        double s = sin(half_angle);
+
+        if (half_angle >= M_PI / 2) return 1;
+        return u * u + cos(deg_rad(lat)) * cosmin * v * v <=
+               s * s * GEO_BOUND_MARGIN;
+    } else {
+        double half_height = shape->t.r.height * shape->conversion / 2;
+        double quarter_angle = shape->t.r.width * shape->conversion /
+                               EARTH_RADIUS_IN_METERS / 4;
+
+        if (deg_rad(dlat) * EARTH_RADIUS_IN_METERS >
+            half_height * GEO_BOUND_MARGIN) return 0;
+        if (quarter_angle >= M_PI / 2) return 1;
+        return cosmin * v <= sin(quarter_angle) * GEO_BOUND_MARGIN;
+    }
+}
+
 /* Judge whether a point is in the axis-aligned rectangle, when the distance
  * between a searched point and the center point is less than or equal to
  * height/2 or width/2 in height and width, the point is in the rectangle.
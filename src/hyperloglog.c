@@ -527,6 +527,19 @@ void hllDenseRegHisto(uint8_t *registers, int* reghisto) {
         unsigned long r0, r1, r2, r3, r4, r5, r6, r7, r8, r9,
                       r10, r11, r12, r13, r14, r15;
         for (j = 0; j < 1024; j++) {
+            uint64_t w0;
+            uint32_t w1;
+
+            /* Fast path for 16 zero registers, common in HLLs that were
+             * just promoted to the dense representation. */
+            memcpy(&w0,r,sizeof(w0));
+            memcpy(&w1,r+8,sizeof(w1));
+            if ((w0|w1) == 0) {
+                reghisto[0] += 16;
+                r += 12;
+                continue;
+            }
+
             /* Handle 16 registers per iteration. */
             r0 = r[0] & 63;
             r1 = (r[0] >> 6 | r[1] << 2) & 63;
@@ -573,6 +586,69 @@ void hllDenseRegHisto(uint8_t *registers, int* reghisto) {
     }
 }
 
+/* Return the bytewise maximum of the words 'a' and 'b', whose bytes must all
+ * be lower than 128, as the values of the registers are. Setting the high bit
+ * of every byte of 'a' prevents the subtraction from borrowing across bytes,
+ * and leaves that bit set only in the bytes where a >= b. */
+static inline uint64_t hllBytewiseMax(uint64_t a, uint64_t b) {
+    const uint64_t high = 0x8080808080808080ULL;
+    uint64_t mask = ((((a | high) - b) & high) >> 7) * 0xff;
+
+    return (a & mask) | (b & ~mask);
+}
+
+/* Merge the dense registers 'registers' into the array of HLL_REGISTERS
+ * uint8_t registers 'max', setting max[i] to MAX(max[i],registers[i]). */
+void hllDenseMerge(uint8_t *max, uint8_t *registers) {
+    int j;
+
+    /* Like in hllDenseRegHisto(), our target value of 16384 registers of 6
+     * bits takes a faster path: 16 registers are unpacked from every 12
+     * bytes, and merged 8 at a time as 64 bit words. */
+    if (HLL_REGISTERS == 16384 && HLL_BITS == 6) {
+        uint8_t *r = registers, v[16];
+        uint64_t v0, v1, m0, m1;
+
+        for (j = 0; j < 1024; j++) {
+            v[0] = r[0] & 63;
+            v[1] = (r[0] >> 6 | r[1] << 2) & 63;
+            v[2] = (r[1] >> 4 | r[2] << 4) & 63;
+            v[3] = (r[2] >> 2) & 63;
+            v[4] = r[3] & 63;
+            v[5] = (r[3] >> 6 | r[4] << 2) & 63;
+            v[6] = (r[4] >> 4 | r[5] << 4) & 63;
+            v[7] = (r[5] >> 2) & 63;
+            v[8] = r[6] & 63;
+            v[9] = (r[6] >> 6 | r[7] << 2) & 63;
+            v[10] = (r[7] >> 4 | r[8] << 4) & 63;
+            v[11] = (r[8] >> 2) & 63;
+            v[12] = r[9] & 63;
+            v[13] = (r[9] >> 6 | r[10] << 2) & 63;
+            v[14] = (r[10] >> 4 | r[11] << 4) & 63;
+            v[15] = (r[11] >> 2) & 63;
+
+            memcpy(&v0,v,8);
+            memcpy(&v1,v+8,8);
+            memcpy(&m0,max,8);
+            memcpy(&m1,max+8,8);
+            m0 = hllBytewiseMax(m0,v0);
+            m1 = hllBytewiseMax(m1,v1);
+            memcpy(max,&m0,8);
+            memcpy(max+8,&m1,8);
+
+            r += 12;
+            max += 16;
+        }
+    } else {
+        uint8_t val;
+
+        for (j = 0; j < HLL_REGISTERS; j++) {
+            HLL_DENSE_GET_REGISTER(val,registers,j);
+            if (val > max[j]) max[j] = val;
+        }
+    }
+}
+
 /* ================== Sparse representation implementation  ================= */
 
 /* Convert the HLL with sparse representation given as input in its dense
@@ -907,6 +983,184 @@ int hllSparseAdd(robj *o, unsigned char *ele, size_t elesize) {
     return hllSparseSet(o,index,count);
 }
 
+/* Write at 'p' the opcodes representing a run of 'len' registers set to
+ * 'val', using the same encoding of createHLLObject() and hllSparseSet().
+ * Returns the pointer past the last opcode written. */
+static uint8_t *hllSparseEmitRun(uint8_t *p, int val, long len) {
+    while (len) {
+        long oplen;
+
+        if (val == 0 && len > HLL_SPARSE_ZERO_MAX_LEN) {
+            oplen = len > HLL_SPARSE_XZERO_MAX_LEN ?
+                    HLL_SPARSE_XZERO_MAX_LEN : len;
+            HLL_SPARSE_XZERO_SET(p,oplen);
+            p += 2;
+        } else if (val == 0) {
+            oplen = len;
+            HLL_SPARSE_ZERO_SET(p,oplen);
+            p++;
+        } else {
+            oplen = len > HLL_SPARSE_VAL_MAX_LEN ? HLL_SPARSE_VAL_MAX_LEN : len;
+            HLL_SPARSE_VAL_SET(p,val,oplen);
+            p++;
+        }
+        len -= oplen;
+    }
+    return p;
+}
+
+/* Low level function to set many sparse HLL registers at once, every
+ * register to the greatest between its current value and the requested one.
+ *
+ * 'regs' is an array of 'count' entries encoded as (index<<8)|value, as
+ * built by hllSparseAddMulti(): sorted by index, one entry per register.
+ * Instead of calling hllSparseSet() for every register, that would memmove
+ * and re-encode opcodes at every step, the sparse representation is
+ * rewritten in a single pass, merging the old runs with the updates.
+ *
+ * On success the number of registers updated is returned, on error (if the
+ * representation is invalid) -1 is returned.
+ *
+ * Like hllSparseSet() the HLL is promoted to the dense representation when
+ * some value is not representable with the sparse representation, or when
+ * the result would be greater than server.hll_sparse_max_bytes. In this
+ * case the promotion happens before any register is updated. */
+int hllSparseSetMulti(robj *o, uint32_t *regs, int count) {
+    struct hllhdr *hdr;
+    uint8_t *p = (uint8_t*)o->ptr + HLL_HDR_SIZE;
+    uint8_t *end = (uint8_t*)o->ptr + sdslen(o->ptr), *n;
+    sds new;
+    long idx = 0, runlen, pos, j = 0, outval = 0, outlen = 0;
+    int regval, updated = 0;
+
+    /* Values greater than HLL_SPARSE_VAL_MAX_VALUE always require the
+     * dense representation. */
+    for (j = 0; j < count; j++)
+        if ((regs[j] & 0xff) > HLL_SPARSE_VAL_MAX_VALUE) goto promote;
+
+    /* Every update splits at most one opcode into three, adding up to
+     * 3 bytes: this is the worst case length of the new representation. */
+    new = sdsnewlen(NULL,sdslen(o->ptr)+(size_t)count*3);
+    memcpy(new,o->ptr,HLL_HDR_SIZE);
+    n = (uint8_t*)new + HLL_HDR_SIZE;
+
+/* Append a run of 'len' registers set to 'val' to the new representation,
+ * coalescing it with the pending run when the value is the same. */
+#define HLL_SPARSE_EMIT(val,len) do { \
+    if ((len) == 0) break; \
+    if ((val) != outval) { \
+        n = hllSparseEmitRun(n,outval,outlen); \
+        outval = (val); \
+        outlen = 0; \
+    } \
+    outlen += (len); \
+} while(0)
+
+    /* Walk the old runs, splitting them where the updates fall. */
+    j = 0;
+    while(p < end) {
+        if (HLL_SPARSE_IS_ZERO(p)) {
+            runlen = HLL_SPARSE_ZERO_LEN(p);
+            regval = 0;
+            p++;
+        } else if (HLL_SPARSE_IS_XZERO(p)) {
+            runlen = HLL_SPARSE_XZERO_LEN(p);
+            regval = 0;
+            p += 2;
+        } else {
+            runlen = HLL_SPARSE_VAL_LEN(p);
+            regval = HLL_SPARSE_VAL_VALUE(p);
+            p++;
+        }
+        if ((runlen + idx) > HLL_REGISTERS) break; /* Overflow. */
+
+        pos = idx;
+        while (j < count && (long)(regs[j] >> 8) < idx+runlen) {
+            long index = regs[j] >> 8;
+            int val = regs[j] & 0xff;
+
+            HLL_SPARSE_EMIT(regval,index-pos);
+            if (val > regval) {
+                HLL_SPARSE_EMIT(val,1);
+                updated++;
+            } else {
+                HLL_SPARSE_EMIT(regval,1);
+            }
+            pos = index+1;
+            j++;
+        }
+        HLL_SPARSE_EMIT(regval,idx+runlen-pos);
+        idx += runlen;
+    }
+    n = hllSparseEmitRun(n,outval,outlen);
+#undef HLL_SPARSE_EMIT
+    serverAssert(n-(uint8_t*)new <= (long)sdslen(new));
+
+    if (idx != HLL_REGISTERS) {
+        sdsfree(new);
+        return -1; /* Invalid format. */
+    }
+    if (updated == 0) {
+        sdsfree(new);
+        return 0;
+    }
+    sdssetlen(new,n-(uint8_t*)new);
+    if (sdslen(new) > server.hll_sparse_max_bytes) {
+        sdsfree(new);
+        goto promote;
+    }
+    sdsfree(o->ptr);
+    o->ptr = sdsRemoveFreeSpace(new);
+    hdr = o->ptr;
+    HLL_INVALIDATE_CACHE(hdr);
+    return updated;
+
+promote: /* Promote to dense representation. */
+    if (hllSparseToDense(o) == C_ERR) return -1; /* Corrupted HLL. */
+    hdr = o->ptr;
+
+    /* As in hllSparseSet(), at least one register requires to be updated
+     * if we need to convert from sparse to dense, so the result is at
+     * least 1 and the conversion gets propagated. */
+    for (j = 0; j < count; j++)
+        updated += hllDenseSet(hdr->registers,regs[j]>>8,regs[j]&0xff);
+    return updated ? updated : 1;
+}
+
+static int hllSparseBatchCompare(const void *a, const void *b) {
+    uint32_t ra = *(const uint32_t*)a, rb = *(const uint32_t*)b;
+    return (ra > rb) - (ra < rb);
+}
+
+/* "Add" the 'numele' elements in the sparse hyperloglog data structure at
+ * once. The elements are hashed first, and the resulting registers sorted
+ * by index keeping only the greatest value for every register, so that
+ * hllSparseSetMulti() can apply them in a single pass.
+ *
+ * Returns the number of registers updated, or -1 on error. */
+int hllSparseAddMulti(robj *o, robj **elev, int numele) {
+    uint32_t *regs = zmalloc(sizeof(uint32_t)*numele);
+    int j, count = 0, retval;
+
+    for (j = 0; j < numele; j++) {
+        long index;
+        uint8_t val = hllPatLen((unsigned char*)elev[j]->ptr,
+                                sdslen(elev[j]->ptr),&index);
+        regs[j] = ((uint32_t)index << 8) | val;
+    }
+    qsort(regs,numele,sizeof(uint32_t),hllSparseBatchCompare);
+
+    /* Since the value is in the low byte, the last entry of every index is
+     * the one with the greatest value. */
+    for (j = 0; j < numele; j++) {
+        if (j+1 < numele && (regs[j] >> 8) == (regs[j+1] >> 8)) continue;
+        regs[count++] = regs[j];
+    }
+    retval = hllSparseSetMulti(o,regs,count);
+    zfree(regs);
+    return retval;
+}
+
 /* Compute the register histogram in the sparse representation. */
 void hllSparseRegHisto(uint8_t *sparse, int sparselen, int *invalid, int* reghisto) {
     int idx = 0, runlen, regval;
@@ -1070,12 +1324,7 @@ int hllMerge(uint8_t *max, robj *hll) {
     int i;
 
     if (hdr->encoding == HLL_DENSE) {
-        uint8_t val;
-
-        for (i = 0; i < HLL_REGISTERS; i++) {
-            HLL_DENSE_GET_REGISTER(val,hdr->registers,i);
-            if (val > max[i]) max[i] = val;
-        }
+        hllDenseMerge(max,hdr->registers);
     } else {
         uint8_t *p = hll->ptr, *end = p + sdslen(hll->ptr);
         long runlen, regval;
@@ -1193,18 +1442,29 @@ void pfaddCommand(client *c) {
         if (isHLLObjectOrReply(c,o) != C_OK) return;
         o = dbUnshareStringValue(c->db,c->argv[1],o);
     }
-    /* Perform the low level ADD operation for every element. */
-    for (j = 2; j < c->argc; j++) {
-        int retval = hllAdd(o, (unsigned char*)c->argv[j]->ptr,
-                               sdslen(c->argv[j]->ptr));
-        switch(retval) {
-        case 1:
-            updated++;
-            break;
-        case -1:
+    /* Perform the low level ADD operation for every element. Sparse HLLs
+     * get all the elements in a single pass, see hllSparseAddMulti(). */
+    hdr = o->ptr;
+    if (hdr->encoding == HLL_SPARSE && c->argc > 3) {
+        int retval = hllSparseAddMulti(o,c->argv+2,c->argc-2);
+        if (retval == -1) {
             addReplyError(c,invalid_hll_err);
             return;
         }
+        updated += retval;
+    } else {
+        for (j = 2; j < c->argc; j++) {
+            int retval = hllAdd(o, (unsigned char*)c->argv[j]->ptr,
+                                   sdslen(c->argv[j]->ptr));
+            switch(retval) {
+            case 1:
+                updated++;
+                break;
+            case -1:
+                addReplyError(c,invalid_hll_err);
+                return;
+            }
+        }
     }
     hdr = o->ptr;
     if (updated) {
@@ -1216,6 +1476,155 @@ void pfaddCommand(client *c) {
     addReply(c, updated ? shared.cone : shared.czero);
 }
 
+/* ========================= Multi-key PFCOUNT cache ========================= */
+
+/* Multi-key PFCOUNT merges all the HLLs at every call. The cardinalities it
+ * computes are cached, so that repeating a query over keys that were not
+ * modified in the meantime costs just a few dictionary lookups.
+ *
+ * Every key involved in a cached query is stamped, in the dictionary of its
+ * DB in pfcountCacheStamps, with a value of the pfcountCacheStamp counter
+ * that is renewed every time signalModifiedKey() is called for the key. A
+ * cached cardinality remembers the stamps of its keys, and is valid only as
+ * long as none of them changed. When the cache is full, or a DB is flushed or
+ * swapped, everything is dropped.
+ *
+ * Keys that are logically expired but not deleted (on replicas, or while
+ * writes are paused) keep their stamp, so the entry also remembers which keys
+ * existed: a key that no longer exists is a cache miss. */
+#define PFCOUNT_CACHE_SIZE 1024
+
+typedef struct pfcountCacheKey {
+    uint64_t stamp;     /* Stamp of the key when the entry was cached. */
+    int exists;         /* Whether the key existed at that time. */
+} pfcountCacheKey;
+
+typedef struct pfcountCacheEntry {
+    uint64_t card;
+    pfcountCacheKey keys[]; /* The keys, in the order of the query. */
+} pfcountCacheEntry;
+
+static void pfcountCacheEntryFree(void *privdata, void *val) {
+    UNUSED(privdata);
+    zfree(val);
+}
+
+/* Query id (see pfcountCacheId()) -> pfcountCacheEntry. */
+dictType pfcountCacheDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    pfcountCacheEntryFree,      /* val destructor */
+    NULL                        /* allow to expand */
+};
+
+static dict *pfcountCache = NULL;
+static dict **pfcountCacheStamps = NULL; /* Key -> stamp, one dict per DB. */
+static uint64_t pfcountCacheStamp = 0;
+
+/* Drop all the cached cardinalities. */
+void hllCountCacheFlush(void) {
+    int j;
+
+    if (pfcountCache == NULL) return;
+    dictRelease(pfcountCache);
+    for (j = 0; j < server.dbnum; j++)
+        if (pfcountCacheStamps[j]) dictRelease(pfcountCacheStamps[j]);
+    zfree(pfcountCacheStamps);
+    pfcountCache = NULL;
+    pfcountCacheStamps = NULL;
+}
+
+/* Called by signalModifiedKey(): invalidate the cached cardinalities of the
+ * queries involving 'key'. */
+void hllCountCacheTouchKey(redisDb *db, robj *key) {
+    dictEntry *de;
+
+    if (pfcountCacheStamps == NULL || pfcountCacheStamps[db->id] == NULL)
+        return;
+    if ((de = dictFind(pfcountCacheStamps[db->id],key)) != NULL)
+        dictSetUnsignedIntegerVal(de,++pfcountCacheStamp);
+}
+
+/* Return the id of the PFCOUNT query of the client: its DB and key names. */
+static sds pfcountCacheId(client *c) {
+    sds id = sdsfromlonglong(c->db->id);
+    int j;
+
+    for (j = 1; j < c->argc; j++) {
+        sds key = c->argv[j]->ptr;
+
+        id = sdscatfmt(id,":%u:",(unsigned int)sdslen(key));
+        id = sdscatsds(id,key);
+    }
+    return id;
+}
+
+/* Return the cached cardinality of the PFCOUNT query 'id' of the client in
+ * '*card' and C_OK, or C_ERR if there is no valid cached value. 'hlls' are
+ * the objects of the keys as looked up by the command, NULL if missing. */
+static int pfcountCacheLookup(client *c, sds id, robj **hlls, uint64_t *card) {
+    pfcountCacheEntry *e;
+    dictEntry *de;
+    int j;
+
+    if (pfcountCache == NULL) return C_ERR;
+    if ((de = dictFind(pfcountCache,id)) == NULL) return C_ERR;
+    e = dictGetVal(de);
+    for (j = 1; j < c->argc; j++) {
+        de = dictFind(pfcountCacheStamps[c->db->id],c->argv[j]);
+        if (de == NULL || dictGetUnsignedIntegerVal(de) != e->keys[j-1].stamp ||
+            (hlls[j-1] != NULL) != e->keys[j-1].exists)
+            return C_ERR;
+    }
+    *card = e->card;
+    return C_OK;
+}
+
+/* Cache the cardinality 'card' of the PFCOUNT query 'id' of the client,
+ * taking ownership of 'id'. 'hlls' are as in pfcountCacheLookup(). */
+static void pfcountCacheAdd(client *c, sds id, robj **hlls, uint64_t card) {
+    pfcountCacheEntry *e;
+    dictEntry *de;
+    dict *stamps;
+    int j;
+
+    if (pfcountCache && dictSize(pfcountCache) >= PFCOUNT_CACHE_SIZE)
+        hllCountCacheFlush();
+    if (pfcountCache == NULL) {
+        pfcountCache = dictCreate(&pfcountCacheDictType,NULL);
+        pfcountCacheStamps = zcalloc(sizeof(dict*)*server.dbnum);
+    }
+    stamps = pfcountCacheStamps[c->db->id];
+    if (stamps == NULL) {
+        stamps = dictCreate(&objectKeyPointerValueDictType,NULL);
+        pfcountCacheStamps[c->db->id] = stamps;
+    }
+
+    e = zmalloc(sizeof(*e)+sizeof(pfcountCacheKey)*(c->argc-1));
+    e->card = card;
+    for (j = 1; j < c->argc; j++) {
+        if ((de = dictFind(stamps,c->argv[j])) == NULL) {
+            de = dictAddRaw(stamps,c->argv[j],NULL);
+            incrRefCount(c->argv[j]);
+            dictSetUnsignedIntegerVal(de,++pfcountCacheStamp);
+        }
+        e->keys[j-1].stamp = dictGetUnsignedIntegerVal(de);
+        e->keys[j-1].exists = hlls[j-1] != NULL;
+    }
+
+    /* A stale entry for the same query may exist. */
+    if ((de = dictFind(pfcountCache,id)) != NULL) {
+        zfree(dictGetVal(de));
+        dictSetVal(pfcountCache,de,e);
+        sdsfree(id);
+    } else {
+        dictAdd(pfcountCache,id,e);
+    }
+}
+
 /* PFCOUNT var -> approximated cardinality of set. */
 void pfcountCommand(client *c) {
     robj *o;
@@ -1228,29 +1637,51 @@ void pfcountCommand(client *c) {
      * the cardinality of the merge of the N HLLs specified. */
     if (c->argc > 2) {
         uint8_t max[HLL_HDR_SIZE+HLL_REGISTERS], *registers;
+        robj **hlls = zmalloc(sizeof(robj*)*(c->argc-1));
+        sds id;
         int j;
 
+        /* Check type and size of all the keys first: looking them up may
+         * expire some, invalidating the cached cardinality. */
+        for (j = 1; j < c->argc; j++) {
+            hlls[j-1] = lookupKeyRead(c->db,c->argv[j]);
+            if (hlls[j-1] && isHLLObjectOrReply(c,hlls[j-1]) != C_OK) {
+                zfree(hlls);
+                return;
+            }
+        }
+        id = pfcountCacheId(c);
+        if (pfcountCacheLookup(c,id,hlls,&card) == C_OK) {
+            sdsfree(id);
+            zfree(hlls);
+            addReplyLongLong(c,card);
+            return;
+        }
+
         /* Compute an HLL with M[i] = MAX(M[i]_j). */
         memset(max,0,sizeof(max));
         hdr = (struct hllhdr*) max;
         hdr->encoding = HLL_RAW; /* Special internal-only encoding. */
         registers = max + HLL_HDR_SIZE;
         for (j = 1; j < c->argc; j++) {
-            /* Check type and size. */
-            robj *o = lookupKeyRead(c->db,c->argv[j]);
-            if (o == NULL) continue; /* Assume empty HLL for non existing var.*/
-            if (isHLLObjectOrReply(c,o) != C_OK) return;
+            /* Assume empty HLL for non existing var. */
+            if (hlls[j-1] == NULL) continue;
 
             /* Merge with this HLL with our 'max' HLL by setting max[i]
              * to MAX(max[i],hll[i]). */
-            if (hllMerge(registers,o) == C_ERR) {
+            if (hllMerge(registers,hlls[j-1]) == C_ERR) {
+                sdsfree(id);
+                zfree(hlls);
                 addReplyError(c,invalid_hll_err);
                 return;
             }
         }
 
         /* Compute cardinality of the resulting set. */
-        addReplyLongLong(c,hllCount(hdr,NULL));
+        card = hllCount(hdr,NULL);
+        pfcountCacheAdd(c,id,hlls,card);
+        zfree(hlls);
+        addReplyLongLong(c,card);
         return;
     }
 
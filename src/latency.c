@@ -34,6 +34,7 @@
  */
 
 #include "server.h"
+#include "hdr_histogram.h"
 
 /* Dictionary type for latency events. */
 int dictStringKeyCompare(void *privdata, const void *key1, const void *key2) {
@@ -167,6 +168,71 @@ int latencyResetEvent(char *event_to_reset) {
     return resets;
 }
 
+/* -------------------------- Event loop stages ----------------------------- */
+
+/* Names of the EL_STAGE_* stages, as reported by INFO and LATENCY EVENTLOOP. */
+static const char *elStageNames[EL_STAGE_NUM] = {
+    "eventloop",
+    "beforesleep",
+    "read",
+    "parse",
+    "command",
+    "write",
+    "cron",
+    "active-expire",
+    "aof-flush"
+};
+
+/* Add a sample of 'duration' microseconds to the specified stage. This is
+ * called for every stage of every event loop iteration, so it only does a
+ * few additions and a constant time histogram update. */
+void elStageAddSample(int stage, uint64_t duration) {
+    struct elStageStats *st = &server.el_stages[stage];
+
+    st->calls++;
+    st->sum += duration;
+    if ((long long)duration > st->max) st->max = duration;
+    updateCommandLatencyHistogram(&st->histogram,(int64_t)duration*1000);
+}
+
+/* Reset the statistics of all the stages. Called by CONFIG RESETSTAT. */
+void elStagesReset(void) {
+    int j;
+
+    for (j = 0; j < EL_STAGE_NUM; j++) {
+        struct elStageStats *st = &server.el_stages[j];
+
+        if (st->histogram) hdr_close(st->histogram);
+        memset(st,0,sizeof(*st));
+    }
+}
+
+/* Append the INFO eventloop fields to 'info': for every stage with samples,
+ * the number of calls, the total and max time, and the percentiles
+ * configured with latency-tracking-info-percentiles. */
+sds genEventLoopStagesInfoString(sds info) {
+    int j, k;
+
+    for (j = 0; j < EL_STAGE_NUM; j++) {
+        struct elStageStats *st = &server.el_stages[j];
+
+        if (st->calls == 0) continue;
+        info = sdscatprintf(info,
+            "eventloop_stage_%s:calls=%lld,usec=%lld,usec_per_call=%.2f,"
+            "max_usec=%lld",
+            elStageNames[j], st->calls, st->sum,
+            (double)st->sum/st->calls, st->max);
+        for (k = 0; k < server.latency_tracking_info_percentiles_len; k++) {
+            double p = server.latency_tracking_info_percentiles[k];
+
+            info = sdscatprintf(info,",p%g=%.3f",p,
+                ((double)hdr_value_at_percentile(st->histogram,p))/1000.0);
+        }
+        info = sdscatlen(info,"\r\n",2);
+    }
+    return info;
+}
+
 /* ------------------------ Latency reporting (doctor) ---------------------- */
 
 /* Analyze the samples available for a given event and return a structure
@@ -530,6 +596,107 @@ void latencyCommandReplyWithLatestEvents(client *c) {
     dictReleaseIterator(di);
 }
 
+/* Reply with the cumulative distribution of the latency in 'histogram',
+ * as a map of <usec bucket> to <calls with latency less or equal than the
+ * bucket>. Buckets grow in powers of two starting at 1024 nanoseconds, and
+ * only buckets that add new calls are emitted. */
+void addReplyLatencyCDF(client *c, struct hdr_histogram *histogram) {
+    void *replylen = addReplyDeferredLen(c);
+    int samples = 0;
+    int64_t previous_count = 0;
+    struct hdr_iter iter;
+
+    hdr_iter_log_init(&iter,histogram,1024,2);
+    while (hdr_iter_next(&iter)) {
+        const int64_t micros = iter.highest_equivalent_value / 1000;
+        const int64_t cumulative_count = iter.cumulative_count;
+        if (cumulative_count > previous_count) {
+            addReplyLongLong(c,(long long) micros);
+            addReplyLongLong(c,(long long) cumulative_count);
+            samples++;
+        }
+        previous_count = cumulative_count;
+    }
+    setDeferredMapLen(c,replylen,samples);
+}
+
+/* latencyCommand() helper to produce for a single command the reply of the
+ * HISTOGRAM subcommand: the total number of calls and the cumulative
+ * distribution of the latency. */
+void fillCommandCDF(client *c, struct hdr_histogram *histogram) {
+    addReplyMapLen(c,2);
+    addReplyBulkCString(c,"calls");
+    addReplyLongLong(c,(long long) histogram->total_count);
+    addReplyBulkCString(c,"histogram_usec");
+    addReplyLatencyCDF(c,histogram);
+}
+
+/* latencyCommand() helper to produce the reply for the EVENTLOOP subcommand:
+ * for every event loop stage with samples, the number of calls, the total
+ * and max time in microseconds, and the cumulative distribution of the
+ * stage duration. */
+void latencyCommandReplyWithEventLoopStages(client *c) {
+    int j, count = 0;
+
+    void *replylen = addReplyDeferredLen(c);
+    for (j = 0; j < EL_STAGE_NUM; j++) {
+        struct elStageStats *st = &server.el_stages[j];
+
+        if (st->calls == 0) continue;
+        addReplyBulkCString(c,elStageNames[j]);
+        addReplyMapLen(c,4);
+        addReplyBulkCString(c,"calls");
+        addReplyLongLong(c,st->calls);
+        addReplyBulkCString(c,"usec");
+        addReplyLongLong(c,st->sum);
+        addReplyBulkCString(c,"max_usec");
+        addReplyLongLong(c,st->max);
+        addReplyBulkCString(c,"histogram_usec");
+        addReplyLatencyCDF(c,st->histogram);
+        count++;
+    }
+    setDeferredMapLen(c,replylen,count);
+}
+
+/* latencyCommand() helper to produce the reply for the HISTOGRAM subcommand.
+ * With no arguments every command with at least one recorded call is
+ * reported, otherwise only the requested ones (unknown commands or commands
+ * without samples are silently skipped). */
+void latencyCommandReplyWithHistograms(client *c) {
+    struct redisCommand *cmd;
+    int j, count = 0;
+
+    if (c->argc == 2) {
+        dictIterator *di;
+        dictEntry *de;
+
+        void *replylen = addReplyDeferredLen(c);
+        di = dictGetSafeIterator(server.commands);
+        while ((de = dictNext(di)) != NULL) {
+            cmd = dictGetVal(de);
+            if (!cmd->latency_histogram ||
+                !cmd->latency_histogram->total_count) continue;
+            addReplyBulkCString(c,cmd->name);
+            fillCommandCDF(c,cmd->latency_histogram);
+            count++;
+        }
+        dictReleaseIterator(di);
+        setDeferredMapLen(c,replylen,count);
+        return;
+    }
+
+    void *replylen = addReplyDeferredLen(c);
+    for (j = 2; j < c->argc; j++) {
+        cmd = lookupCommandOrOriginal(c->argv[j]->ptr);
+        if (!cmd || !cmd->latency_histogram ||
+            !cmd->latency_histogram->total_count) continue;
+        addReplyBulkCString(c,cmd->name);
+        fillCommandCDF(c,cmd->latency_histogram);
+        count++;
+    }
+    setDeferredMapLen(c,replylen,count);
+}
+
 #define LATENCY_GRAPH_COLS 80
 sds latencyCommandGenSparkeline(char *event, struct latencyTimeSeries *ts) {
     int j;
@@ -582,6 +749,8 @@ sds latencyCommandGenSparkeline(char *event, struct latencyTimeSeries *ts) {
  * LATENCY DOCTOR: returns a human readable analysis of instance latency.
  * LATENCY GRAPH: provide an ASCII graph of the latency of the specified event.
  * LATENCY RESET: reset data of a specified event or all the data if no event provided.
+ * LATENCY HISTOGRAM: return a cumulative distribution of latencies per command.
+ * LATENCY EVENTLOOP: return the time spent in every stage of the event loop.
  */
 void latencyCommand(client *c) {
     struct latencyTimeSeries *ts;
@@ -617,6 +786,12 @@ void latencyCommand(client *c) {
 
         addReplyVerbatim(c,report,sdslen(report),"txt");
         sdsfree(report);
+    } else if (!strcasecmp(c->argv[1]->ptr,"histogram") && c->argc >= 2) {
+        /* LATENCY HISTOGRAM [command ...] */
+        latencyCommandReplyWithHistograms(c);
+    } else if (!strcasecmp(c->argv[1]->ptr,"eventloop") && c->argc == 2) {
+        /* LATENCY EVENTLOOP */
+        latencyCommandReplyWithEventLoopStages(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"reset") && c->argc >= 2) {
         /* LATENCY RESET */
         if (c->argc == 2) {
@@ -632,10 +807,17 @@ void latencyCommand(client *c) {
         const char *help[] = {
 "DOCTOR",
 "    Return a human readable latency analysis report.",
+"EVENTLOOP",
+"    Return the time spent by the main thread in every stage of the event",
+"    loop: calls, total and max time, and the cumulative distribution.",
 "GRAPH <event>",
 "    Return an ASCII latency graph for the <event> class.",
 "HISTORY <event>",
 "    Return time-latency samples for the <event> class.",
+"HISTOGRAM [<command> ...]",
+"    Return a cumulative distribution of latencies in the format of a",
+"    histogram for the specified command names. If no commands are",
+"    specified then all histograms are replied.",
 "LATEST",
 "    Return the latest latency samples for all events.",
 "RESET [<event> ...]",
@@ -91,4 +91,41 @@ int THPDisable(void);
 #define latencyRemoveNestedEvent(event_var,nested_var) \
     event_var += nested_var;
 
+/* Event loop stages profiling.
+ *
+ * Unlike the latency monitor above, that only logs events exceeding a
+ * threshold, the time spent by the main thread in every stage of the event
+ * loop is always accumulated, so that it is possible to tell where an
+ * iteration spends its time without external profilers. Stages may nest:
+ * for instance EL_STAGE_WRITE and EL_STAGE_AOF_FLUSH are part of
+ * EL_STAGE_BEFORE_SLEEP, that in turn is part of EL_STAGE_EVENTLOOP. */
+#define EL_STAGE_EVENTLOOP 0        /* Iteration, excluding the poll wait. */
+#define EL_STAGE_BEFORE_SLEEP 1     /* beforeSleep(). */
+#define EL_STAGE_READ 2             /* Reading queries from sockets. */
+#define EL_STAGE_PARSE 3            /* Parsing the query buffer. */
+#define EL_STAGE_COMMAND 4          /* Top level call() of commands. */
+#define EL_STAGE_WRITE 5            /* Writing replies to sockets. */
+#define EL_STAGE_CRON 6             /* serverCron(). */
+#define EL_STAGE_ACTIVE_EXPIRE 7    /* activeExpireCycle(). */
+#define EL_STAGE_AOF_FLUSH 8        /* flushAppendOnlyFile(). */
+#define EL_STAGE_NUM 9
+
+/* Cumulative statistics of an event loop stage. */
+struct elStageStats {
+    long long calls;    /* Number of samples. */
+    long long sum;      /* Total time in microseconds. */
+    long long max;      /* Max time in microseconds. */
+    struct hdr_histogram *histogram; /* Durations in nanoseconds, lazily
+                                        allocated on the first sample. */
+};
+
+void elStageAddSample(int stage, uint64_t duration);
+void elStagesReset(void);
+sds genEventLoopStagesInfoString(sds info);
+
+/* Event loop stages macros, the pattern is the same of the latency monitor
+ * ones, but the monotonic clock is used and the sample is always added. */
+#define elStageStart(var) elapsedStart(&(var))
+#define elStageEnd(stage,var) elStageAddSample((stage),elapsedUs(var))
+
 #endif /* __LATENCY_H */
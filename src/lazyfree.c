@@ -39,6 +39,15 @@ void lazyfreeFreeSlotsMap(void *args[]) {
     atomicIncr(lazyfreed_objects,len);
 }
 
+/* Release the ordered key index of a DB in the lazyfree thread. */
+void lazyfreeFreeKeyIndex(void *args[]) {
+    rax *rt = args[0];
+    size_t len = rt->numele;
+    raxFree(rt);
+    atomicDecr(lazyfree_objects,len);
+    atomicIncr(lazyfreed_objects,len);
+}
+
 /* Release the key tracking table. */
 void lazyFreeTrackingTable(void *args[]) {
     rax *rt = args[0];
@@ -180,6 +189,7 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     if (de) {
         dictFreeUnlinkedEntry(db->dict,de);
         if (server.cluster_enabled) slotToKeyDel(key->ptr);
+        keyIndexDel(db,key->ptr);
         return 1;
     } else {
         return 0;
@@ -214,6 +224,12 @@ void freeSlotsToKeysMapAsync(rax *rt) {
     bioCreateLazyFreeJob(lazyfreeFreeSlotsMap,1,rt);
 }
 
+/* Release the ordered key index of a DB asynchronously. */
+void freeKeyIndexAsync(rax *rt) {
+    atomicIncr(lazyfree_objects,rt->numele);
+    bioCreateLazyFreeJob(lazyfreeFreeKeyIndex,1,rt);
+}
+
 /* Free an object, if the object is huge enough, free it in async way. */
 void freeTrackingRadixTreeAsync(rax *tracking) {
     atomicIncr(lazyfree_objects,tracking->numele);
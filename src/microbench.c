@@ -0,0 +1,788 @@
+/* Copyright (c) 2009-2021, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Microbenchmarks for the core data structures.
+ *
+ * This is reachable via "redis-server microbench" and measures the hot paths
+ * of dict, ziplist, listpack, quicklist, intset, sds and crc64 at different
+ * sizes, so that a change slowing down one of them can be caught before it
+ * ships. Every benchmark reports the best per-round cost in nanoseconds per
+ * operation (the least noisy figure on a shared box) and the mean across all
+ * the rounds. Results can be saved as JSON and compared against a previous
+ * run with --baseline: any benchmark slower than the baseline by more than
+ * the threshold is reported as a regression and the process exits with 1. */
+
+#include "server.h"
+#include "intset.h"
+#include "listpack.h"
+#include "crc64.h"
+#include <time.h>
+
+#define MICROBENCH_DEFAULT_DURATION 100 /* Timed ms for every benchmark. */
+#define MICROBENCH_DEFAULT_THRESHOLD 10 /* Regression threshold percentage. */
+#define MICROBENCH_MIN_ROUNDS 3
+#define MICROBENCH_MAX_SIZES 16
+#define MICROBENCH_SCAN_OPS 1000   /* Ops per round for O(N) operations. */
+#define MICROBENCH_CRC_BYTES (1024*1024) /* Bytes per crc64 round. */
+
+typedef struct microbench {
+    long long start;    /* Start of the current timed section, in ns. */
+    long long elapsed;  /* Time accumulated by the current round, in ns. */
+    long long bytes;    /* Bytes processed per op, 0 if not meaningful. */
+} microbench;
+
+/* A benchmark performs one round on a structure of 'size' elements, timing
+ * only the interesting part between mbStart() and mbStop(), and returns the
+ * number of operations performed. */
+typedef long long microbenchProc(microbench *mb, long size);
+
+typedef struct microbenchBaseline {
+    char name[64];
+    long size;
+    double ns_per_op;
+} microbenchBaseline;
+
+/* Written by the benchmarks so the compiler can't drop the measured work. */
+static volatile uint64_t mbSink;
+
+static long long mbNanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void mbStart(microbench *mb) {
+    mb->start = mbNanoseconds();
+}
+
+static void mbStop(microbench *mb) {
+    mb->elapsed += mbNanoseconds() - mb->start;
+}
+
+/* Fill 'buf' with the i-th element used to populate the structures. Even
+ * elements are integers and odd ones are short strings, so that both the
+ * integer and the string encodings of the compact structures are exercised.
+ * Returns the element length. */
+static int mbElement(char *buf, long i) {
+    if (i & 1) return snprintf(buf,32,"element:%ld",i);
+    return ll2string(buf,32,i*7919);
+}
+
+/* Visit positions in a scattered but deterministic order. */
+static long mbScatter(long i, long size) {
+    return (long)(((unsigned long)i * 2654435761UL) % (unsigned long)size);
+}
+
+/* ----------------------------- dict ------------------------------------- */
+
+static dictType mbDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    NULL,                       /* val destructor */
+    NULL                        /* allow to expand */
+};
+
+static sds *mbDictKeys(long size, const char *prefix) {
+    sds *keys = zmalloc(sizeof(sds)*size);
+    for (long j = 0; j < size; j++) keys[j] = sdscatfmt(sdsempty(),"%s%I",prefix,(long long)j);
+    return keys;
+}
+
+static void mbDictFreeKeys(sds *keys, long size) {
+    for (long j = 0; j < size; j++) sdsfree(keys[j]);
+    zfree(keys);
+}
+
+/* Create a dict with 'size' keys and no rehashing in progress. */
+static dict *mbDictCreate(long size) {
+    dict *d = dictCreate(&mbDictType,NULL);
+    for (long j = 0; j < size; j++)
+        dictAdd(d,sdscatfmt(sdsempty(),"key:%I",(long long)j),NULL);
+    while (dictIsRehashing(d)) dictRehash(d,100);
+    return d;
+}
+
+static long long mbDictInsert(microbench *mb, long size) {
+    sds *keys = mbDictKeys(size,"key:");
+    dict *d = dictCreate(&mbDictType,NULL);
+    mbStart(mb);
+    for (long j = 0; j < size; j++) dictAdd(d,keys[j],NULL);
+    mbStop(mb);
+    dictRelease(d);
+    zfree(keys); /* Owned by the dict now. */
+    return size;
+}
+
+static long long mbDictLookup(microbench *mb, long size) {
+    dict *d = mbDictCreate(size);
+    sds *keys = mbDictKeys(size,"key:");
+    uint64_t found = 0;
+    mbStart(mb);
+    for (long j = 0; j < size; j++)
+        found += dictFind(d,keys[mbScatter(j,size)]) != NULL;
+    mbStop(mb);
+    mbSink += found;
+    mbDictFreeKeys(keys,size);
+    dictRelease(d);
+    return size;
+}
+
+static long long mbDictLookupMiss(microbench *mb, long size) {
+    dict *d = mbDictCreate(size);
+    sds *keys = mbDictKeys(size,"missing:");
+    uint64_t found = 0;
+    mbStart(mb);
+    for (long j = 0; j < size; j++) found += dictFind(d,keys[j]) != NULL;
+    mbStop(mb);
+    mbSink += found;
+    mbDictFreeKeys(keys,size);
+    dictRelease(d);
+    return size;
+}
+
+static long long mbDictIterate(microbench *mb, long size) {
+    dict *d = mbDictCreate(size);
+    dictIterator *di = dictGetIterator(d);
+    dictEntry *de;
+    uint64_t sum = 0;
+    mbStart(mb);
+    while ((de = dictNext(di)) != NULL) sum += sdslen(dictGetKey(de));
+    mbStop(mb);
+    dictReleaseIterator(di);
+    mbSink += sum;
+    dictRelease(d);
+    return size;
+}
+
+static long long mbDictRandom(microbench *mb, long size) {
+    dict *d = mbDictCreate(size);
+    uint64_t sum = 0;
+    mbStart(mb);
+    for (long j = 0; j < size; j++) sum += (uintptr_t)dictGetRandomKey(d);
+    mbStop(mb);
+    mbSink += sum;
+    dictRelease(d);
+    return size;
+}
+
+static long long mbDictDelete(microbench *mb, long size) {
+    dict *d = mbDictCreate(size);
+    sds *keys = mbDictKeys(size,"key:");
+    mbStart(mb);
+    for (long j = 0; j < size; j++) dictDelete(d,keys[j]);
+    mbStop(mb);
+    mbDictFreeKeys(keys,size);
+    dictRelease(d);
+    return size;
+}
+
+/* Time needed to rehash every entry to a table twice as large. */
+static long long mbDictRehash(microbench *mb, long size) {
+    dict *d = mbDictCreate(size);
+    mbStart(mb);
+    dictExpand(d,size*2);
+    while (dictIsRehashing(d)) dictRehash(d,100);
+    mbStop(mb);
+    dictRelease(d);
+    return size;
+}
+
+/* ----------------------------- ziplist ---------------------------------- */
+
+static unsigned char *mbZiplistCreate(long size) {
+    unsigned char *zl = ziplistNew();
+    char buf[32];
+    for (long j = 0; j < size; j++) {
+        int len = mbElement(buf,j);
+        zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+    }
+    return zl;
+}
+
+/* Encoding cost: append elements, including the reallocations. */
+static long long mbZiplistPush(microbench *mb, long size) {
+    unsigned char *zl = ziplistNew();
+    char buf[32];
+    mbStart(mb);
+    for (long j = 0; j < size; j++) {
+        int len = mbElement(buf,j);
+        zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+    }
+    mbStop(mb);
+    zfree(zl);
+    return size;
+}
+
+/* Decoding cost: walk the ziplist reading every entry. */
+static long long mbZiplistIterate(microbench *mb, long size) {
+    unsigned char *zl = mbZiplistCreate(size), *p, *sval;
+    unsigned int slen;
+    long long lval;
+    uint64_t sum = 0;
+    mbStart(mb);
+    p = ziplistIndex(zl,0);
+    while (p && ziplistGet(p,&sval,&slen,&lval)) {
+        sum += sval ? slen : (uint64_t)lval;
+        p = ziplistNext(zl,p);
+    }
+    mbStop(mb);
+    mbSink += sum;
+    zfree(zl);
+    return size;
+}
+
+static long long mbZiplistIndex(microbench *mb, long size) {
+    unsigned char *zl = mbZiplistCreate(size);
+    long ops = size < MICROBENCH_SCAN_OPS ? size : MICROBENCH_SCAN_OPS;
+    uint64_t sum = 0;
+    mbStart(mb);
+    for (long j = 0; j < ops; j++)
+        sum += (uintptr_t)ziplistIndex(zl,mbScatter(j,size));
+    mbStop(mb);
+    mbSink += sum;
+    zfree(zl);
+    return ops;
+}
+
+static long long mbZiplistDelete(microbench *mb, long size) {
+    unsigned char *zl = mbZiplistCreate(size);
+    mbStart(mb);
+    for (long j = 0; j < size; j++) zl = ziplistDeleteRange(zl,0,1);
+    mbStop(mb);
+    zfree(zl);
+    return size;
+}
+
+/* ----------------------------- listpack --------------------------------- */
+
+static unsigned char *mbListpackCreate(long size) {
+    unsigned char *lp = lpNew(0);
+    char buf[32];
+    for (long j = 0; j < size; j++) {
+        int len = mbElement(buf,j);
+        lp = lpAppend(lp,(unsigned char*)buf,len);
+    }
+    return lp;
+}
+
+static long long mbListpackAppend(microbench *mb, long size) {
+    unsigned char *lp = lpNew(0);
+    char buf[32];
+    mbStart(mb);
+    for (long j = 0; j < size; j++) {
+        int len = mbElement(buf,j);
+        lp = lpAppend(lp,(unsigned char*)buf,len);
+    }
+    mbStop(mb);
+    lpFree(lp);
+    return size;
+}
+
+static long long mbListpackIterate(microbench *mb, long size) {
+    unsigned char *lp = mbListpackCreate(size), *p;
+    unsigned char intbuf[LP_INTBUF_SIZE];
+    int64_t count;
+    uint64_t sum = 0;
+    mbStart(mb);
+    p = lpFirst(lp);
+    while (p) {
+        unsigned char *ele = lpGet(p,&count,intbuf);
+        sum += ele ? (uint64_t)count : 0;
+        p = lpNext(lp,p);
+    }
+    mbStop(mb);
+    mbSink += sum;
+    lpFree(lp);
+    return size;
+}
+
+static long long mbListpackSeek(microbench *mb, long size) {
+    unsigned char *lp = mbListpackCreate(size);
+    long ops = size < MICROBENCH_SCAN_OPS ? size : MICROBENCH_SCAN_OPS;
+    uint64_t sum = 0;
+    mbStart(mb);
+    for (long j = 0; j < ops; j++)
+        sum += (uintptr_t)lpSeek(lp,mbScatter(j,size));
+    mbStop(mb);
+    mbSink += sum;
+    lpFree(lp);
+    return ops;
+}
+
+/* ----------------------------- quicklist -------------------------------- */
+
+static quicklist *mbQuicklistCreate(long size) {
+    quicklist *ql = quicklistNew(-2,0);
+    char buf[32];
+    for (long j = 0; j < size; j++) {
+        int len = mbElement(buf,j);
+        quicklistPushTail(ql,buf,len);
+    }
+    return ql;
+}
+
+static long long mbQuicklistPushTail(microbench *mb, long size) {
+    quicklist *ql = quicklistNew(-2,0);
+    char buf[32];
+    mbStart(mb);
+    for (long j = 0; j < size; j++) {
+        int len = mbElement(buf,j);
+        quicklistPushTail(ql,buf,len);
+    }
+    mbStop(mb);
+    quicklistRelease(ql);
+    return size;
+}
+
+static long long mbQuicklistPushHead(microbench *mb, long size) {
+    quicklist *ql = quicklistNew(-2,0);
+    char buf[32];
+    mbStart(mb);
+    for (long j = 0; j < size; j++) {
+        int len = mbElement(buf,j);
+        quicklistPushHead(ql,buf,len);
+    }
+    mbStop(mb);
+    quicklistRelease(ql);
+    return size;
+}
+
+static long long mbQuicklistIterate(microbench *mb, long size) {
+    quicklist *ql = mbQuicklistCreate(size);
+    quicklistIter *iter = quicklistGetIterator(ql,AL_START_HEAD);
+    quicklistEntry entry;
+    uint64_t sum = 0;
+    mbStart(mb);
+    while (quicklistNext(iter,&entry))
+        sum += entry.value ? entry.sz : (uint64_t)entry.longval;
+    mbStop(mb);
+    quicklistReleaseIterator(iter);
+    mbSink += sum;
+    quicklistRelease(ql);
+    return size;
+}
+
+static long long mbQuicklistIndex(microbench *mb, long size) {
+    quicklist *ql = mbQuicklistCreate(size);
+    long ops = size < MICROBENCH_SCAN_OPS ? size : MICROBENCH_SCAN_OPS;
+    quicklistEntry entry;
+    uint64_t found = 0;
+    mbStart(mb);
+    for (long j = 0; j < ops; j++)
+        found += quicklistIndex(ql,mbScatter(j,size),&entry);
+    mbStop(mb);
+    mbSink += found;
+    quicklistRelease(ql);
+    return ops;
+}
+
+static long long mbQuicklistPop(microbench *mb, long size) {
+    quicklist *ql = mbQuicklistCreate(size);
+    unsigned char *data;
+    unsigned int sz;
+    long long lval;
+    mbStart(mb);
+    for (long j = 0; j < size; j++) {
+        quicklistPop(ql,QUICKLIST_HEAD,&data,&sz,&lval);
+        zfree(data);
+    }
+    mbStop(mb);
+    quicklistRelease(ql);
+    return size;
+}
+
+/* ----------------------------- intset ----------------------------------- */
+
+static intset *mbIntsetCreate(long size) {
+    intset *is = intsetNew();
+    for (long j = 0; j < size; j++) is = intsetAdd(is,mbScatter(j,size)*3,NULL);
+    return is;
+}
+
+static long long mbIntsetAdd(microbench *mb, long size) {
+    intset *is = intsetNew();
+    mbStart(mb);
+    for (long j = 0; j < size; j++) is = intsetAdd(is,mbScatter(j,size)*3,NULL);
+    mbStop(mb);
+    zfree(is);
+    return size;
+}
+
+static long long mbIntsetFind(microbench *mb, long size) {
+    intset *is = mbIntsetCreate(size);
+    uint64_t found = 0;
+    mbStart(mb);
+    for (long j = 0; j < size; j++) found += intsetFind(is,j*3);
+    mbStop(mb);
+    mbSink += found;
+    zfree(is);
+    return size;
+}
+
+static long long mbIntsetIterate(microbench *mb, long size) {
+    intset *is = mbIntsetCreate(size);
+    int64_t value;
+    uint64_t sum = 0;
+    mbStart(mb);
+    for (uint32_t j = 0; intsetGet(is,j,&value); j++) sum += value;
+    mbStop(mb);
+    mbSink += sum;
+    zfree(is);
+    return size;
+}
+
+/* Adding a value that doesn't fit the current encoding converts the whole
+ * set, so this measures the cost of the encoding upgrade. */
+static long long mbIntsetUpgrade(microbench *mb, long size) {
+    intset *is = mbIntsetCreate(size);
+    mbStart(mb);
+    is = intsetAdd(is,INT64_MAX,NULL);
+    mbStop(mb);
+    zfree(is);
+    return size;
+}
+
+/* ----------------------------- sds -------------------------------------- */
+
+static long long mbSdsNew(microbench *mb, long size) {
+    char buf[32];
+    mbStart(mb);
+    for (long j = 0; j < size; j++) {
+        int len = mbElement(buf,j);
+        sdsfree(sdsnewlen(buf,len));
+    }
+    mbStop(mb);
+    return size;
+}
+
+static long long mbSdsCat(microbench *mb, long size) {
+    sds s = sdsempty();
+    mbStart(mb);
+    for (long j = 0; j < size; j++) s = sdscatlen(s,"0123456789",10);
+    mbStop(mb);
+    sdsfree(s);
+    return size;
+}
+
+static long long mbSdsFromLongLong(microbench *mb, long size) {
+    uint64_t sum = 0;
+    mbStart(mb);
+    for (long j = 0; j < size; j++) {
+        sds s = sdsfromlonglong((long long)j*1000003);
+        sum += sdslen(s);
+        sdsfree(s);
+    }
+    mbStop(mb);
+    mbSink += sum;
+    return size;
+}
+
+static long long mbSdsSplit(microbench *mb, long size) {
+    sds s = sdsempty();
+    char buf[32];
+    int count;
+    for (long j = 0; j < size; j++) {
+        int len = mbElement(buf,j);
+        if (j) s = sdscatlen(s,",",1);
+        s = sdscatlen(s,buf,len);
+    }
+    mbStart(mb);
+    sds *tokens = sdssplitlen(s,sdslen(s),",",1,&count);
+    mbStop(mb);
+    sdsfreesplitres(tokens,count);
+    sdsfree(s);
+    return size;
+}
+
+/* ----------------------------- crc64 ------------------------------------ */
+
+/* Checksum of a 'size' bytes buffer, repeated to process about 1MB. */
+static long long mbCrc64(microbench *mb, long size) {
+    unsigned char *buf = zmalloc(size);
+    long ops = MICROBENCH_CRC_BYTES / size;
+    uint64_t crc = 0;
+    if (ops == 0) ops = 1;
+    for (long j = 0; j < size; j++) buf[j] = j*31;
+    mbStart(mb);
+    for (long j = 0; j < ops; j++) crc ^= crc64(0,buf,size);
+    mbStop(mb);
+    mbSink += crc;
+    mb->bytes = size;
+    zfree(buf);
+    return ops;
+}
+
+/* ----------------------------- harness ---------------------------------- */
+
+struct microbenchEntry {
+    char *name;
+    microbenchProc *proc;
+    long max_size;  /* Sizes above this are skipped, 0 means no limit. */
+} microbenchTable[] = {
+    {"dict.insert", mbDictInsert, 0},
+    {"dict.lookup", mbDictLookup, 0},
+    {"dict.lookup-miss", mbDictLookupMiss, 0},
+    {"dict.iterate", mbDictIterate, 0},
+    {"dict.random", mbDictRandom, 0},
+    {"dict.delete", mbDictDelete, 0},
+    {"dict.rehash", mbDictRehash, 0},
+    {"ziplist.push", mbZiplistPush, 10000},
+    {"ziplist.iterate", mbZiplistIterate, 10000},
+    {"ziplist.index", mbZiplistIndex, 10000},
+    {"ziplist.delete", mbZiplistDelete, 10000},
+    {"listpack.append", mbListpackAppend, 10000},
+    {"listpack.iterate", mbListpackIterate, 10000},
+    {"listpack.seek", mbListpackSeek, 10000},
+    {"quicklist.push-tail", mbQuicklistPushTail, 0},
+    {"quicklist.push-head", mbQuicklistPushHead, 0},
+    {"quicklist.iterate", mbQuicklistIterate, 0},
+    {"quicklist.index", mbQuicklistIndex, 0},
+    {"quicklist.pop", mbQuicklistPop, 0},
+    {"intset.add", mbIntsetAdd, 10000},
+    {"intset.find", mbIntsetFind, 10000},
+    {"intset.iterate", mbIntsetIterate, 10000},
+    {"intset.upgrade", mbIntsetUpgrade, 10000},
+    {"sds.new", mbSdsNew, 0},
+    {"sds.cat", mbSdsCat, 0},
+    {"sds.fromlonglong", mbSdsFromLongLong, 0},
+    {"sds.split", mbSdsSplit, 0},
+    {"crc64.checksum", mbCrc64, 0},
+};
+
+/* A benchmark is selected if no filter was given, or if one of the filters
+ * is "all", its full name, or the name of its data structure. */
+static int microbenchSelected(const char *name, char **filters, int numfilters) {
+    const char *dot = strchr(name,'.');
+    if (numfilters == 0) return 1;
+    for (int j = 0; j < numfilters; j++) {
+        if (!strcasecmp(filters[j],"all") || !strcasecmp(filters[j],name))
+            return 1;
+        if (strlen(filters[j]) == (size_t)(dot-name) &&
+            !strncasecmp(filters[j],name,dot-name)) return 1;
+    }
+    return 0;
+}
+
+/* Load a JSON file previously written with --json. Only the format emitted
+ * by this program is understood: one result object per line. */
+static microbenchBaseline *microbenchLoadBaseline(const char *filename, int *count) {
+    FILE *fp = fopen(filename,"r");
+    microbenchBaseline *base = NULL;
+    char line[1024];
+    *count = 0;
+    if (!fp) return NULL;
+    while (fgets(line,sizeof(line),fp) != NULL) {
+        microbenchBaseline b;
+        long long ops;
+        if (sscanf(line," {\"name\": \"%63[^\"]\", \"size\": %ld, \"ops\": %lld, "
+                   "\"ns_per_op\": %lf",b.name,&b.size,&ops,&b.ns_per_op) != 4)
+            continue;
+        base = zrealloc(base,sizeof(*base)*(*count+1));
+        base[(*count)++] = b;
+    }
+    fclose(fp);
+    return base;
+}
+
+static microbenchBaseline *microbenchFindBaseline(microbenchBaseline *base, int count,
+                                                  const char *name, long size) {
+    for (int j = 0; j < count; j++)
+        if (base[j].size == size && !strcmp(base[j].name,name)) return base+j;
+    return NULL;
+}
+
+static void microbenchUsage(void) {
+    fprintf(stderr,
+"Usage: ./redis-server microbench [<name> ...] [options]\n"
+"\n"
+"<name> is 'all' (the default), a data structure such as 'dict', or a single\n"
+"benchmark such as 'dict.insert'. Options:\n"
+"\n"
+" --sizes <n,n,...>       Structure sizes to benchmark (default 100,1000,10000,100000).\n"
+" --duration <ms>         Timed milliseconds for every benchmark (default %d).\n"
+" --json <file>           Write the results to <file> as JSON.\n"
+" --baseline <file>       Compare against the JSON results of a previous run.\n"
+" --threshold <percent>   Slowdown considered a regression (default %d).\n"
+" --list                  List the available benchmarks.\n"
+"\n"
+"Exits with 1 if a regression against the baseline was detected.\n",
+        MICROBENCH_DEFAULT_DURATION, MICROBENCH_DEFAULT_THRESHOLD);
+}
+
+int microbenchMain(int argc, char **argv) {
+    long sizes[MICROBENCH_MAX_SIZES] = {100,1000,10000,100000};
+    int numsizes = 4, numfilters = 0, regressions = 0, numbase = 0;
+    long long duration = MICROBENCH_DEFAULT_DURATION;
+    double threshold = MICROBENCH_DEFAULT_THRESHOLD;
+    char **filters = zmalloc(sizeof(char*)*argc);
+    char *jsonfile = NULL, *basefile = NULL;
+    microbenchBaseline *base = NULL;
+    int numbench = sizeof(microbenchTable)/sizeof(microbenchTable[0]);
+    FILE *json = NULL;
+
+    for (int j = 2; j < argc; j++) {
+        int lastarg = j == argc-1;
+        if (!strcmp(argv[j],"--sizes") && !lastarg) {
+            char *p = argv[++j];
+            numsizes = 0;
+            while (*p && numsizes < MICROBENCH_MAX_SIZES) {
+                char *end;
+                long size = strtol(p,&end,10);
+                if (end == p || size <= 0) goto badsizes;
+                sizes[numsizes++] = size;
+                if (*end == ',') end++;
+                else if (*end != '\0') goto badsizes;
+                p = end;
+            }
+            if (numsizes == 0) goto badsizes;
+        } else if (!strcmp(argv[j],"--duration") && !lastarg) {
+            duration = strtoll(argv[++j],NULL,10);
+            if (duration <= 0) duration = MICROBENCH_DEFAULT_DURATION;
+        } else if (!strcmp(argv[j],"--json") && !lastarg) {
+            jsonfile = argv[++j];
+        } else if (!strcmp(argv[j],"--baseline") && !lastarg) {
+            basefile = argv[++j];
+        } else if (!strcmp(argv[j],"--threshold") && !lastarg) {
+            threshold = strtod(argv[++j],NULL);
+        } else if (!strcmp(argv[j],"--list")) {
+            for (int i = 0; i < numbench; i++) printf("%s\n",microbenchTable[i].name);
+            zfree(filters);
+            return 0;
+        } else if (argv[j][0] == '-') {
+            microbenchUsage();
+            zfree(filters);
+            return 1;
+        } else {
+            filters[numfilters++] = argv[j];
+        }
+    }
+
+    if (basefile) {
+        base = microbenchLoadBaseline(basefile,&numbase);
+        if (base == NULL) {
+            fprintf(stderr,"Can't load the baseline '%s'\n",basefile);
+            zfree(filters);
+            return 1;
+        }
+    }
+    if (jsonfile) {
+        json = fopen(jsonfile,"w");
+        if (json == NULL) {
+            fprintf(stderr,"Can't open '%s': %s\n",jsonfile,strerror(errno));
+            zfree(filters);
+            zfree(base);
+            return 1;
+        }
+        fprintf(json,"{\n  \"version\": \"%s\",\n  \"duration_ms\": %lld,\n"
+                     "  \"results\": [\n",REDIS_VERSION,duration);
+    }
+
+    int emitted = 0;
+    for (int i = 0; i < numbench; i++) {
+        struct microbenchEntry *e = microbenchTable+i;
+        if (!microbenchSelected(e->name,filters,numfilters)) continue;
+        for (int s = 0; s < numsizes; s++) {
+            long size = sizes[s];
+            if (e->max_size && size > e->max_size) continue;
+
+            /* Run rounds until enough time was spent in the timed sections,
+             * also bounding the wall clock time since the setup of the large
+             * structures can be much slower than the measured operation. */
+            microbench mb = {0};
+            long long ops = 0, elapsed = 0, rounds = 0;
+            long long wall_start = mbNanoseconds();
+            double best = 0;
+            e->proc(&mb,size); /* Warm up the allocator and the caches. */
+            while (rounds < MICROBENCH_MIN_ROUNDS ||
+                   (elapsed < duration*1000000 &&
+                    mbNanoseconds()-wall_start < duration*5000000))
+            {
+                mb.elapsed = 0;
+                long long n = e->proc(&mb,size);
+                double ns = (double)mb.elapsed/n;
+                if (rounds == 0 || ns < best) best = ns;
+                ops += n;
+                elapsed += mb.elapsed;
+                rounds++;
+            }
+            double mean = (double)elapsed/ops;
+            double mbps = mb.bytes ? mb.bytes*1000.0/best : 0;
+
+            printf("%-22s size=%-8ld %12.2f ns/op %14.0f ops/sec",
+                e->name, size, best, 1e9/best);
+            if (mbps) printf(" %10.2f MB/s",mbps);
+            if (base) {
+                microbenchBaseline *b =
+                    microbenchFindBaseline(base,numbase,e->name,size);
+                if (b == NULL) {
+                    printf("  [new]");
+                } else {
+                    double delta = (best-b->ns_per_op)*100/b->ns_per_op;
+                    printf("  %+7.2f%%",delta);
+                    if (delta > threshold) {
+                        printf(" [REGRESSION]");
+                        regressions++;
+                    } else if (delta < -threshold) {
+                        printf(" [improved]");
+                    }
+                }
+            }
+            printf("\n");
+            fflush(stdout);
+
+            if (json) {
+                fprintf(json,"%s    {\"name\": \"%s\", \"size\": %ld, \"ops\": %lld, "
+                             "\"ns_per_op\": %.3f, \"mean_ns_per_op\": %.3f, "
+                             "\"ops_per_sec\": %.0f, \"mb_per_sec\": %.2f}",
+                    emitted ? ",\n" : "", e->name, size, ops, best, mean,
+                    1e9/best, mbps);
+                emitted++;
+            }
+        }
+    }
+
+    if (json) {
+        fprintf(json,"\n  ]\n}\n");
+        fclose(json);
+    }
+    if (base) {
+        printf("%d regression(s) above %.1f%% against %s\n",
+            regressions, threshold, basefile);
+    }
+    zfree(base);
+    zfree(filters);
+    return regressions ? 1 : 0;
+
+badsizes:
+    fprintf(stderr,"Invalid --sizes list, expected comma separated positive numbers\n");
+    zfree(filters);
+    return 1;
+}
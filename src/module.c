@@ -56,6 +56,7 @@
 #include "slowlog.h"
 #include "rdb.h"
 #include "monotonic.h"
+#include "hdr_histogram.h"
 #include <dlfcn.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -341,6 +342,7 @@ typedef struct RedisModuleDictIter {
 typedef struct RedisModuleCommandFilterCtx {
     RedisModuleString **argv;
     int argc;
+    int argv_transient;     /* Like client->argv_transient. */
 } RedisModuleCommandFilterCtx;
 
 typedef void (*RedisModuleCommandFilterFunc) (RedisModuleCommandFilterCtx *filter);
@@ -916,6 +918,8 @@ int RM_CreateCommand(RedisModuleCtx *ctx, const char *name, RedisModuleCmdFunc c
     cp->rediscmd->calls = 0;
     cp->rediscmd->rejected_calls = 0;
     cp->rediscmd->failed_calls = 0;
+    cp->rediscmd->latency_histogram = NULL;
+    updateCommandLatencyTracking(cp->rediscmd);
     dictAdd(server.commands,sdsdup(cmdname),cp->rediscmd);
     dictAdd(server.orig_commands,sdsdup(cmdname),cp->rediscmd);
     cp->rediscmd->id = ACLGetCommandID(cmdname); /* ID used for ACL. */
@@ -7440,7 +7444,8 @@ void moduleCallCommandFilters(client *c) {
 
     RedisModuleCommandFilterCtx filter = {
         .argv = c->argv,
-        .argc = c->argc
+        .argc = c->argc,
+        .argv_transient = c->argv_transient
     };
 
     while((ln = listNext(&li))) {
@@ -7455,8 +7460,10 @@ void moduleCallCommandFilters(client *c) {
         f->callback(&filter);
     }
 
+    /* Filters may have reallocated argv, argc is a safe bound for its size. */
     c->argv = filter.argv;
     c->argc = filter.argc;
+    c->argv_len = c->argc;
 }
 
 /* Return the number of arguments a filtered command has.  The number of
@@ -7487,7 +7494,11 @@ int RM_CommandFilterArgInsert(RedisModuleCommandFilterCtx *fctx, int pos, RedisM
 
     if (pos < 0 || pos > fctx->argc) return REDISMODULE_ERR;
 
-    fctx->argv = zrealloc(fctx->argv, (fctx->argc+1)*sizeof(RedisModuleString *));
+    /* Grow the vector with the allocator the client's one came from. */
+    if (fctx->argv_transient)
+        fctx->argv = zrealloc_transient(fctx->argv, (fctx->argc+1)*sizeof(RedisModuleString *));
+    else
+        fctx->argv = zrealloc(fctx->argv, (fctx->argc+1)*sizeof(RedisModuleString *));
     for (i = fctx->argc; i > pos; i--) {
         fctx->argv[i] = fctx->argv[i-1];
     }
@@ -8511,6 +8522,8 @@ void moduleUnregisterCommands(struct RedisModule *module) {
                 dictDelete(server.commands,cmdname);
                 dictDelete(server.orig_commands,cmdname);
                 sdsfree(cmdname);
+                if (cp->rediscmd->latency_histogram)
+                    hdr_close(cp->rediscmd->latency_histogram);
                 zfree(cp->rediscmd);
                 zfree(cp);
             }
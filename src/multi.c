@@ -37,6 +37,7 @@ void initClientMultiState(client *c) {
     c->mstate.count = 0;
     c->mstate.cmd_flags = 0;
     c->mstate.cmd_inv_flags = 0;
+    c->mstate.argv_len_sums = 0;
 }
 
 /* Release all the resources associated with MULTI/EXEC state */
@@ -76,6 +77,7 @@ void queueMultiCommand(client *c) {
     for (j = 0; j < c->argc; j++)
         incrRefCount(mc->argv[j]);
     c->mstate.count++;
+    c->mstate.argv_len_sums += c->argv_len_sum + sizeof(robj*)*c->argc;
     c->mstate.cmd_flags |= c->cmd->flags;
     c->mstate.cmd_inv_flags |= ~c->cmd->flags;
 }
@@ -159,7 +161,7 @@ void execCommandAbort(client *c, sds error) {
 void execCommand(client *c) {
     int j;
     robj **orig_argv;
-    int orig_argc;
+    int orig_argc, orig_argv_len, orig_argv_transient;
     struct redisCommand *orig_cmd;
     int was_master = server.masterhost == NULL;
 
@@ -193,11 +195,15 @@ void execCommand(client *c) {
 
     orig_argv = c->argv;
     orig_argc = c->argc;
+    orig_argv_len = c->argv_len;
+    orig_argv_transient = c->argv_transient;
     orig_cmd = c->cmd;
     addReplyArrayLen(c,c->mstate.count);
     for (j = 0; j < c->mstate.count; j++) {
         c->argc = c->mstate.commands[j].argc;
         c->argv = c->mstate.commands[j].argv;
+        c->argv_len = c->argc;
+        c->argv_transient = 0;
         c->cmd = c->mstate.commands[j].cmd;
 
         /* ACL permissions are also checked at the time of execution in case
@@ -244,6 +250,8 @@ void execCommand(client *c) {
 
     c->argv = orig_argv;
     c->argc = orig_argc;
+    c->argv_len = orig_argv_len;
+    c->argv_transient = orig_argv_transient;
     c->cmd = orig_cmd;
     discardTransaction(c);
 
@@ -314,6 +322,16 @@ void watchForKey(client *c, robj *key) {
     listAddNodeTail(c->watched_keys,wk);
 }
 
+/* Return the memory used by the MULTI queue and the WATCHed keys of the
+ * client. Like for the client argv, the queued arguments are accounted by
+ * their length. */
+size_t multiStateMemOverhead(client *c) {
+    size_t mem = c->mstate.argv_len_sums;
+    mem += sizeof(multiCmd) * c->mstate.count;
+    mem += listLength(c->watched_keys) * (sizeof(listNode) + sizeof(watchedKey));
+    return mem;
+}
+
 /* Unwatch all the keys watched by this client. To clean the EXEC dirty
  * flag is up to the caller. */
 void unwatchAllKeys(client *c) {
@@ -41,6 +41,17 @@ int postponeClientRead(client *c);
 
 int ProcessingEventsWhileBlocked = 0; /* See processEventsWhileBlocked(). */
 
+/* Most reads contain only whole commands, that are executed right away, so
+ * there is no reason for every client to own a query buffer large enough
+ * for a read. The main thread reads for the clients that have nothing
+ * pending into this shared buffer, and the data left unprocessed, if any,
+ * is moved to the client query buffer once the commands are executed.
+ * Reads performed by the I/O threads always use the client query buffer,
+ * since the commands are executed later by the main thread. */
+static sds shared_querybuf = NULL;
+static client *shared_querybuf_client = NULL;  /* Client using it now. */
+static sds shared_querybuf_private = NULL;     /* Its own query buffer. */
+
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
  * the client output buffer size. */
@@ -85,13 +96,13 @@ size_t getStringObjectLen(robj *o) {
  */
 void *dupClientReplyValue(void *o) {
     clientReplyBlock *old = o;
-    clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock) + old->size);
+    clientReplyBlock *buf = zmalloc_transient(sizeof(clientReplyBlock) + old->size);
     memcpy(buf, o, sizeof(clientReplyBlock) + old->size);
     return buf;
 }
 
 void freeClientReplyValue(void *o) {
-    zfree(o);
+    zfree_transient(o);
 }
 
 
@@ -120,6 +131,10 @@ static void clientSetDefaultAuth(client *c) {
     /* If the default user does not require authentication, the user is
      * directly authenticated. */
     c->user = DefaultUser;
+    sdsfree(c->acl_key_cache);
+    c->acl_key_cache = NULL;
+    c->acl_key_cache_user = NULL;
+    c->acl_key_cache_epoch = 0;
     c->authenticated = (c->user->flags & USER_FLAG_NOPASS) &&
                        !(c->user->flags & USER_FLAG_DISABLED);
 }
@@ -167,6 +182,9 @@ client *createClient(connection *conn) {
     c->name = NULL;
     // 回复缓冲区的偏移量
     c->bufpos = 0;
+    c->buf_peak = 0;
+    c->buf_usable_size = 0;
+    c->buf = NULL;
     c->qb_pos = 0;
     // 查询缓冲区
     c->querybuf = sdsempty();
@@ -179,6 +197,8 @@ client *createClient(connection *conn) {
     c->argc = 0;
     // 命令参数
     c->argv = NULL;
+    c->argv_len = 0;
+    c->argv_transient = 0;
     // 当前执行的命令和最近一次执行的命令
     c->argv_len_sum = 0;
     c->original_argc = 0;
@@ -195,6 +215,7 @@ client *createClient(connection *conn) {
     // 创建时间和最后一次互动时间
     c->ctime = c->lastinteraction = server.unixtime;
     // 认证状态
+    c->acl_key_cache = NULL;
     clientSetDefaultAuth(c);
     // 复制状态
     c->replstate = REPL_STATE_NONE;
@@ -369,8 +390,6 @@ int prepareClientToWrite(client *c) {
  * 尝试将回复添加到 c->buf 中
  */
 int _addReplyToBuffer(client *c, const char *s, size_t len) {
-    size_t available = sizeof(c->buf) - c->bufpos;
-
     // 正准备关闭客户端，无须再发送内容
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return C_OK;
 
@@ -379,13 +398,24 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
     // 回复链表里已经有内容，再添加内容到 c->buf 里面就是错误了
     if (listLength(c->reply) > 0) return C_ERR;
 
+    /* The buffer is allocated only once the client gets its first reply,
+     * so that connections that don't receive replies don't pay for it. */
+    if (c->buf == NULL)
+        c->buf = zmalloc_transient_usable(PROTO_REPLY_CHUNK_BYTES,&c->buf_usable_size);
+
     /* Check that the buffer has enough space available for this string. */
     // 空间必须满足
-    if (len > available) return C_ERR;
+    size_t available = c->buf_usable_size - c->bufpos;
+    if (len > available) {
+        /* Remember that the buffer was too small, so that it can grow. */
+        c->buf_peak = c->buf_usable_size;
+        return C_ERR;
+    }
 
     // 复制内容到 c->buf 里面
     memcpy(c->buf + c->bufpos, s, len);
     c->bufpos += len;
+    if (c->bufpos > c->buf_peak) c->buf_peak = c->bufpos;
     return C_OK;
 }
 
@@ -416,7 +446,7 @@ void _addReplyProtoToList(client *c, const char *s, size_t len) {
         /* Create a new node, make sure it is allocated to at
          * least PROTO_REPLY_CHUNK_BYTES */
         size_t size = len < PROTO_REPLY_CHUNK_BYTES ? PROTO_REPLY_CHUNK_BYTES : len;
-        tail = zmalloc(size + sizeof(clientReplyBlock));
+        tail = zmalloc_transient(size + sizeof(clientReplyBlock));
         /* take over the allocation's internal fragmentation */
         tail->size = zmalloc_usable_size(tail) - sizeof(clientReplyBlock);
         tail->used = len;
@@ -653,7 +683,7 @@ void trimReplyUnusedTailSpace(client *c) {
     if (tail->size - tail->used > tail->size / 4 &&
         tail->used < PROTO_REPLY_CHUNK_BYTES) {
         size_t old_size = tail->size;
-        tail = zrealloc(tail, tail->used + sizeof(clientReplyBlock));
+        tail = zrealloc_transient(tail, tail->used + sizeof(clientReplyBlock));
         /* take over the allocation's internal fragmentation (at least for
          * memory usage tracking) */
         tail->size = zmalloc_usable_size(tail) - sizeof(clientReplyBlock);
@@ -720,7 +750,7 @@ void setDeferredReply(client *c, void *node, const char *s, size_t length) {
         listDelNode(c->reply, ln);
     } else {
         /* Create a new node */
-        clientReplyBlock *buf = zmalloc(length + sizeof(clientReplyBlock));
+        clientReplyBlock *buf = zmalloc_transient(length + sizeof(clientReplyBlock));
         /* Take over the allocation's internal fragmentation */
         buf->size = zmalloc_usable_size(buf) - sizeof(clientReplyBlock);
         buf->used = length;
@@ -1111,7 +1141,11 @@ void copyClientOutputBuffer(client *dst, client *src) {
     dst->sentlen = 0;
     dst->reply = listDup(src->reply);
     // 复制内容到回复 buf
-    memcpy(dst->buf, src->buf, src->bufpos);
+    if (src->bufpos && dst->buf_usable_size < (size_t)src->bufpos) {
+        zfree_transient(dst->buf);
+        dst->buf = zmalloc_transient_usable(src->buf_usable_size,&dst->buf_usable_size);
+    }
+    if (src->bufpos) memcpy(dst->buf, src->buf, src->bufpos);
     // 同步偏移量和字节数
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
@@ -1339,6 +1373,18 @@ void freeClientOriginalArgv(client *c) {
     c->original_argc = 0;
 }
 
+/* Release the argv array itself (not the arguments) with the allocator it
+ * came from: the vectors read from the socket come from the transient arena,
+ * the ones set by scripts, modules, MULTI and command rewriting don't. */
+static void freeClientArgvArray(client *c) {
+    if (c->argv_transient)
+        zfree_transient(c->argv);
+    else
+        zfree(c->argv);
+    c->argv = NULL;
+    c->argv_transient = 0;
+}
+
 /*
  * 清空所有命令参数
  */
@@ -1504,9 +1550,21 @@ void freeClient(client *c) {
     }
 
     /* Free the query buffer */
+    if (c == shared_querybuf_client) {
+        /* Freed while processing a read in the shared query buffer. */
+        c->querybuf = shared_querybuf_private;
+        sdsclear(shared_querybuf);
+        shared_querybuf_client = NULL;
+        shared_querybuf_private = NULL;
+    }
     sdsfree(c->querybuf);
     sdsfree(c->pending_querybuf);
     c->querybuf = NULL;
+    sdsfree(c->acl_key_cache);
+
+    /* Free the reply buffer */
+    zfree_transient(c->buf);
+    c->buf = NULL;
 
     /* Deallocate structures used to block on blocking ops. */
     if (c->flags & CLIENT_BLOCKED) unblockClient(c);
@@ -1589,7 +1647,7 @@ void freeClient(client *c) {
      * and finally release the client structure itself. */
     if (c->name) decrRefCount(c->name);
     // 清除参数空间
-    zfree(c->argv);
+    freeClientArgvArray(c);
     c->argv_len_sum = 0;
     // 清除事务状态信息
     freeClientMultiState(c);
@@ -1803,7 +1861,11 @@ int writeToClient(client *c, int handler_installed) {
  */
 void sendReplyToClient(connection *conn) {
     client *c = connGetPrivateData(conn);
+    monotime write_timer;
+
+    elStageStart(write_timer);
     writeToClient(c, 1);
+    elStageEnd(EL_STAGE_WRITE,write_timer);
 }
 
 /* This function is called just before entering the event loop, in the hope
@@ -1915,6 +1977,47 @@ void unprotectClient(client *c) {
     }
 }
 
+/* Make sure c->argv can hold 'argc' arguments. The array of the previous
+ * command is reused when it is big enough, so that pipelines of small
+ * commands don't pay an allocation and a free for every command. Arrays
+ * bigger than PROTO_REUSE_ARGV_MAX slots are not retained, so that a single
+ * huge command doesn't leave the client with a huge array. */
+static void setupClientArgv(client *c, int argc) {
+    if (c->argv && c->argv_len >= argc && c->argv_len <= PROTO_REUSE_ARGV_MAX)
+        return;
+    freeClientArgvArray(c);
+    c->argv = zmalloc_transient(sizeof(robj *) * argc);
+    c->argv_len = argc;
+    c->argv_transient = 1;
+}
+
+/* Fast path for the "*<count>\r\n" and "$<len>\r\n" headers of the RESP
+ * protocol: 'p' points just after the type byte. When the header is well
+ * formed and complete (at most 18 digits, no sign or leading zeros) the
+ * length is stored in '*len' and the pointer to the '\r' is returned, so the
+ * line is scanned once instead of strchr() followed by string2ll().
+ * Otherwise NULL is returned and the caller uses the generic code, that
+ * also reports protocol errors. The query buffer is null terminated, so the
+ * scan always stops before its end. */
+static inline char *parseProtoLengthFast(char *p, long long *len) {
+    long long v;
+    int digits = 1;
+
+    if (*p < '1' || *p > '9') {
+        if (p[0] != '0' || p[1] != '\r' || p[2] != '\n') return NULL;
+        *len = 0;
+        return p+1;
+    }
+    v = *p++ - '0';
+    while (*p >= '0' && *p <= '9' && digits < 18) {
+        v = v*10 + (*p++ - '0');
+        digits++;
+    }
+    if (p[0] != '\r' || p[1] != '\n') return NULL;
+    *len = v;
+    return p;
+}
+
 /* Like processMultibulkBuffer(), but for the inline protocol instead of RESP,
  * this function consumes the client query buffer and creates a command ready
  * to be executed inside the client structure. Returns C_OK if the command
@@ -2004,8 +2107,7 @@ int processInlineBuffer(client *c) {
     /* Setup argv array on client structure */
     // 为客户端的参数分配空间
     if (argc) {
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj *) * argc);
+        setupClientArgv(c,argc);
         c->argv_len_sum = 0;
     }
 
@@ -2090,6 +2192,13 @@ int processMultibulkBuffer(client *c) {
         /* The client should have been reset */
         serverAssertWithInfo(c, NULL, c->argc == 0);
 
+        if (c->querybuf[c->qb_pos] == '*' &&
+            (newline = parseProtoLengthFast(c->querybuf + c->qb_pos + 1, &ll)) != NULL)
+        {
+            ok = 1;
+            goto mbulk_len_parsed;
+        }
+
         /* Multi bulk length cannot be read without a \r\n */
         // 检查缓冲区的内容第一个 "\r\n"
         newline = strchr(c->querybuf + c->qb_pos, '\r');
@@ -2112,6 +2221,7 @@ int processMultibulkBuffer(client *c) {
         // 将参数个数，也即是 * 之后， \r\n 之前的数字取出并保存到 ll 中
         // 比如对于 *3\r\n ，那么 ll 将等于 3
         ok = string2ll(c->querybuf + 1 + c->qb_pos, newline - (c->querybuf + 1 + c->qb_pos), &ll);
+mbulk_len_parsed:
         if (!ok || ll > 1024 * 1024) {
             addReplyError(c, "Protocol error: invalid multibulk length");
             setProtocolError("invalid mbulk count", c);
@@ -2136,8 +2246,7 @@ int processMultibulkBuffer(client *c) {
 
         /* Setup argv array on client structure */
         // 根据参数数量，为各个参数对象分配空间
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj *) * c->multibulklen);
+        setupClientArgv(c,c->multibulklen);
         c->argv_len_sum = 0;
     }
 
@@ -2147,6 +2256,13 @@ int processMultibulkBuffer(client *c) {
         /* Read bulk length if unknown */
         // 读入参数长度
         if (c->bulklen == -1) {
+            if (c->querybuf[c->qb_pos] == '$' &&
+                (newline = parseProtoLengthFast(c->querybuf + c->qb_pos + 1, &ll)) != NULL)
+            {
+                ok = 1;
+                goto bulk_len_parsed;
+            }
+
             // 确保 "\r\n" 存在
             newline = strchr(c->querybuf + c->qb_pos, '\r');
             if (newline == NULL) {
@@ -2176,6 +2292,7 @@ int processMultibulkBuffer(client *c) {
             // 读取长度
             // 比如 $3\r\nSET\r\n 将会让 ll 的值设置 3
             ok = string2ll(c->querybuf + c->qb_pos + 1, newline - (c->querybuf + c->qb_pos + 1), &ll);
+bulk_len_parsed:
             if (!ok || ll < 0 ||
                 (!(c->flags & CLIENT_MASTER) && ll > server.proto_max_bulk_len)) {
                 addReplyError(c, "Protocol error: invalid bulk length");
@@ -2201,7 +2318,9 @@ int processMultibulkBuffer(client *c) {
                  * or equal to ll+2. If the data length is greater than
                  * ll+2, trimming querybuf is just a waste of time, because
                  * at this time the querybuf contains not only our bulk. */
-                if (sdslen(c->querybuf) - c->qb_pos <= (size_t) ll + 2) {
+                if (sdslen(c->querybuf) - c->qb_pos <= (size_t) ll + 2 &&
+                    c->querybuf != shared_querybuf)
+                {
                     sdsrange(c->querybuf, c->qb_pos, -1);
                     c->qb_pos = 0;
                     /* Hint the sds library about the amount of bytes this string is
@@ -2225,7 +2344,7 @@ int processMultibulkBuffer(client *c) {
             /* Optimization: if the buffer contains JUST our bulk element
              * instead of creating a new object by *copying* the sds we
              * just use the current sds string. */
-            if (c->qb_pos == 0 &&
+            if (c->qb_pos == 0 && c->querybuf != shared_querybuf &&
                 c->bulklen >= PROTO_MBULK_BIG_ARG &&
                 sdslen(c->querybuf) == (size_t) (c->bulklen + 2)) {
                 c->argv[c->argc++] = createObject(OBJ_STRING, c->querybuf);
@@ -2342,6 +2461,9 @@ int processPendingCommandsAndResetClient(client *c) {
  * pending query buffer, already representing a full command, to process. */
 // 处理客户端输入的命令内容
 void processInputBuffer(client *c) {
+    monotime parse_timer;
+    int parsed;
+
     /* Keep processing while there is something in the input buffer */
     // 尽可能地处理查询缓冲区中的内容
     // 如果读取出现 short read ，那么可能会有内容滞留在读取缓冲区里面
@@ -2387,8 +2509,21 @@ void processInputBuffer(client *c) {
         }
 
         // 将缓冲区中的内容转换成命令，以及命令参数
+        /* The parsing time is accounted in the event loop parse stage,
+         * unless we are in the context of an I/O thread. */
+        elStageStart(parse_timer);
+        if (c->reqtype == PROTO_REQ_INLINE) {
+            parsed = processInlineBuffer(c);
+        } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
+            parsed = processMultibulkBuffer(c);
+        } else {
+            serverPanic("Unknown request type");
+        }
+        if (!(c->flags & CLIENT_PENDING_READ))
+            elStageEnd(EL_STAGE_PARSE,parse_timer);
+        if (parsed != C_OK) break;
+
         if (c->reqtype == PROTO_REQ_INLINE) {
-            if (processInlineBuffer(c) != C_OK) break;
             /* If the Gopher mode and we got zero or one argument, process
              * the request in Gopher mode. To avoid data race, Redis won't
              * support Gopher if enable io threads to read queries. */
@@ -2400,10 +2535,6 @@ void processInputBuffer(client *c) {
                 c->flags |= CLIENT_CLOSE_AFTER_REPLY;
                 break;
             }
-        } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != C_OK) break;
-        } else {
-            serverPanic("Unknown request type");
         }
 
         /* Multibulk processing could see a <= 0 length. */
@@ -2434,6 +2565,40 @@ void processInputBuffer(client *c) {
         sdsrange(c->querybuf, c->qb_pos, -1);
         c->qb_pos = 0;
     }
+
+    /* Now that the query buffer and the replies of the processed commands
+     * are accounted, enforce the client memory limit. Not in the context
+     * of an I/O thread, the main thread will get here again later. */
+    if (!(c->flags & CLIENT_PENDING_READ) && c->conn) {
+        updateClientMemUsage(c);
+        evictClients();
+    }
+}
+
+/* Give back the shared query buffer used by the client for the last read:
+ * the data not processed yet, if any, is moved to the client own query
+ * buffer, making room for the whole argument if a big one is pending. */
+static void releaseSharedQueryBuffer(client *c) {
+    sds qb = shared_querybuf_private;
+    size_t remaining = sdslen(shared_querybuf) - c->qb_pos;
+
+    if (remaining) {
+        size_t room = remaining;
+        if (c->reqtype == PROTO_REQ_MULTIBULK && c->multibulklen &&
+            c->bulklen >= PROTO_MBULK_BIG_ARG &&
+            (size_t)c->bulklen + 2 > room)
+        {
+            room = c->bulklen + 2;
+        }
+        qb = sdsMakeRoomFor(qb, room);
+        qb = sdscatlen(qb, shared_querybuf + c->qb_pos, remaining);
+        if (c->querybuf_peak < remaining) c->querybuf_peak = remaining;
+    }
+    c->querybuf = qb;
+    c->qb_pos = 0;
+    sdsclear(shared_querybuf);
+    shared_querybuf_client = NULL;
+    shared_querybuf_private = NULL;
 }
 
 /*
@@ -2443,12 +2608,20 @@ void readQueryFromClient(connection *conn) {
     client *c = connGetPrivateData(conn);
     int nread, readlen;
     size_t qblen;
+    monotime read_timer;
 
     /* Check if we want to read from the client later when exiting from
      * the event loop. This is the case if threaded I/O is enabled. */
     // 设置服务器的当前客户端
     if (postponeClientRead(c)) return;
 
+    /* The connection is still performing its handshake, that was handed to
+     * the I/O threads: see postponeConnHandshake(). */
+    if (connGetState(conn) == CONN_STATE_ACCEPTING) {
+        connHandshake(conn);
+        return;
+    }
+
     /* Update total number of reads on server */
     atomicIncr(server.stat_total_reads_processed, 1);
 
@@ -2467,6 +2640,18 @@ void readQueryFromClient(connection *conn) {
         /* Note that the 'remaining' variable may be zero in some edge case,
          * for example once we resume a blocked client after CLIENT PAUSE. */
         if (remaining > 0 && remaining < readlen) readlen = remaining;
+    } else if (sdslen(c->querybuf) == 0 && shared_querybuf_client == NULL &&
+               !(c->flags & (CLIENT_MASTER|CLIENT_PENDING_READ)))
+    {
+        /* Nothing pending: read into the shared query buffer. It may be
+         * already in use if we are processing events while blocked. */
+        if (shared_querybuf == NULL) {
+            shared_querybuf = sdsnewlen(SDS_NOINIT, PROTO_IOBUF_LEN);
+            sdsclear(shared_querybuf);
+        }
+        shared_querybuf_client = c;
+        shared_querybuf_private = c->querybuf;
+        c->querybuf = shared_querybuf;
     }
 
     // 获取查询缓冲区当前内容的长度
@@ -2477,8 +2662,15 @@ void readQueryFromClient(connection *conn) {
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
     // 为查询缓冲区分配空间
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
+    if (c == shared_querybuf_client) shared_querybuf = c->querybuf;
     // 读入内容到查询缓存
+    elStageStart(read_timer);
     nread = connRead(c->conn, c->querybuf + qblen, readlen);
+    /* Reads performed by I/O threads are accounted by the main thread
+     * as a whole, see handleClientsWithPendingReadsUsingThreads(). */
+    if (!(c->flags & CLIENT_PENDING_READ))
+        elStageEnd(EL_STAGE_READ,read_timer);
+    if (nread <= 0 && c == shared_querybuf_client) releaseSharedQueryBuffer(c);
     // 读入出错
     if (nread == -1) {
         if (connGetState(conn) == CONN_STATE_CONNECTED) {
@@ -2519,6 +2711,7 @@ void readQueryFromClient(connection *conn) {
                   bytes);
         sdsfree(ci);
         sdsfree(bytes);
+        if (c == shared_querybuf_client) releaseSharedQueryBuffer(c);
         freeClientAsync(c);
         return;
     }
@@ -2528,6 +2721,10 @@ void readQueryFromClient(connection *conn) {
     // 从查询缓存重读取内容，创建参数，并执行命令
     // 函数会执行到缓存中的所有内容都被处理完为止
     processInputBuffer(c);
+
+    /* If the client was not freed while executing its commands, it may
+     * still hold the shared query buffer. */
+    if (c == shared_querybuf_client) releaseSharedQueryBuffer(c);
 }
 
 // 获取客户端目前最大的一块缓冲区的大小
@@ -2636,16 +2833,7 @@ sds catClientInfoString(sds s, client *client) {
     *p = '\0';
 
     /* Compute the total memory consumed by this client. */
-    size_t obufmem = getClientOutputBufferMemoryUsage(client);
-    size_t total_mem = obufmem;
-    total_mem += zmalloc_size(client); /* includes client->buf */
-    total_mem += sdsZmallocSize(client->querybuf);
-    /* For efficiency (less work keeping track of the argv memory), it doesn't include the used memory
-     * i.e. unused sds space and internal fragmentation, just the string length. but this is enough to
-     * spot problematic clients. */
-    total_mem += client->argv_len_sum;
-    if (client->argv)
-        total_mem += zmalloc_size(client->argv);
+    size_t obufmem, total_mem = getClientMemoryUsage(client,&obufmem);
 
     return sdscatfmt(s,
                      "id=%U addr=%s laddr=%s %s name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U argv-mem=%U obl=%U oll=%U omem=%U tot-mem=%U events=%s cmd=%s user=%s redir=%I",
@@ -3429,9 +3617,10 @@ void replaceClientCommandVector(client *c, int argc, robj **argv) {
     int j;
     retainOriginalCommandVector(c);
     freeClientArgv(c);
-    zfree(c->argv);
+    freeClientArgvArray(c);
     c->argv = argv;
     c->argc = argc;
+    c->argv_len = argc;
     c->argv_len_sum = 0;
     for (j = 0; j < c->argc; j++)
         if (c->argv[j])
@@ -3456,7 +3645,13 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
     robj *oldval;
     retainOriginalCommandVector(c);
     if (i >= c->argc) {
-        c->argv = zrealloc(c->argv, sizeof(robj *) * (i + 1));
+        /* The vector of script, module and MULTI clients is released with
+         * zfree(), so the new one always comes from the default arena. */
+        robj **argv = zmalloc(sizeof(robj *) * (i + 1));
+        if (c->argc) memcpy(argv,c->argv,sizeof(robj *) * c->argc);
+        freeClientArgvArray(c);
+        c->argv = argv;
+        c->argv_len = i + 1;
         c->argc = i + 1;
         c->argv[i] = NULL;
     }
@@ -3491,6 +3686,122 @@ unsigned long getClientOutputBufferMemoryUsage(client *c) {
     return c->reply_bytes + (list_item_size * listLength(c->reply));
 }
 
+/* Return the total memory used by the client: output and query buffers,
+ * argv, MULTI queue, WATCHed keys, Pub/Sub subscriptions and tracking
+ * prefixes. If 'output_buffer_mem_usage' is not NULL it is set to the
+ * output buffer part, as returned by getClientOutputBufferMemoryUsage().
+ *
+ * For efficiency the arguments are accounted by their length, without the
+ * unused sds space and the internal fragmentation, but this is enough to
+ * spot the problematic clients. Like the function above, this is fast
+ * enough to be called after every command. */
+size_t getClientMemoryUsage(client *c, size_t *output_buffer_mem_usage) {
+    size_t mem = getClientOutputBufferMemoryUsage(c);
+    if (output_buffer_mem_usage) *output_buffer_mem_usage = mem;
+
+    mem += zmalloc_size(c);
+    if (c->buf) mem += zmalloc_size(c->buf);
+    if (c->querybuf && c->querybuf != shared_querybuf)
+        mem += sdsZmallocSize(c->querybuf);
+    if (c->pending_querybuf) mem += sdsZmallocSize(c->pending_querybuf);
+    mem += c->argv_len_sum;
+    if (c->argv) mem += zmalloc_size(c->argv);
+    mem += multiStateMemOverhead(c);
+    mem += dictSize(c->pubsub_channels) * sizeof(dictEntry) +
+           dictSlots(c->pubsub_channels) * sizeof(dictEntry*);
+    mem += listLength(c->pubsub_patterns) * sizeof(listNode);
+    if (c->client_tracking_prefixes)
+        mem += c->client_tracking_prefixes->numnodes * sizeof(raxNode) +
+               raxSize(c->client_tracking_prefixes) * sizeof(void*);
+    return mem;
+}
+
+/* Update the memory used by the client in the per type totals, that are
+ * reported by INFO and checked against the maxmemory-clients limit. The
+ * last value is remembered in the client so that it can be removed from
+ * the old total when the client changes type or is released. Clients
+ * already scheduled to be released don't count: otherwise the totals would
+ * stay over the limit, and every command would rescan all the clients in
+ * evictClients(), until they are actually freed. */
+void updateClientMemUsage(client *c) {
+    size_t mem = 0;
+    int type = getClientType(c);
+
+    if (!(c->flags & CLIENT_CLOSE_ASAP)) mem = getClientMemoryUsage(c,NULL);
+    server.stat_clients_type_memory[c->client_cron_last_memory_type] -=
+        c->client_cron_last_memory_usage;
+    server.stat_clients_type_memory[type] += mem;
+    c->client_cron_last_memory_usage = mem;
+    c->client_cron_last_memory_type = type;
+}
+
+typedef struct clientMemUsage {
+    client *c;
+    size_t mem;
+} clientMemUsage;
+
+static int clientMemUsageCompareDesc(const void *a, const void *b) {
+    const clientMemUsage *ca = a, *cb = b;
+    if (ca->mem == cb->mem) return 0;
+    return ca->mem < cb->mem ? 1 : -1;
+}
+
+/* If the memory used by the normal and Pub/Sub clients is over the
+ * maxmemory-clients limit, disconnect the clients using the most memory
+ * until the total is back under the limit. Masters and replicas are never
+ * evicted: the replicas output buffers have limits of their own.
+ *
+ * The check against the totals maintained by updateClientMemUsage() is
+ * O(1). Since those totals may be stale for clients not served recently,
+ * the usage of all the clients is refreshed before evicting any of them,
+ * so that clients are only evicted if the limit is really exceeded. */
+void evictClients(void) {
+    size_t used, limit = server.maxmemory_clients;
+
+    if (!limit) return;
+    used = server.stat_clients_type_memory[CLIENT_TYPE_NORMAL] +
+           server.stat_clients_type_memory[CLIENT_TYPE_PUBSUB];
+    if (used <= limit) return;
+
+    clientMemUsage *candidates =
+        zmalloc(sizeof(clientMemUsage)*listLength(server.clients));
+    unsigned long count = 0;
+    listIter li;
+    listNode *ln;
+
+    used = 0;
+    listRewind(server.clients,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        client *c = listNodeValue(ln);
+        int type;
+
+        updateClientMemUsage(c);
+        type = getClientType(c);
+        if (type != CLIENT_TYPE_NORMAL && type != CLIENT_TYPE_PUBSUB) continue;
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+        used += c->client_cron_last_memory_usage;
+        candidates[count].c = c;
+        candidates[count].mem = c->client_cron_last_memory_usage;
+        count++;
+    }
+
+    if (used > limit) {
+        qsort(candidates,count,sizeof(clientMemUsage),clientMemUsageCompareDesc);
+        for (unsigned long j = 0; j < count && used > limit; j++) {
+            client *c = candidates[j].c;
+            sds client = catClientInfoString(sdsempty(),c);
+            serverLog(LL_WARNING,"Client %s evicted for overcoming the "
+                "maxmemory-clients limit.", client);
+            sdsfree(client);
+            freeClientAsync(c);
+            updateClientMemUsage(c);
+            used -= candidates[j].mem;
+            server.stat_evictedclients++;
+        }
+    }
+    zfree(candidates);
+}
+
 /* Get the class of a client, used in order to enforce limits to different
  * classes of clients.
  *
@@ -4026,6 +4337,9 @@ int handleClientsWithPendingWritesUsingThreads(void) {
     while ((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
 
+        /* Apply the event loop changes postponed by the I/O threads. */
+        connUpdateState(c->conn);
+
         /* Install the write handler if there are pending writes in some
          * of the clients. */
         if (clientHasPendingReplies(c) &&
@@ -4058,6 +4372,31 @@ int postponeClientRead(client *c) {
     }
 }
 
+/* Return 1 if the next step of the handshake of the accepted connection
+ * 'conn' should be run by the I/O threads. This is called by connection
+ * types having a CPU bound handshake, such as TLS, in the main thread: in
+ * that case the client is put in the pending read clients, the I/O thread
+ * serving it runs the step calling connHandshake() from
+ * readQueryFromClient(), and the main thread completes it calling
+ * connUpdateState() in handleClientsWithPendingReadsUsingThreads().
+ *
+ * Unlike the reads, the handshakes don't wait for the I/O threads to be
+ * activated by the pending writes: a storm of reconnections produces little
+ * write traffic but plenty of handshakes, so these are enough to start the
+ * threads, see handleClientsWithPendingReadsUsingThreads(). */
+int postponeConnHandshake(connection *conn) {
+    client *c;
+
+    if (conn->conn_handler != clientAcceptHandler) return 0;
+    if (server.io_threads_num == 1 || !server.io_threads_do_reads ||
+        ProcessingEventsWhileBlocked) return 0;
+    c = connGetPrivateData(conn);
+    if (c->flags & CLIENT_PENDING_READ) return 0;
+    c->flags |= CLIENT_PENDING_READ;
+    listAddNodeHead(server.clients_pending_read, c);
+    return 1;
+}
+
 /* When threaded I/O is also enabled for the reading + parsing side, the
  * readable handler will just put normal clients into a queue of clients to
  * process (instead of serving them synchronously). This function runs
@@ -4065,10 +4404,20 @@ int postponeClientRead(client *c) {
  * the reads in the buffers, and also parse the first command available
  * rendering it in the client structures. */
 int handleClientsWithPendingReadsUsingThreads(void) {
-    if (!server.io_threads_active || !server.io_threads_do_reads) return 0;
+    if (server.io_threads_num == 1 || !server.io_threads_do_reads) return 0;
     int processed = listLength(server.clients_pending_read);
     if (processed == 0) return 0;
 
+    /* Only postponed handshakes are queued while the threads are not
+     * active: start them, handleClientsWithPendingWritesUsingThreads() will
+     * stop them again if there are too few pending writes. */
+    if (!server.io_threads_active) startThreadedIO();
+
+    /* The time the main thread spends reading and waiting for the I/O
+     * threads to read and parse is accounted in the read stage. */
+    monotime read_timer;
+    elStageStart(read_timer);
+
     /* Distribute the clients across N different lists. */
     listIter li;
     listNode *ln;
@@ -4104,6 +4453,7 @@ int handleClientsWithPendingReadsUsingThreads(void) {
             pending += getIOPendingCount(j);
         if (pending == 0) break;
     }
+    elStageEnd(EL_STAGE_READ,read_timer);
 
     /* Run the list of clients again to process the new buffers. */
     while (listLength(server.clients_pending_read)) {
@@ -4112,6 +4462,10 @@ int handleClientsWithPendingReadsUsingThreads(void) {
         c->flags &= ~CLIENT_PENDING_READ;
         listDelNode(server.clients_pending_read, ln);
 
+        /* Apply the event loop changes postponed by the I/O threads, and
+         * call the accept handler if the handshake was completed. */
+        connUpdateState(c->conn);
+
         if (processPendingCommandsAndResetClient(c) == C_ERR) {
             /* If the client is no longer valid, we avoid
              * processing the client later. So we just go
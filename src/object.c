@@ -1044,8 +1044,6 @@ size_t streamRadixTreeMemoryUsage(rax *rax) {
  * Note that the returned value is just an approximation, especially in the
  * case of aggregated data types where only "sample_size" elements
  * are checked and averaged to estimate the total size. */
-#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
-
 size_t objectComputeSize(robj *o, size_t sample_size) {
     sds ele, ele2;
     dict *d;
@@ -1538,12 +1536,14 @@ void objectCommand(client *c) {
             == NULL)
             return;
         addReplyLongLong(c, o->refcount);
-        // 返回对象的编码    } else if (!strcasecmp(c->argv[1]->ptr,"encoding") && c->argc == 3) {
+        // 返回对象的编码
+    } else if (!strcasecmp(c->argv[1]->ptr,"encoding") && c->argc == 3) {
         if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.null[c->resp]))
             == NULL)
             return;
         addReplyBulkCString(c, strEncoding(o->encoding));
-        // 返回对象的空闲时间    } else if (!strcasecmp(c->argv[1]->ptr,"idletime") && c->argc == 3) {
+        // 返回对象的空闲时间
+    } else if (!strcasecmp(c->argv[1]->ptr,"idletime") && c->argc == 3) {
         if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.null[c->resp]))
             == NULL)
             return;
@@ -1581,10 +1581,17 @@ void memoryCommand(client *c) {
         const char *help[] = {
                 "DOCTOR",
                 "    Return memory problems reports.",
+                "ANALYZE [TOP <count>] [SEPARATOR <char>] [SAMPLES <count>]",
+                "    Start a background analysis of the memory used by the keys, grouped",
+                "    by type, encoding and key prefix (the part before <char>, default",
+                "    ':'). The <count> biggest keys are reported (default: 100), nested",
+                "    values are sampled like in USAGE.",
                 "MALLOC-STATS"
                 "    Return internal statistics report from the memory allocator.",
                 "PURGE",
                 "    Attempt to purge dirty pages for reclamation by the allocator.",
+                "REPORT",
+                "    Return the status of the keyspace analysis and its last report.",
                 "STATS",
                 "    Return information about the memory usage of the server.",
                 "USAGE <key> [SAMPLES <count>]",
@@ -1733,6 +1740,10 @@ void memoryCommand(client *c) {
             addReply(c, shared.ok);
         else
             addReplyError(c, "Error purging dirty pages");
+    } else if (!strcasecmp(c->argv[1]->ptr, "analyze")) {
+        memoryAnalyzeCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr, "report") && c->argc == 2) {
+        memoryReportCommand(c);
     } else {
         addReplySubcommandSyntaxError(c);
     }
@@ -452,7 +452,8 @@ int pubsubPublishMessage(robj *channel, robj *message) {
     // 将消息也发送给那些和频道匹配的模式
     di = dictGetIterator(server.pubsub_patterns);
     if (di) {
-        // 遍历模式链表        channel = getDecodedObject(channel);
+        // 遍历模式链表
+        channel = getDecodedObject(channel);
         while ((de = dictNext(di)) != NULL) {
             // 取出 robj
             robj *pattern = dictGetKey(de);
@@ -40,7 +40,7 @@
 
 #ifndef RAX_MALLOC_INCLUDE
 #define RAX_MALLOC_INCLUDE "rax_malloc.h"
-#define RAX_DEBUG_MSG 1
+// #define RAX_DEBUG_MSG 1
 #endif
 
 #include RAX_MALLOC_INCLUDE
@@ -1018,6 +1018,41 @@ void *raxFind(rax *rax, unsigned char *s, size_t len) {
     return raxGetData(h);
 }
 
+/* Call 'fn' for every key of the rax that is a prefix of the string 's',
+ * including the string itself, in order of increasing length, passing the
+ * value associated with the key, the prefix length, and 'privdata'. The
+ * walk stops as soon as 'fn' returns non zero, and in that case the function
+ * returns 1, otherwise 0 is returned once all the prefixes are visited.
+ * Since all the prefixes of a string lay on the path from the root to the
+ * node representing the string, this is a single descent of the tree. */
+int raxWalkPrefixes(rax *rax, unsigned char *s, size_t len, raxPrefixCallback fn, void *privdata) {
+    raxNode *h = rax->head;
+    size_t i = 0; /* Position in the string. */
+
+    while(1) {
+        if (h->iskey && fn(raxGetData(h),i,privdata)) return 1;
+        if (h->size == 0 || i == len) break;
+
+        unsigned char *v = h->data;
+        size_t j = 0;
+        if (h->iscompr) {
+            /* The compressed node represents no key inside its chars, so
+             * we can jump to its child only if the whole chars match. */
+            if (len-i < h->size || memcmp(v,s+i,h->size) != 0) break;
+            i += h->size;
+        } else {
+            for (j = 0; j < h->size; j++) {
+                if (v[j] == s[i]) break;
+            }
+            if (j == h->size) break;
+            i++;
+        }
+        raxNode **children = raxNodeFirstChildPtr(h);
+        memcpy(&h,children+j,sizeof(h));
+    }
+    return 0;
+}
+
 /* Return the memory address where the 'parent' node stores the specified
  * 'child' pointer, so that the caller can update the pointer with another
  * one if needed. The function assumes it will find a match, otherwise the
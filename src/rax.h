@@ -164,6 +164,10 @@ typedef struct raxStack {
  * This is currently only supported in forward iterations (raxNext) */
 typedef int (*raxNodeCallback)(raxNode **noderef);
 
+/* Callback called by raxWalkPrefixes() for every key that is a prefix of
+ * the searched string. Returning non zero stops the walk. */
+typedef int (*raxPrefixCallback)(void *data, size_t prefixlen, void *privdata);
+
 /* Radix tree iterator state is encapsulated into this data structure. */
 #define RAX_ITER_STATIC_LEN 128
 #define RAX_ITER_JUST_SEEKED (1<<0) /* Iterator was just seeked. Return current
@@ -194,6 +198,7 @@ int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old);
 int raxTryInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old);
 int raxRemove(rax *rax, unsigned char *s, size_t len, void **old);
 void *raxFind(rax *rax, unsigned char *s, size_t len);
+int raxWalkPrefixes(rax *rax, unsigned char *s, size_t len, raxPrefixCallback fn, void *privdata);
 void raxFree(rax *rax);
 void raxFreeWithCallback(rax *rax, void (*free_callback)(void*));
 void raxStart(raxIterator *it, rax *rt);
@@ -3168,7 +3168,8 @@ static void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
         server.dirty = server.dirty - server.dirty_before_bgsave;
         server.lastsave = time(NULL);
         server.lastbgsave_status = C_OK;
-        // BGSAVE 出错    } else if (!bysignal && exitcode != 0) {
+        // BGSAVE 出错
+    } else if (!bysignal && exitcode != 0) {
         serverLog(LL_WARNING, "Background saving error");
         server.lastbgsave_status = C_ERR;
 
@@ -36,6 +36,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <ctype.h>
 #include <time.h>
 #include <sys/time.h>
 #include <signal.h>
@@ -74,9 +76,20 @@
 #define CLIENT_GET_EVENTLOOP(c) \
     (c->thread_id >= 0 ? config.threads[c->thread_id]->el : config.el)
 
+#define WORKLOAD_MAX_ARGS 64
+#define WORKLOAD_MAX_SIZES 32
+#define WORKLOAD_DIST_UNIFORM 0
+#define WORKLOAD_DIST_SEQUENTIAL 1
+#define WORKLOAD_DIST_ZIPF 2
+#define WORKLOAD_DIST_HOTSPOT 3
+#define WORKLOAD_ARG_LITERAL 0
+#define WORKLOAD_ARG_KEY 1      /* __key__ */
+#define WORKLOAD_ARG_VALUE 2    /* __value__ */
+
 struct benchmarkThread;
 struct clusterNode;
 struct redisConfig;
+struct workload;
 
 static struct config {
     aeEventLoop *el;
@@ -125,6 +138,11 @@ static struct config {
     redisAtomic int is_updating_slots;
     redisAtomic int slots_last_update;
     int enable_tracking;
+    int rps;                /* Open-loop mode: requests per second, or 0. */
+    char *hdr_prefix;       /* Write the latency distribution to files. */
+    const char *workload_file;
+    struct workload *workload; /* Loaded with --workload, or NULL. */
+    redisAtomic long long workload_seq; /* Sequential distribution counter */
     pthread_mutex_t liveclients_mutex;
     pthread_mutex_t is_updating_slots_mutex;
 } config;
@@ -149,6 +167,22 @@ typedef struct _client {
     int thread_id;
     struct clusterNode *cluster_node;
     int slots_last_update;
+    /* Open-loop (--rps) mode state. Requests are sent at the scheduled time
+     * even if the replies of the previous ones were not received, and the
+     * latency is measured from the scheduled time, not from the time the
+     * request was actually written. */
+    double next_send;       /* Scheduled time of the next request (us). */
+    long long *intended;    /* Ring of scheduled times of pending requests */
+    size_t intended_head;   /* Index of the oldest pending request. */
+    size_t intended_len;    /* Number of pending requests. */
+    size_t intended_size;   /* Allocated slots in 'intended'. */
+    sds sendbuf;            /* Requests not yet written to the socket. */
+    int prefix_sent;        /* True if the prefix commands were queued. */
+    long long timer_id;     /* Time event sending the scheduled requests. */
+    /* Workload mode: ring of the commands of the pending requests, as
+     * indexes in the command mix of the current phase. */
+    int *wl_cmds;
+    size_t wl_head, wl_len, wl_size;
 } *client;
 
 /* Threads. */
@@ -186,10 +220,46 @@ typedef struct redisConfig {
     sds appendonly;
 } redisConfig;
 
+/* Workload. */
+typedef struct workloadCommand {
+    sds title;          /* The command template, as shown in the report. */
+    int argc;
+    sds *argv;
+    int *argtype;       /* WORKLOAD_ARG_* for every argument. */
+    double weight;
+    struct hdr_histogram *histogram;
+} workloadCommand;
+
+typedef struct workloadPhase {
+    sds name;
+    int requests;
+    int rps;            /* Open-loop rate, or 0 for closed-loop clients. */
+    long long keyspace;
+    sds key_prefix;
+    int dist;           /* WORKLOAD_DIST_* */
+    double dist_param[2];
+    double zipf_hx1, zipf_hn, zipf_sc; /* Precomputed zipf sampler state. */
+    int numsizes;
+    size_t sizes[WORKLOAD_MAX_SIZES];
+    double size_weights[WORKLOAD_MAX_SIZES]; /* Cumulative. */
+    int numcmds;
+    workloadCommand *cmds;
+    double *cmd_weights; /* Cumulative. */
+    int inherited_cmds; /* True until the phase defines its own commands. */
+} workloadPhase;
+
+typedef struct workload {
+    int numphases;
+    workloadPhase **phases;
+    workloadPhase *current;
+    char *valuebuf;     /* Shared by all the __value__ arguments. */
+} workload;
+
 /* Prototypes */
 char *redisGitSHA1(void);
 char *redisGitDirty(void);
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 static void createMissingClients(client c);
 static benchmarkThread *createBenchmarkThread(int index);
 static void freeBenchmarkThread(benchmarkThread *thread);
@@ -203,6 +273,8 @@ static redisContext *getRedisContext(const char *ip, int port,
 static void freeRedisConfig(redisConfig *cfg);
 static int fetchClusterSlotsConfiguration(client c);
 static void updateClusterSlotsConfiguration();
+static sds workloadAppendRequest(client c, sds buf);
+static void workloadRecordReply(client c, long long latency);
 int showThroughput(struct aeEventLoop *eventLoop, long long id,
                    void *clientData);
 
@@ -390,6 +462,7 @@ static void freeClient(client c) {
     listNode *ln;
     aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
     aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
+    if (c->timer_id != -1) aeDeleteTimeEvent(el,c->timer_id);
     if (c->thread_id >= 0) {
         int requests_finished = 0;
         atomicGet(config.requests_finished, requests_finished);
@@ -401,6 +474,9 @@ static void freeClient(client c) {
     sdsfree(c->obuf);
     zfree(c->randptr);
     zfree(c->stagptr);
+    zfree(c->intended);
+    zfree(c->wl_cmds);
+    sdsfree(c->sendbuf);
     zfree(c);
     if (config.num_threads) pthread_mutex_lock(&(config.liveclients_mutex));
     config.liveclients--;
@@ -504,7 +580,7 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     /* Calculate latency only for the first read event. This means that the
      * server already sent the reply and we need to parse it. Parsing overhead
      * is not part of the latency, so calculate it only once, here. */
-    if (c->latency < 0) c->latency = ustime()-(c->start);
+    if (!config.rps && c->latency < 0) c->latency = ustime()-(c->start);
 
     if (redisBufferRead(c->context) != REDIS_OK) {
         fprintf(stderr,"Error: %s\n",c->context->errstr);
@@ -578,25 +654,42 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                 }
                 int requests_finished = 0;
                 atomicGetIncr(config.requests_finished, requests_finished, 1);
+                long long latency = c->latency;
+                if (config.rps) {
+                    /* Replies arrive in order, so this is the reply of the
+                     * oldest pending request. */
+                    latency = ustime()-c->intended[c->intended_head];
+                    c->intended_head = (c->intended_head+1) % c->intended_size;
+                    c->intended_len--;
+                }
+                if (config.workload && requests_finished < config.requests)
+                    workloadRecordReply(c,latency);
                 if (requests_finished < config.requests){
                         if (config.num_threads == 0) {
                             hdr_record_value(
                             config.latency_histogram,  // Histogram to record to
-                            (long)c->latency<=CONFIG_LATENCY_HISTOGRAM_MAX_VALUE ? (long)c->latency : CONFIG_LATENCY_HISTOGRAM_MAX_VALUE);  // Value to record
+                            (long)latency<=CONFIG_LATENCY_HISTOGRAM_MAX_VALUE ? (long)latency : CONFIG_LATENCY_HISTOGRAM_MAX_VALUE);  // Value to record
                             hdr_record_value(
                             config.current_sec_latency_histogram,  // Histogram to record to
-                            (long)c->latency<=CONFIG_LATENCY_HISTOGRAM_INSTANT_MAX_VALUE ? (long)c->latency : CONFIG_LATENCY_HISTOGRAM_INSTANT_MAX_VALUE);  // Value to record
+                            (long)latency<=CONFIG_LATENCY_HISTOGRAM_INSTANT_MAX_VALUE ? (long)latency : CONFIG_LATENCY_HISTOGRAM_INSTANT_MAX_VALUE);  // Value to record
                         } else {
                             hdr_record_value_atomic(
                             config.latency_histogram,  // Histogram to record to
-                            (long)c->latency<=CONFIG_LATENCY_HISTOGRAM_MAX_VALUE ? (long)c->latency : CONFIG_LATENCY_HISTOGRAM_MAX_VALUE);  // Value to record
+                            (long)latency<=CONFIG_LATENCY_HISTOGRAM_MAX_VALUE ? (long)latency : CONFIG_LATENCY_HISTOGRAM_MAX_VALUE);  // Value to record
                             hdr_record_value_atomic(
                             config.current_sec_latency_histogram,  // Histogram to record to
-                            (long)c->latency<=CONFIG_LATENCY_HISTOGRAM_INSTANT_MAX_VALUE ? (long)c->latency : CONFIG_LATENCY_HISTOGRAM_INSTANT_MAX_VALUE);  // Value to record
+                            (long)latency<=CONFIG_LATENCY_HISTOGRAM_INSTANT_MAX_VALUE ? (long)latency : CONFIG_LATENCY_HISTOGRAM_INSTANT_MAX_VALUE);  // Value to record
                         }
                 }
                 c->pending--;
-                if (c->pending == 0) {
+                if (config.rps) {
+                    /* In open-loop mode the client is never reset, it just
+                     * goes on sending requests at the scheduled rate. */
+                    if (requests_finished+1 >= config.requests) {
+                        clientDone(c);
+                        break;
+                    }
+                } else if (c->pending == 0) {
                     clientDone(c);
                     break;
                 }
@@ -623,6 +716,13 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
 
         /* Really initialize: randomize keys and set start time. */
+        if (config.workload) {
+            /* Generate a new pipeline of requests, keeping the prefix. */
+            sdssetlen(c->obuf,c->prefixlen);
+            c->obuf[c->prefixlen] = '\0';
+            for (int j = 0; j < config.pipeline; j++)
+                c->obuf = workloadAppendRequest(c,c->obuf);
+        }
         if (config.randomkeys) randomizeClientKey(c);
         if (config.cluster_mode && c->staglen > 0) setClusterKeyHashTag(c);
         atomicGet(config.slots_last_update, c->slots_last_update);
@@ -653,6 +753,89 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Write as much as possible of the requests accumulated by the open-loop
+ * scheduler, installing a writable handler to flush the rest later. */
+static void rpsWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client c = privdata;
+    UNUSED(fd);
+    UNUSED(mask);
+
+    while (sdslen(c->sendbuf)) {
+        ssize_t nwritten = cliWriteConn(c->context,c->sendbuf,
+                                        sdslen(c->sendbuf));
+        if (nwritten == -1) {
+            if (errno == EAGAIN) break;
+            if (errno != EPIPE)
+                fprintf(stderr, "Error writing to the server: %s\n", strerror(errno));
+            freeClient(c);
+            return;
+        }
+        sdsrange(c->sendbuf,nwritten,-1);
+    }
+    if (sdslen(c->sendbuf))
+        aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,rpsWriteHandler,c);
+    else
+        aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+}
+
+/* Open-loop scheduler: queue every request whose scheduled time is due,
+ * regardless of the replies still pending, so that a slow server can't
+ * slow down the rate at which requests are generated (the "coordinated
+ * omission" problem of the closed-loop mode). */
+static int rpsSendHandler(aeEventLoop *el, long long id, void *privdata) {
+    client c = privdata;
+    const double interval = 1e6*config.numclients/config.rps;
+    long long now = ustime();
+    UNUSED(id);
+
+    /* The AUTH/SELECT prefix is sent along with the first request. */
+    if (!c->prefix_sent && c->next_send <= now) {
+        c->sendbuf = sdscatlen(c->sendbuf,c->obuf,c->prefixlen);
+        c->prefix_sent = 1;
+    }
+    while (c->next_send <= now) {
+        int requests_issued = 0;
+        atomicGetIncr(config.requests_issued, requests_issued, 1);
+        if (requests_issued >= config.requests) {
+            c->timer_id = -1;
+            rpsWriteHandler(el,c->context->fd,c,0);
+            return AE_NOMORE;
+        }
+        if (config.workload) {
+            c->sendbuf = workloadAppendRequest(c,c->sendbuf);
+        } else {
+            if (config.randomkeys) randomizeClientKey(c);
+            if (config.cluster_mode && c->staglen > 0) setClusterKeyHashTag(c);
+            c->sendbuf = sdscatlen(c->sendbuf,c->obuf+c->prefixlen,
+                                   sdslen(c->obuf)-c->prefixlen);
+        }
+
+        if (c->intended_len == c->intended_size) {
+            size_t newsize = c->intended_size ? c->intended_size*2 : 16;
+            long long *ring = zmalloc(sizeof(long long)*newsize);
+            for (size_t j = 0; j < c->intended_len; j++)
+                ring[j] = c->intended[(c->intended_head+j) % c->intended_size];
+            zfree(c->intended);
+            c->intended = ring;
+            c->intended_head = 0;
+            c->intended_size = newsize;
+        }
+        c->intended[(c->intended_head+c->intended_len) % c->intended_size] =
+            (long long)c->next_send;
+        c->intended_len++;
+        c->pending++;
+        c->next_send += interval;
+    }
+    atomicGet(config.slots_last_update, c->slots_last_update);
+    rpsWriteHandler(el,c->context->fd,c,0);
+
+    /* Timers have millisecond resolution: when the next request is due in
+     * less than one millisecond we are called again at the next iteration
+     * of the event loop. */
+    long long wait = (long long)c->next_send - ustime();
+    return wait >= 1000 ? wait/1000 : 0;
+}
+
 /* Create a benchmark client, configured to send the command passed as 'cmd' of
  * 'len' bytes.
  *
@@ -776,6 +959,13 @@ static client createClient(char *cmd, size_t len, client from, int thread_id) {
     c->randlen = 0;
     c->stagptr = NULL;
     c->staglen = 0;
+    c->intended = NULL;
+    c->intended_head = c->intended_len = c->intended_size = 0;
+    c->sendbuf = sdsempty();
+    c->prefix_sent = 0;
+    c->timer_id = -1;
+    c->wl_cmds = NULL;
+    c->wl_head = c->wl_len = c->wl_size = 0;
 
     /* Find substrings in the output buffer that need to be randomized. */
     if (config.randomkeys) {
@@ -842,8 +1032,19 @@ static client createClient(char *cmd, size_t len, client from, int thread_id) {
         benchmarkThread *thread = config.threads[thread_id];
         el = thread->el;
     }
-    if (config.idlemode == 0)
+    if (config.idlemode == 0 && config.rps) {
+        /* Requests are written by the scheduler, only the prefix commands
+         * are pending. Every client starts at a random phase of its
+         * interval to avoid sending all the requests in lockstep. */
+        double interval = 1e6*config.numclients/config.rps;
+        c->pending = c->prefix_pending;
+        c->latency = 0;
+        c->next_send = ustime() + interval*((double)random()/RAND_MAX);
+        c->timer_id = aeCreateTimeEvent(el,0,rpsSendHandler,c,NULL);
+        aeCreateFileEvent(el,c->context->fd,AE_READABLE,readHandler,c);
+    } else if (config.idlemode == 0) {
         aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
+    }
     listAddNodeTail(config.clients,c);
     atomicIncr(config.liveclients, 1);
     atomicGet(config.slots_last_update, c->slots_last_update);
@@ -882,7 +1083,10 @@ static void showLatencyReport(void) {
         printf("  %d requests completed in %.2f seconds\n", config.requests_finished,
             (float)config.totlatency/1000);
         printf("  %d parallel clients\n", config.numclients);
-        printf("  %d bytes payload\n", config.datasize);
+        if (config.workload)
+            printf("  workload: %s\n", config.workload_file);
+        else
+            printf("  %d bytes payload\n", config.datasize);
         printf("  keep alive: %d\n", config.keepalive);
         if (config.cluster_mode) {
             printf("  cluster mode: yes (%d masters)\n",
@@ -908,6 +1112,9 @@ static void showLatencyReport(void) {
         printf("  multi-thread: %s\n", (config.num_threads ? "yes" : "no"));
         if (config.num_threads)
             printf("  threads: %d\n", config.num_threads);
+        if (config.rps)
+            printf("  open-loop: %d requests per second, latency measured "
+                   "from the scheduled send time\n", config.rps);
 
         printf("\n");
         printf("Latency by percentile distribution:\n");
@@ -948,6 +1155,8 @@ static void showLatencyReport(void) {
         printf("\n");
         printf("Summary:\n");
         printf("  throughput summary: %.2f requests per second\n", reqpersec);
+        if (config.rps)
+            printf("  target throughput: %d requests per second\n", config.rps);
         printf("  latency summary (msec):\n");
         printf("    %9s %9s %9s %9s %9s %9s\n", "avg", "min", "p50", "p95", "p99", "max");
         printf("    %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", avg, p0, p50, p95, p99, p100);
@@ -959,6 +1168,29 @@ static void showLatencyReport(void) {
     }
 }
 
+/* Write the latency distribution of the current test in the HdrHistogram
+ * percentile format (values in milliseconds) to <prefix><title>.hgrm, so
+ * that runs can be compared with the usual HdrHistogram plotting tools. */
+static void writeLatencyHistogramFile(void) {
+    sds filename = sdsnew(config.hdr_prefix);
+    const char *p;
+    FILE *fp;
+
+    for (p = config.title; *p && p-config.title < 64; p++) {
+        if (isalnum((unsigned char)*p)) filename = sdscatlen(filename,p,1);
+        else if (*p == ' ') break;
+        else filename = sdscatlen(filename,"_",1);
+    }
+    filename = sdscat(filename,".hgrm");
+    if ((fp = fopen(filename,"w")) == NULL) {
+        fprintf(stderr,"Can't open %s: %s\n",filename,strerror(errno));
+    } else {
+        hdr_percentiles_print(config.latency_histogram,fp,5,1000.0,CLASSIC);
+        fclose(fp);
+    }
+    sdsfree(filename);
+}
+
 static void initBenchmarkThreads() {
     int i;
     if (config.threads) freeBenchmarkThreads();
@@ -1013,6 +1245,7 @@ static void benchmark(char *title, char *cmd, int len) {
     config.totlatency = mstime()-config.start;
 
     showLatencyReport();
+    if (config.hdr_prefix) writeLatencyHistogramFile();
     freeAllClients();
     if (config.threads) freeBenchmarkThreads();
     if (config.current_sec_latency_histogram) hdr_close(config.current_sec_latency_histogram);
@@ -1052,6 +1285,455 @@ static void *execBenchmarkThread(void *ptr) {
     return NULL;
 }
 
+/* Workload functions.
+ *
+ * A workload file describes the traffic to generate as a mix of command
+ * templates, each with its weight, using a key distribution and a value
+ * size histogram, optionally split into phases run one after the other.
+ * The format is line oriented, '#' starts a comment:
+ *
+ *   keyspace 100000
+ *   distribution zipf 0.99
+ *   value-size 32 70 512 25 4096 5
+ *   command 80 GET __key__
+ *   command 20 SET __key__ __value__
+ *   phase warmup 100000
+ *   distribution sequential
+ *   command 1 SET __key__ __value__
+ *   phase steady 1000000
+ *
+ * Directives before the first "phase" line are the defaults inherited by
+ * every phase, the ones following it only apply to that phase (the first
+ * "command" of a phase replaces the inherited command mix). Every
+ * __key__ argument is replaced by a key drawn from the distribution, and
+ * every __value__ argument by a value of a size drawn from the histogram. */
+
+static void workloadError(const char *filename, int linenum, const char *err) {
+    fprintf(stderr, "Error in workload file %s, line %d: %s\n",
+            filename, linenum, err);
+    exit(1);
+}
+
+static workloadPhase *workloadCreatePhase(const char *name, workloadPhase *from) {
+    workloadPhase *p = zcalloc(sizeof(*p));
+    p->name = sdsnew(name);
+    if (from) {
+        p->requests = from->requests;
+        p->rps = from->rps;
+        p->keyspace = from->keyspace;
+        p->key_prefix = sdsdup(from->key_prefix);
+        p->dist = from->dist;
+        p->dist_param[0] = from->dist_param[0];
+        p->dist_param[1] = from->dist_param[1];
+        p->numsizes = from->numsizes;
+        memcpy(p->sizes,from->sizes,sizeof(p->sizes));
+        memcpy(p->size_weights,from->size_weights,sizeof(p->size_weights));
+        p->numcmds = from->numcmds;
+        p->cmds = zmalloc(sizeof(workloadCommand)*from->numcmds);
+        for (int j = 0; j < from->numcmds; j++) p->cmds[j] = from->cmds[j];
+        p->inherited_cmds = 1;
+    } else {
+        p->requests = config.requests;
+        p->rps = config.rps;
+        p->keyspace = config.randomkeys_keyspacelen ?
+                      config.randomkeys_keyspacelen : 100000;
+        p->key_prefix = sdsnew("key:");
+        p->dist = WORKLOAD_DIST_UNIFORM;
+        p->numsizes = 1;
+        p->sizes[0] = config.datasize;
+        p->size_weights[0] = 1;
+    }
+    return p;
+}
+
+/* Zipf distribution sampler using rejection-inversion (Hörmann and
+ * Derflinger, "Rejection-inversion to generate variates from monotone
+ * discrete distributions"): it needs O(1) memory and time per sample
+ * regardless of the keyspace size. */
+static double zipfHelper1(double x) {
+    return fabs(x) > 1e-8 ? log1p(x)/x : 1-x*(0.5-x*(1.0/3-0.25*x));
+}
+
+static double zipfHelper2(double x) {
+    return fabs(x) > 1e-8 ? expm1(x)/x : 1+x*0.5*(1+x/3*(1+0.25*x));
+}
+
+static double zipfH(double s, double x) {
+    return exp(-s*log(x));
+}
+
+static double zipfHIntegral(double s, double x) {
+    double logx = log(x);
+    return zipfHelper2((1-s)*logx)*logx;
+}
+
+static double zipfHIntegralInverse(double s, double x) {
+    double t = x*(1-s);
+    if (t < -1) t = -1;
+    return exp(zipfHelper1(t)*x);
+}
+
+static void workloadInitZipf(workloadPhase *p) {
+    double s = p->dist_param[0];
+    p->zipf_hx1 = zipfHIntegral(s,1.5)-1;
+    p->zipf_hn = zipfHIntegral(s,p->keyspace+0.5);
+    p->zipf_sc = 2-zipfHIntegralInverse(s,zipfHIntegral(s,2.5)-zipfH(s,2));
+}
+
+/* Uniform double in [0,1). random() is used since it is thread safe. */
+static double workloadRandom(void) {
+    return (double)random()/((double)RAND_MAX+1);
+}
+
+static unsigned long long workloadRandomIndex(unsigned long long n) {
+    unsigned long long r = ((unsigned long long)random() << 31) | random();
+    return r % n;
+}
+
+static unsigned long long workloadNextKey(workloadPhase *p) {
+    unsigned long long n = p->keyspace;
+
+    switch(p->dist) {
+    case WORKLOAD_DIST_SEQUENTIAL: {
+        long long seq;
+        atomicGetIncr(config.workload_seq, seq, 1);
+        return seq % n;
+    }
+    case WORKLOAD_DIST_ZIPF: {
+        double s = p->dist_param[0];
+        while (1) {
+            double u = p->zipf_hn+workloadRandom()*(p->zipf_hx1-p->zipf_hn);
+            double x = zipfHIntegralInverse(s,u);
+            long long k = (long long)(x+0.5);
+            if (k < 1) k = 1;
+            else if ((unsigned long long)k > n) k = n;
+            if (k-x <= p->zipf_sc || u >= zipfHIntegral(s,k+0.5)-zipfH(s,k))
+                return k-1;
+        }
+    }
+    case WORKLOAD_DIST_HOTSPOT: {
+        unsigned long long hot = n*p->dist_param[0];
+        if (hot == 0) hot = 1;
+        if (hot >= n || workloadRandom() < p->dist_param[1])
+            return workloadRandomIndex(hot);
+        return hot+workloadRandomIndex(n-hot);
+    }
+    default:
+        return workloadRandomIndex(n);
+    }
+}
+
+/* Pick an index in an array of cumulative weights. */
+static int workloadPickWeighted(double *cumulative, int count) {
+    double r = workloadRandom()*cumulative[count-1];
+    int j;
+    for (j = 0; j < count-1; j++)
+        if (r < cumulative[j]) break;
+    return j;
+}
+
+/* Append to 'buf' a request generated by the current phase, and remember
+ * its command so that the latency of the reply is accounted to it. */
+static sds workloadAppendRequest(client c, sds buf) {
+    workloadPhase *p = config.workload->current;
+    int cmdidx = workloadPickWeighted(p->cmd_weights,p->numcmds);
+    workloadCommand *cmd = p->cmds+cmdidx;
+    char keys[WORKLOAD_MAX_ARGS][128];
+    const char *argv[WORKLOAD_MAX_ARGS];
+    size_t argvlen[WORKLOAD_MAX_ARGS];
+    char *req;
+    int len;
+
+    for (int j = 0; j < cmd->argc; j++) {
+        if (cmd->argtype[j] == WORKLOAD_ARG_KEY) {
+            argvlen[j] = snprintf(keys[j],sizeof(keys[j]),"%s%012llu",
+                                  p->key_prefix,workloadNextKey(p));
+            if (argvlen[j] >= sizeof(keys[j])) argvlen[j] = sizeof(keys[j])-1;
+            argv[j] = keys[j];
+        } else if (cmd->argtype[j] == WORKLOAD_ARG_VALUE) {
+            argvlen[j] = p->sizes[workloadPickWeighted(p->size_weights,
+                                                       p->numsizes)];
+            argv[j] = config.workload->valuebuf;
+        } else {
+            argvlen[j] = sdslen(cmd->argv[j]);
+            argv[j] = cmd->argv[j];
+        }
+    }
+    len = redisFormatCommandArgv(&req,cmd->argc,argv,argvlen);
+    buf = sdscatlen(buf,req,len);
+    free(req);
+
+    if (c->wl_len == c->wl_size) {
+        size_t newsize = c->wl_size ? c->wl_size*2 : 16;
+        int *ring = zmalloc(sizeof(int)*newsize);
+        for (size_t j = 0; j < c->wl_len; j++)
+            ring[j] = c->wl_cmds[(c->wl_head+j) % c->wl_size];
+        zfree(c->wl_cmds);
+        c->wl_cmds = ring;
+        c->wl_head = 0;
+        c->wl_size = newsize;
+    }
+    c->wl_cmds[(c->wl_head+c->wl_len) % c->wl_size] = cmdidx;
+    c->wl_len++;
+    return buf;
+}
+
+/* Account the latency of a reply to the command that generated it. */
+static void workloadRecordReply(client c, long long latency) {
+    workloadPhase *p = config.workload->current;
+    if (c->wl_len == 0) return;
+    workloadCommand *cmd = p->cmds+c->wl_cmds[c->wl_head];
+    c->wl_head = (c->wl_head+1) % c->wl_size;
+    c->wl_len--;
+
+    if (latency > CONFIG_LATENCY_HISTOGRAM_MAX_VALUE)
+        latency = CONFIG_LATENCY_HISTOGRAM_MAX_VALUE;
+    if (config.num_threads)
+        hdr_record_value_atomic(cmd->histogram,latency);
+    else
+        hdr_record_value(cmd->histogram,latency);
+}
+
+static void workloadParseLine(workloadPhase *p, sds *argv, int argc,
+                              const char *filename, int linenum)
+{
+    char *eptr;
+
+    if (!strcasecmp(argv[0],"requests") && argc == 2) {
+        p->requests = strtol(argv[1],&eptr,10);
+        if (*eptr || p->requests <= 0)
+            workloadError(filename,linenum,"Invalid number of requests");
+    } else if (!strcasecmp(argv[0],"rps") && argc == 2) {
+        errno = 0;
+        long rps = strtol(argv[1],&eptr,10);
+        if (eptr == argv[1] || *eptr || errno || rps < 0 || rps > INT_MAX)
+            workloadError(filename,linenum,"Invalid rate");
+        p->rps = rps;
+    } else if (!strcasecmp(argv[0],"keyspace") && argc == 2) {
+        p->keyspace = strtoll(argv[1],&eptr,10);
+        if (*eptr || p->keyspace <= 0)
+            workloadError(filename,linenum,"Invalid keyspace size");
+    } else if (!strcasecmp(argv[0],"key-prefix") && argc == 2) {
+        sdsfree(p->key_prefix);
+        p->key_prefix = sdsdup(argv[1]);
+        if (sdslen(p->key_prefix) > 64)
+            workloadError(filename,linenum,"Key prefix too long");
+    } else if (!strcasecmp(argv[0],"distribution") && argc >= 2) {
+        if (!strcasecmp(argv[1],"uniform") && argc == 2) {
+            p->dist = WORKLOAD_DIST_UNIFORM;
+        } else if (!strcasecmp(argv[1],"sequential") && argc == 2) {
+            p->dist = WORKLOAD_DIST_SEQUENTIAL;
+        } else if (!strcasecmp(argv[1],"zipf") && argc == 3) {
+            p->dist = WORKLOAD_DIST_ZIPF;
+            p->dist_param[0] = strtod(argv[2],&eptr);
+            if (*eptr || p->dist_param[0] <= 0)
+                workloadError(filename,linenum,"Zipf exponent must be > 0");
+        } else if (!strcasecmp(argv[1],"hotspot") && argc == 4) {
+            p->dist = WORKLOAD_DIST_HOTSPOT;
+            for (int j = 0; j < 2; j++) {
+                p->dist_param[j] = strtod(argv[2+j],&eptr);
+                if (*eptr || p->dist_param[j] < 0 || p->dist_param[j] > 1)
+                    workloadError(filename,linenum,
+                        "Hotspot fractions must be between 0 and 1");
+            }
+        } else {
+            workloadError(filename,linenum,"Invalid distribution, use "
+                "uniform, sequential, zipf <exponent> or "
+                "hotspot <keys-fraction> <requests-fraction>");
+        }
+    } else if (!strcasecmp(argv[0],"value-size") && argc >= 2) {
+        if (argc != 2 && argc % 2 != 1)
+            workloadError(filename,linenum,"Sizes and weights must be paired");
+        p->numsizes = 0;
+        for (int j = 1; j < argc; j += 2) {
+            long long size = strtoll(argv[j],&eptr,10);
+            double weight = 1;
+            if (*eptr || size < 0 || size > 1024*1024*1024)
+                workloadError(filename,linenum,"Invalid value size");
+            if (argc > 2) {
+                weight = strtod(argv[j+1],&eptr);
+                if (*eptr || weight <= 0)
+                    workloadError(filename,linenum,"Invalid weight");
+            }
+            if (p->numsizes == WORKLOAD_MAX_SIZES)
+                workloadError(filename,linenum,"Too many value sizes");
+            p->sizes[p->numsizes] = size;
+            p->size_weights[p->numsizes] = weight +
+                (p->numsizes ? p->size_weights[p->numsizes-1] : 0);
+            p->numsizes++;
+        }
+    } else if (!strcasecmp(argv[0],"command") && argc >= 3) {
+        workloadCommand *cmd;
+        double weight = strtod(argv[1],&eptr);
+
+        if (*eptr || weight <= 0)
+            workloadError(filename,linenum,"Invalid weight");
+        if (argc-2 > WORKLOAD_MAX_ARGS)
+            workloadError(filename,linenum,"Too many arguments");
+        if (p->inherited_cmds) {
+            p->numcmds = 0;
+            p->inherited_cmds = 0;
+        }
+        p->cmds = zrealloc(p->cmds,sizeof(workloadCommand)*(p->numcmds+1));
+        cmd = p->cmds+p->numcmds++;
+        cmd->weight = weight;
+        cmd->argc = argc-2;
+        cmd->argv = zmalloc(sizeof(sds)*cmd->argc);
+        cmd->argtype = zmalloc(sizeof(int)*cmd->argc);
+        cmd->title = sdsempty();
+        cmd->histogram = NULL;
+        for (int j = 0; j < cmd->argc; j++) {
+            cmd->argv[j] = sdsdup(argv[j+2]);
+            if (!strcmp(cmd->argv[j],"__key__"))
+                cmd->argtype[j] = WORKLOAD_ARG_KEY;
+            else if (!strcmp(cmd->argv[j],"__value__"))
+                cmd->argtype[j] = WORKLOAD_ARG_VALUE;
+            else
+                cmd->argtype[j] = WORKLOAD_ARG_LITERAL;
+            cmd->title = sdscatfmt(cmd->title,j ? " %S" : "%S",cmd->argv[j]);
+        }
+    } else {
+        workloadError(filename,linenum,"Bad directive or wrong number of arguments");
+    }
+}
+
+/* Load the workload file, exiting with an error if it is not valid. */
+static void loadWorkload(const char *filename) {
+    FILE *fp = fopen(filename,"r");
+    workload *wl = zcalloc(sizeof(*wl));
+    workloadPhase *defaults, *p;
+    char buf[4096];
+    int linenum = 0;
+    size_t maxsize = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr,"Can't open workload file %s: %s\n",filename,
+                strerror(errno));
+        exit(1);
+    }
+    defaults = p = workloadCreatePhase("workload",NULL);
+    while(fgets(buf,sizeof(buf),fp) != NULL) {
+        int argc;
+        sds *argv;
+        sds line = sdstrim(sdsnew(buf)," \t\r\n");
+
+        linenum++;
+        if (line[0] == '#' || line[0] == '\0') {
+            sdsfree(line);
+            continue;
+        }
+        argv = sdssplitargs(line,&argc);
+        if (argv == NULL)
+            workloadError(filename,linenum,"Unbalanced quotes");
+        if (!strcasecmp(argv[0],"phase") && (argc == 2 || argc == 3)) {
+            p = workloadCreatePhase(argv[1],defaults);
+            if (argc == 3) {
+                char *eptr;
+                p->requests = strtol(argv[2],&eptr,10);
+                if (*eptr || p->requests <= 0)
+                    workloadError(filename,linenum,"Invalid number of requests");
+            }
+            wl->phases = zrealloc(wl->phases,
+                                  sizeof(workloadPhase*)*(wl->numphases+1));
+            wl->phases[wl->numphases++] = p;
+        } else {
+            workloadParseLine(p,argv,argc,filename,linenum);
+        }
+        sdsfreesplitres(argv,argc);
+        sdsfree(line);
+    }
+    fclose(fp);
+
+    /* No phases: the whole file describes a single one. */
+    if (wl->numphases == 0) {
+        wl->phases = zmalloc(sizeof(workloadPhase*));
+        wl->phases[wl->numphases++] = defaults;
+    }
+    for (int j = 0; j < wl->numphases; j++) {
+        p = wl->phases[j];
+        if (p->numcmds == 0) {
+            fprintf(stderr,"Error in workload file %s: no commands in "
+                           "phase '%s'\n", filename, p->name);
+            exit(1);
+        }
+        if (p->rps && config.pipeline > 1) {
+            fprintf(stderr,"Error in workload file %s: phase '%s' sets a "
+                           "rate, that can't be used together with -P\n",
+                           filename, p->name);
+            exit(1);
+        }
+        p->cmd_weights = zmalloc(sizeof(double)*p->numcmds);
+        for (int i = 0; i < p->numcmds; i++)
+            p->cmd_weights[i] = p->cmds[i].weight +
+                                (i ? p->cmd_weights[i-1] : 0);
+        if (p->dist == WORKLOAD_DIST_ZIPF) workloadInitZipf(p);
+        for (int i = 0; i < p->numsizes; i++)
+            if (p->sizes[i] > maxsize) maxsize = p->sizes[i];
+    }
+    wl->valuebuf = zmalloc(maxsize+1);
+    memset(wl->valuebuf,'x',maxsize);
+    wl->valuebuf[maxsize] = '\0';
+    config.workload = wl;
+}
+
+/* Report the latency of every command of the phase that just completed. */
+static void showWorkloadCommandsReport(workloadPhase *p) {
+    if (!config.quiet && !config.csv) {
+        printf("Latency by command (msec):\n");
+        printf("  %9s %9s %9s %9s %9s %9s  %s\n",
+               "calls", "avg", "p50", "p95", "p99", "max", "command");
+    }
+    for (int j = 0; j < p->numcmds; j++) {
+        workloadCommand *cmd = p->cmds+j;
+        struct hdr_histogram *h = cmd->histogram;
+        const float avg = hdr_mean(h)/1000.0f;
+        const float p0 = ((float)hdr_min(h))/1000.0f;
+        const float p50 = hdr_value_at_percentile(h,50.0)/1000.0f;
+        const float p95 = hdr_value_at_percentile(h,95.0)/1000.0f;
+        const float p99 = hdr_value_at_percentile(h,99.0)/1000.0f;
+        const float p100 = ((float)hdr_max(h))/1000.0f;
+        const float reqpersec = (float)h->total_count /
+                                ((float)config.totlatency/1000.0f);
+
+        if (config.csv) {
+            printf("\"%s: %s\",\"%.2f\",\"%.3f\",\"%.3f\",\"%.3f\",\"%.3f\","
+                   "\"%.3f\",\"%.3f\"\n", p->name, cmd->title, reqpersec,
+                   avg, p0, p50, p95, p99, p100);
+        } else if (config.quiet) {
+            printf("  %s: %.2f requests per second, p50=%.3f msec\n",
+                   cmd->title, reqpersec, p50);
+        } else {
+            printf("  %9lld %9.3f %9.3f %9.3f %9.3f %9.3f  %s\n",
+                   (long long)h->total_count, avg, p50, p95, p99, p100,
+                   cmd->title);
+        }
+    }
+}
+
+/* Run all the phases of the workload, in order. */
+static void runWorkload(void) {
+    workload *wl = config.workload;
+    int rps = config.rps;
+
+    for (int j = 0; j < wl->numphases; j++) {
+        workloadPhase *p = wl->phases[j];
+
+        for (int i = 0; i < p->numcmds; i++) {
+            if (p->cmds[i].histogram) hdr_close(p->cmds[i].histogram);
+            hdr_init(CONFIG_LATENCY_HISTOGRAM_MIN_VALUE,
+                     CONFIG_LATENCY_HISTOGRAM_MAX_VALUE,
+                     config.precision, &p->cmds[i].histogram);
+        }
+        wl->current = p;
+        config.requests = p->requests;
+        config.rps = p->rps;
+        benchmark(p->name,"",0);
+        showWorkloadCommandsReport(p);
+        if (!config.csv) printf("\n");
+    }
+    config.rps = rps;
+}
+
 /* Cluster helper functions. */
 
 static clusterNode *createClusterNode(char *ip, int port) {
@@ -1506,6 +2188,21 @@ int parseOptions(int argc, const char **argv) {
             config.cluster_mode = 1;
         } else if (!strcmp(argv[i],"--enable-tracking")) {
             config.enable_tracking = 1;
+        } else if (!strcmp(argv[i],"--rps")) {
+            if (lastarg) goto invalid;
+            char *eptr;
+            const char *rate = argv[++i];
+            errno = 0;
+            long rps = strtol(rate,&eptr,10);
+            if (eptr == rate || *eptr || errno || rps <= 0 || rps > INT_MAX)
+                goto invalid;
+            config.rps = rps;
+        } else if (!strcmp(argv[i],"--workload")) {
+            if (lastarg) goto invalid;
+            config.workload_file = argv[++i];
+        } else if (!strcmp(argv[i],"--hdr-file")) {
+            if (lastarg) goto invalid;
+            config.hdr_prefix = strdup(argv[++i]);
         } else if (!strcmp(argv[i],"--help")) {
             exit_status = 0;
             goto usage;
@@ -1567,6 +2264,21 @@ usage:
 " --threads <num>    Enable multi-thread mode.\n"
 " --cluster          Enable cluster mode.\n"
 " --enable-tracking  Send CLIENT TRACKING on before starting benchmark.\n"
+" --rps <rate>       Open-loop mode: send <rate> requests per second in total,\n"
+"                    spread evenly across the clients, without waiting for\n"
+"                    the replies. Latency is measured from the time each\n"
+"                    request was scheduled to be sent, so it is not hidden\n"
+"                    when the server can't keep up with the rate.\n"
+"                    Can't be combined with -P.\n"
+" --workload <file>  Generate the traffic described by a workload file: a\n"
+"                    weighted mix of command templates where __key__ and\n"
+"                    __value__ are replaced by keys drawn from a uniform,\n"
+"                    sequential, zipf or hotspot distribution and values of\n"
+"                    sizes drawn from a histogram, optionally in phases.\n"
+"                    Latency is reported per phase and per command. See\n"
+"                    utils/benchmark-workload.conf for an example.\n"
+" --hdr-file <prefix> Write the latency distribution of every test to\n"
+"                    <prefix><test>.hgrm, in the HdrHistogram format.\n"
 " -k <boolean>       1=keep alive 0=reconnect (default 1)\n"
 " -r <keyspacelen>   Use random keys for SET/GET/INCR, random values for SADD,\n"
 "                    random members and scores for ZADD.\n"
@@ -1575,6 +2287,8 @@ usage:
 "  from 0 to keyspacelen-1. The substitution changes every time a command\n"
 "  is executed. Default tests use this to hit random keys in the\n"
 "  specified range.\n"
+    );
+    printf(
 " -P <numreq>        Pipeline <numreq> requests. Default 1 (no pipeline).\n"
 " -q                 Quiet. Just show query/sec values\n"
 " --precision        Number of decimal places to display in latency output (default 0)\n"
@@ -1605,6 +2319,8 @@ usage:
 #endif
 " --help             Output this help and exit.\n"
 " --version          Output version and exit.\n\n"
+    );
+    printf(
 "Examples:\n\n"
 " Run the benchmark with the default configuration against 127.0.0.1:6379:\n"
 "   $ redis-benchmark\n\n"
@@ -1614,6 +2330,9 @@ usage:
 "   $ redis-benchmark -t set -n 1000000 -r 100000000\n\n"
 " Benchmark 127.0.0.1:6379 for a few commands producing CSV output:\n"
 "   $ redis-benchmark -t ping,set,get -n 100000 --csv\n\n"
+" Measure the latency of SET and GET at a constant rate of 50k requests per\n"
+" second, using 4 threads:\n"
+"   $ redis-benchmark -t set,get -n 500000 --rps 50000 --threads 4\n\n"
 " Benchmark a specific command line:\n"
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
 " Fill a list with 10000 random elements:\n"
@@ -1724,6 +2443,11 @@ int main(int argc, const char **argv) {
     config.is_updating_slots = 0;
     config.slots_last_update = 0;
     config.enable_tracking = 0;
+    config.rps = 0;
+    config.hdr_prefix = NULL;
+    config.workload_file = NULL;
+    config.workload = NULL;
+    config.workload_seq = 0;
 
     i = parseOptions(argc,argv);
     argc -= i;
@@ -1795,6 +2519,22 @@ int main(int argc, const char **argv) {
         printf("WARNING: keepalive disabled, you probably need 'echo 1 > /proc/sys/net/ipv4/tcp_tw_reuse' for Linux and 'sudo sysctl -w net.inet.tcp.msl=1000' for Mac OS X in order to use a lot of clients/requests\n");
     }
 
+    if (config.rps && config.pipeline > 1) {
+        fprintf(stderr, "--rps can't be used together with -P: in open-loop "
+                        "mode requests are pipelined as needed to keep the "
+                        "rate.\n");
+        exit(1);
+    }
+
+    if (config.workload_file) {
+        if (config.cluster_mode || argc) {
+            fprintf(stderr, "--workload can't be used with --cluster or a "
+                            "command line to benchmark.\n");
+            exit(1);
+        }
+        loadWorkload(config.workload_file);
+    }
+
     if (config.idlemode) {
         printf("Creating %d idle connections and waiting forever (Ctrl+C when done)\n", config.numclients);
         int thread_id = -1, use_threads = (config.num_threads > 0);
@@ -1811,6 +2551,16 @@ int main(int argc, const char **argv) {
     if(config.csv){
         printf("\"test\",\"rps\",\"avg_latency_ms\",\"min_latency_ms\",\"p50_latency_ms\",\"p95_latency_ms\",\"p99_latency_ms\",\"max_latency_ms\"\n");
     }
+    /* Run the phases of the workload file. */
+    if (config.workload) {
+        do {
+            runWorkload();
+        } while(config.loop);
+
+        if (config.redis_config != NULL) freeRedisConfig(config.redis_config);
+        return 0;
+    }
+
     /* Run benchmark with command in the remainder of the arguments. */
     if (argc) {
         sds title = sdsnew(argv[0]);
@@ -852,7 +852,7 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
      *
      * 首先要做的就是为客户端输出缓存中创建一个字符串
      */
-    if (listLength(c->reply) == 0 && c->bufpos < PROTO_REPLY_CHUNK_BYTES) {
+    if (listLength(c->reply) == 0 && (size_t)c->bufpos < c->buf_usable_size) {
         /* This is a fast path for the common case of a reply inside the
          * client static buffer. Don't create an SDS string but just use
          * the client buffer directly. */
@@ -105,6 +105,10 @@ typedef struct sentinelAddr {
 #define SENTINEL_ASK_PERIOD 1000
 // 发送 PUBLISH 命令的间隔
 #define SENTINEL_PUBLISH_PERIOD 2000
+// INFO 和 PUBLISH 间隔的最大随机偏移量
+#define SENTINEL_PERIOD_JITTER (SENTINEL_PUBLISH_PERIOD/4)
+// 最近处理过的问候信息缓存的槽数
+#define SENTINEL_HELLO_CACHE_SIZE 4096
 // 默认的判断服务器已下线的时长
 #define SENTINEL_DEFAULT_DOWN_AFTER 30000
 // 默认的信息频道
@@ -279,6 +283,11 @@ typedef struct sentinelRedisInstance {
     // 只在当前实例为 sentinel 时使用
     mstime_t last_pub_time;   /* Last time we sent hello via Pub/Sub. */
 
+    // 从 INFO 和 PUBLISH 的发送间隔中减去的随机偏移量
+    mstime_t period_jitter;   /* Random amount of milliseconds subtracted to
+                                 the INFO and hello periods, so that the
+                                 instances don't stay in lockstep. */
+
     // 最后一次接收到这个 sentinel 发来的问候信息的时间
     // 只在当前实例为 sentinel 时使用
     mstime_t last_hello_time; /* Only used if SRI_SENTINEL is set. Last time
@@ -454,6 +463,11 @@ struct sentinelState {
     char *sentinel_auth_user;    /* Username for ACLs AUTH against other sentinel. */
     int resolve_hostnames;       /* Support use of hostnames, assuming DNS is well configured. */
     int announce_hostnames;      /* Announce hostnames instead of IPs when we have them. */
+    // 最近处理过的问候信息，用于忽略同一信息的其他副本
+    struct {
+        sds payload;             /* Hello message, NULL if the slot is free. */
+        mstime_t time;           /* When it was processed. */
+    } hello_cache[SENTINEL_HELLO_CACHE_SIZE]; /* Recently processed hellos. */
 } sentinel;
 
 /* A script execution job. */
@@ -605,6 +619,7 @@ static int redisAeAttach(aeEventLoop *loop, redisAsyncContext *ac) {
 void sentinelLinkEstablishedCallback(const redisAsyncContext *c, int status);
 void sentinelDisconnectCallback(const redisAsyncContext *c, int status);
 void sentinelReceiveHelloMessages(redisAsyncContext *c, void *reply, void *privdata);
+void sentinelFlushHelloCache(void);
 sentinelRedisInstance *sentinelGetMasterByName(char *name);
 char *sentinelGetSubjectiveLeader(sentinelRedisInstance *master);
 char *sentinelGetObjectiveLeader(sentinelRedisInstance *master);
@@ -1720,7 +1735,10 @@ sentinelRedisInstance *createSentinelRedisInstance(char *name, int flags, char *
     ri->config_epoch = 0;
     ri->addr = addr;
     ri->link = createInstanceLink();
-    ri->last_pub_time = mstime();
+    /* Spread the first hello of the instances created at the same time,
+     * for instance when the config is loaded, over a whole period. */
+    ri->period_jitter = rand() % SENTINEL_PERIOD_JITTER;
+    ri->last_pub_time = mstime() - rand() % SENTINEL_PUBLISH_PERIOD;
     ri->last_hello_time = mstime();
     ri->last_master_down_reply_time = mstime();
     ri->s_down_since_time = 0;
@@ -1767,6 +1785,7 @@ sentinelRedisInstance *createSentinelRedisInstance(char *name, int flags, char *
     /* Add into the right table. */
     // 将实例添加到适当的表中
     dictAdd(table, ri->name, ri);
+    if (flags & SRI_MASTER) sentinelFlushHelloCache();
     // 返回实例
     return ri;
 }
@@ -1990,6 +2009,7 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
 #define SENTINEL_RESET_NO_SENTINELS (1<<0)
         void sentinelResetMaster(sentinelRedisInstance *ri, int flags) {
             serverAssert(ri->flags & SRI_MASTER);
+            sentinelFlushHelloCache();
             dictRelease(ri->slaves);
             ri->slaves = dictCreate(&instancesDictType,NULL);
             if (!(flags & SENTINEL_RESET_NO_SENTINELS)) {
@@ -3111,9 +3131,9 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
         // 从主服务器或者从服务器所返回的 INFO 命令的回复中分析相关信息
         // （上面的英文注释错了，这个函数不仅处理主服务器的 INFO 回复，还处理从服务器的 INFO 回复）
         void sentinelRefreshInstanceInfo(sentinelRedisInstance *ri, const char *info) {
-            sds *lines;
-            int numlines, j;
-            int role = 0;
+            sds buf;
+            char *p, *end;
+            int role = 0, skip = 0;
 
             /* cache full INFO output for instance */
             sdsfree(ri->info);
@@ -3124,16 +3144,41 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
             // 将该变量重置为 0 ，避免 INFO 回复中无该值的情况
             ri->master_link_down_time = 0;
 
-            /* Process line by line. */
-            // 对 INFO 命令的回复进行逐行分析
-            lines = sdssplitlen(info,strlen(info),"\r\n",2,&numlines);
-            for (j = 0; j < numlines; j++) {
+            /* Process line by line. A single copy of the reply is split in
+             * place, and only the "Server" and "Replication" sections are
+             * parsed: the lines of the other sections are skipped as soon as
+             * their header is found. With thousands of monitored instances
+             * this is a large part of the work done by the Sentinel timer. */
+            // 对 INFO 命令的回复进行逐行分析，只分析 Server 和 Replication 两个部分
+            buf = sdsdup(ri->info);
+            p = buf;
+            end = buf+sdslen(buf);
+            while (p < end) {
                 sentinelRedisInstance *slave;
-                sds l = lines[j];
+                char *l = p, *eol = memchr(p,'\n',end-p);
+                size_t llen;
+
+                if (eol) {
+                    p = eol+1;
+                } else {
+                    eol = end;
+                    p = end;
+                }
+                if (eol > l && eol[-1] == '\r') eol--;
+                *eol = '\0';
+                llen = eol-l;
+
+                /* Section header. Old versions have no sections at all. */
+                if (llen && l[0] == '#') {
+                    skip = strcasecmp(l,"# Server") &&
+                           strcasecmp(l,"# Replication");
+                    continue;
+                }
+                if (skip) continue;
 
                 /* run_id:<40 hex chars>*/
                 // 读取并分析 runid
-                if (sdslen(l) >= 47 && !memcmp(l,"run_id:",7)) {
+                if (llen >= 47 && !memcmp(l,"run_id:",7)) {
 
                     // 新设置 runid
                     if (ri->runid == NULL) {
@@ -3153,7 +3198,7 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
                 /* old versions: slave0:<ip>,<port>,<state>
                  * new versions: slave0:ip=127.0.0.1,port=9999,... */
                 if ((ri->flags & SRI_MASTER) &&
-                sdslen(l) >= 7 &&
+                llen >= 7 &&
                 !memcmp(l,"slave",5) && isdigit(l[5]))
                 {
                     char *ip, *port, *end;
@@ -3194,7 +3239,7 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
                 /* master_link_down_since_seconds:<seconds> */
                 // 读取主从服务器的断线时长
                 // 这个只会在实例是从服务器，并且主从连接断开的情况下出现
-                if (sdslen(l) >= 32 &&
+                if (llen >= 32 &&
                 !memcmp(l,"master_link_down_since_seconds",30))
                 {
                     ri->master_link_down_time = strtoll(l+31,NULL,10)*1000;
@@ -3202,15 +3247,15 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
 
                 /* role:<role> */
                 // 读取实例的角色
-                if (sdslen(l) >= 11 && !memcmp(l,"role:master",11)) role = SRI_MASTER;
-                else if (sdslen(l) >= 10 && !memcmp(l,"role:slave",10)) role = SRI_SLAVE;
+                if (llen >= 11 && !memcmp(l,"role:master",11)) role = SRI_MASTER;
+                else if (llen >= 10 && !memcmp(l,"role:slave",10)) role = SRI_SLAVE;
 
                 // 处理从服务器
                 if (role == SRI_SLAVE) {
 
                     /* master_host:<host> */
                     // 读入主服务器的 IP
-                    if (sdslen(l) >= 12 && !memcmp(l,"master_host:",12)) {
+                    if (llen >= 12 && !memcmp(l,"master_host:",12)) {
                         if (ri->slave_master_host == NULL ||
                         strcasecmp(l+12,ri->slave_master_host))
                         {
@@ -3222,7 +3267,7 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
 
                     /* master_port:<port> */
                     // 读入主服务器的端口号
-                    if (sdslen(l) >= 12 && !memcmp(l,"master_port:",12)) {
+                    if (llen >= 12 && !memcmp(l,"master_port:",12)) {
                         int slave_master_port = atoi(l+12);
 
                         if (ri->slave_master_port != slave_master_port) {
@@ -3233,7 +3278,7 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
 
                     /* master_link_status:<status> */
                     // 读入主服务器的状态
-                    if (sdslen(l) >= 19 && !memcmp(l,"master_link_status:",19)) {
+                    if (llen >= 19 && !memcmp(l,"master_link_status:",19)) {
                         ri->slave_master_link_status =
                                 (strcasecmp(l+19,"up") == 0) ?
                                 SENTINEL_MASTER_LINK_STATUS_UP :
@@ -3242,22 +3287,22 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
 
                     /* slave_priority:<priority> */
                     // 读入从服务器的优先级
-                    if (sdslen(l) >= 15 && !memcmp(l,"slave_priority:",15))
+                    if (llen >= 15 && !memcmp(l,"slave_priority:",15))
                         ri->slave_priority = atoi(l+15);
 
                     /* slave_repl_offset:<offset> */
                     // 读入从服务器的复制偏移量
-                    if (sdslen(l) >= 18 && !memcmp(l,"slave_repl_offset:",18))
+                    if (llen >= 18 && !memcmp(l,"slave_repl_offset:",18))
                         ri->slave_repl_offset = strtoull(l+18,NULL,10);
 
                     /* replica_announced:<announcement> */
-                    if (sdslen(l) >= 18 && !memcmp(l,"replica_announced:",18))
+                    if (llen >= 18 && !memcmp(l,"replica_announced:",18))
                         ri->replica_announced = atoi(l+18);
                 }
             }
             // 更新刷新 INFO 命令回复的时间
             ri->info_refresh = mstime();
-            sdsfreesplitres(lines,numlines);
+            sdsfree(buf);
 
             /* ---------------------------- Acting half -----------------------------
              * Some things will not happen if sentinel.tilt is true, but some will
@@ -3498,6 +3543,56 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
             link->last_pong_time = mstime();
         }
 
+        /* The same hello is received several times in a short time: from the
+         * Sentinel that sent it, and via the Hello channel of the master and of
+         * every one of its replicas, that the other Sentinels publish to at
+         * different times. Processing a copy of an hello that was just processed
+         * changes nothing, so the processed hellos are remembered in a direct
+         * mapped cache and their copies received in the next
+         * SENTINEL_HELLO_CACHE_TTL milliseconds are discarded without parsing
+         * them. A cache miss just means the hello is processed again. */
+        #define SENTINEL_HELLO_CACHE_TTL (SENTINEL_PUBLISH_PERIOD-SENTINEL_PERIOD_JITTER)
+
+        static unsigned int sentinelHelloCacheSlot(char *hello, int hello_len) {
+            return dictGenHashFunction(hello,hello_len) &
+                   (SENTINEL_HELLO_CACHE_SIZE-1);
+        }
+
+        int sentinelHelloRecentlyProcessed(char *hello, int hello_len) {
+            unsigned int slot = sentinelHelloCacheSlot(hello,hello_len);
+            sds payload = sentinel.hello_cache[slot].payload;
+
+            return payload && sdslen(payload) == (size_t)hello_len &&
+                   !memcmp(payload,hello,hello_len) &&
+                   mstime() - sentinel.hello_cache[slot].time <
+                   SENTINEL_HELLO_CACHE_TTL;
+        }
+
+        void sentinelHelloProcessed(char *hello, int hello_len) {
+            unsigned int slot = sentinelHelloCacheSlot(hello,hello_len);
+            sds payload = sentinel.hello_cache[slot].payload;
+
+            if (payload && sdslen(payload) == (size_t)hello_len &&
+                !memcmp(payload,hello,hello_len))
+            {
+                sentinel.hello_cache[slot].time = mstime();
+                return;
+            }
+            sdsfree(payload);
+            sentinel.hello_cache[slot].payload = sdsnewlen(hello,hello_len);
+            sentinel.hello_cache[slot].time = mstime();
+        }
+
+        /* Forget the processed hellos, so that the next ones are processed even
+         * if just received. Called when the masters configuration is changed
+         * in a way that makes processing the same hello again meaningful. */
+        void sentinelFlushHelloCache(void) {
+            for (int j = 0; j < SENTINEL_HELLO_CACHE_SIZE; j++) {
+                sdsfree(sentinel.hello_cache[j].payload);
+                sentinel.hello_cache[j].payload = NULL;
+            }
+        }
+
         /* This is called when we get the reply about the PUBLISH command we send
          * to the master to advertise this sentinel. */
         // 处理 PUBLISH 命令的回复
@@ -3534,8 +3629,11 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
              * 5=master_ip,6=master_port,7=master_config_epoch. */
             int numtokens, port, removed, master_port;
             uint64_t current_epoch, master_config_epoch;
-            char **token = sdssplitlen(hello, hello_len, ",", 1, &numtokens);
-            sentinelRedisInstance *si, *master;
+            char **token;
+            sentinelRedisInstance *si = NULL, *master;
+
+            if (sentinelHelloRecentlyProcessed(hello,hello_len)) return;
+            token = sdssplitlen(hello, hello_len, ",", 1, &numtokens);
 
             if (numtokens == 8) {
                 /* Obtain a reference to the master this hello message is about */
@@ -3634,6 +3732,7 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
             }
 
             cleanup:
+            if (si) sentinelHelloProcessed(hello,hello_len);
             sdsfreesplitres(token,numtokens);
         }
 
@@ -3851,7 +3950,7 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
             {
                 info_period = 1000;
             } else {
-                info_period = SENTINEL_INFO_PERIOD;
+                info_period = SENTINEL_INFO_PERIOD - ri->period_jitter;
             }
 
             /* We ping instances every time the last received pong is older than
@@ -3882,7 +3981,9 @@ sentinelRedisInstance *sentinelRedisInstanceLookupSlave(
             }
 
             /* PUBLISH hello messages to all the three kinds of instances. */
-            if ((now - ri->last_pub_time) > SENTINEL_PUBLISH_PERIOD) {
+            if ((now - ri->last_pub_time) >
+                SENTINEL_PUBLISH_PERIOD - ri->period_jitter)
+            {
                 sentinelSendHello(ri);
             }
         }
@@ -5310,9 +5411,6 @@ char *sentinelGetLeader(sentinelRedisInstance *master, uint64_t epoch) {
         // 为目标 Sentinel 选出的领头 Sentinel 增加一票
         if (ri->leader != NULL && ri->leader_epoch == sentinel.current_epoch)
             sentinelLeaderIncr(counters,ri->leader);
-
-        // 统计投票数量
-        voters++;
     }
     dictReleaseIterator(di);
 
@@ -35,6 +35,7 @@
 #include "latency.h"
 #include "atomicvar.h"
 #include "mt19937-64.h"
+#include "hdr_histogram.h"
 
 #include <time.h>
 #include <signal.h>
@@ -1588,9 +1589,10 @@ int incrementallyRehash(int dbid) {
  * to play well with copy-on-write (otherwise when a resize happens lots of
  * memory pages are copied). The goal of this function is to update the ability
  * for dict.c to resize the hash tables accordingly to the fact we have an
- * active fork child running. */
+ * active fork child running. The keyspace analysis child is not tracked in
+ * server.child_pid, but it walks the whole keyspace as well. */
 void updateDictResizePolicy(void) {
-    if (!hasActiveChildProcess())
+    if (!hasActiveChildProcess() && !keyspaceAnalysisInProgress())
         dictEnableResize();
     else
         dictDisableResize();
@@ -1602,6 +1604,7 @@ const char *strChildType(int type) {
         case CHILD_TYPE_AOF: return "AOF";
         case CHILD_TYPE_LDB: return "LDB";
         case CHILD_TYPE_MODULE: return "MODULE";
+        case CHILD_TYPE_ANALYSIS: return "ANALYSIS";
         default: return "Unknown";
     }
 }
@@ -1689,6 +1692,14 @@ int clientsCronResizeQueryBuffer(client *c) {
             c->querybuf = sdsRemoveFreeSpace(c->querybuf);
         }
     }
+    /* Clients with nothing pending read into the shared query buffer (see
+     * readQueryFromClient()), so an empty query buffer that was not read
+     * into since the last check is just wasting memory. */
+    else if (sdslen(c->querybuf) == 0 && c->bulklen == -1 &&
+             c->querybuf_peak == 0 && sdsavail(c->querybuf))
+    {
+        c->querybuf = sdsRemoveFreeSpace(c->querybuf);
+    }
     /* Reset the peak again to capture the peak memory usage in the next
      * cycle. */
     c->querybuf_peak = 0;
@@ -1712,6 +1723,45 @@ int clientsCronResizeQueryBuffer(client *c) {
     return 0;
 }
 
+/* The client reply buffer is allocated with the first reply. Here it is
+ * released if the client is idle, shrunk if the latest replies used just a
+ * small part of it, or brought back to the default size if it was found too
+ * small, according to the peak usage since the last check.
+ *
+ * The function always returns 0 as it never terminates the client. */
+int clientsCronResizeOutputBuffer(client *c) {
+    size_t new_size = 0;
+    time_t idletime = server.unixtime - c->lastinteraction;
+
+    /* The buffer can't be replaced while it holds replies to write. */
+    if (c->buf == NULL || c->bufpos) {
+        c->buf_peak = c->bufpos;
+        return 0;
+    }
+
+    if (idletime > 2) {
+        zfree_transient(c->buf);
+        c->buf = NULL;
+        c->buf_usable_size = 0;
+    } else if (c->buf_usable_size > PROTO_REPLY_MIN_BYTES &&
+               (size_t)c->buf_peak < c->buf_usable_size/2)
+    {
+        new_size = c->buf_peak+1 > PROTO_REPLY_MIN_BYTES ?
+                   (size_t)c->buf_peak+1 : PROTO_REPLY_MIN_BYTES;
+    } else if (c->buf_usable_size < PROTO_REPLY_CHUNK_BYTES &&
+               (size_t)c->buf_peak == c->buf_usable_size)
+    {
+        new_size = PROTO_REPLY_CHUNK_BYTES;
+    }
+
+    if (new_size) {
+        zfree_transient(c->buf);
+        c->buf = zmalloc_transient_usable(new_size,&c->buf_usable_size);
+    }
+    c->buf_peak = 0;
+    return 0;
+}
+
 /* This function is used in order to track clients using the biggest amount
  * of memory in the latest few seconds. This way we can provide such information
  * in the INFO output (clients section), without having to do an O(N) scan for
@@ -1746,21 +1796,7 @@ int clientsCronTrackExpansiveClients(client *c, int time_idx) {
  * to the second) total memory used by clients using clinetsCron() in
  * a more incremental way (depending on server.hz). */
 int clientsCronTrackClientsMemUsage(client *c) {
-    size_t mem = 0;
-    int type = getClientType(c);
-    mem += getClientOutputBufferMemoryUsage(c);
-    mem += sdsZmallocSize(c->querybuf);
-    mem += zmalloc_size(c);
-    mem += c->argv_len_sum;
-    if (c->argv) mem += zmalloc_size(c->argv);
-    /* Now that we have the memory used by the client, remove the old
-     * value from the old category, and add it back. */
-    server.stat_clients_type_memory[c->client_cron_last_memory_type] -=
-        c->client_cron_last_memory_usage;
-    server.stat_clients_type_memory[type] += mem;
-    /* Remember what we added and where, to remove it next time. */
-    c->client_cron_last_memory_usage = mem;
-    c->client_cron_last_memory_type = type;
+    updateClientMemUsage(c);
     return 0;
 }
 
@@ -1841,6 +1877,7 @@ void clientsCron(void) {
          * terminated. */
         if (clientsCronHandleTimeout(c,now)) continue;
         if (clientsCronResizeQueryBuffer(c)) continue;
+        if (clientsCronResizeOutputBuffer(c)) continue;
         if (clientsCronTrackExpansiveClients(c, curr_peak_mem_usage_slot)) continue;
         if (clientsCronTrackClientsMemUsage(c)) continue;
         if (closeClientOnOutputBufferLimitReached(c, 0)) continue;
@@ -1855,7 +1892,11 @@ void databasesCron(void) {
      * as master will synthesize DELs for us. */
     if (server.active_expire_enabled) {
         if (iAmMaster()) {
+            monotime expire_timer;
+
+            elStageStart(expire_timer);
             activeExpireCycle(ACTIVE_EXPIRE_CYCLE_SLOW);
+            elStageEnd(EL_STAGE_ACTIVE_EXPIRE,expire_timer);
         } else {
             expireSlaveKeys();
         }
@@ -1867,7 +1908,7 @@ void databasesCron(void) {
     /* Perform hash tables rehashing if needed, but only if there are no
      * other processes saving the DB on disk. Otherwise rehashing is bad
      * as will cause a lot of copy-on-write of memory pages. */
-    if (!hasActiveChildProcess()) {
+    if (!hasActiveChildProcess() && !keyspaceAnalysisInProgress()) {
         /* We use global counters so if we stop the computation at a given
          * DB we'll be able to start from the successive in the next
          * cron loop iteration. */
@@ -1972,7 +2013,7 @@ void checkChildrenDone(void) {
             }
             if (!bysignal && exitcode == 0) receiveChildInfo();
             resetChildState();
-        } else {
+        } else if (!keyspaceAnalysisChildDone(pid, exitcode, bysignal)) {
             if (!ldbRemoveChild(pid)) {
                 serverLog(LL_WARNING,
                           "Warning, detected child with unmatched pid: %ld",
@@ -2017,6 +2058,9 @@ void cronUpdateMemoryStats() {
             server.cron_malloc_stats.allocator_active = server.cron_malloc_stats.allocator_resident;
         if (!server.cron_malloc_stats.allocator_allocated)
             server.cron_malloc_stats.allocator_allocated = server.cron_malloc_stats.zmalloc_used;
+        zmalloc_get_transient_allocator_info(&server.cron_malloc_stats.transient_allocated,
+                                             &server.cron_malloc_stats.transient_active,
+                                             &server.cron_malloc_stats.transient_resident);
     }
 }
 
@@ -2041,10 +2085,13 @@ void cronUpdateMemoryStats() {
 
 int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     int j;
+    monotime cron_timer;
     UNUSED(eventLoop);
     UNUSED(id);
     UNUSED(clientData);
 
+    elStageStart(cron_timer);
+
     /* Software watchdog: deliver the SIGALRM that will reach the signal
      * handler if we don't return here fast enough. */
     if (server.watchdog_period) watchdogScheduleSignal(server.watchdog_period);
@@ -2133,9 +2180,20 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* We need to do a few operations on clients asynchronously. */
     clientsCron();
 
+    /* The output buffers of the clients may grow without them sending
+     * commands (Pub/Sub, tracking), and clientsCron() just refreshed the
+     * memory usage of some of them. */
+    evictClients();
+
     /* Handle background operations on Redis databases. */
     databasesCron();
 
+    /* Aggregate the stacks sampled by DEBUG PROFILE, if active. */
+    profilerCron();
+
+    /* Rotate the TLS session ticket keys. */
+    run_with_period(1000) tlsCron();
+
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
     if (!hasActiveChildProcess() &&
@@ -2145,6 +2203,11 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         rewriteAppendOnlyFileBackground();
     }
 
+    /* The keyspace analysis child doesn't prevent the other children from
+     * starting, so it is reaped on its own. */
+    if (keyspaceAnalysisInProgress() && !hasActiveChildProcess())
+        checkChildrenDone();
+
     /* Check if a background saving or AOF rewrite in progress terminated. */
     if (hasActiveChildProcess() || ldbPendingChildren())
     {
@@ -2202,16 +2265,26 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
     /* AOF postponed flush: Try at every cron cycle if the slow fsync
      * completed. */
-    if (server.aof_state == AOF_ON && server.aof_flush_postponed_start)
+    if (server.aof_state == AOF_ON && server.aof_flush_postponed_start) {
+        monotime aof_timer;
+
+        elStageStart(aof_timer);
         flushAppendOnlyFile(0);
+        elStageEnd(EL_STAGE_AOF_FLUSH,aof_timer);
+    }
 
     /* AOF write errors: in this case we have a buffer to flush as well and
      * clear the AOF error in case of success to make the DB writable again,
      * however to try every second is enough in case of 'hz' is set to
      * a higher frequency. */
     run_with_period(1000) {
-        if (server.aof_state == AOF_ON && server.aof_last_write_status == C_ERR)
+        if (server.aof_state == AOF_ON && server.aof_last_write_status == C_ERR) {
+            monotime aof_timer;
+
+            elStageStart(aof_timer);
             flushAppendOnlyFile(0);
+            elStageEnd(EL_STAGE_AOF_FLUSH,aof_timer);
+        }
     }
 
     /* Clear the paused clients state if needed. */
@@ -2275,6 +2348,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                           &ei);
 
     server.cronloops++;
+    elStageEnd(EL_STAGE_CRON,cron_timer);
     return 1000/server.hz;
 }
 
@@ -2358,8 +2432,10 @@ extern int ProcessingEventsWhileBlocked;
  * The most important is freeClientsInAsyncFreeQueue but we also
  * call some other low-risk functions. */
 void beforeSleep(struct aeEventLoop *eventLoop) {
+    monotime before_sleep_timer, stage_timer;
     UNUSED(eventLoop);
 
+    elStageStart(before_sleep_timer);
     size_t zmalloc_used = zmalloc_used_memory();
     if (zmalloc_used > server.stat_peak_memory)
         server.stat_peak_memory = zmalloc_used;
@@ -2399,8 +2475,11 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 
     /* Run a fast expire cycle (the called function will return
      * ASAP if a fast cycle is not needed). */
-    if (server.active_expire_enabled && server.masterhost == NULL)
+    if (server.active_expire_enabled && server.masterhost == NULL) {
+        elStageStart(stage_timer);
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
+        elStageEnd(EL_STAGE_ACTIVE_EXPIRE,stage_timer);
+    }
 
     /* Unblock all the clients blocked for synchronous replication
      * in WAIT. */
@@ -2444,11 +2523,16 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     trackingBroadcastInvalidationMessages();
 
     /* Write the AOF buffer on disk */
-    if (server.aof_state == AOF_ON)
+    if (server.aof_state == AOF_ON) {
+        elStageStart(stage_timer);
         flushAppendOnlyFile(0);
+        elStageEnd(EL_STAGE_AOF_FLUSH,stage_timer);
+    }
 
     /* Handle writes with pending output buffers. */
+    elStageStart(stage_timer);
     handleClientsWithPendingWritesUsingThreads();
+    elStageEnd(EL_STAGE_WRITE,stage_timer);
 
     /* Close clients that need to be closed asynchronous */
     freeClientsInAsyncFreeQueue();
@@ -2458,6 +2542,14 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
      * visit processCommand() at all). */
     handleClientsBlockedOnKeys();
 
+    /* Account the time spent in this function and, if we know when the
+     * current iteration started, the time of the whole iteration. */
+    elStageEnd(EL_STAGE_BEFORE_SLEEP,before_sleep_timer);
+    if (server.el_cycle_start) {
+        elStageEnd(EL_STAGE_EVENTLOOP,server.el_cycle_start);
+        server.el_cycle_start = 0;
+    }
+
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
      * time. */
@@ -2477,6 +2569,9 @@ void afterSleep(struct aeEventLoop *eventLoop) {
     /* Aquire the modules GIL so that their threads won't touch anything. */
     if (!ProcessingEventsWhileBlocked) {
         if (moduleCount()) moduleAcquireGIL();
+        /* The event loop iteration starts now: the poll wait is not
+         * accounted as busy time. */
+        elStageStart(server.el_cycle_start);
     }
 }
 
@@ -2735,6 +2830,14 @@ void initServerConfig(void) {
     for (j = 0; j < CONFIG_OOM_COUNT; j++)
         server.oom_score_adj_values[j] = configOOMScoreAdjValuesDefaults[j];
 
+    /* Latency tracking: percentiles reported by INFO latencystats, see
+     * CONFIG_LATENCY_TRACKING_INFO_PERCENTILES. */
+    server.latency_tracking_info_percentiles_len = 3;
+    server.latency_tracking_info_percentiles = zmalloc(sizeof(double)*3);
+    server.latency_tracking_info_percentiles[0] = 50.0;  /* p50 */
+    server.latency_tracking_info_percentiles[1] = 99.0;  /* p99 */
+    server.latency_tracking_info_percentiles[2] = 99.9;  /* p999 */
+
     /* Double constants initialization */
     R_Zero = 0.0;
     R_PosInf = 1.0/R_Zero;
@@ -3101,6 +3204,7 @@ void resetServerStats(void) {
     server.stat_expired_time_cap_reached_count = 0;
     server.stat_expire_cycle_time_used = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evictedclients = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_active_defrag_hits = 0;
@@ -3119,6 +3223,8 @@ void resetServerStats(void) {
     atomicSet(server.stat_total_reads_processed, 0);
     server.stat_io_writes_processed = 0;
     atomicSet(server.stat_total_writes_processed, 0);
+    atomicSet(server.stat_tls_handshakes_full, 0);
+    atomicSet(server.stat_tls_handshakes_resumed, 0);
     for (j = 0; j < STATS_METRIC_COUNT; j++) {
         server.inst_metric[j].idx = 0;
         server.inst_metric[j].last_sample_time = mstime();
@@ -3132,6 +3238,7 @@ void resetServerStats(void) {
     server.stat_total_error_replies = 0;
     server.stat_dump_payload_sanitizations = 0;
     server.aof_delayed_fsync = 0;
+    elStagesReset();
 }
 
 /* Make the thread killable at any time, so that kill threads functions
@@ -3247,6 +3354,7 @@ void initServer(void) {
         server.db[j].avg_ttl = 0;
         server.db[j].defrag_later = listCreate();
         listSetFreeMethod(server.db[j].defrag_later,(void (*)(void*))sdsfree);
+        server.db[j].key_index = server.ordered_key_index ? raxNew() : NULL;
     }
     evictionPoolAlloc(); /* Initialize the LRU keys pool. */
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
@@ -3294,6 +3402,9 @@ void initServer(void) {
     server.cron_malloc_stats.allocator_allocated = 0;
     server.cron_malloc_stats.allocator_active = 0;
     server.cron_malloc_stats.allocator_resident = 0;
+    server.cron_malloc_stats.transient_allocated = 0;
+    server.cron_malloc_stats.transient_active = 0;
+    server.cron_malloc_stats.transient_resident = 0;
     server.lastbgsave_status = C_OK;
     server.aof_last_write_status = C_OK;
     server.aof_last_write_errno = 0;
@@ -3359,6 +3470,7 @@ void initServer(void) {
     scriptingInit(1);
     slowlogInit();
     latencyMonitorInit();
+    updateLatencyTrackingHistograms();
     
     /* Initialize ACL default password if it exists */
     ACLUpdateDefaultUserPassword(server.requirepass);
@@ -3373,6 +3485,7 @@ void InitServerLast() {
     bioInit();
     initThreadedIO();
     set_jemalloc_bg_thread(server.jemalloc_bg_thread);
+    set_jemalloc_transient_arena(server.jemalloc_transient_arena);
     server.initial_memory_usage = zmalloc_used_memory();
 }
 
@@ -3477,11 +3590,58 @@ void resetCommandTableStats(void) {
         c->calls = 0;
         c->rejected_calls = 0;
         c->failed_calls = 0;
+        if (c->latency_histogram) hdr_reset(c->latency_histogram);
     }
     dictReleaseIterator(di);
 
 }
 
+/* Create or release the latency histogram of 'cmd' according to the
+ * latency-tracking config. */
+void updateCommandLatencyTracking(struct redisCommand *cmd) {
+    if (server.latency_tracking_enabled) {
+        if (cmd->latency_histogram == NULL)
+            hdr_init(LATENCY_HISTOGRAM_MIN_VALUE,LATENCY_HISTOGRAM_MAX_VALUE,
+                     LATENCY_HISTOGRAM_PRECISION,&cmd->latency_histogram);
+    } else if (cmd->latency_histogram) {
+        hdr_close(cmd->latency_histogram);
+        cmd->latency_histogram = NULL;
+    }
+}
+
+/* Create the latency histograms of all the commands when latency tracking
+ * is enabled, or release them when it is disabled. The histograms are
+ * allocated upfront and not on the first call of each command: otherwise
+ * running a command for the first time would grow used_memory as a side
+ * effect, and could evict keys or clients near maxmemory.
+ *
+ * We iterate orig_commands so that renamed commands are covered too. */
+void updateLatencyTrackingHistograms(void) {
+    dictIterator *di;
+    dictEntry *de;
+
+    di = dictGetSafeIterator(server.orig_commands);
+    while((de = dictNext(di)) != NULL)
+        updateCommandLatencyTracking(dictGetVal(de));
+    dictReleaseIterator(di);
+}
+
+/* Record 'duration_hist' (in nanoseconds) into the latency histogram,
+ * creating the histogram on the first sample if it doesn't exist yet (the
+ * command histograms already exist, see updateLatencyTrackingHistograms()).
+ * Values outside the trackable range are clamped so that no sample is ever
+ * lost. */
+void updateCommandLatencyHistogram(struct hdr_histogram **latency_histogram, int64_t duration_hist) {
+    if (duration_hist < LATENCY_HISTOGRAM_MIN_VALUE)
+        duration_hist = LATENCY_HISTOGRAM_MIN_VALUE;
+    if (duration_hist > LATENCY_HISTOGRAM_MAX_VALUE)
+        duration_hist = LATENCY_HISTOGRAM_MAX_VALUE;
+    if (*latency_histogram == NULL)
+        hdr_init(LATENCY_HISTOGRAM_MIN_VALUE,LATENCY_HISTOGRAM_MAX_VALUE,
+                 LATENCY_HISTOGRAM_PRECISION,latency_histogram);
+    hdr_record_value(*latency_histogram,duration_hist);
+}
+
 void resetErrorTableStats(void) {
     raxFreeWithCallback(server.errors, zfree);
     server.errors = raxNew();
@@ -3789,6 +3949,11 @@ void call(client *c, int flags) {
     if (flags & CMD_CALL_STATS) {
         real_cmd->microseconds += duration;
         real_cmd->calls++;
+        /* If the client is blocked we will handle latency stats when it
+         * is unblocked. */
+        if (server.latency_tracking_enabled && !(c->flags & CLIENT_BLOCKED))
+            updateCommandLatencyHistogram(&(real_cmd->latency_histogram),
+                                          duration*1000);
     }
 
     /* Propagate the command into the AOF and replication link */
@@ -4244,6 +4409,7 @@ int processCommand(client *c) {
         addReply(c,shared.queued);
     } else {
         call(c,CMD_CALL_FULL);
+        elStageAddSample(EL_STAGE_COMMAND,c->duration);
         c->woff = server.master_repl_offset;
         if (listLength(server.ready_keys))
             handleClientsBlockedOnKeys();
@@ -4317,6 +4483,9 @@ int prepareForShutdown(int flags) {
         rdbRemoveTempFile(server.child_pid, 0);
     }
 
+    /* Kill the keyspace analysis child if there is one. */
+    killKeyspaceAnalysisChild();
+
     /* Kill module child if there is one. */
     if (server.child_type == CHILD_TYPE_MODULE) {
         serverLog(LL_WARNING,"There is a module fork child. Killing it!");
@@ -4624,6 +4793,25 @@ const char *getSafeInfoString(const char *s, size_t len, char **tmp) {
                        sizeof(unsafe_info_chars)-1);
 }
 
+/* Append to 'info' the latency_percentiles_usec_<name> line for the given
+ * histogram, one field for each percentile configured with
+ * latency-tracking-info-percentiles. */
+sds fillPercentileDistributionLatencies(sds info, const char *histogram_name, struct hdr_histogram *histogram) {
+    int j;
+
+    info = sdscatprintf(info,"latency_percentiles_usec_%s:",histogram_name);
+    for (j = 0; j < server.latency_tracking_info_percentiles_len; j++) {
+        double p = server.latency_tracking_info_percentiles[j];
+
+        info = sdscatprintf(info,"p%g=%.3f",p,
+            ((double)hdr_value_at_percentile(histogram,p))/1000.0);
+        if (j != server.latency_tracking_info_percentiles_len-1)
+            info = sdscatlen(info,",",1);
+    }
+    info = sdscatlen(info,"\r\n",2);
+    return info;
+}
+
 /* Create the string returned by the INFO command. This is decoupled
  * by the INFO command itself as we need to report the same information
  * on memory corruption problems. */
@@ -4867,6 +5055,29 @@ sds genRedisInfoString(const char *section) {
             lazyfreeGetPendingObjectsCount(),
             lazyfreeGetFreedObjectsCount()
         );
+
+        /* Fragmentation of the jemalloc arena serving the client buffers,
+         * and of the other arenas (mostly the keyspace) once those are
+         * taken out of the totals. */
+        struct malloc_stats *ms = &server.cron_malloc_stats;
+        size_t keyspace_allocated = 0, keyspace_active = 0;
+        if (ms->allocator_allocated > ms->transient_allocated)
+            keyspace_allocated = ms->allocator_allocated - ms->transient_allocated;
+        if (ms->allocator_active > ms->transient_active)
+            keyspace_active = ms->allocator_active - ms->transient_active;
+        info = sdscatprintf(info,
+            "allocator_transient_allocated:%zu\r\n"
+            "allocator_transient_active:%zu\r\n"
+            "allocator_transient_resident:%zu\r\n"
+            "allocator_transient_frag_ratio:%.2f\r\n"
+            "allocator_keyspace_frag_ratio:%.2f\r\n",
+            ms->transient_allocated,
+            ms->transient_active,
+            ms->transient_resident,
+            ms->transient_allocated ?
+                (double)ms->transient_active/ms->transient_allocated : 0,
+            keyspace_allocated ?
+                (double)keyspace_active/keyspace_allocated : 0);
         freeMemoryOverheadData(mh);
     }
 
@@ -4997,10 +5208,13 @@ sds genRedisInfoString(const char *section) {
     if (allsections || defsections || !strcasecmp(section,"stats")) {
         long long stat_total_reads_processed, stat_total_writes_processed;
         long long stat_net_input_bytes, stat_net_output_bytes;
+        long long stat_tls_handshakes_full, stat_tls_handshakes_resumed;
         atomicGet(server.stat_total_reads_processed, stat_total_reads_processed);
         atomicGet(server.stat_total_writes_processed, stat_total_writes_processed);
         atomicGet(server.stat_net_input_bytes, stat_net_input_bytes);
         atomicGet(server.stat_net_output_bytes, stat_net_output_bytes);
+        atomicGet(server.stat_tls_handshakes_full, stat_tls_handshakes_full);
+        atomicGet(server.stat_tls_handshakes_resumed, stat_tls_handshakes_resumed);
 
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
@@ -5021,6 +5235,7 @@ sds genRedisInfoString(const char *section) {
             "expired_time_cap_reached_count:%lld\r\n"
             "expire_cycle_cpu_milliseconds:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_clients:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
@@ -5042,7 +5257,9 @@ sds genRedisInfoString(const char *section) {
             "total_reads_processed:%lld\r\n"
             "total_writes_processed:%lld\r\n"
             "io_threaded_reads_processed:%lld\r\n"
-            "io_threaded_writes_processed:%lld\r\n",
+            "io_threaded_writes_processed:%lld\r\n"
+            "tls_handshakes_full:%lld\r\n"
+            "tls_handshakes_resumed:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -5059,6 +5276,7 @@ sds genRedisInfoString(const char *section) {
             server.stat_expired_time_cap_reached_count,
             server.stat_expire_cycle_time_used/1000,
             server.stat_evictedkeys,
+            server.stat_evictedclients,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
@@ -5080,7 +5298,9 @@ sds genRedisInfoString(const char *section) {
             stat_total_reads_processed,
             stat_total_writes_processed,
             server.stat_io_reads_processed,
-            server.stat_io_writes_processed);
+            server.stat_io_writes_processed,
+            stat_tls_handshakes_full,
+            stat_tls_handshakes_resumed);
     }
 
     /* Replication */
@@ -5284,6 +5504,36 @@ sds genRedisInfoString(const char *section) {
         }
         dictReleaseIterator(di);
     }
+    /* Time spent in every stage of the event loop */
+    if (allsections || !strcasecmp(section,"eventloop")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info, "# Eventloop\r\n");
+        info = genEventLoopStagesInfoString(info);
+    }
+
+    /* Latency by percentile distribution per command */
+    if (allsections || !strcasecmp(section,"latencystats")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info, "# Latencystats\r\n");
+        if (server.latency_tracking_enabled) {
+            struct redisCommand *c;
+            dictEntry *de;
+            dictIterator *di;
+            di = dictGetSafeIterator(server.commands);
+            while((de = dictNext(di)) != NULL) {
+                char *tmpsafe;
+                c = (struct redisCommand *) dictGetVal(de);
+                if (!c->latency_histogram || !c->latency_histogram->total_count)
+                    continue;
+                info = fillPercentileDistributionLatencies(info,
+                    getSafeInfoString(c->name, strlen(c->name), &tmpsafe),
+                    c->latency_histogram);
+                if (tmpsafe != NULL) zfree(tmpsafe);
+            }
+            dictReleaseIterator(di);
+        }
+    }
+
     /* Error statistics */
     if (allsections || defsections || !strcasecmp(section,"errorstats")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -5594,7 +5844,8 @@ void usage(void) {
     fprintf(stderr,"       ./redis-server - (read config from stdin)\n");
     fprintf(stderr,"       ./redis-server -v or --version\n");
     fprintf(stderr,"       ./redis-server -h or --help\n");
-    fprintf(stderr,"       ./redis-server --test-memory <megabytes>\n\n");
+    fprintf(stderr,"       ./redis-server --test-memory <megabytes>\n");
+    fprintf(stderr,"       ./redis-server microbench [<name> ...] [options]\n\n");
     fprintf(stderr,"Examples:\n");
     fprintf(stderr,"       ./redis-server (run the server with default conf)\n");
     fprintf(stderr,"       ./redis-server /etc/redis/6379.conf\n");
@@ -6139,7 +6390,8 @@ struct redisTest {
     {"crc64", crc64Test},
     {"zmalloc", zmalloc_test},
     {"sds", sdsTest},
-    {"dict", dictTest}
+    {"dict", dictTest},
+    {"ae", aeTest}
 };
 redisTestProc *getTestProcByName(const char *name) {
     int numtests = sizeof(redisTests)/sizeof(struct redisTest);
@@ -6219,6 +6471,12 @@ int main(int argc, char **argv) {
     uint8_t hashseed[16];
     getRandomBytes(hashseed,sizeof(hashseed));
     dictSetHashFunctionSeed(hashseed);
+
+    /* The data structure microbenchmarks just need the allocator, the hash
+     * function seed and the CRC tables initialized above. */
+    if (argc >= 2 && strcmp(argv[1], "microbench") == 0)
+        exit(microbenchMain(argc,argv));
+
     server.sentinel_mode = checkForSentinelMode(argc,argv);
     initServerConfig();
     ACLInit(); /* The ACL subsystem must be initialized ASAP because the
@@ -145,8 +145,10 @@ typedef long long ustime_t; /* microsecond time type. */
 /* Protocol and I/O related defines */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define PROTO_REPLY_MIN_BYTES (1024) /* the lower limit on reply buffer size */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_REUSE_ARGV_MAX    1024 /* Max argv slots kept between commands */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define REDIS_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -166,6 +168,14 @@ typedef long long ustime_t; /* microsecond time type. */
 
 extern int configOOMScoreAdjValuesDefaults[CONFIG_OOM_COUNT];
 
+/* Per command latency histograms. Values are recorded in nanoseconds and
+ * clamped to [MIN_VALUE, MAX_VALUE]. A precision of 2 significant digits
+ * keeps the value error at 1% at every magnitude. */
+#define LATENCY_HISTOGRAM_MIN_VALUE 1L           /* >= 1 nanosec */
+#define LATENCY_HISTOGRAM_MAX_VALUE 1000000000L  /* <= 1 sec */
+#define LATENCY_HISTOGRAM_PRECISION 2
+#define CONFIG_LATENCY_TRACKING_INFO_PERCENTILES "50 99 99.9"
+
 /* Hash table parameters */
 #define HASHTABLE_MIN_FILL        10      /* Minimal hash table fill 10% */
 #define HASHTABLE_MAX_LOAD_FACTOR 1.618   /* Maximum hash table load factor. */
@@ -718,6 +728,7 @@ typedef struct redisDb {
     long long avg_ttl;          /* Average TTL, just for stats */
     unsigned long expires_cursor; /* Cursor of the active expire cycle. */
     list *defrag_later;         /* List of key names to attempt to defrag one by one, gradually. */
+    rax *key_index;             /* Sorted key names, NULL if ordered-key-index is off. */
 } redisDb;
 
 /* Declare database backup that include redis main DBs and slots to keys map.
@@ -741,6 +752,8 @@ typedef struct multiState {
     int cmd_inv_flags;      /* Same as cmd_flags, OR-ing the ~flags. so that it
                                is possible to know if all the commands have a
                                certain flag. */
+    size_t argv_len_sums;   /* Memory used by the queued argv, see
+                               multiStateMemOverhead(). */
 } multiState;
 
 /* This structure holds the blocking operation state for a client.
@@ -801,6 +814,8 @@ typedef struct readyList {
                                            in the user structure. The last valid
                                            command ID we can set in the user
                                            is USER_COMMAND_BITS_COUNT-1. */
+#define ACL_KEY_CACHE_MAX_LEN 256       /* Longer keys are not cached by
+                                           the ACL per client key cache. */
 #define USER_FLAG_ENABLED (1<<0)        /* The user is active. */
 #define USER_FLAG_DISABLED (1<<1)       /* The user is disabled. */
 #define USER_FLAG_ALLKEYS (1<<2)        /* The user can mention any key. */
@@ -846,6 +861,8 @@ typedef struct {
                         field is NULL the user cannot mention any channel in a
                         `PUBLISH` or [P][UNSUBSCRIBE] command, unless the flag
                         ALLCHANNELS is set in the user. */
+    rax *patterns_compiled; /* 'patterns' and 'channels' compiled for fast */
+    rax *channels_compiled; /* matching, or NULL if not compiled yet. */
 } user;
 
 /* With multiplexing we need to take per-client state.
@@ -870,6 +887,10 @@ typedef struct client {
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size. */
     int argc;               /* Num of arguments of current command. */
     robj **argv;            /* Arguments of current command. */
+    int argv_len;           /* Size of the argv array (may be more than argc),
+                               so that it can be reused by the next command. */
+    int argv_transient;     /* True if argv was allocated with
+                               zmalloc_transient(), false for zmalloc(). */
     int original_argc;      /* Num of arguments of original command if arguments were rewritten. */
     robj **original_argv;   /* Arguments of original command if arguments were rewritten. */
     size_t argv_len_sum;    /* Sum of lengths of objects in argv list. */
@@ -877,6 +898,9 @@ typedef struct client {
     user *user;             /* User associated with this connection. If the
                                user is set to NULL the connection can do
                                anything (admin). */
+    sds acl_key_cache;      /* Last key found accessible by glob matching. */
+    user *acl_key_cache_user;       /* User that can access acl_key_cache. */
+    uint64_t acl_key_cache_epoch;   /* ACL patterns epoch of acl_key_cache. */
     int reqtype;            /* Request protocol type: PROTO_REQ_* */
     int multibulklen;       /* Number of multi bulk arguments left to read. */
     long bulklen;           /* Length of bulk argument in multi bulk request. */
@@ -943,9 +967,13 @@ typedef struct client {
      * before adding it the new value. */
     uint64_t client_cron_last_memory_usage;
     int      client_cron_last_memory_type;
-    /* Response buffer */
+    /* Response buffer. It is allocated with the first reply, resized by
+     * clientsCronResizeOutputBuffer() according to the peak usage, and
+     * released when the client is idle. */
     int bufpos;
-    char buf[PROTO_REPLY_CHUNK_BYTES];
+    int buf_peak;                   /* Peak bufpos since the last cron check. */
+    size_t buf_usable_size;         /* Usable size of 'buf', 0 if not allocated. */
+    char *buf;
 } client;
 
 struct saveparam {
@@ -1106,6 +1134,9 @@ struct malloc_stats {
     size_t allocator_allocated;
     size_t allocator_active;
     size_t allocator_resident;
+    size_t transient_allocated;     /* Same as above, for the transient arena. */
+    size_t transient_active;
+    size_t transient_resident;
 };
 
 typedef struct socketFds {
@@ -1134,6 +1165,9 @@ typedef struct redisTLSContextConfig {
     int session_caching;
     int session_cache_size;
     int session_cache_timeout;
+    int session_tickets;            /* Allow stateless resumption with tickets */
+    int session_ticket_key_rotation; /* Ticket key rotation period (seconds) */
+    int ktls;                       /* Let the kernel encrypt/decrypt records */
 } redisTLSContextConfig;
 
 /*-----------------------------------------------------------------------------
@@ -1153,6 +1187,7 @@ struct clusterState;
 #define CHILD_TYPE_AOF 2
 #define CHILD_TYPE_LDB 3
 #define CHILD_TYPE_MODULE 4
+#define CHILD_TYPE_ANALYSIS 5
 
 typedef enum childInfoType {
     CHILD_INFO_TYPE_CURRENT_INFO,
@@ -1183,6 +1218,7 @@ struct redisServer {
     redisAtomic unsigned int lruclock; /* Clock for LRU eviction */
     volatile sig_atomic_t shutdown_asap; /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int ordered_key_index;      /* Keep the key names of every DB sorted. */
     int active_defrag_running;  /* Active defragmentation running (holds current scan aggressiveness) */
     char *pidfile;              /* PID file path */
     int arch_bits;              /* 32 or 64 depending on sizeof(long) */
@@ -1264,6 +1300,7 @@ struct redisServer {
     long long stat_expired_time_cap_reached_count; /* Early expire cylce stops.*/
     long long stat_expire_cycle_time_used; /* Cumulative microseconds used. */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_evictedclients;  /* Number of evicted clients (maxmemory-clients) */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
     long long stat_active_defrag_hits;      /* number of allocations moved */
@@ -1283,6 +1320,8 @@ struct redisServer {
     long long slowlog_entry_id;     /* SLOWLOG current entry ID */
     long long slowlog_log_slower_than; /* SLOWLOG time limit (to get logged) */
     unsigned long slowlog_max_len;     /* SLOWLOG max number of items logged */
+    dict *slowlog_signatures;       /* SLOWLOG AGGREGATE signature -> stats */
+    unsigned long slowlog_aggregate_max_len; /* Max number of signatures. */
     struct malloc_stats cron_malloc_stats; /* sampled in serverCron(). */
     redisAtomic long long stat_net_input_bytes; /* Bytes read from network. */
     redisAtomic long long stat_net_output_bytes; /* Bytes written to network. */
@@ -1302,6 +1341,8 @@ struct redisServer {
     long long stat_io_writes_processed; /* Number of write events processed by IO / Main threads */
     redisAtomic long long stat_total_reads_processed; /* Total number of read events processed */
     redisAtomic long long stat_total_writes_processed; /* Total number of write events processed */
+    redisAtomic long long stat_tls_handshakes_full; /* TLS handshakes without session resumption */
+    redisAtomic long long stat_tls_handshakes_resumed; /* TLS handshakes resuming a session */
     /* The following two are used to track instantaneous metrics, like
      * number of operations per second, network traffic. */
     struct {
@@ -1320,6 +1361,7 @@ struct redisServer {
     int sanitize_dump_payload;      /* Enables deep sanitization for ziplist and listpack in RDB and RESTORE. */
     int skip_checksum_validation;   /* Disables checksum validateion for RDB and RESTORE payload. */
     int jemalloc_bg_thread;         /* Enable jemalloc background thread */
+    int jemalloc_transient_arena;   /* Serve client buffers from their own arena */
     size_t active_defrag_ignore_bytes; /* minimum amount of fragmentation waste to start active defrag */
     int active_defrag_threshold_lower; /* minimum percentage of fragmentation to start active defrag */
     int active_defrag_threshold_upper; /* maximum percentage of fragmentation at which we use maximum effort */
@@ -1490,6 +1532,7 @@ struct redisServer {
     /* Limits */
     unsigned int maxclients;            /* Max number of simultaneous clients */
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
+    size_t maxmemory_clients;       /* Max memory used by all the clients, 0 = no limit */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Precision of random sampling */
     int maxmemory_eviction_tenacity;/* Aggressiveness of eviction processing */
@@ -1593,6 +1636,16 @@ struct redisServer {
     /* Latency monitor */
     long long latency_monitor_threshold;
     dict *latency_events;
+    /* Latency tracking */
+    int latency_tracking_enabled;            /* Record per command latency
+                                                histograms in call(). */
+    double *latency_tracking_info_percentiles; /* Percentiles reported by
+                                                  INFO latencystats. */
+    int latency_tracking_info_percentiles_len;
+    /* Event loop stages profiling */
+    struct elStageStats el_stages[EL_STAGE_NUM];
+    monotime el_cycle_start;    /* Start of the current event loop iteration,
+                                   set in afterSleep(), 0 if unknown. */
     /* ACLs */
     char *acl_filename;           /* ACL Users file. NULL if not configured. */
     unsigned long acllog_max_len; /* Maximum length of the ACL LOG list. */
@@ -1655,6 +1708,9 @@ struct redisCommand {
     int lastkey;  /* The last argument that's a key */
     int keystep;  /* The step between first and last key */
     long long microseconds, calls, rejected_calls, failed_calls;
+    struct hdr_histogram* latency_histogram; /* Per command latency histogram
+                                                in nanoseconds, NULL when
+                                                latency-tracking is off. */
     int id;     /* Command ID. This is a progressive ID starting from 0 that
                    is assigned at runtime, and is used in order to check
                    ACLs. A connection is able to execute a given command if
@@ -1866,6 +1922,9 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval);
 void replaceClientCommandVector(client *c, int argc, robj **argv);
 void redactClientCommandArgument(client *c, int argc);
 unsigned long getClientOutputBufferMemoryUsage(client *c);
+size_t getClientMemoryUsage(client *c, size_t *output_buffer_mem_usage);
+void updateClientMemUsage(client *c);
+void evictClients(void);
 int freeClientsInAsyncFreeQueue(void);
 int closeClientOnOutputBufferLimitReached(client *c, int async);
 int getClientType(client *c);
@@ -1886,6 +1945,7 @@ void blockingOperationEnds();
 int handleClientsWithPendingWrites(void);
 int handleClientsWithPendingWritesUsingThreads(void);
 int handleClientsWithPendingReadsUsingThreads(void);
+int postponeConnHandshake(connection *conn);
 int stopThreadedIOIfNeeded(void);
 int clientHasPendingReplies(client *c);
 void unlinkClient(client *c);
@@ -1941,6 +2001,7 @@ void listElementsRemoved(client *c, robj *key, int where, robj *o, long count);
 
 /* MULTI/EXEC/WATCH... */
 void unwatchAllKeys(client *c);
+size_t multiStateMemOverhead(client *c);
 void initClientMultiState(client *c);
 void freeClientMultiState(client *c);
 void queueMultiCommand(client *c);
@@ -2003,6 +2064,8 @@ int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
+size_t objectComputeSize(robj *o, size_t sample_size);
 void trimStringObjectIfNeeded(robj *o);
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
 
@@ -2074,6 +2137,7 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
 int loadAppendOnlyFile(char *filename);
+int rewriteAppendOnlyFileRio(rio *aof);
 void stopAppendOnly(void);
 int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
@@ -2230,6 +2294,9 @@ void updateDictResizePolicy(void);
 int htNeedsResize(dict *dict);
 void populateCommandTable(void);
 void resetCommandTableStats(void);
+void updateCommandLatencyTracking(struct redisCommand *cmd);
+void updateLatencyTrackingHistograms(void);
+void updateCommandLatencyHistogram(struct hdr_histogram** latency_histogram, int64_t duration_hist);
 void resetErrorTableStats(void);
 void adjustOpenFilesLimit(void);
 void incrementErrorCount(const char *fullerr, size_t namelen);
@@ -2360,6 +2427,8 @@ void discardDbBackup(dbBackup *buckup, int flags, void(callback)(void*));
 int selectDb(client *c, int id);
 void signalModifiedKey(client *c, redisDb *db, robj *key);
 void signalFlushedDb(int dbid, int async);
+void hllCountCacheTouchKey(redisDb *db, robj *key);
+void hllCountCacheFlush(void);
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
 unsigned int countKeysInSlot(unsigned int hashslot);
 unsigned int delKeysInSlot(unsigned int hashslot);
@@ -2371,11 +2440,17 @@ void slotToKeyDel(sds key);
 int dbAsyncDelete(redisDb *db, robj *key);
 void emptyDbAsync(redisDb *db);
 void slotToKeyFlush(int async);
+void keyIndexAdd(redisDb *db, sds key);
+void keyIndexDel(redisDb *db, sds key);
+void freeKeyIndex(rax *rt, int async);
+void keyIndexFlush(redisDb *db, int async);
+void keyIndexUpdateConfig(redisDb *db);
 size_t lazyfreeGetPendingObjectsCount(void);
 size_t lazyfreeGetFreedObjectsCount(void);
 void freeObjAsync(robj *key, robj *obj);
 void freeSlotsToKeysMapAsync(rax *rt);
 void freeSlotsToKeysMap(rax *rt, int async);
+void freeKeyIndexAsync(rax *rt);
 
 
 /* API to get key arguments from commands */
@@ -2417,6 +2492,16 @@ int redis_check_rdb(char *rdbfilename, FILE *fp);
 int redis_check_rdb_main(int argc, char **argv, FILE *fp);
 int redis_check_aof_main(int argc, char **argv);
 
+/* Data structure microbenchmarks */
+int microbenchMain(int argc, char **argv);
+
+/* Background keyspace analysis */
+int keyspaceAnalysisInProgress(void);
+int keyspaceAnalysisChildDone(pid_t pid, int exitcode, int bysignal);
+void killKeyspaceAnalysisChild(void);
+void memoryAnalyzeCommand(client *c);
+void memoryReportCommand(client *c);
+
 /* Scripting */
 void scriptingInit(int setup);
 int ldbRemoveChild(pid_t pid);
@@ -2718,6 +2803,7 @@ sds genModulesInfoString(sds info);
 void enableWatchdog(int period);
 void disableWatchdog(void);
 void watchdogScheduleSignal(int period);
+void profilerCron(void);
 void serverLogHexDump(int level, char *descr, void *value, size_t len);
 int memtest_preserving_test(unsigned long *m, size_t bytes, int passes);
 void mixDigest(unsigned char *digest, void *ptr, size_t len);
@@ -2739,6 +2825,7 @@ void makeThreadKillable(void);
 void tlsInit(void);
 void tlsCleanup(void);
 int tlsConfigure(redisTLSContextConfig *ctx_config);
+void tlsCron(void);
 
 #define redisDebug(fmt, ...) \
     printf("DEBUG %s:%d > " fmt "\n", __FILE__, __LINE__, __VA_ARGS__)
@@ -46,6 +46,22 @@
 
 #include "server.h"
 #include "slowlog.h"
+#include "hdr_histogram.h"
+
+#include <ctype.h>
+
+void slowlogFreeSignature(void *privdata, void *val);
+
+/* SLOWLOG AGGREGATE table, signature (sds) -> slowlogSignature. */
+dictType slowlogSignatureDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    slowlogFreeSignature,       /* val destructor */
+    NULL                        /* allow to expand */
+};
 
 /* Create a new slowlog entry.
  *
@@ -151,6 +167,185 @@ void slowlogInit(void) {
     server.slowlog_entry_id = 0;
     // 日志链表的释构函数
     listSetFreeMethod(server.slowlog,slowlogFreeEntry);
+    server.slowlog_signatures = dictCreate(&slowlogSignatureDictType,NULL);
+}
+
+void slowlogFreeSignature(void *privdata, void *val) {
+    slowlogSignature *ss = val;
+    UNUSED(privdata);
+
+    hdr_close(ss->histogram);
+    zfree(ss);
+}
+
+/* Append to 's' the pattern of the key name 'key': the name is split into
+ * segments by the usual separators, and every segment containing a digit
+ * (numeric IDs, hashes, UUIDs and so forth) is replaced by a '*'. */
+static sds slowlogCatKeyPattern(sds s, sds key) {
+    size_t len = sdslen(key), j = 0;
+
+    if (len > SLOWLOG_SIGNATURE_MAX_KEYLEN) len = SLOWLOG_SIGNATURE_MAX_KEYLEN;
+    while (j < len) {
+        size_t seglen = strcspn(key+j,":./-_|{}# ");
+        int hasdigit = 0;
+
+        if (j+seglen > len) seglen = len-j;
+        for (size_t i = 0; i < seglen; i++) {
+            if (isdigit((unsigned char)key[j+i])) {
+                hasdigit = 1;
+                break;
+            }
+        }
+        if (hasdigit)
+            s = sdscatlen(s,"*",1);
+        else
+            s = sdscatlen(s,key+j,seglen);
+        j += seglen;
+        /* Copy the separator, if any. */
+        if (j < len) s = sdscatlen(s,key+j++,1);
+    }
+    if (sdslen(key) > len) s = sdscatlen(s,"...",3);
+    return s;
+}
+
+/* Return the signature of the command: its name followed by the distinct
+ * patterns of the keys it accesses. Other arguments are stripped. */
+sds slowlogCommandSignature(robj **argv, int argc) {
+    struct redisCommand *cmd = lookupCommandOrOriginal(argv[0]->ptr);
+    getKeysResult result = GETKEYS_RESULT_INIT;
+    sds patterns[SLOWLOG_SIGNATURE_MAX_KEYS];
+    int numpatterns = 0, numkeys;
+    sds sig;
+
+    if (!cmd) {
+        sig = sdsnew(argv[0]->ptr);
+        sdstolower(sig);
+        return sig;
+    }
+    sig = sdsnew(cmd->name);
+    numkeys = getKeysFromCommand(cmd,argv,argc,&result);
+    for (int j = 0; j < numkeys; j++) {
+        robj *keyobj = argv[result.keys[j]];
+        int dup = 0;
+
+        if (!sdsEncodedObject(keyobj)) continue;
+        sds p = slowlogCatKeyPattern(sdsempty(),keyobj->ptr);
+        for (int i = 0; i < numpatterns; i++) {
+            if (!sdscmp(patterns[i],p)) {
+                dup = 1;
+                break;
+            }
+        }
+        if (dup) {
+            sdsfree(p);
+        } else if (numpatterns == SLOWLOG_SIGNATURE_MAX_KEYS) {
+            sdsfree(p);
+            sig = sdscatlen(sig," ...",4);
+            break;
+        } else {
+            patterns[numpatterns++] = p;
+            sig = sdscatfmt(sig," %S",p);
+        }
+    }
+    for (int i = 0; i < numpatterns; i++) sdsfree(patterns[i]);
+    getKeysFreeResult(&result);
+    return sig;
+}
+
+/* qsort() comparator sorting signatures by total time, descending. */
+static int slowlogSignatureCompare(const void *a, const void *b) {
+    slowlogSignature *sa = dictGetVal(*(dictEntry**)a);
+    slowlogSignature *sb = dictGetVal(*(dictEntry**)b);
+
+    if (sa->total == sb->total) return 0;
+    return sa->total < sb->total ? 1 : -1;
+}
+
+/* qsort() comparator sorting signatures by last execution, oldest first. */
+static int slowlogSignatureAgeCompare(const void *a, const void *b) {
+    slowlogSignature *sa = dictGetVal(*(dictEntry**)a);
+    slowlogSignature *sb = dictGetVal(*(dictEntry**)b);
+
+    if (sa->last_seen == sb->last_seen) return 0;
+    return sa->last_seen < sb->last_seen ? -1 : 1;
+}
+
+/* Evict signatures until no more than 'maxlen' are left in the SLOWLOG
+ * AGGREGATE table. The victims are the ones with the lowest total time among
+ * the least recently seen half of the table: a new signature can't be evicted
+ * before it had the time to add up, while an old but expensive one survives
+ * the cheap ones that were seen about as long ago. */
+void slowlogAggregateTrim(unsigned long maxlen) {
+    unsigned long numsigs = dictSize(server.slowlog_signatures), j = 0;
+    unsigned long numvictims, numcandidates;
+    dictIterator *di;
+    dictEntry *de, **sigs;
+    sds *victims;
+
+    if (numsigs <= maxlen) return;
+    numvictims = numsigs-maxlen;
+    numcandidates = numsigs/2;
+    if (numcandidates < numvictims) numcandidates = numvictims;
+
+    sigs = zmalloc(sizeof(dictEntry*)*numsigs);
+    di = dictGetIterator(server.slowlog_signatures);
+    while((de = dictNext(di)) != NULL) sigs[j++] = de;
+    dictReleaseIterator(di);
+    qsort(sigs,numsigs,sizeof(dictEntry*),slowlogSignatureAgeCompare);
+    qsort(sigs,numcandidates,sizeof(dictEntry*),slowlogSignatureCompare);
+
+    /* Collect the keys first: deleting may move the entries around when
+     * the dictionary is rehashing. */
+    victims = zmalloc(sizeof(sds)*numvictims);
+    for (j = 0; j < numvictims; j++)
+        victims[j] = dictGetKey(sigs[numcandidates-numvictims+j]);
+    for (j = 0; j < numvictims; j++)
+        dictDelete(server.slowlog_signatures,victims[j]);
+    zfree(victims);
+    zfree(sigs);
+}
+
+/* Account a slow command into the SLOWLOG AGGREGATE table. When the table
+ * is full a batch of signatures is evicted, see slowlogAggregateTrim().
+ * A whole batch is evicted at once, so that the table is not sorted again
+ * at every new signature. */
+void slowlogAggregate(robj **argv, int argc, long long duration) {
+    static unsigned long long clock = 0;
+
+    if (server.slowlog_aggregate_max_len == 0) return;
+
+    sds sig = slowlogCommandSignature(argv,argc);
+    dictEntry *de = dictFind(server.slowlog_signatures,sig);
+    slowlogSignature *ss;
+
+    if (de) {
+        sdsfree(sig);
+        ss = dictGetVal(de);
+    } else {
+        unsigned long maxlen = server.slowlog_aggregate_max_len;
+
+        if (dictSize(server.slowlog_signatures) >= maxlen) {
+            unsigned long batch = maxlen/SLOWLOG_AGGREGATE_EVICT_RATIO;
+            if (batch == 0) batch = 1;
+            slowlogAggregateTrim(maxlen-batch);
+        }
+        ss = zcalloc(sizeof(*ss));
+        dictAdd(server.slowlog_signatures,sig,ss);
+    }
+    ss->count++;
+    ss->total += duration;
+    if (duration > ss->max) ss->max = duration;
+    ss->last_time = time(NULL);
+    ss->last_seen = ++clock;
+    /* The percentiles are tracked with an HDR histogram, clamping values to
+     * its range. */
+    if (ss->histogram == NULL)
+        hdr_init(1,SLOWLOG_HISTOGRAM_MAX_VALUE,LATENCY_HISTOGRAM_PRECISION,
+                 &ss->histogram);
+    if (duration < 1) duration = 1;
+    if (duration > SLOWLOG_HISTOGRAM_MAX_VALUE)
+        duration = SLOWLOG_HISTOGRAM_MAX_VALUE;
+    hdr_record_value(ss->histogram,duration);
 }
 
 /* Push a new entry into the slow log.
@@ -167,10 +362,12 @@ void slowlogPushEntryIfNeeded(client *c, robj **argv, int argc, long long durati
     // 慢查询功能未开启，直接返回
     if (server.slowlog_log_slower_than < 0) return; /* Slowlog disabled */
     // 如果执行时间超过服务器设置的上限，那么将命令添加到慢查询日志
-    if (duration >= server.slowlog_log_slower_than)
+    if (duration >= server.slowlog_log_slower_than) {
         // 新日志添加到链表表头
         listAddNodeHead(server.slowlog,
                         slowlogCreateEntry(c,argv,argc,duration));
+        slowlogAggregate(argv,argc,duration);
+    }
 
     /* Remove old entries if needed. */
     // 如果日志数量过多，那么进行删除
@@ -196,6 +393,12 @@ void slowlogCommand(client *c) {
     // 重置
     if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"help")) {
         const char *help[] = {
+                "AGGREGATE [<count>|RESET]",
+                "    Return the top <count> command signatures (default: 10) by total time.",
+                "    A signature is the command name followed by the patterns of the keys",
+                "    it accessed. Entries are made of: signature, number of slow commands,",
+                "    total, max and 99th percentile time in microseconds, and the unix time",
+                "    of the last one. RESET discards the signatures.",
                 "GET [<count>]",
                 "    Return top <count> entries from the slowlog (default: 10). Entries are",
                 "    made of:",
@@ -247,6 +450,54 @@ void slowlogCommand(client *c) {
             sent++;
         }
         setDeferredArrayLen(c,totentries,sent);
+    } else if ((c->argc == 2 || c->argc == 3) &&
+               !strcasecmp(c->argv[1]->ptr,"aggregate"))
+    {
+        long count = 10, j = 0, numsigs;
+        dictIterator *di;
+        dictEntry *de, **sigs;
+
+        if (c->argc == 3 && !strcasecmp(c->argv[2]->ptr,"reset")) {
+            dictEmpty(server.slowlog_signatures,NULL);
+            addReply(c,shared.ok);
+            return;
+        }
+        if (c->argc == 3 &&
+            getRangeLongFromObjectOrReply(c,c->argv[2],0,LONG_MAX,&count,NULL)
+            != C_OK) return;
+
+        numsigs = dictSize(server.slowlog_signatures);
+        sigs = zmalloc(sizeof(dictEntry*)*(numsigs+1));
+        di = dictGetIterator(server.slowlog_signatures);
+        while((de = dictNext(di)) != NULL) sigs[j++] = de;
+        dictReleaseIterator(di);
+        qsort(sigs,numsigs,sizeof(dictEntry*),slowlogSignatureCompare);
+
+        if (count > numsigs) count = numsigs;
+        addReplyArrayLen(c,count);
+        for (j = 0; j < count; j++) {
+            slowlogSignature *ss = dictGetVal(sigs[j]);
+            sds sig = dictGetKey(sigs[j]);
+
+            addReplyMapLen(c,6);
+            addReplyBulkCString(c,"signature");
+            addReplyBulkCBuffer(c,sig,sdslen(sig));
+            addReplyBulkCString(c,"count");
+            addReplyLongLong(c,ss->count);
+            addReplyBulkCString(c,"total_usec");
+            addReplyLongLong(c,ss->total);
+            addReplyBulkCString(c,"max_usec");
+            addReplyLongLong(c,ss->max);
+            /* The histogram reports the highest value equivalent to the
+             * recorded ones, that may be above the actual max. */
+            long long p99 = hdr_value_at_percentile(ss->histogram,99.0);
+            if (p99 > ss->max) p99 = ss->max;
+            addReplyBulkCString(c,"p99_usec");
+            addReplyLongLong(c,p99);
+            addReplyBulkCString(c,"last_time");
+            addReplyLongLong(c,ss->last_time);
+        }
+        zfree(sigs);
     } else {
         addReplySubcommandSyntaxError(c);
     }
@@ -44,9 +44,28 @@ typedef struct slowlogEntry {
     sds peerid;         /* Client network address. */
 } slowlogEntry;
 
+#define SLOWLOG_SIGNATURE_MAX_KEYS 8
+#define SLOWLOG_SIGNATURE_MAX_KEYLEN 64
+#define SLOWLOG_HISTOGRAM_MAX_VALUE 3600000000LL /* One hour, in microseconds. */
+#define SLOWLOG_AGGREGATE_EVICT_RATIO 10 /* Evict 1/10 of the table when full. */
+
+/* Aggregated statistics of the slow commands sharing the same signature,
+ * that is the command name followed by the normalized patterns of the keys
+ * it accessed. */
+typedef struct slowlogSignature {
+    long long count;    /* Number of slow commands with this signature. */
+    long long total;    /* Total time spent, in microseconds. */
+    long long max;      /* Slowest execution, in microseconds. */
+    time_t last_time;   /* Unix time of the last execution. */
+    unsigned long long last_seen; /* Order of the last execution, used to
+                                     find the least recently seen ones. */
+    struct hdr_histogram *histogram; /* Durations, in microseconds. */
+} slowlogSignature;
+
 /* Exported API */
 void slowlogInit(void);
 void slowlogPushEntryIfNeeded(client *c, robj **argv, int argc, long long duration);
+void slowlogAggregateTrim(unsigned long maxlen);
 
 /* Exported commands */
 void slowlogCommand(client *c);
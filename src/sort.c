@@ -236,6 +236,48 @@ int sortCompare(const void *s1, const void *s2) {
     return server.sort_desc ? -cmp : cmp;
 }
 
+/* When LIMIT selects at most 1/SORT_TOPK_RATIO of the elements, the ones in
+ * the range are selected with a heap instead of sorting the whole vector. */
+#define SORT_TOPK_RATIO 8
+
+/* Restore the max-heap property, according to sortCompare(), of the 'len'
+ * elements heap 'heap' whose root 'pos' may be out of place. */
+static void sortHeapSiftDown(redisSortObject *heap, long len, long pos) {
+    redisSortObject tmp;
+
+    while (1) {
+        long child = pos*2+1;
+
+        if (child >= len) break;
+        if (child+1 < len && sortCompare(&heap[child+1],&heap[child]) > 0)
+            child++;
+        if (sortCompare(&heap[child],&heap[pos]) <= 0) break;
+        tmp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = tmp;
+        pos = child;
+    }
+}
+
+/* Move the 'k' smallest elements of 'vector' to its first 'k' positions,
+ * sorted, leaving the other elements in the rest of the vector in no
+ * particular order. The first 'k' positions are used as a max-heap, so this
+ * costs O(N*log(k)) comparisons and no allocation. */
+static void sortTopK(redisSortObject *vector, long len, long k) {
+    redisSortObject tmp;
+    long j;
+
+    for (j = k/2-1; j >= 0; j--) sortHeapSiftDown(vector,k,j);
+    for (j = k; j < len; j++) {
+        if (sortCompare(&vector[j],&vector[0]) >= 0) continue;
+        tmp = vector[0];
+        vector[0] = vector[j];
+        vector[j] = tmp;
+        sortHeapSiftDown(vector,k,0);
+    }
+    qsort(vector,k,sizeof(redisSortObject),sortCompare);
+}
+
 /* The SORT command is the most complex command in Redis. Warning: this code
  * is optimized for speed and a bit less for readability */
 void sortCommand(client *c) {
@@ -605,7 +647,9 @@ void sortCommand(client *c) {
         server.sort_alpha = alpha;
         server.sort_bypattern = sortby ? 1 : 0;
         server.sort_store = storekey ? 1 : 0;
-        if (sortby && (start != 0 || end != vectorlen-1))
+        if (end >= start && (end+1)*SORT_TOPK_RATIO <= vectorlen)
+            sortTopK(vector,vectorlen,end+1);
+        else if (sortby && (start != 0 || end != vectorlen-1))
             pqsort(vector,vectorlen,sizeof(redisSortObject),sortCompare, start,end);
         else
             qsort(vector,vectorlen,sizeof(redisSortObject),sortCompare);
@@ -39,6 +39,11 @@
 #include <openssl/err.h>
 #include <openssl/rand.h>
 #include <openssl/pem.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
 #define REDIS_TLS_PROTO_TLSv1       (1<<0)
 #define REDIS_TLS_PROTO_TLSv1_1     (1<<1)
@@ -229,6 +234,15 @@ static SSL_CTX *createSSLContext(redisTLSContextConfig *ctx_config, int protocol
     SSL_CTX_set_options(ctx, SSL_OP_NO_COMPRESSION);
 #endif
 
+    /* With kernel TLS the records are encrypted and decrypted by the kernel
+     * once the handshake is over. OpenSSL silently falls back to doing it
+     * in user space if the kernel or the negotiated cipher don't support
+     * it. */
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ctx_config->ktls)
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
     SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE|SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
     SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER|SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
 
@@ -273,6 +287,117 @@ error:
     return NULL;
 }
 
+/* Session tickets let clients resume a session without the server keeping
+ * any state: the session is encrypted with a server side key and handed to
+ * the client. The keys are process wide rather than per SSL_CTX, so the
+ * tickets issued before a tlsConfigure() are still accepted after it.
+ *
+ * The current key encrypts the new tickets, the previous one is still
+ * accepted (and the client gets a new ticket) for another rotation period,
+ * so a ticket is valid between one and two periods. Keys are only rotated by
+ * the main thread while the I/O threads are idle, see tlsCron(). */
+typedef struct tlsTicketKey {
+    int valid;
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+} tlsTicketKey;
+
+static tlsTicketKey ticket_keys[2];     /* Current and previous key. */
+static mstime_t ticket_keys_ctime = 0;  /* Creation time of the current key. */
+
+/* Generate a new current ticket key, the current one becomes the previous.
+ * The retired previous key and the temporary copy are wiped, so that no
+ * stale key material is left in memory. */
+static int tlsRotateTicketKeys(void) {
+    tlsTicketKey key;
+
+    if (RAND_bytes(key.name, sizeof(key.name)) <= 0 ||
+        RAND_bytes(key.aes_key, sizeof(key.aes_key)) <= 0 ||
+        RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) <= 0)
+    {
+        OPENSSL_cleanse(&key, sizeof(key));
+        serverLog(LL_WARNING, "OpenSSL: Failed to generate a session ticket key.");
+        return C_ERR;
+    }
+    key.valid = 1;
+    OPENSSL_cleanse(&ticket_keys[1], sizeof(ticket_keys[1]));
+    ticket_keys[1] = ticket_keys[0];
+    ticket_keys[0] = key;
+    OPENSSL_cleanse(&key, sizeof(key));
+    ticket_keys_ctime = mstime();
+    return C_OK;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX tlsTicketMacCtx;
+#else
+typedef HMAC_CTX tlsTicketMacCtx;
+#endif
+
+static int tlsSetTicketMacKey(tlsTicketMacCtx *mac_ctx, tlsTicketKey *key) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM params[3];
+
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+                    key->hmac_key, sizeof(key->hmac_key));
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                    "SHA256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+    return EVP_MAC_CTX_set_params(mac_ctx, params);
+#else
+    return HMAC_Init_ex(mac_ctx, key->hmac_key, sizeof(key->hmac_key),
+                        EVP_sha256(), NULL);
+#endif
+}
+
+/* Called by OpenSSL to encrypt (enc == 1) or decrypt a session ticket.
+ * When decrypting, returns 0 if the key is unknown (full handshake), 1 if
+ * the ticket was issued with the current key and 2 if it was issued with the
+ * previous one, so that a new ticket is sent to the client. */
+static int tlsTicketKeyCallback(SSL *ssl, unsigned char *key_name,
+                                unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx,
+                                tlsTicketMacCtx *mac_ctx, int enc)
+{
+    tlsTicketKey *key = NULL;
+    int retval = 1;
+    UNUSED(ssl);
+
+    if (enc) {
+        key = &ticket_keys[0];
+        if (!key->valid) return 0;
+        memcpy(key_name, key->name, sizeof(key->name));
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0 ||
+            !EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL,
+                                key->aes_key, iv)) return -1;
+    } else {
+        for (int j = 0; j < 2; j++) {
+            if (ticket_keys[j].valid &&
+                !memcmp(key_name, ticket_keys[j].name, sizeof(ticket_keys[j].name)))
+            {
+                key = &ticket_keys[j];
+                if (j) retval = 2;
+                break;
+            }
+        }
+        if (!key) return 0;
+        if (!EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL,
+                                key->aes_key, iv)) return -1;
+    }
+    if (!tlsSetTicketMacKey(mac_ctx, key)) return -1;
+    return retval;
+}
+
+/* Called by serverCron() to rotate the session ticket keys. */
+void tlsCron(void) {
+    int period = server.tls_ctx_config.session_ticket_key_rotation;
+
+    if (!redis_tls_ctx || !server.tls_ctx_config.session_tickets ||
+        period <= 0) return;
+    if (mstime() - ticket_keys_ctime >= (mstime_t) period*1000)
+        tlsRotateTicketKeys();
+}
+
 /* Attempt to configure/reconfigure TLS. This operation is atomic and will
  * leave the SSL_CTX unchanged if fails.
  */
@@ -308,11 +433,26 @@ int tlsConfigure(redisTLSContextConfig *ctx_config) {
         SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
         SSL_CTX_sess_set_cache_size(ctx, ctx_config->session_cache_size);
         SSL_CTX_set_timeout(ctx, ctx_config->session_cache_timeout);
-        SSL_CTX_set_session_id_context(ctx, (void *) "redis", 5);
     } else {
         SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
     }
 
+    if (ctx_config->session_tickets) {
+        if (!ticket_keys[0].valid && tlsRotateTicketKeys() == C_ERR) goto error;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, tlsTicketKeyCallback);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb(ctx, tlsTicketKeyCallback);
+#endif
+    } else {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+
+    /* Required to resume sessions of authenticated clients, whether the
+     * session comes from the cache or from a ticket. */
+    if (ctx_config->session_caching || ctx_config->session_tickets)
+        SSL_CTX_set_session_id_context(ctx, (void *) "redis", 5);
+
 #ifdef SSL_OP_NO_CLIENT_RENEGOTIATION
     SSL_CTX_set_options(ctx, SSL_OP_NO_CLIENT_RENEGOTIATION);
 #endif
@@ -401,6 +541,12 @@ typedef enum {
 #define TLS_CONN_FLAG_READ_WANT_WRITE   (1<<0)
 #define TLS_CONN_FLAG_WRITE_WANT_READ   (1<<1)
 #define TLS_CONN_FLAG_FD_SET            (1<<2)
+#define TLS_CONN_FLAG_POSTPONE_UPDATE_STATE (1<<3) /* Event loop update left
+                                                      by an I/O thread. */
+#define TLS_CONN_FLAG_ACCEPT_POSTPONED  (1<<4) /* Handshake step handed to
+                                                  the I/O threads. */
+#define TLS_CONN_FLAG_ACCEPT_WANT_WRITE (1<<5) /* The postponed handshake step
+                                                  needs the socket writable. */
 
 typedef struct tls_connection {
     connection c;
@@ -525,7 +671,18 @@ void registerSSLEvent(tls_connection *conn, WantIOType want) {
     }
 }
 
+/* Connections are served by the I/O threads too, that can't touch the event
+ * loop owned by the main thread. */
+static inline int tlsInMainThread(void) {
+    return pthread_equal(pthread_self(), server.main_thread_id);
+}
+
 void updateSSLEvent(tls_connection *conn) {
+    if (!tlsInMainThread()) {
+        conn->flags |= TLS_CONN_FLAG_POSTPONE_UPDATE_STATE;
+        return;
+    }
+
     int mask = aeGetFileEvents(server.el, conn->c.fd);
     int need_read = conn->c.read_handler || (conn->flags & TLS_CONN_FLAG_WRITE_WANT_READ);
     int need_write = conn->c.write_handler || (conn->flags & TLS_CONN_FLAG_READ_WANT_WRITE);
@@ -541,6 +698,52 @@ void updateSSLEvent(tls_connection *conn) {
         aeDeleteFileEvent(server.el, conn->c.fd, AE_WRITABLE);
 }
 
+/* If SSL has pending data, already read from the socket, we're at risk of
+ * not calling the read handler again, make sure to add it to a list of
+ * pending connections that should be handled anyway. */
+static void updatePendingData(tls_connection *conn) {
+    if (SSL_pending(conn->ssl) > 0) {
+        if (!conn->pending_list_node) {
+            listAddNodeTail(pending_list, conn);
+            conn->pending_list_node = listLast(pending_list);
+        }
+    } else if (conn->pending_list_node) {
+        listDelNode(pending_list, conn->pending_list_node);
+        conn->pending_list_node = NULL;
+    }
+}
+
+/* Run a step of the server side handshake. Returns 0 if the handshake needs
+ * more I/O, that is described by 'want', otherwise the handshake is over and
+ * the connection state is either CONN_STATE_CONNECTED or CONN_STATE_ERROR.
+ * The event loop is not touched, so this is safe in the I/O threads. */
+static int tlsAcceptStep(tls_connection *conn, WantIOType *want) {
+    int ret = SSL_accept(conn->ssl);
+
+    if (ret <= 0) {
+        if (!handleSSLReturnCode(conn, ret, want)) return 0;
+        /* If not handled, it's an error */
+        conn->c.state = CONN_STATE_ERROR;
+    } else {
+        conn->c.state = CONN_STATE_CONNECTED;
+        if (SSL_session_reused(conn->ssl))
+            atomicIncr(server.stat_tls_handshakes_resumed, 1);
+        else
+            atomicIncr(server.stat_tls_handshakes_full, 1);
+    }
+    return 1;
+}
+
+/* The handshake is the most CPU intensive part of a TLS connection, so when
+ * the I/O threads are active the handshake steps of clients connections are
+ * run there: see postponeConnHandshake(). Returns 1 if the step was
+ * postponed. */
+static int tlsPostponeHandshake(tls_connection *conn) {
+    if (!postponeConnHandshake((connection *) conn)) return 0;
+    conn->flags |= TLS_CONN_FLAG_ACCEPT_POSTPONED;
+    return 1;
+}
+
 static void tlsHandleEvent(tls_connection *conn, int mask) {
     int ret, conn_error;
 
@@ -585,27 +788,22 @@ static void tlsHandleEvent(tls_connection *conn, int mask) {
             conn->c.conn_handler = NULL;
             break;
         case CONN_STATE_ACCEPTING:
-            ret = SSL_accept(conn->ssl);
-            if (ret <= 0) {
-                WantIOType want = 0;
-                if (!handleSSLReturnCode(conn, ret, &want)) {
-                    /* Avoid hitting UpdateSSLEvent, which knows nothing
-                     * of what SSL_connect() wants and instead looks at our
-                     * R/W handlers.
-                     */
-                    registerSSLEvent(conn, want);
-                    return;
-                }
-
-                /* If not handled, it's an error */
-                conn->c.state = CONN_STATE_ERROR;
-            } else {
-                conn->c.state = CONN_STATE_CONNECTED;
+        {
+            WantIOType want = 0;
+            if (tlsPostponeHandshake(conn)) return;
+            if (!tlsAcceptStep(conn, &want)) {
+                /* Avoid hitting UpdateSSLEvent, which knows nothing
+                 * of what SSL_connect() wants and instead looks at our
+                 * R/W handlers.
+                 */
+                registerSSLEvent(conn, want);
+                return;
             }
 
             if (!callHandler((connection *) conn, conn->c.conn_handler)) return;
             conn->c.conn_handler = NULL;
             break;
+        }
         case CONN_STATE_CONNECTED:
         {
             int call_read = ((mask & AE_READABLE) && conn->c.read_handler) ||
@@ -644,20 +842,7 @@ static void tlsHandleEvent(tls_connection *conn, int mask) {
                 if (!callHandler((connection *) conn, conn->c.read_handler)) return;
             }
 
-            /* If SSL has pending that, already read from the socket, we're at
-             * risk of not calling the read handler again, make sure to add it
-             * to a list of pending connection that should be handled anyway. */
-            if ((mask & AE_READABLE)) {
-                if (SSL_pending(conn->ssl) > 0) {
-                    if (!conn->pending_list_node) {
-                        listAddNodeTail(pending_list, conn);
-                        conn->pending_list_node = listLast(pending_list);
-                    }
-                } else if (conn->pending_list_node) {
-                    listDelNode(pending_list, conn->pending_list_node);
-                    conn->pending_list_node = NULL;
-                }
-            }
+            if ((mask & AE_READABLE)) updatePendingData(conn);
 
             break;
         }
@@ -698,27 +883,21 @@ static void connTLSClose(connection *conn_) {
 
 static int connTLSAccept(connection *_conn, ConnectionCallbackFunc accept_handler) {
     tls_connection *conn = (tls_connection *) _conn;
-    int ret;
 
     if (conn->c.state != CONN_STATE_ACCEPTING) return C_ERR;
     ERR_clear_error();
 
     /* Try to accept */
     conn->c.conn_handler = accept_handler;
-    ret = SSL_accept(conn->ssl);
+    if (tlsPostponeHandshake(conn)) return C_OK;
 
-    if (ret <= 0) {
-        WantIOType want = 0;
-        if (!handleSSLReturnCode(conn, ret, &want)) {
-            registerSSLEvent(conn, want);   /* We'll fire back */
-            return C_OK;
-        } else {
-            conn->c.state = CONN_STATE_ERROR;
-            return C_ERR;
-        }
+    WantIOType want = 0;
+    if (!tlsAcceptStep(conn, &want)) {
+        registerSSLEvent(conn, want);   /* We'll fire back */
+        return C_OK;
     }
+    if (conn->c.state == CONN_STATE_ERROR) return C_ERR;
 
-    conn->c.state = CONN_STATE_CONNECTED;
     if (!callHandler((connection *) conn, conn->c.conn_handler)) return C_OK;
     conn->c.conn_handler = NULL;
 
@@ -824,6 +1003,48 @@ int connTLSSetReadHandler(connection *conn, ConnectionCallbackFunc func) {
     return C_OK;
 }
 
+/* Handshake step postponed to the I/O threads by tlsPostponeHandshake(). */
+static void connTLSHandshake(connection *conn_) {
+    tls_connection *conn = (tls_connection *) conn_;
+    WantIOType want = 0;
+
+    if (!(conn->flags & TLS_CONN_FLAG_ACCEPT_POSTPONED)) return;
+    ERR_clear_error();
+    if (!tlsAcceptStep(conn, &want)) {
+        if (want == WANT_WRITE)
+            conn->flags |= TLS_CONN_FLAG_ACCEPT_WANT_WRITE;
+        else
+            conn->flags &= ~TLS_CONN_FLAG_ACCEPT_WANT_WRITE;
+    }
+}
+
+/* Called by the main thread once the I/O threads served the connection:
+ * complete a postponed handshake step, update the event loop, and track the
+ * data decrypted by the threads but not read yet. */
+static void connTLSUpdateState(connection *conn_) {
+    tls_connection *conn = (tls_connection *) conn_;
+
+    if (conn->flags & TLS_CONN_FLAG_ACCEPT_POSTPONED) {
+        conn->flags &= ~TLS_CONN_FLAG_ACCEPT_POSTPONED;
+        if (conn->c.state == CONN_STATE_ACCEPTING) {
+            registerSSLEvent(conn,
+                (conn->flags & TLS_CONN_FLAG_ACCEPT_WANT_WRITE) ?
+                WANT_WRITE : WANT_READ);
+            return;
+        }
+        if (!callHandler((connection *) conn, conn->c.conn_handler)) return;
+        conn->c.conn_handler = NULL;
+        updateSSLEvent(conn);
+        return;
+    }
+
+    if (conn->flags & TLS_CONN_FLAG_POSTPONE_UPDATE_STATE) {
+        conn->flags &= ~TLS_CONN_FLAG_POSTPONE_UPDATE_STATE;
+        updateSSLEvent(conn);
+    }
+    if (conn->c.state == CONN_STATE_CONNECTED) updatePendingData(conn);
+}
+
 static void setBlockingTimeout(tls_connection *conn, long long timeout) {
     anetBlock(NULL, conn->c.fd);
     anetSendTimeout(NULL, conn->c.fd, timeout);
@@ -932,7 +1153,9 @@ ConnectionType CT_TLS = {
     .sync_write = connTLSSyncWrite,
     .sync_read = connTLSSyncRead,
     .sync_readline = connTLSSyncReadLine,
-    .get_type = connTLSGetType
+    .get_type = connTLSGetType,
+    .handshake = connTLSHandshake,
+    .update_state = connTLSUpdateState
 };
 
 int tlsHasPendingData() {
@@ -991,6 +1214,9 @@ int tlsConfigure(redisTLSContextConfig *ctx_config) {
     return C_OK;
 }
 
+void tlsCron(void) {
+}
+
 connection *connCreateTLS(void) { 
     return NULL;
 }
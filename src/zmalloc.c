@@ -78,13 +78,43 @@ void zlibc_free(void *ptr) {
 #define free(ptr) je_free(ptr)
 #define mallocx(size,flags) je_mallocx(size,flags)
 #define dallocx(ptr,flags) je_dallocx(ptr,flags)
+#define rallocx(ptr,size,flags) je_rallocx(ptr,size,flags)
 #endif
 
-#define update_zmalloc_stat_alloc(__n) atomicIncr(used_memory,(__n))
-#define update_zmalloc_stat_free(__n) atomicDecr(used_memory,(__n))
+/* The used memory counter is sharded per thread: every thread updates its
+ * own slot, padded to a full cache line, so that the main thread, the IO
+ * threads, the bio threads and the module threads don't bounce a single
+ * cache line between cores on every allocation. Threads are assigned a
+ * slot the first time they allocate; if there are more threads than slots
+ * some of them share a slot, which is still correct since the slots are
+ * updated atomically. Note that a thread may free memory allocated by
+ * another thread, so a single slot may wrap below zero: only the sum of
+ * all the slots is meaningful. */
+#define ZMALLOC_USED_MEMORY_SHARDS 16
+#define ZMALLOC_CACHE_LINE_SIZE 64
+
+typedef struct {
+    redisAtomic size_t used;
+    char padding[ZMALLOC_CACHE_LINE_SIZE-sizeof(size_t)];
+} zmallocUsedMemoryShard;
+
+// 当前内存使用量（按线程分片）
+static zmallocUsedMemoryShard used_memory[ZMALLOC_USED_MEMORY_SHARDS]
+    __attribute__((aligned(ZMALLOC_CACHE_LINE_SIZE)));
+static redisAtomic unsigned int used_memory_next_shard = 0;
+static __thread int used_memory_shard = -1;
+
+static inline redisAtomic size_t *zmalloc_thread_used_memory(void) {
+    if (unlikely(used_memory_shard == -1)) {
+        unsigned int shard;
+        atomicGetIncr(used_memory_next_shard,shard,1);
+        used_memory_shard = shard % ZMALLOC_USED_MEMORY_SHARDS;
+    }
+    return &used_memory[used_memory_shard].used;
+}
 
-// 当前内存使用量
-static redisAtomic size_t used_memory = 0;
+#define update_zmalloc_stat_alloc(__n) atomicIncr(*zmalloc_thread_used_memory(),(__n))
+#define update_zmalloc_stat_free(__n) atomicDecr(*zmalloc_thread_used_memory(),(__n))
 
 static void zmalloc_default_oom(size_t size) {
     fprintf(stderr, "zmalloc: Out of memory trying to allocate %zu bytes\n",
@@ -340,6 +370,195 @@ void zfree_usable(void *ptr, size_t *usable) {
 #endif
 }
 
+/* Transient allocations: memory that belongs to a client and is released
+ * shortly after, like the reply blocks and the argv arrays. With jemalloc
+ * these are served by a dedicated arena, so that they don't interleave in
+ * the same slabs with the long lived keyspace objects, which would leave
+ * the keyspace pages fragmented once the client buffers are released.
+ *
+ * The arena must be used together with a thread cache of its own, otherwise
+ * the default thread cache would hand out regions of one arena to the
+ * allocations meant for the other. Every thread creates its transient
+ * tcache the first time it needs it, and destroys it when it exits.
+ *
+ * While the arena is enabled zfree_transient() and zrealloc_transient()
+ * release the regions through the transient thread cache as well, so that
+ * the buffers of the clients are recycled without taking the arena lock.
+ * A thread cache keeps the regions released through it regardless of their
+ * arena, and returns them to the arena that owns them only when flushed, so
+ * a region released with the wrong function may be handed out once for an
+ * allocation of the other kind. This is harmless for the few vectors that
+ * change kind (see rewriteClientCommandArgument()), but the buffers should
+ * be released with the function matching their allocation. Once the arena
+ * is disabled the regions are returned straight to the arena that owns
+ * them, bypassing the thread caches. */
+#if defined(USE_JEMALLOC)
+
+static redisAtomic int transient_arena_enabled = 0;
+static unsigned transient_arena = 0;
+static pthread_key_t transient_tcache_key;
+static pthread_once_t transient_tcache_key_once = PTHREAD_ONCE_INIT;
+
+static void zmalloc_transient_tcache_destroy(void *tcache) {
+    unsigned tc = (unsigned)(uintptr_t)tcache - 1;
+    je_mallctl("tcache.destroy", NULL, NULL, &tc, sizeof(tc));
+}
+
+static void zmalloc_transient_tcache_key_create(void) {
+    pthread_key_create(&transient_tcache_key, zmalloc_transient_tcache_destroy);
+}
+
+/* Return the MALLOCX_TCACHE() flag of the transient thread cache of the
+ * calling thread. If it can't be created (jemalloc limits the number of
+ * explicit tcaches) the thread cache is just bypassed. */
+static int zmalloc_transient_tcache_flags(void) {
+    uintptr_t tcache = (uintptr_t)pthread_getspecific(transient_tcache_key);
+
+    if (tcache == 0) {
+        unsigned tc;
+        size_t sz = sizeof(tc);
+        if (je_mallctl("tcache.create", &tc, &sz, NULL, 0) != 0)
+            return MALLOCX_TCACHE_NONE;
+        tcache = (uintptr_t)tc + 1;
+        pthread_setspecific(transient_tcache_key, (void*)tcache);
+    }
+    return MALLOCX_TCACHE((unsigned)(tcache - 1));
+}
+
+/* Return the mallocx() flags for a transient allocation, or 0 if the
+ * transient arena is disabled. */
+static int zmalloc_transient_flags(void) {
+    int enabled;
+    atomicGet(transient_arena_enabled,enabled);
+    if (!enabled) return 0;
+    return MALLOCX_ARENA(transient_arena) | zmalloc_transient_tcache_flags();
+}
+
+void *zmalloc_transient_usable(size_t size, size_t *usable) {
+    int flags = zmalloc_transient_flags();
+    if (!flags) return zmalloc_usable(size,usable);
+
+    ASSERT_NO_SIZE_OVERFLOW(size);
+    void *ptr = mallocx(MALLOC_MIN_SIZE(size)+PREFIX_SIZE, flags);
+    if (!ptr) zmalloc_oom_handler(size);
+    size = zmalloc_size(ptr);
+    update_zmalloc_stat_alloc(size);
+    if (usable) *usable = size;
+    return ptr;
+}
+
+void *zrealloc_transient(void *ptr, size_t size) {
+    int enabled;
+    atomicGet(transient_arena_enabled,enabled);
+    if (ptr == NULL) return zmalloc_transient(size);
+    if (size == 0) {
+        zfree_transient(ptr);
+        return NULL;
+    }
+    if (transient_arena == 0) return zrealloc(ptr,size);
+
+    /* The old region, if moved, is released like in zfree_transient(). */
+    int flags = MALLOCX_TCACHE_NONE;
+    if (enabled)
+        flags = MALLOCX_ARENA(transient_arena) | zmalloc_transient_tcache_flags();
+    ASSERT_NO_SIZE_OVERFLOW(size);
+    size_t oldsize = zmalloc_size(ptr);
+    void *newptr = rallocx(ptr, size+PREFIX_SIZE, flags);
+    if (!newptr) zmalloc_oom_handler(size);
+    update_zmalloc_stat_free(oldsize);
+    update_zmalloc_stat_alloc(zmalloc_size(newptr));
+    return newptr;
+}
+
+void zfree_transient(void *ptr) {
+    int enabled;
+
+    /* Once the arena exists it may own the region even if it was disabled
+     * in the meantime. */
+    if (transient_arena == 0 || ptr == NULL) {
+        zfree(ptr);
+        return;
+    }
+    atomicGet(transient_arena_enabled,enabled);
+    update_zmalloc_stat_free(zmalloc_size(ptr));
+    dallocx(ptr, enabled ? zmalloc_transient_tcache_flags() : MALLOCX_TCACHE_NONE);
+}
+
+/* Enable or disable the transient arena. The arena is created the first
+ * time it is enabled and never destroyed, since disabling it just routes the
+ * new allocations to the default arenas: the existing ones are still there. */
+void set_jemalloc_transient_arena(int enable) {
+    if (enable && transient_arena == 0) {
+        unsigned arena;
+        size_t sz = sizeof(arena);
+        pthread_once(&transient_tcache_key_once,
+                     zmalloc_transient_tcache_key_create);
+        if (je_mallctl("arenas.create", &arena, &sz, NULL, 0) != 0) return;
+        transient_arena = arena;
+    }
+    enable = enable && transient_arena != 0;
+    atomicSet(transient_arena_enabled,enable);
+}
+
+/* Report the allocator stats of the transient arena, in the same terms of
+ * zmalloc_get_allocator_info(). Returns 0 if there is no transient arena. */
+int zmalloc_get_transient_allocator_info(size_t *allocated,
+                                         size_t *active,
+                                         size_t *resident) {
+    uint64_t epoch = 1;
+    size_t sz, small = 0, large = 0, pactive = 0, page = 0;
+    char name[64];
+
+    *allocated = *active = *resident = 0;
+    if (transient_arena == 0) return 0;
+    sz = sizeof(epoch);
+    je_mallctl("epoch", &epoch, &sz, &epoch, sz);
+    sz = sizeof(size_t);
+    snprintf(name,sizeof(name),"stats.arenas.%u.small.allocated",transient_arena);
+    je_mallctl(name, &small, &sz, NULL, 0);
+    snprintf(name,sizeof(name),"stats.arenas.%u.large.allocated",transient_arena);
+    je_mallctl(name, &large, &sz, NULL, 0);
+    snprintf(name,sizeof(name),"stats.arenas.%u.pactive",transient_arena);
+    je_mallctl(name, &pactive, &sz, NULL, 0);
+    snprintf(name,sizeof(name),"stats.arenas.%u.resident",transient_arena);
+    je_mallctl(name, resident, &sz, NULL, 0);
+    je_mallctl("arenas.page", &page, &sz, NULL, 0);
+    *allocated = small + large;
+    *active = pactive * page;
+    return 1;
+}
+
+#else
+
+void *zmalloc_transient_usable(size_t size, size_t *usable) {
+    return zmalloc_usable(size,usable);
+}
+
+void *zrealloc_transient(void *ptr, size_t size) {
+    return zrealloc(ptr,size);
+}
+
+void zfree_transient(void *ptr) {
+    zfree(ptr);
+}
+
+void set_jemalloc_transient_arena(int enable) {
+    ((void)(enable));
+}
+
+int zmalloc_get_transient_allocator_info(size_t *allocated,
+                                         size_t *active,
+                                         size_t *resident) {
+    *allocated = *active = *resident = 0;
+    return 0;
+}
+
+#endif
+
+void *zmalloc_transient(size_t size) {
+    return zmalloc_transient_usable(size,NULL);
+}
+
 char *zstrdup(const char *s) {
     size_t l = strlen(s)+1;
     char *p = zmalloc(l);
@@ -348,10 +567,25 @@ char *zstrdup(const char *s) {
     return p;
 }
 
+/* Return the sum of the per thread counters. Every slot is read atomically
+ * but the sum is not a snapshot: a block allocated by a thread in a slot
+ * that was already read, and freed by another thread in a slot read later,
+ * is subtracted without having been added. The error of the result is
+ * therefore bounded by the memory that changed slot (allocated by a thread
+ * and freed by another one) during the call, which only lasts a few dozen
+ * loads. It can only matter for the maxmemory and eviction checks when bio
+ * or module threads are freeing memory that the main thread allocated: the
+ * IO threads are idle while the main thread runs the commands and the
+ * eviction loop. The slots are summed as signed values and the sum is
+ * clamped at zero, so an under-count can never wrap to a huge value. */
 size_t zmalloc_used_memory(void) {
-    size_t um;
-    atomicGet(used_memory,um);
-    return um;
+    long long um = 0;
+    for (int j = 0; j < ZMALLOC_USED_MEMORY_SHARDS; j++) {
+        size_t shard;
+        atomicGet(used_memory[j].used,shard);
+        um += (long long)shard;
+    }
+    return um < 0 ? 0 : (size_t)um;
 }
 
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t)) {
@@ -703,6 +937,56 @@ size_t zmalloc_get_memory_size(void) {
 
 #ifdef REDIS_TEST
 #define UNUSED(x) ((void)(x))
+
+/* Blocks are handed from a producer thread, that allocates them, to a
+ * consumer thread, that frees them, so that the memory keeps moving from
+ * a slot of the used memory counter to another. */
+#define ZMALLOC_TEST_PAIRS 4
+#define ZMALLOC_TEST_BLOCKS 2000
+#define ZMALLOC_TEST_BLOCK_SIZE (1024*1024)
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    void *block;
+    int done;
+} zmallocTestSlot;
+
+static redisAtomic int zmalloc_test_running;
+
+static void *zmallocTestProducer(void *arg) {
+    zmallocTestSlot *slot = arg;
+    int j;
+
+    pthread_mutex_lock(&slot->lock);
+    for (j = 0; j < ZMALLOC_TEST_BLOCKS; j++) {
+        while (slot->block != NULL) pthread_cond_wait(&slot->cond,&slot->lock);
+        slot->block = zmalloc(ZMALLOC_TEST_BLOCK_SIZE);
+        pthread_cond_signal(&slot->cond);
+    }
+    slot->done = 1;
+    pthread_cond_signal(&slot->cond);
+    pthread_mutex_unlock(&slot->lock);
+    return NULL;
+}
+
+static void *zmallocTestConsumer(void *arg) {
+    zmallocTestSlot *slot = arg;
+
+    pthread_mutex_lock(&slot->lock);
+    while (1) {
+        while (slot->block == NULL && !slot->done)
+            pthread_cond_wait(&slot->cond,&slot->lock);
+        if (slot->block == NULL) break;
+        zfree(slot->block);
+        slot->block = NULL;
+        pthread_cond_signal(&slot->cond);
+    }
+    pthread_mutex_unlock(&slot->lock);
+    atomicDecr(zmalloc_test_running,1);
+    return NULL;
+}
+
 int zmalloc_test(int argc, char **argv, int accurate) {
     void *ptr;
 
@@ -717,6 +1001,41 @@ int zmalloc_test(int argc, char **argv, int accurate) {
     printf("Reallocated to 456 bytes; used: %zu\n", zmalloc_used_memory());
     zfree(ptr);
     printf("Freed pointer; used: %zu\n", zmalloc_used_memory());
+
+    /* Read the counter while memory moves between the slots of other
+     * threads: it may be off by the blocks that moved while summing, but
+     * must never wrap below zero. */
+    {
+        pthread_t producers[ZMALLOC_TEST_PAIRS], consumers[ZMALLOC_TEST_PAIRS];
+        zmallocTestSlot slots[ZMALLOC_TEST_PAIRS];
+        size_t initial = zmalloc_used_memory(), used, max = 0;
+        int j, running;
+
+        atomicSet(zmalloc_test_running,ZMALLOC_TEST_PAIRS);
+        for (j = 0; j < ZMALLOC_TEST_PAIRS; j++) {
+            pthread_mutex_init(&slots[j].lock,NULL);
+            pthread_cond_init(&slots[j].cond,NULL);
+            slots[j].block = NULL;
+            slots[j].done = 0;
+            pthread_create(&producers[j],NULL,zmallocTestProducer,&slots[j]);
+            pthread_create(&consumers[j],NULL,zmallocTestConsumer,&slots[j]);
+        }
+        do {
+            used = zmalloc_used_memory();
+            if (used > max) max = used;
+            atomicGet(zmalloc_test_running,running);
+        } while (running);
+        for (j = 0; j < ZMALLOC_TEST_PAIRS; j++) {
+            pthread_join(producers[j],NULL);
+            pthread_join(consumers[j],NULL);
+            pthread_mutex_destroy(&slots[j].lock);
+            pthread_cond_destroy(&slots[j].cond);
+        }
+        printf("Max used memory with %d threads: %zu\n",
+            ZMALLOC_TEST_PAIRS*2, max);
+        assert(max < SIZE_MAX/2);
+        assert(zmalloc_used_memory() == initial);
+    }
     return 0;
 }
 #endif
@@ -142,6 +142,14 @@ size_t zmalloc_get_private_dirty(long pid);/* 获取私有的脏数据大小 */
 size_t zmalloc_get_smap_bytes_by_field(char *field, long pid); /* 从 libproc api 调用中获取指定字段的总和。 */
 size_t zmalloc_get_memory_size(void);/* 以字节为单位返回物理内存 (RAM) 的大小。 */
 
+/* Client buffers and other short lived allocations, see zmalloc.c. */
+void *zmalloc_transient(size_t size);
+void *zmalloc_transient_usable(size_t size, size_t *usable);
+void *zrealloc_transient(void *ptr, size_t size);
+void zfree_transient(void *ptr);
+void set_jemalloc_transient_arena(int enable);
+int zmalloc_get_transient_allocator_info(size_t *allocated, size_t *active, size_t *resident);
+
 #ifdef HAVE_DEFRAG
 void zfree_no_tcache(void *ptr);
 void *zmalloc_no_tcache(size_t size);
@@ -0,0 +1,85 @@
+# Smoke test of "redis-server microbench": every benchmark must run, and the
+# JSON results must be usable as a baseline.
+
+proc microbench {args} {
+    exec src/redis-server microbench {*}$args 2>@1
+}
+
+# Run the microbenchmarks expecting them to fail, and return the exit code
+# and the output.
+proc microbench_fail {args} {
+    if {![catch {exec src/redis-server microbench {*}$args 2>@1} out opts]} {
+        fail "microbench didn't fail: $out"
+    }
+    list [lindex [dict get $opts -errorcode] 2] $out
+}
+
+tags {"microbench"} {
+    set names [split [string trim [microbench --list]] "\n"]
+
+    test {microbench: --list names every benchmark} {
+        assert {[llength $names] > 0}
+        assert {[lsearch $names dict.insert] != -1}
+        assert {[lsearch $names crc64.checksum] != -1}
+    }
+
+    set json [tmpfile "microbench.json"]
+
+    test {microbench: every benchmark runs and is written as JSON} {
+        set out [microbench all --sizes 10,20 --duration 1 --json $json]
+        set fp [open $json]
+        set results [read $fp]
+        close $fp
+        foreach name $names {
+            foreach size {10 20} {
+                assert_match "*$name *size=$size *ns/op*" $out
+                assert_match "*\"name\": \"$name\", \"size\": $size,*" $results
+            }
+        }
+    }
+
+    test {microbench: only the selected benchmarks run} {
+        set out [microbench intset sds.new --sizes 10 --duration 1]
+        foreach name $names {
+            if {[string match "intset.*" $name] || $name eq "sds.new"} {
+                assert_match "*$name *" $out
+            } else {
+                assert_no_match "*$name *" $out
+            }
+        }
+    }
+
+    test {microbench: a run is compared against the baseline} {
+        set out [microbench dict.insert --sizes 10 --duration 1 \
+                            --baseline $json --threshold 1000000]
+        assert_match "*dict.insert*%*" $out
+        assert_match "*0 regression(s)*" $out
+
+        # A baseline much faster than any real run reports a regression.
+        set fp [open $json]
+        set results [read $fp]
+        close $fp
+        regsub -all {"ns_per_op": [0-9.]+} $results {"ns_per_op": 0.001} results
+        set fast [tmpfile "microbench-fast.json"]
+        set fp [open $fast w]
+        puts -nonewline $fp $results
+        close $fp
+        lassign [microbench_fail dict.insert --sizes 10 --duration 1 \
+                                 --baseline $fast] code out
+        assert_equal 1 $code
+        assert_match "*\\\[REGRESSION\\\]*" $out
+        assert_match "*1 regression(s)*" $out
+    }
+
+    test {microbench: invalid arguments are rejected} {
+        lassign [microbench_fail --sizes 0] code out
+        assert_equal 1 $code
+        assert_match "*Invalid --sizes list*" $out
+        lassign [microbench_fail --no-such-option] code out
+        assert_equal 1 $code
+        assert_match "*Usage:*" $out
+        lassign [microbench_fail --baseline /nonexistent/microbench.json] code out
+        assert_equal 1 $code
+        assert_match "*Can't load the baseline*" $out
+    }
+}
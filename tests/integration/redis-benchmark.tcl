@@ -124,6 +124,58 @@ start_server {tags {"benchmark network"}} {
             assert_match  {50} [scan [regexp -inline {keys\=([\d]*)} [r info keyspace]] keys=%d]
         }
 
+        test {benchmark: open-loop rate with threads} {
+            r flushall
+            r config resetstat
+            set cmd [redisbenchmark $master_host $master_port "--rps 2000 --threads 2 -c 4 -n 400 -r 50 -e -t set,get"]
+            if {[catch { exec {*}$cmd } error]} {
+                set first_line [lindex [split $error "\n"] 0]
+                puts [colorstr red "redis-benchmark non zero code. first line: $first_line"]
+                fail "redis-benchmark non zero code. first line: $first_line"
+            }
+            assert_match  {*calls=400,*} [cmdstat set]
+            assert_match  {*calls=400,*} [cmdstat get]
+            # assert one of the non benchmarked commands is not present
+            assert_match  {} [cmdstat lrange]
+        }
+
+        test {benchmark: invalid open-loop rates are rejected} {
+            foreach rate {abc 10k 0 -5 99999999999} {
+                set cmd [redisbenchmark $master_host $master_port "--rps $rate -n 10 -t ping"]
+                catch { exec {*}$cmd } error
+                assert_match "*Invalid option \"$rate\"*" $error
+            }
+        }
+
+        test {benchmark: workload file with phases} {
+            r flushall
+            r config resetstat
+            set wlfile [tmpfile "workload"]
+            set fd [open $wlfile w]
+            puts $fd "keyspace 50"
+            puts $fd "value-size 10 1 100 1"
+            puts $fd "phase populate 50"
+            puts $fd "distribution sequential"
+            puts $fd "command 1 SET __key__ __value__"
+            puts $fd "phase mixed 300"
+            puts $fd "distribution zipf 0.99"
+            puts $fd "command 2 GET __key__"
+            puts $fd "command 1 HSET myhash __key__ __value__"
+            close $fd
+            set cmd [redisbenchmark $master_host $master_port "-c 5 -n 10 -P 2 --workload $wlfile"]
+            if {[catch { exec {*}$cmd } error]} {
+                set first_line [lindex [split $error "\n"] 0]
+                puts [colorstr red "redis-benchmark non zero code. first line: $first_line"]
+                fail "redis-benchmark non zero code. first line: $first_line"
+            }
+            assert_match  {*calls=50,*} [cmdstat set]
+            regexp {calls=([0-9]+)} [cmdstat get] _ gets
+            regexp {calls=([0-9]+)} [cmdstat hset] _ hsets
+            assert_equal 300 [expr {$gets + $hsets}]
+            # the sequential distribution populated the whole keyspace
+            assert_match  {51} [scan [regexp -inline {keys\=([\d]*)} [r info keyspace]] keys=%d]
+        }
+
         # tls specific tests
         if {$::tls} {
             test {benchmark: specific tls-ciphers} {
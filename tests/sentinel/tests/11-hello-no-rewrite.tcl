@@ -0,0 +1,19 @@
+# Check that hellos that don't change anything don't rewrite the config.
+source "../tests/includes/init-tests.tcl"
+
+test "Unchanged hellos don't rewrite the Sentinels config" {
+    # Every Sentinel receives the hellos of all the others, directly and via
+    # the master and each replica, every SENTINEL_PUBLISH_PERIOD (2 seconds).
+    # Set the config files modification time in the past, so that any
+    # rewrite, even in the same second, is noticed.
+    set past [expr {[clock seconds]-3600}]
+    foreach_sentinel_id id {
+        file mtime [file join sentinel_$id sentinel.conf] $past
+    }
+    after 6000
+    foreach_sentinel_id id {
+        assert_equal [dict get [S $id SENTINEL MASTER mymaster] num-other-sentinels] \
+                     [expr {[llength $::sentinel_instances]-1}]
+        assert_equal $past [file mtime [file join sentinel_$id sentinel.conf]]
+    }
+}
@@ -0,0 +1,28 @@
+# Check that a strict majority of Sentinels can elect a leader.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Failover works with only a strict majority of Sentinels alive" {
+    set old_port [RPort $master_id]
+    set addr [S 0 SENTINEL GET-MASTER-ADDR-BY-NAME mymaster]
+    assert {[lindex $addr 1] == $old_port}
+
+    # Crash a minority of Sentinels: the ones left are just enough to elect
+    # a leader, so every one of them must be counted once as a voter.
+    for {set id $quorum} {$id < $sentinels} {incr id} {
+        kill_instance sentinel $id
+    }
+
+    kill_instance redis $master_id
+    for {set id 0} {$id < $quorum} {incr id} {
+        wait_for_condition 1000 50 {
+            [lindex [S $id SENTINEL GET-MASTER-ADDR-BY-NAME mymaster] 1] != $old_port
+        } else {
+            fail "Sentinel $id did not receive failover info"
+        }
+    }
+    restart_instance redis $master_id
+    for {set id $quorum} {$id < $sentinels} {incr id} {
+        restart_instance sentinel $id
+    }
+}
@@ -0,0 +1,75 @@
+# Check the cache of recently processed hellos, and that the INFO fields
+# Sentinel relies on are still parsed.
+
+source "../tests/includes/init-tests.tcl"
+
+# Send to Sentinel 0 the hello of a Sentinel that does not exist. Port 1 is
+# never reachable, so only the hellos sent here update this fake Sentinel.
+set ::fake_runid [string repeat f 40]
+proc fake_hello {port} {
+    set master [S 0 SENTINEL MASTER mymaster]
+    set hello [join [list 127.0.0.1 $port $::fake_runid 0 mymaster \
+                          [dict get $master ip] [dict get $master port] \
+                          [dict get $master config-epoch]] ,]
+    S 0 PUBLISH __sentinel__:hello $hello
+}
+
+proc fake_sentinel {} {
+    foreach s [S 0 SENTINEL SENTINELS mymaster] {
+        if {[dict get $s runid] eq $::fake_runid} {return $s}
+    }
+    return {}
+}
+
+test "A repeated hello is not processed again before the cache expires" {
+    fake_hello 1
+    assert {[fake_sentinel] ne {}}
+    after 1000
+    # The same hello is discarded without updating the last hello time.
+    fake_hello 1
+    assert {[dict get [fake_sentinel] last-hello-message] >= 1000}
+    # Once the cache entry expired (1500 ms) the hello is processed again.
+    after 1000
+    fake_hello 1
+    assert {[dict get [fake_sentinel] last-hello-message] < 1000}
+}
+
+test "A changed hello is processed immediately" {
+    fake_hello 2
+    assert_equal 2 [dict get [fake_sentinel] port]
+    assert {[dict get [fake_sentinel] last-hello-message] < 1000}
+}
+
+test "Forget the fake Sentinel" {
+    S 0 SENTINEL RESET mymaster
+    assert_equal {} [fake_sentinel]
+    wait_for_condition 100 100 {
+        [dict get [S 0 SENTINEL MASTER mymaster] num-other-sentinels] ==
+        [expr {[llength $::sentinel_instances]-1}]
+    } else {
+        fail "Sentinel 0 did not discover the other Sentinels again"
+    }
+}
+
+proc replica_by_port {port} {
+    foreach r [S 0 SENTINEL REPLICAS mymaster] {
+        if {[dict get $r port] == $port} {return $r}
+    }
+    return {slave-priority {}}
+}
+
+test "Replica fields of the Server and Replication INFO sections are parsed" {
+    set id [expr {($master_id+1) % [llength $::redis_instances]}]
+    set port [get_instance_attrib redis $id port]
+    R $id CONFIG SET replica-priority 42
+    # Sentinel refreshes the INFO of the replicas every 10 seconds.
+    wait_for_condition 60 500 {
+        [dict get [replica_by_port $port] slave-priority] == 42
+    } else {
+        fail "Sentinel did not parse the replica priority"
+    }
+    set r [replica_by_port $port]
+    assert_equal [RI $id run_id] [dict get $r runid]
+    assert_equal ok [dict get $r master-link-status]
+    R $id CONFIG SET replica-priority 100
+}
@@ -55,6 +55,7 @@ set ::all_tests {
     integration/failover
     integration/redis-cli
     integration/redis-benchmark
+    integration/microbench
     unit/pubsub
     unit/slowlog
     unit/scripting
@@ -81,6 +81,55 @@ start_server {tags {"acl"}} {
         set e
     } {*NOPERM*key*}
 
+    test {Key patterns of every kind are matched} {
+        r ACL setuser newuser allcommands resetkeys ~exact ~pre:* ~obj:*:name ~*:tail ~esc\\* ~a?c {~[xy]z}
+        foreach key {exact pre: pre:1 obj:1:name head:tail esc* abc xz yz} {
+            r SET $key v
+        }
+        foreach key {exac exactx pr obj:1:nam obj:1:names tail esc\\ escx ac xyz} {
+            catch {r SET $key v} e
+            assert_match {*NOPERM*key*} $e
+        }
+        r ACL setuser newuser allkeys
+        set _ {}
+    } {}
+
+    test {RESET releases the cached ACL key} {
+        r ACL setuser cacheuser on >cachepass allcommands resetkeys ~obj:*:name
+        set rd [redis_deferring_client]
+        # The first round warms up the one-off allocations (key, stats
+        # tables), so only the second round is measured.
+        for {set round 0} {$round < 2} {incr round} {
+            set info [r info memory]
+            set orig_mem [expr {[getInfoProperty $info used_memory] -
+                                [getInfoProperty $info mem_clients_normal]}]
+            for {set j 0} {$j < 5000} {incr j} {
+                $rd AUTH cacheuser cachepass
+                $rd INCR obj:3:name
+                $rd RESET
+            }
+            for {set j 0} {$j < 15000} {incr j} {$rd read}
+        }
+        $rd close
+        set info [r info memory]
+        set cur_mem [expr {[getInfoProperty $info used_memory] -
+                           [getInfoProperty $info mem_clients_normal]}]
+        r ACL deluser cacheuser
+        r DEL obj:3:name
+        assert {$cur_mem < $orig_mem + 20000}
+    }
+
+    test {Key patterns changes apply to the keys already checked} {
+        r ACL setuser newuser allcommands resetkeys ~obj:*:name
+        r DEL obj:2:name
+        r INCR obj:2:name
+        r INCR obj:2:name
+        r ACL setuser newuser resetkeys ~other
+        catch {r INCR obj:2:name} e
+        r ACL setuser newuser allkeys
+        set e
+    } {*NOPERM*key*}
+
     test {By default users are able to publish to any channel} {
         r ACL setuser psuser on >pspass +acl +client +@pubsub
         r AUTH psuser pspass
@@ -113,6 +162,19 @@ start_server {tags {"acl"}} {
         set e
     } {*NOPERM*channel*}
 
+    test {Channel patterns of every kind are matched} {
+        r ACL setuser psuser resetchannels &news &feed:* &room:*:msg
+        foreach channel {news feed: feed:1 room:1:msg} {
+            assert_equal {0} [r PUBLISH $channel m]
+        }
+        foreach channel {new newsx room:1:msgs} {
+            catch {r PUBLISH $channel m} e
+            assert_match {*NOPERM*channel*} $e
+        }
+        r ACL setuser psuser resetchannels &foo:1 &bar:*
+        set _ {}
+    } {}
+
     test {Validate subset of channels is prefixed with resetchannels flag} {
         r ACL setuser hpuser on nopass resetchannels &foo +@all
 
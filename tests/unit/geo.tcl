@@ -404,6 +404,28 @@ start_server {tags {"geo"}} {
         assert_equal {point2 point1} [r geosearch points fromlonlat -179 37 bybox 400 400 km asc]
     }
 
+    test {GEOSEARCH with COUNT matches the sorted full result} {
+        r del points
+        set argv {}
+        for {set j 0} {$j < 2000} {incr j} {
+            geo_random_point lon lat
+            lappend argv $lon $lat place:$j
+        }
+        r geoadd points {*}$argv
+        assert_encoding skiplist points
+        foreach shape {{byradius 5000 km} {bybox 6000 4000 km}} {
+            foreach order {asc desc} {
+                set full [r geosearch points fromlonlat 10 20 {*}$shape $order withdist]
+                assert {[llength $full] > 20}
+                assert_equal [lrange $full 0 9] \
+                    [r geosearch points fromlonlat 10 20 {*}$shape count 10 $order withdist]
+            }
+        }
+        r geosearchstore dst points fromlonlat 10 20 byradius 5000 km count 5 desc storedist
+        set far [r geosearch points fromlonlat 10 20 byradius 5000 km count 5 desc]
+        assert_equal [lsort $far] [lsort [r zrange dst 0 -1]]
+    }
+
     foreach {type} {byradius bybox} {
     test "GEOSEARCH fuzzy test - $type" {
         if {$::accurate} { set attempt 300 } else { set attempt 30 }
@@ -79,6 +79,35 @@ start_server {tags {"hll"}} {
         }
     }
 
+    test {PFADD of many elements in a sparse HLL matches single adds} {
+        foreach maxbytes {3000 200} {
+            r config set hll-sparse-max-bytes $maxbytes
+            for {set x 0} {$x < 50} {incr x} {
+                r del hll1 hll2
+                # Add a few batches to hll1, and the same elements one
+                # by one to hll2, that takes the single register path.
+                for {set b 0} {$b < 3} {incr b} {
+                    set elements {}
+                    for {set j 0} {$j < [randomInt 150]+2} {incr j} {
+                        lappend elements [randomInt 1000]
+                    }
+                    set r1 [r pfadd hll1 {*}$elements]
+                    set r2 0
+                    foreach e $elements {
+                        if {[r pfadd hll2 $e]} {set r2 1}
+                    }
+                    assert_equal $r2 $r1
+                }
+                assert_equal [r pfdebug getreg hll2] [r pfdebug getreg hll1]
+                assert_equal [r pfcount hll2] [r pfcount hll1]
+                if {[r pfdebug encoding hll1] eq {sparse}} {
+                    assert {[r strlen hll1] <= $maxbytes}
+                }
+            }
+        }
+        r config set hll-sparse-max-bytes 3000
+    }
+
     test {Corrupted sparse HyperLogLogs are detected: Additional at tail} {
         r del hll
         r pfadd hll a b c
@@ -194,6 +223,62 @@ start_server {tags {"hll"}} {
         assert {$err < (double($card)/100)*5}
     }
 
+    test {PFMERGE of dense HLLs takes the max of every register} {
+        r del hll1 hll2 hll3 hll
+        for {set j 1} {$j <= 3} {incr j} {
+            set items {}
+            for {set x 0} {$x < 5000} {incr x} {lappend items [randomInt 1000000]}
+            r pfadd hll$j {*}$items
+            r pfdebug todense hll$j
+        }
+        r pfmerge hll hll1 hll2 hll3
+        set expected [lmap a [r pfdebug getreg hll1] b [r pfdebug getreg hll2] \
+                           c [r pfdebug getreg hll3] {
+            expr {max($a,$b,$c)}
+        }]
+        assert_equal $expected [r pfdebug getreg hll]
+        assert_equal [r pfcount hll] [r pfcount hll1 hll2 hll3]
+    }
+
+    test {PFCOUNT multiple-keys cached result follows the changes of the keys} {
+        r del hll1 hll2 hll3
+        r pfadd hll1 a b c
+        r pfadd hll2 c d
+        assert_equal 4 [r pfcount hll1 hll2 hll3]
+        assert_equal 4 [r pfcount hll1 hll2 hll3]
+        r pfadd hll3 e
+        assert_equal 5 [r pfcount hll1 hll2 hll3]
+        r pfadd hll2 c d
+        assert_equal 5 [r pfcount hll1 hll2 hll3]
+        r del hll1
+        assert_equal 3 [r pfcount hll1 hll2 hll3]
+        r rename hll2 hll1
+        assert_equal 3 [r pfcount hll1 hll2 hll3]
+        r set hll2 foo
+        assert_error {*WRONGTYPE*} {r pfcount hll1 hll2 hll3}
+        r del hll2
+
+        r debug set-active-expire 0
+        r pexpire hll3 1
+        after 10
+        assert_equal 2 [r pfcount hll1 hll2 hll3]
+        r debug set-active-expire 1
+
+        r pfadd hll3 f
+        assert_equal 3 [r pfcount hll1 hll2 hll3]
+        r select 10
+        r flushdb
+        assert_equal 0 [r pfcount hll1 hll2 hll3]
+        r swapdb 9 10
+        assert_equal 3 [r pfcount hll1 hll2 hll3]
+        r swapdb 9 10
+        assert_equal 0 [r pfcount hll1 hll2 hll3]
+        r select 9
+        assert_equal 3 [r pfcount hll1 hll2 hll3]
+        r flushdb
+        assert_equal 0 [r pfcount hll1 hll2 hll3]
+    }
+
     test {PFDEBUG GETREG returns the HyperLogLog raw registers} {
         r del hll
         r pfadd hll 1 2 3
@@ -211,3 +296,33 @@ start_server {tags {"hll"}} {
         assert {[r getrange hll 15 15] eq "\x80"}
     }
 }
+
+start_server {tags {"hll repl"}} {
+    start_server {} {
+        set master [srv -1 client]
+        set master_host [srv -1 host]
+        set master_port [srv -1 port]
+        set replica [srv 0 client]
+
+        test {PFCOUNT multiple-keys cache misses logically expired keys on replicas} {
+            $replica replicaof $master_host $master_port
+            wait_for_condition 50 100 {
+                [s 0 master_link_status] eq {up}
+            } else {
+                fail "Replication not started."
+            }
+
+            # Keep the master from expiring the key, so that the replica
+            # never receives the DEL and the key only expires logically.
+            $master debug set-active-expire 0
+            $master pfadd hll1 a b c
+            $master pfadd hll2 c d
+            $master pexpire hll2 500
+            wait_for_ofs_sync $master $replica
+            assert_equal 4 [$replica pfcount hll1 hll2]
+            after 600
+            assert_equal 3 [$replica pfcount hll1 hll2]
+            $master debug set-active-expire 1
+        }
+    }
+}
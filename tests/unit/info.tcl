@@ -6,6 +6,10 @@ proc errorstat {cmd} {
     return [errorrstat $cmd r]
 }
 
+proc latency_percentiles_usec {cmd} {
+    return [latencyrstat_percentiles $cmd r]
+}
+
 start_server {tags {"info"}} {
     start_server {} {
 
@@ -164,6 +168,60 @@ start_server {tags {"info"}} {
         }
     }
 
+    start_server {} {
+        test {latencystats: disable/enable} {
+            r config resetstat
+            r config set latency-tracking no
+            r set a b
+            assert_match {} [latency_percentiles_usec set]
+            r config set latency-tracking yes
+            r set a b
+            assert_match {*p50=*,p99=*,p99.9=*} [latency_percentiles_usec set]
+            r config resetstat
+            assert_match {} [latency_percentiles_usec set]
+        }
+
+        test {latencystats: configure percentiles} {
+            r config resetstat
+            assert_match {} [latency_percentiles_usec set]
+            r set a b
+            r get a
+            assert_match {*p50=*,p99=*,p99.9=*} [latency_percentiles_usec set]
+            assert_match {*p50=*,p99=*,p99.9=*} [latency_percentiles_usec get]
+            r config set latency-tracking-info-percentiles "0.0 50.0 100.0"
+            assert_equal [lindex [r config get latency-tracking-info-percentiles] 1] {0 50 100}
+            assert_match {*p0=*,p50=*,p100=*} [latency_percentiles_usec set]
+            assert_match {*p0=*,p50=*,p100=*} [latency_percentiles_usec get]
+            catch {r config set latency-tracking-info-percentiles "50 101"} e
+            assert_match {*between 0 and 100*} $e
+            assert_equal [lindex [r config get latency-tracking-info-percentiles] 1] {0 50 100}
+            r config set latency-tracking-info-percentiles "50 99 99.9"
+        }
+
+        test {latencystats: blocking commands} {
+            r config resetstat
+            set rd [redis_deferring_client]
+            $rd blpop list1 0
+            wait_for_condition 100 10 {
+                [s blocked_clients] == 1
+            } else {
+                fail "Timeout waiting for blocked clients"
+            }
+            r lpush list1 a
+            assert_equal [$rd read] {list1 a}
+            $rd blpop list1 0
+            wait_for_condition 100 10 {
+                [s blocked_clients] == 1
+            } else {
+                fail "Timeout waiting for blocked clients"
+            }
+            r lpush list1 b
+            assert_equal [$rd read] {list1 b}
+            assert_match {*p50=*,p99=*,p99.9=*} [latency_percentiles_usec blpop]
+            $rd close
+        }
+    }
+
     start_server {} {
         test {Unsafe command names are sanitized in INFO output} {
             catch {r host:} e
@@ -85,6 +85,24 @@ start_server {tags {"introspection"}} {
         r client list
     } {*name= *}
 
+    test {Partial command read in the shared query buffer is kept by the client} {
+        set rd [redis_deferring_client]
+        $rd client setname partial
+        assert_equal OK [$rd read]
+        $rd write "*3\r\n\$3\r\nSET\r\n\$7\r\npartial\r\n\$5\r\nva"
+        $rd flush
+        wait_for_condition 50 100 {
+            [string match {*name=partial*qbuf=2 *} [r client list]]
+        } else {
+            fail "partial command not kept in the client query buffer"
+        }
+        $rd write "lue\r\n"
+        $rd flush
+        assert_equal OK [$rd read]
+        $rd close
+        r get partial
+    } {value}
+
     test {CLIENT SETNAME does not accept spaces} {
         catch {r client setname "foo bar"} e
         set e
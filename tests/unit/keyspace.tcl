@@ -479,4 +479,57 @@ start_server {tags {"keyspace"}} {
         r keys *
         r keys *
     } {dlskeriewrioeuwqoirueioqwrueoqwrueqw}
+
+    test {KEYS and SCAN MATCH with ordered-key-index} {
+        r flushdb
+        r debug populate 100 user 10
+        r set user:12:a x
+        r set usr:12 x
+        r config set ordered-key-index yes
+
+        assert_equal {user:12 user:12:a} [r keys user:12*]
+        assert_equal {usr:12} [r keys {us[r]:*}]
+        assert_equal 102 [llength [r keys *]]
+
+        # Keys created, renamed and deleted are tracked by the index.
+        r rename user:12:a user:12:b
+        r del user:12
+        r set user:12:c x
+        assert_equal {user:12:b user:12:c} [r keys user:12*]
+
+        # A small prefix range is returned by a single SCAN call.
+        set res [r scan 0 match user:12* count 1]
+        assert_equal 0 [lindex $res 0]
+        assert_equal {user:12:b user:12:c} [lsort [lindex $res 1]]
+
+        # A large one falls back to the incremental scan.
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r scan $cur match user:* count 5]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal 101 [llength [lsort -unique $keys]]
+
+        # The index follows SWAPDB and FLUSHDB.
+        r select 10
+        r flushdb
+        r set user:12:other x
+        r swapdb 9 10
+        assert_equal {user:12:b user:12:c} [r keys user:12*]
+        r select 9
+        assert_equal {user:12:other} [r keys user:12*]
+        r flushdb
+        assert_equal {} [r keys user:*]
+        r set user:1 x
+        assert_equal {user:1} [r keys user:*]
+
+        r config set ordered-key-index no
+        assert_equal {user:1} [r keys user:*]
+        r select 10
+        r flushdb
+        r select 9
+    }
 }
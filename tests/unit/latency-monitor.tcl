@@ -3,6 +3,85 @@ start_server {tags {"latency-monitor"}} {
     r config set latency-monitor-threshold 200
     r latency reset
 
+    test {LATENCY HISTOGRAM with empty histogram} {
+        r config resetstat
+        set histo [dict create {*}[r latency histogram]]
+        # Config resetstat is recorded
+        assert_equal [dict size $histo] 1
+        assert_match {*config*} $histo
+    }
+
+    test {LATENCY HISTOGRAM all commands} {
+        r config resetstat
+        r set a b
+        r set c d
+        set histo [dict create {*}[r latency histogram]]
+        assert_match {calls 2 histogram_usec *} [dict get $histo set]
+        assert_match {calls 1 histogram_usec *} [dict get $histo config]
+    }
+
+    test {LATENCY HISTOGRAM with a subset of commands} {
+        r config resetstat
+        r set a b
+        r set c d
+        r get a
+        r hset f k v
+        r hgetall f
+        set histo [dict create {*}[r latency histogram set hset]]
+        assert_match {calls 2 histogram_usec *} [dict get $histo set]
+        assert_match {calls 1 histogram_usec *} [dict get $histo hset]
+        assert_equal [dict size $histo] 2
+        set histo [dict create {*}[r latency histogram hgetall get zadd]]
+        assert_match {calls 1 histogram_usec *} [dict get $histo hgetall]
+        assert_match {calls 1 histogram_usec *} [dict get $histo get]
+        assert_equal [dict size $histo] 2
+    }
+
+    test {LATENCY HISTOGRAM with wrong command name skips the invalid one} {
+        r config resetstat
+        assert {[llength [r latency histogram blabla]] == 0}
+        assert {[llength [r latency histogram blabla blabla2 set get]] == 0}
+        r set a b
+        r get a
+        assert_match {calls 1 histogram_usec *} [lindex [r latency histogram blabla blabla2 set get] 1]
+        assert_match {calls 1 histogram_usec *} [lindex [r latency histogram blabla blabla2 set get] 3]
+        assert {[string length [r latency histogram blabla set get]] > 0}
+    }
+
+    test {LATENCY HISTOGRAM is not recorded when latency-tracking is off} {
+        r config resetstat
+        r config set latency-tracking no
+        r set a b
+        assert {[llength [r latency histogram set]] == 0}
+        r config set latency-tracking yes
+    }
+
+    test {LATENCY EVENTLOOP reports the event loop stages} {
+        r config resetstat
+        r set a b
+        r get a
+        set stages [dict create {*}[r latency eventloop]]
+        foreach stage {read parse command} {
+            assert_match {calls * usec * max_usec * histogram_usec *} [dict get $stages $stage]
+        }
+        # CONFIG RESETSTAT, SET and GET. The command stage of CONFIG RESETSTAT
+        # is recorded after the reset, while LATENCY EVENTLOOP is still running
+        # when it builds its reply.
+        assert_equal 3 [dict get [dict get $stages command] calls]
+    }
+
+    test {INFO eventloop reports the event loop stages} {
+        r config resetstat
+        r ping
+        # Let at least one event loop iteration and cron run complete.
+        after 200
+        set info [r info eventloop]
+        assert_match {*eventloop_stage_eventloop:calls=*,usec=*,max_usec=*,p50=*} $info
+        assert_match {*eventloop_stage_beforesleep:calls=*} $info
+        assert_match {*eventloop_stage_cron:calls=*} $info
+        assert_match {*eventloop_stage_command:calls=*} $info
+    }
+
     test {Test latency events logging} {
         r debug sleep 0.3
         after 1100
@@ -324,3 +324,52 @@ start_server {tags {"maxmemory"}} {
         if {$::verbose} { puts "evicted: $evicted" }
     }
 }
+
+start_server {tags {"maxmemory"}} {
+    proc client_tot_mem {name} {
+        regexp "name=$name \[^\n\]*tot-mem=(\[0-9\]+)" [r client list] - mem
+        return $mem
+    }
+
+    test {Client memory accounts for the MULTI queue} {
+        set rd [redis_deferring_client]
+        $rd client setname multiclient
+        $rd read
+        $rd multi
+        $rd read
+        set before [client_tot_mem multiclient]
+        for {set j 0} {$j < 100} {incr j} {
+            $rd set k [string repeat x 1000]
+            $rd read
+        }
+        set after [client_tot_mem multiclient]
+        assert {$after - $before >= 100000}
+        $rd close
+    }
+
+    test {maxmemory-clients evicts the client using the most memory} {
+        r config set maxmemory-clients 3mb
+        set rd [redis_deferring_client]
+        $rd client setname bigqbuf
+        $rd read
+        # Start a big bulk argument without completing it: the query buffer
+        # is sized for the whole argument.
+        # The connection may be closed while we are still writing.
+        catch {
+            $rd write "*3\r\n\$3\r\nset\r\n\$1\r\nk\r\n\$5000000\r\n"
+            $rd write [string repeat x 100000]
+            $rd flush
+        }
+        wait_for_condition 50 100 {
+            [s evicted_clients] == 1
+        } else {
+            fail "client was not evicted"
+        }
+        assert_no_match {*name=bigqbuf*} [r client list]
+        # The small clients are left alone.
+        assert_equal {PONG} [r ping]
+        assert_equal 0 [r exists k]
+        r config set maxmemory-clients 0
+        catch {$rd close}
+    }
+}
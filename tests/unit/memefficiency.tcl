@@ -34,6 +34,66 @@ start_server {tags {"memefficiency"}} {
             assert {$efficiency >= $expected_min_efficiency}
         }
     }
+
+    if {[string match {*jemalloc*} [s mem_allocator]]} {
+        test "Client buffers are served by the transient arena" {
+            r flushall
+            r config set jemalloc-transient-arena yes
+            r set foo [string repeat x 100000]
+            set rd [redis_deferring_client]
+            for {set j 0} {$j < 100} {incr j} {$rd get foo}
+            for {set j 0} {$j < 100} {incr j} {
+                assert_equal 100000 [string length [$rd read]]
+            }
+            wait_for_condition 50 100 {
+                [s allocator_transient_resident] > 0
+            } else {
+                fail "Transient arena not used"
+            }
+            # Buffers allocated before disabling the arena are still
+            # released to it.
+            r config set jemalloc-transient-arena no
+            for {set j 0} {$j < 100} {incr j} {$rd get foo}
+            for {set j 0} {$j < 100} {incr j} {
+                assert_equal 100000 [string length [$rd read]]
+            }
+            $rd close
+            assert_equal 100000 [r strlen foo]
+        }
+    }
+
+    test "MEMORY ANALYZE reports the keyspace in the background" {
+        r flushall
+        r debug populate 1000 user 10
+        r debug populate 10 session 10
+        r rpush biglist {*}[lrepeat 2000 element]
+        r setex volatile 30 x
+        r select 10
+        r set nottl x
+
+        assert_equal {none} [dict get [r memory report] status]
+        assert_error {*single character*} {r memory analyze separator ::}
+        r memory analyze top 2
+        assert_error {*already in progress*} {r memory analyze}
+        wait_for_condition 100 50 {
+            [dict get [r memory report] status] eq {done}
+        } else {
+            fail "Keyspace analysis not done"
+        }
+        set report [r memory report]
+        assert_equal 1013 [dict get $report keys]
+        assert_equal 1012 [dict get $report types string keys]
+        assert_equal {user {(no prefix)} session} [dict keys [dict get $report prefixes]]
+        assert_equal 1000 [dict get $report prefixes user keys]
+        assert_equal 1 [dict get $report encodings quicklist keys]
+        assert_equal 1 [dict get $report ttl <1m]
+        assert_equal 1012 [dict get $report ttl none]
+        set top [dict get $report top-keys]
+        assert_equal 2 [llength $top]
+        assert_equal {biglist} [dict get [lindex $top 0] key]
+        assert {[dict get [lindex $top 0] bytes] > [dict get $report types list bytes] - 1}
+        r select 9
+    }
 }
 
 run_solo {defrag} {
@@ -108,6 +108,30 @@ start_server {overrides {save ""} tags {"other"}} {
         }
     }
 
+    test {DEBUG PERSISTBENCH times every type and preserves the dataset} {
+        r flushdb
+        r set x 10
+        r expire x 1000
+        set digest [r debug digest]
+        set res [r debug persistbench 100 20 16]
+        assert_equal {string list set intset zset hash stream} [dict keys $res]
+        dict for {type stats} $res {
+            assert_equal 100 [dict get $stats keys]
+            assert {[dict get $stats rdb_bytes] > 0}
+            assert {[dict get $stats aof_bytes] > 0}
+            assert {[dict get $stats rdb_load_keys_per_sec] > 0}
+        }
+        assert_equal hashtable [dict get [r debug persistbench 2 1000 16 hash] hash encoding]
+        assert_equal intset [dict get $res intset encoding]
+        assert_equal hashtable [dict get $res set encoding]
+        # Values larger than the internal filler buffer.
+        set stats [dict get [r debug persistbench 2 1 100000 string] string]
+        assert {[dict get $stats aof_bytes] > 200000}
+        assert_error {*Unknown type*} {r debug persistbench 10 10 10 foo}
+        assert_equal $digest [r debug digest]
+        assert {[r ttl x] > 900}
+    }
+
     test {EXPIRES after a reload (snapshot + append only file rewrite)} {
         r flushdb
         r set x 10
@@ -368,3 +392,38 @@ start_server {tags {"other"}} {
     }
 }
 
+
+start_server {tags {"other"}} {
+    test {DEBUG PROFILE collects folded stacks} {
+        r debug profile start 997
+        # Burn some CPU time so that the timer fires.
+        r eval {
+            local i = 0
+            while (i < 5000000) do i = i+1 end
+        } 0
+        r debug profile stop
+        set stats [r debug profile stats]
+        assert_equal 0 [dict get $stats active]
+        assert {[dict get $stats samples] > 0}
+        set dump [r debug profile dump]
+        foreach line [split [string trim $dump] "\n"] {
+            assert_match {*;* [0-9]*} $line
+        }
+        assert_match {*main;aeMain*} $dump
+    }
+
+    test {DEBUG PROFILE RESET discards the samples} {
+        r debug profile reset
+        assert_equal 0 [dict get [r debug profile stats] samples]
+        assert_equal {} [r debug profile dump]
+        assert_error {*hz must be*} {r debug profile start 0}
+    }
+
+    test {DEBUG PROFILE can sample once per second} {
+        # A one second period must be armed as tv_sec, not as 1000000 usec.
+        r debug profile start 1
+        assert_equal 1 [dict get [r debug profile stats] active]
+        r debug profile stop
+        r debug profile reset
+    }
+}
@@ -48,6 +48,27 @@ start_server {tags {"protocol network"}} {
         assert_error "*invalid bulk length*" {r read}
     }
 
+    test "Multibulk payload length with leading zeros" {
+        reconnect
+        r write "*3\r\n\$3\r\nSET\r\n\$1\r\nx\r\n\$01\r\ny\r\n"
+        r flush
+        assert_error "*invalid bulk length*" {r read}
+    }
+
+    test "Pipelined commands with empty and mixed size arguments" {
+        reconnect
+        r write "*3\r\n\$3\r\nSET\r\n\$1\r\nx\r\n\$0\r\n\r\n"
+        r write "*2\r\n\$6\r\nSTRLEN\r\n\$1\r\nx\r\n"
+        r write "*4\r\n\$5\r\nRPUSH\r\n\$4\r\nlist\r\n\$12\r\nhello world!\r\n\$1\r\na\r\n"
+        r write "*2\r\n\$3\r\nGET\r\n\$1\r\nx\r\n"
+        r flush
+        assert_equal OK [r read]
+        assert_equal 0 [r read]
+        assert_equal 2 [r read]
+        assert_equal {} [r read]
+        assert_equal {{hello world!} a} [r lrange list 0 -1]
+    }
+
     test "Multi bulk request not followed by bulk arguments" {
         reconnect
         r write "*1\r\nfoo\r\n"
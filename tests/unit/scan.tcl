@@ -98,6 +98,47 @@ start_server {tags {"scan network"}} {
         assert_equal 1000 [llength $keys]
     }
 
+    test "SCAN MINSIZE, NOTTL, IDLE and ENCODING filters" {
+        r flushdb
+        r debug populate 100 small 10
+        r set big [string repeat x 10000]
+        r setex volatile 1000 [string repeat x 10000]
+        r rpush list a b c
+        r set int 12345
+
+        proc scan_all {args} {
+            set cur 0
+            set keys {}
+            while 1 {
+                set res [r scan $cur {*}$args]
+                set cur [lindex $res 0]
+                lappend keys {*}[lindex $res 1]
+                if {$cur == 0} break
+            }
+            lsort $keys
+        }
+
+        assert_equal {big volatile} [scan_all minsize 5000]
+        assert_equal {big} [scan_all minsize 5000 nottl]
+        assert_equal {volatile} [scan_all minsize 5000 match vol*]
+        assert_equal {} [scan_all minsize 100000]
+        assert_equal {int} [scan_all encoding int]
+        assert_equal {list} [scan_all encoding quicklist type list]
+        assert_equal 103 [llength [scan_all nottl count 5]]
+
+        r config set maxmemory-policy allkeys-lru
+        assert_equal {} [scan_all idle 100]
+        assert_equal 104 [llength [scan_all idle 0]]
+        r config set maxmemory-policy allkeys-lfu
+        catch {r scan 0 idle 10} e
+        assert_match {*LFU*} $e
+        r config set maxmemory-policy noeviction
+
+        assert_error {*value is out of range*} {r scan 0 minsize -1}
+        r sadd myset a
+        assert_error {*syntax*} {r sscan myset 0 nottl}
+    }
+
     foreach enc {intset hashtable} {
         test "SSCAN with encoding $enc" {
             # Create the Set
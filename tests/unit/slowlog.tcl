@@ -174,4 +174,82 @@ start_server {tags {"slowlog"} overrides {slowlog-log-slower-than 1000000}} {
         r debug sleep 0.2
         assert_equal [r slowlog len] 0
     }
+
+    test {SLOWLOG - AGGREGATE groups commands by signature} {
+        r config set slowlog-log-slower-than 0
+        r config set slowlog-max-len 2
+        r slowlog aggregate reset
+        for {set i 0} {$i < 20} {incr i} {
+            r set user:$i:name foo
+        }
+        r mget user:1:name user:2:name order:ab12
+        r ping
+        set sigs {}
+        foreach e [r slowlog aggregate 100] {
+            dict set sigs [dict get $e signature] $e
+        }
+        assert_equal 20 [dict get [dict get $sigs {set user:*:name}] count]
+        assert_equal 1 [dict get [dict get $sigs {mget user:*:name order:*}] count]
+        assert {[dict exists $sigs ping]}
+        set e [dict get $sigs {set user:*:name}]
+        assert {[dict get $e total_usec] >= [dict get $e max_usec]}
+        assert {[dict get $e max_usec] >= [dict get $e p99_usec]}
+        # The raw log only retains the last entries.
+        assert_equal 2 [r slowlog len]
+    }
+
+    test {SLOWLOG - AGGREGATE sorts by total time and evicts the least recently seen} {
+        r config set slowlog-log-slower-than 0
+        r config set slowlog-aggregate-max-len 3
+        r slowlog aggregate reset
+        r debug sleep 0.1
+        r ping
+        set sigs [r slowlog aggregate]
+        assert_equal 3 [llength $sigs]
+        assert_equal {debug} [dict get [lindex $sigs 0] signature]
+        assert_equal 1 [llength [r slowlog aggregate 1]]
+        # DEBUG is the most expensive but also the least recently seen
+        # signature, so it is the one making room for GET.
+        r get foo
+        set sigs {}
+        foreach e [r slowlog aggregate] {lappend sigs [dict get $e signature]}
+        assert_equal [list {get foo} ping slowlog] [lsort $sigs]
+        # Lowering the limit trims the table right away. Logging is paused
+        # so that CONFIG SET itself does not enter the table.
+        r config set slowlog-log-slower-than -1
+        r config set slowlog-aggregate-max-len 1
+        set sigs [r slowlog aggregate]
+        assert_equal 1 [llength $sigs]
+        assert_equal {slowlog} [dict get [lindex $sigs 0] signature]
+        r config set slowlog-log-slower-than 0
+        r config set slowlog-aggregate-max-len 0
+        r slowlog aggregate reset
+        r ping
+        assert_equal {} [r slowlog aggregate]
+        r config set slowlog-aggregate-max-len 128
+    }
+
+    test {SLOWLOG - AGGREGATE keeps a new hot signature when the table is full} {
+        r config set slowlog-log-slower-than 0
+        r config set slowlog-aggregate-max-len 20
+        r slowlog aggregate reset
+        # Fill the table with signatures that add up a lot of time.
+        foreach key {a b c d e f g h i j k l m n o p q r s} {
+            for {set j 0} {$j < 200} {incr j} {r get $key}
+        }
+        # Every new one-off signature needs room, but the hot signature
+        # that arrived after the table was full keeps its statistics.
+        set letters {a b c d e f g h i j k l m n o p q r s t}
+        for {set j 0} {$j < 20} {incr j} {
+            r set hot v
+            r get once:[lindex $letters $j]
+        }
+        set sigs {}
+        foreach e [r slowlog aggregate 100] {
+            dict set sigs [dict get $e signature] $e
+        }
+        assert {[llength [dict keys $sigs]] <= 20}
+        assert_equal 20 [dict get [dict get $sigs {set hot}] count]
+        r config set slowlog-aggregate-max-len 128
+    }
 }
@@ -56,6 +56,22 @@ start_server {
         test "$title: SORT BY hash field" {
             assert_equal $result [r sort tosort BY wobj_*->weight]
         }
+
+        test "$title: SORT with a small limit matches the full sort" {
+            foreach opts {{} {DESC} {ALPHA} {ALPHA DESC} {BY weight_*}
+                          {BY weight_* DESC} {BY wobj_*->weight}} {
+                set full [r sort tosort {*}$opts]
+                assert_equal [lrange $full 0 1] [r sort tosort {*}$opts LIMIT 0 2]
+                assert_equal [lrange $full 1 1] [r sort tosort {*}$opts LIMIT 1 1]
+            }
+            set first [lindex $result 0]
+            set second [lindex $result 1]
+            assert_equal [list $first [r get weight_$first] \
+                               $second [r get weight_$second]] \
+                [r sort tosort BY weight_* LIMIT 0 2 GET # GET weight_*]
+            r sort tosort BY weight_* LIMIT 0 2 STORE sorted
+            assert_equal [lrange $result 0 1] [r lrange sorted 0 -1]
+        }
     }
 
     set result [create_random_dataset 16 lpush]
@@ -1,3 +1,19 @@
+# Connect with openssl s_client, which, unlike the Tcl tls package, can save
+# and reuse a session. TLS 1.2 is used since it sends the ticket within the
+# handshake. Returns a dict with the handshake type (New or Reused) and the
+# name of the key that encrypted the ticket the client holds.
+proc tls_session_connect {args} {
+    set out [exec -ignorestderr openssl s_client \
+        -connect [srv 0 host]:[srv 0 port] -tls1_2 \
+        -cert $::tlsdir/client.crt -key $::tlsdir/client.key \
+        -CAfile $::tlsdir/ca.crt {*}$args < /dev/null 2>/dev/null]
+    set handshake {}
+    set ticket {}
+    regexp {\n(New|Reused), } $out -> handshake
+    regexp {TLS session ticket:\s+0000 - ([0-9a-f -]{47})} $out -> ticket
+    dict create handshake $handshake ticket $ticket
+}
+
 start_server {tags {"tls"}} {
     if {$::tls} {
         package require tls
@@ -154,5 +170,90 @@ start_server {tags {"tls"}} {
             r config set tls-key-file-pass 1234
             r config set tls-key-file $keyfile_encrypted
         }
+
+        test {TLS: Sessions are resumed with tickets} {
+            r config resetstat
+            set sess [tmpfile tls_session]
+            set c [tls_session_connect -sess_out $sess]
+            assert_equal New [dict get $c handshake]
+            assert {[dict get $c ticket] ne {}}
+            set c [tls_session_connect -sess_in $sess]
+            assert_equal Reused [dict get $c handshake]
+
+            set info [r info stats]
+            assert_equal 1 [getInfoProperty $info tls_handshakes_full]
+            assert_equal 1 [getInfoProperty $info tls_handshakes_resumed]
+        }
+
+        test {TLS: Ticket keys are rotated and retired} {
+            r config set tls-session-ticket-key-rotation 2
+            r config resetstat
+            set sess [tmpfile tls_session]
+            set key [dict get [tls_session_connect -sess_out $sess] ticket]
+
+            # Once the key rotated, tickets of the previous key are
+            # still accepted.
+            wait_for_condition 100 50 {
+                [set newkey [dict get [tls_session_connect] ticket]] ne $key
+            } else {
+                fail "Ticket key was not rotated"
+            }
+            assert_equal Reused [dict get [tls_session_connect -sess_in $sess] handshake]
+
+            # After the next rotation they are rejected.
+            wait_for_condition 100 50 {
+                [dict get [tls_session_connect] ticket] ne $newkey
+            } else {
+                fail "Ticket key was not rotated"
+            }
+            assert_equal New [dict get [tls_session_connect -sess_in $sess] handshake]
+
+            set info [r info stats]
+            assert_equal 1 [getInfoProperty $info tls_handshakes_resumed]
+            assert {[getInfoProperty $info tls_handshakes_full] >= 4}
+            r config set tls-session-ticket-key-rotation 3600
+        }
+
+        test {TLS: handshakes, reads and writes in I/O threads} {
+            start_server {overrides {io-threads 4 io-threads-do-reads yes}} {
+                set clients {}
+                for {set round 0} {$round < 5} {incr round} {
+                    # New connections keep handshakes going while the I/O
+                    # threads are serving the ones connected already.
+                    for {set j 0} {$j < 10} {incr j} {
+                        lappend clients [redis_deferring_client]
+                    }
+                    foreach rd $clients {
+                        for {set k 0} {$k < 10} {incr k} {
+                            $rd incr counter
+                        }
+                        $rd flush
+                    }
+                    foreach rd $clients {
+                        for {set k 0} {$k < 10} {incr k} {
+                            assert_match {[0-9]*} [$rd read]
+                        }
+                    }
+                }
+                foreach rd $clients {
+                    $rd close
+                }
+                # 10+20+30+40+50 clients sent 10 increments each.
+                assert_equal 1500 [r get counter]
+            }
+        }
+
+        test {TLS: handshakes go to the I/O threads without write traffic} {
+            start_server {overrides {io-threads 4 io-threads-do-reads yes}} {
+                # Too few pending writes to activate the threaded I/O: only
+                # the handshakes of the reconnecting clients use the threads.
+                for {set j 0} {$j < 20} {incr j} {
+                    set rd [redis_client]
+                    assert_equal {PONG} [$rd ping]
+                    $rd close
+                }
+                assert {[s io_threaded_reads_processed] >= 20}
+            }
+        }
     }
 }